@@ -0,0 +1,178 @@
+#include "capture_scaler.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+using namespace std;
+
+// rows are accumulated with 8 fractional bits, so the horizontal sums of up to 1 << CAPTURE_SCALE_WEIGHT_BITS times
+// that fit in 32 bits
+#define CAPTURE_SCALE_ROW_SHIFT (CAPTURE_SCALE_WEIGHT_BITS - 8)
+
+// acc[x] += src[x * Step] * weight, with the step a constant so the common ones vectorise
+template <int Step>
+static void accumulateRow(const uint8_t* src, int32_t* acc, int count, int32_t weight) {
+    for (int x = 0; x < count; ++x) acc[x] += src[x * Step] * weight;
+}
+
+CaptureScaler::CaptureScaler(int threads) : workers(threads) {
+}
+
+bool CaptureScaler::configure(const FrameFormat& in, const FrameFormat& out) {
+    this->planes.clear();
+
+    // where a component of the captured frame is and how much smaller than the frame it is
+    struct Component { int plane; int offset; int step; int divide; int divideLines; };
+    Component luma{0, 0, 1, 1, 1};
+    Component cb{}, cr{};
+    bool      chroma = true;
+    switch (in.fourcc) {
+        case V4L2_PIX_FMT_YUYV:
+            luma = {0, 0, 2, 1, 1}; cb = {0, 1, 4, 2, 1}; cr = {0, 3, 4, 2, 1};
+            break;
+        case V4L2_PIX_FMT_UYVY:
+            luma = {0, 1, 2, 1, 1}; cb = {0, 0, 4, 2, 1}; cr = {0, 2, 4, 2, 1};
+            break;
+        case V4L2_PIX_FMT_YUV420:
+            cb = {1, 0, 1, 2, 2}; cr = {2, 0, 1, 2, 2};
+            break;
+        case V4L2_PIX_FMT_NV12:
+            cb = {1, 0, 2, 2, 2}; cr = {1, 1, 2, 2, 2};
+            break;
+        case FRAME_FOURCC_YUV24:
+            luma = {0, 0, 3, 1, 1}; cb = {0, 1, 3, 1, 1}; cr = {0, 2, 3, 1, 1};
+            break;
+        case V4L2_PIX_FMT_GREY:
+            chroma = false;
+            break;
+        default:
+            return false;
+    }
+    if (out.fourcc != V4L2_PIX_FMT_YUV420 && out.fourcc != V4L2_PIX_FMT_GREY && out.fourcc != V4L2_PIX_FMT_Y16) {
+        return false;
+    }
+    if (!in.valid() || !out.valid() || in.width < 2 || in.height < 1 || out.width < 1 || out.height < 1) {
+        return false;
+    }
+
+    auto add = [&](const Component* c, int dstPlane, int dstWidth, int fill) {
+        Plane p{};
+        p.dstOffset = out.planeOffset(dstPlane);
+        p.dstStride = out.bytesPerLine[dstPlane];
+        p.dstWidth  = dstWidth;
+        p.dstHeight = out.planeLines[dstPlane];
+        p.wide      = out.fourcc == V4L2_PIX_FMT_Y16;
+        p.fill      = fill;
+        if (c) {
+            p.srcOffset = in.planeOffset(c->plane) + (size_t)c->offset;
+            p.srcStep   = c->step;
+            p.srcStride = in.bytesPerLine[c->plane];
+            p.srcWidth  = (in.width + c->divide - 1) / c->divide;
+            p.srcHeight = (in.height + c->divideLines - 1) / c->divideLines;
+            buildTaps(p.srcWidth, p.dstWidth, p.columns);
+            buildTaps(p.srcHeight, p.dstHeight, p.rows);
+        }
+        this->planes.push_back(p);
+    };
+    add(&luma, 0, out.width, -1);
+    if (out.fourcc == V4L2_PIX_FMT_YUV420) {
+        const int chromaWidth = (out.width + 1) / 2;
+        add(chroma ? &cb : nullptr, 1, chromaWidth, chroma ? -1 : 128);
+        add(chroma ? &cr : nullptr, 2, chromaWidth, chroma ? -1 : 128);
+    }
+
+    this->rowAcc.assign((size_t)this->threadCount(), vector<int32_t>((size_t)in.width));
+    return true;
+}
+
+void CaptureScaler::scale(const uint8_t* src, uint8_t* dst) {
+    const int bands = this->threadCount();
+    this->workers.run(bands, [&](int band) {
+        int32_t* acc = this->rowAcc[band].data();
+        for (const Plane& p : this->planes) {
+            const int first = (int)((int64_t)p.dstHeight * band / bands);
+            const int last  = (int)((int64_t)p.dstHeight * (band + 1) / bands);
+            this->scaleBand(p, src, dst, first, last, acc);
+        }
+    });
+}
+
+void CaptureScaler::scaleBand(const Plane& p, const uint8_t* src, uint8_t* dst, int first, int last,
+                              int32_t* acc) const {
+    for (int y = first; y < last; ++y) {
+        uint8_t* out = dst + p.dstOffset + (size_t)y * p.dstStride;
+        if (p.fill >= 0) {
+            memset(out, p.fill, (size_t)p.dstWidth);
+            continue;
+        }
+
+        fill(acc, acc + p.srcWidth, 0);
+        const int32_t* rowWeights = &p.rows.weights[(size_t)y * p.rows.taps];
+        for (int k = 0; k < p.rows.taps; ++k) {
+            if (!rowWeights[k]) continue;
+            const uint8_t* in = src + p.srcOffset + (size_t)(p.rows.start[y] + k) * p.srcStride;
+            switch (p.srcStep) {
+                case 1:  accumulateRow<1>(in, acc, p.srcWidth, rowWeights[k]); break;
+                case 2:  accumulateRow<2>(in, acc, p.srcWidth, rowWeights[k]); break;
+                case 3:  accumulateRow<3>(in, acc, p.srcWidth, rowWeights[k]); break;
+                default: accumulateRow<4>(in, acc, p.srcWidth, rowWeights[k]); break;
+            }
+        }
+        for (int x = 0; x < p.srcWidth; ++x) {
+            acc[x] = (acc[x] + (1 << (CAPTURE_SCALE_ROW_SHIFT - 1))) >> CAPTURE_SCALE_ROW_SHIFT;
+        }
+
+        for (int x = 0; x < p.dstWidth; ++x) {
+            const int32_t* in      = acc + p.columns.start[x];
+            const int32_t* weights = &p.columns.weights[(size_t)x * p.columns.taps];
+            int32_t sum = 0;
+            for (int k = 0; k < p.columns.taps; ++k) sum += in[k] * weights[k];
+            // 8 fractional bits left, 0 .. 255 << 8
+            const int32_t value = (sum + (1 << (CAPTURE_SCALE_WEIGHT_BITS - 1))) >> CAPTURE_SCALE_WEIGHT_BITS;
+            if (p.wide) {
+                reinterpret_cast<uint16_t*>(out)[x] = (uint16_t)(value + (value >> 8));
+            } else {
+                out[x] = (uint8_t)((value + 128) >> 8);
+            }
+        }
+    }
+}
+
+// Inputs past the edges are clamped to the edge pixels, whose weights they add to.
+void CaptureScaler::buildTaps(int in, int out, Taps& t) {
+    const double scale   = (double)in / out;
+    const double support = max(1.0, scale);
+    const int    one     = 1 << CAPTURE_SCALE_WEIGHT_BITS;
+
+    t.taps = min(in, (int)ceil(2.0 * support) + 1);
+    t.start.assign((size_t)out, 0);
+    t.weights.assign((size_t)out * t.taps, 0);
+
+    vector<double> w((size_t)t.taps);
+    for (int o = 0; o < out; ++o) {
+        const double center = (o + 0.5) * scale - 0.5;
+        const int    lo     = (int)floor(center - support) + 1;
+        const int    hi     = (int)ceil(center + support) - 1;
+        const int    start  = max(0, min(lo, in - t.taps));
+
+        fill(w.begin(), w.end(), 0.0);
+        double total = 0.0;
+        for (int i = lo; i <= hi; ++i) {
+            const double weight = max(0.0, 1.0 - fabs(i - center) / support);
+            w[(size_t)(max(0, min(i, in - 1)) - start)] += weight;
+            total += weight;
+        }
+
+        // rounded to fixed point, with the rounding error given to the largest weight so they add up to exactly one
+        int32_t* fixed   = &t.weights[(size_t)o * t.taps];
+        int      sum     = 0;
+        int      largest = 0;
+        for (int k = 0; k < t.taps; ++k) {
+            fixed[k] = (int32_t)lround(w[(size_t)k] / total * one);
+            sum += fixed[k];
+            if (fixed[k] > fixed[largest]) largest = k;
+        }
+        fixed[largest] += one - sum;
+        t.start[(size_t)o] = start;
+    }
+}
@@ -0,0 +1,70 @@
+#ifndef kinect2pipe_IR_capture_scaler_H
+#define kinect2pipe_IR_capture_scaler_H
+
+#include <cstdint>
+#include <vector>
+#include "frame_format.h"
+#include "worker_group.h"
+
+// fractional bits of the filter weights
+#define CAPTURE_SCALE_WEIGHT_BITS 14
+
+/**
+ * Converts backup camera frames to the pipeline's output format and size on several threads. The output rows are
+ * split into one horizontal band per thread, and each band is filtered from the capture buffer on its own, so the
+ * result is the same on any number of threads.
+ *
+ * The filter is the bilinear one swscale uses with SWS_BILINEAR: a tent one input pixel wide when enlarging and one
+ * output pixel wide when shrinking, so every input pixel counts. It is separable, with fixed-point weights; each
+ * output row accumulates its weighted input rows first and is then reduced horizontally.
+ *
+ * Reads YUYV, UYVY, GREY, YUV420, NV12 and the MJPEG decoder's FRAME_FOURCC_YUV24 and writes YUV420, GREY and Y16.
+ * Luma is copied as is, without a range conversion, and the chroma of a GREY camera is neutral.
+ */
+class CaptureScaler {
+public:
+    // threads including the caller, 0 for one per core
+    explicit CaptureScaler(int threads);
+
+    // false, leaving the scaler unconfigured, if it can't convert in to out
+    bool configure(const FrameFormat& in, const FrameFormat& out);
+    bool configured() const { return !this->planes.empty(); }
+
+    // converts one whole frame in the configured layouts
+    void scale(const uint8_t* src, uint8_t* dst);
+
+    int threadCount() const { return this->workers.threadCount(); }
+
+private:
+    struct Taps {
+        int                  taps;    // inputs contributing to one output
+        std::vector<int32_t> start;   // first input of every output
+        std::vector<int32_t> weights; // outputs x taps, output-major, every output's adding up to 1
+    };
+
+    // one output plane and the component of the captured frame it is made of
+    struct Plane {
+        size_t srcOffset;   // first sample of the component
+        int    srcStep;     // bytes from one sample to the next
+        int    srcStride;
+        int    srcWidth;
+        int    srcHeight;
+        size_t dstOffset;
+        int    dstStride;
+        int    dstWidth;
+        int    dstHeight;
+        bool   wide;        // 16-bit output
+        int    fill;        // constant value instead of a component, or -1
+        Taps   columns;
+        Taps   rows;
+    };
+
+    WorkerGroup        workers;
+    std::vector<Plane> planes;
+    std::vector<std::vector<int32_t>> rowAcc; // per band
+
+    void scaleBand(const Plane& plane, const uint8_t* src, uint8_t* dst, int first, int last, int32_t* acc) const;
+    static void buildTaps(int in, int out, Taps& t);
+};
+
+#endif // kinect2pipe_IR_capture_scaler_H
@@ -0,0 +1,81 @@
+#include "change_detector.h"
+#include <cstring>
+
+ChangeDetector::ChangeDetector() {
+    this->absDiff       = selectIrKernels<0>().absDiff;
+    this->threshold     = 0.0f;
+    this->keepAliveFps  = CHANGE_KEEPALIVE_FPS;
+    this->frameWidth    = 0;
+    this->regionX       = 0;
+    this->regionY       = 0;
+    this->regionWidth   = 0;
+    this->regionHeight  = 0;
+    this->referenceSum  = 0.0;
+    this->haveReference = false;
+    this->skippedCount.store(0);
+    this->keepAliveCount.store(0);
+}
+
+void ChangeDetector::setRegion(int frameWidth, int x, int y, int width, int height) {
+    this->frameWidth   = frameWidth;
+    this->regionX      = x;
+    this->regionY      = y;
+    this->regionWidth  = width;
+    this->regionHeight = height;
+    const int rows = (height + CHANGE_ROW_STEP - 1) / CHANGE_ROW_STEP;
+    this->reference.assign((size_t)rows * width, 0.0f);
+    this->zeros.assign((size_t)width, 0.0f);
+    this->haveReference = false;
+}
+
+void ChangeDetector::reset() {
+    this->haveReference = false;
+}
+
+ChangeDetector::Verdict ChangeDetector::admit(const float* frame, Clock::time_point now) {
+    if (!this->enabled() || this->regionWidth <= 0) return VERDICT_MOVING;
+    if (!this->haveReference) {
+        this->keep(frame, now);
+        return VERDICT_MOVING;
+    }
+
+    // row by row keeps the float sums of absDiff short, they are added up in double
+    double      diff = 0.0;
+    const float* ref = this->reference.data();
+    for (int y = this->regionY; y < this->regionY + this->regionHeight; y += CHANGE_ROW_STEP) {
+        const float* row = frame + (size_t)y * this->frameWidth + this->regionX;
+        diff += this->absDiff(row, ref, (size_t)this->regionWidth);
+        ref  += this->regionWidth;
+    }
+
+    // a black reference has no brightness to be relative to, any difference at all is a change then
+    const bool moving = this->referenceSum > 0.0 ? diff > this->threshold * this->referenceSum : diff > 0.0;
+    if (moving) {
+        this->keep(frame, now);
+        return VERDICT_MOVING;
+    }
+    // the reference stays the frame that is repeated, so a slow drift still adds up to a change
+    if (this->keepAliveFps > 0.0 &&
+        now - this->lastAdmitted >= std::chrono::duration<double>(1.0 / this->keepAliveFps)) {
+        this->keepAliveCount.fetch_add(1, std::memory_order_relaxed);
+        this->lastAdmitted = now;
+        return VERDICT_KEEPALIVE;
+    }
+    this->skippedCount.fetch_add(1, std::memory_order_relaxed);
+    return VERDICT_STATIC;
+}
+
+// Makes frame the reference the next ones are compared with.
+void ChangeDetector::keep(const float* frame, Clock::time_point now) {
+    float* ref = this->reference.data();
+    double sum = 0.0;
+    for (int y = this->regionY; y < this->regionY + this->regionHeight; y += CHANGE_ROW_STEP) {
+        const float* row = frame + (size_t)y * this->frameWidth + this->regionX;
+        memcpy(ref, row, (size_t)this->regionWidth * sizeof(float));
+        sum += this->absDiff(ref, this->zeros.data(), (size_t)this->regionWidth);
+        ref += this->regionWidth;
+    }
+    this->referenceSum  = sum;
+    this->haveReference = true;
+    this->lastAdmitted  = now;
+}
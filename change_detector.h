@@ -0,0 +1,67 @@
+#ifndef kinect2pipe_IR_change_detector_H
+#define kinect2pipe_IR_change_detector_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <vector>
+#include "ir_convert.h"
+
+// one row in CHANGE_ROW_STEP of the published region is compared
+#define CHANGE_ROW_STEP 8
+// rate a static scene is still published at unless set otherwise
+#define CHANGE_KEEPALIVE_FPS 2.0
+
+/**
+ * Tells static scenes apart from moving ones, so frames that would only repeat the last one published are neither
+ * converted nor written.
+ *
+ * Every frame is compared with the last frame published, on a grid of one row in CHANGE_ROW_STEP across the published
+ * region: the mean absolute difference, relative to the mean brightness of the reference, is the change. A frame
+ * whose change is below the threshold is static and skipped, except once every keep-alive interval, when the last
+ * frame published is sent again so consumers still get frames; any frame above it goes through right away. Called
+ * from the capture thread only, the counters may be read from anywhere.
+ */
+class ChangeDetector {
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    // VERDICT_KEEPALIVE: the frame is static, but the last one published is due to be sent again in its place
+    enum Verdict { VERDICT_STATIC, VERDICT_MOVING, VERDICT_KEEPALIVE };
+
+    ChangeDetector();
+
+    // relative change a frame needs to count as moving, e.g. 0.02 for 2%; 0 (the default) admits every frame
+    void setThreshold(float threshold) { this->threshold = threshold; }
+    void setKeepAliveFps(double fps) { this->keepAliveFps = fps; }
+    bool enabled() const { return this->threshold > 0.0f; }
+
+    // area of the width x height IR frames that is published, the only part compared
+    void setRegion(int frameWidth, int x, int y, int width, int height);
+    // forget the reference, so the next frame is admitted
+    void reset();
+
+    // what to publish for the frame captured at now
+    Verdict admit(const float* frame, Clock::time_point now);
+
+    uint64_t skipped() const { return this->skippedCount.load(std::memory_order_relaxed); }
+    uint64_t keepAlives() const { return this->keepAliveCount.load(std::memory_order_relaxed); }
+
+private:
+    IrAbsDiffFn        absDiff;
+    float              threshold;
+    double             keepAliveFps;
+    int                frameWidth, regionX, regionY, regionWidth, regionHeight;
+    std::vector<float> reference;    // sampled rows of the last admitted frame
+    std::vector<float> zeros;        // one row, to sum the reference with absDiff
+    double             referenceSum;
+    bool               haveReference;
+    Clock::time_point  lastAdmitted;
+
+    std::atomic<uint64_t> skippedCount;
+    std::atomic<uint64_t> keepAliveCount;
+
+    void keep(const float* frame, Clock::time_point now);
+};
+
+#endif // kinect2pipe_IR_change_detector_H
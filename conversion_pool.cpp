@@ -0,0 +1,101 @@
+#include "conversion_pool.h"
+#include <iostream>
+#include <cstring>
+#include <pthread.h>
+#include <sched.h>
+
+using namespace std;
+
+class ConversionPool::Strand {
+public:
+    explicit Strand(Drain drain) : drain(drain), queued(false), running(false), again(false) {}
+
+    Drain drain;
+    bool  queued;   // waiting in the queue
+    bool  running;  // on a worker
+    bool  again;    // scheduled while running
+};
+
+ConversionPool::ConversionPool(size_t workers) {
+    this->stopping = false;
+
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) < 0) CPU_ZERO(&allowed);
+    vector<int> cores;
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+        if (CPU_ISSET(cpu, &allowed)) cores.push_back(cpu);
+    }
+
+    for (size_t i = 0; i < workers; ++i) {
+        this->workers.push_back(thread(&ConversionPool::work, this));
+        if (i >= cores.size()) continue;
+
+        cpu_set_t core;
+        CPU_ZERO(&core);
+        CPU_SET(cores[i], &core);
+        const int err = pthread_setaffinity_np(this->workers.back().native_handle(), sizeof(core), &core);
+        if (err) cerr << "failed to pin conversion worker to core " << cores[i] << ": " << strerror(err) << endl;
+    }
+}
+
+ConversionPool::~ConversionPool() {
+    {
+        lock_guard<std::mutex> lk(this->mutex);
+        this->stopping = true;
+    }
+    this->workCv.notify_all();
+    for (auto& t : this->workers) t.join();
+}
+
+ConversionPool::Strand* ConversionPool::addStrand(Drain drain) {
+    lock_guard<std::mutex> lk(this->mutex);
+    this->strands.emplace_back(new Strand(drain));
+    return this->strands.back().get();
+}
+
+void ConversionPool::schedule(Strand* strand) {
+    {
+        lock_guard<std::mutex> lk(this->mutex);
+        if (strand->running) {
+            strand->again = true;
+            return;
+        }
+        if (strand->queued) return;
+        strand->queued = true;
+        this->queue.push_back(strand);
+    }
+    this->workCv.notify_one();
+}
+
+void ConversionPool::wait(Strand* strand) {
+    unique_lock<std::mutex> lk(this->mutex);
+    this->idleCv.wait(lk, [strand]{ return !strand->queued && !strand->running; });
+}
+
+void ConversionPool::work() {
+    unique_lock<std::mutex> lk(this->mutex);
+    while (true) {
+        this->workCv.wait(lk, [this]{ return this->stopping || !this->queue.empty(); });
+        if (this->stopping) return;
+
+        Strand* strand = this->queue.front();
+        this->queue.pop_front();
+        strand->queued  = false;
+        strand->running = true;
+
+        lk.unlock();
+        strand->drain();
+        lk.lock();
+
+        strand->running = false;
+        if (strand->again) {
+            strand->again  = false;
+            strand->queued = true;
+            this->queue.push_back(strand);
+            this->workCv.notify_one();
+        } else {
+            this->idleCv.notify_all();
+        }
+    }
+}
@@ -0,0 +1,52 @@
+#ifndef kinect2pipe_IR_conversion_pool_H
+#define kinect2pipe_IR_conversion_pool_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * Worker threads shared by the conversion stages of several devices, each worker pinned to a core of its own.
+ *
+ * A device's work is a strand: its drain function converts whatever frames the device has queued. A strand runs on
+ * one worker at a time, so a device's frames are converted in order and its conversion state needs no locking, while
+ * the strands of different devices run on different workers at once. schedule() is called after every frame is
+ * queued; a strand scheduled while it runs is run again once it returns, so no frame is left behind.
+ */
+class ConversionPool {
+public:
+    class Strand;
+    typedef std::function<void()> Drain;
+
+    // starts that many threads, pinned one to a core in the order of the cores the process may run on
+    explicit ConversionPool(size_t workers);
+    ~ConversionPool();
+
+    ConversionPool(const ConversionPool&) = delete;
+    ConversionPool& operator=(const ConversionPool&) = delete;
+
+    // strands live as long as the pool
+    Strand* addStrand(Drain drain);
+    void    schedule(Strand* strand);
+    // returns once strand is neither queued nor running
+    void    wait(Strand* strand);
+
+    size_t workerCount() const { return this->workers.size(); }
+
+private:
+    std::vector<std::thread>             workers;
+    std::vector<std::unique_ptr<Strand>> strands;
+    std::deque<Strand*>                  queue;
+    std::mutex                           mutex;
+    std::condition_variable              workCv;
+    std::condition_variable              idleCv;
+    bool                                 stopping;
+
+    void work();
+};
+
+#endif // kinect2pipe_IR_conversion_pool_H
@@ -0,0 +1,179 @@
+#include "device_server.h"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <map>
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <unistd.h>
+#include "event_loop.h"
+
+using namespace std;
+
+DeviceServer::DeviceServer() {
+    // blocked before the first thread is started, like kinect2pipe_IR does, so only the signalfd ever sees them
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+}
+
+bool DeviceServer::load(const char* path) {
+    ifstream in(path);
+    if (!in) {
+        cerr << "failed to open " << path << ": " << strerror(errno) << endl;
+        return false;
+    }
+
+    string line;
+    for (int number = 1; getline(in, line); ++number) {
+        const size_t comment = line.find('#');
+        if (comment != string::npos) line.erase(comment);
+
+        istringstream fields(line);
+        Device        device;
+        string        extra;
+        if (!(fields >> device.serial)) continue;
+        if (!(fields >> device.loopback) || ((fields >> device.backup) && (fields >> extra))) {
+            cerr << path << ":" << number << ": expected serial, loopback device and optionally backup device" << endl;
+            return false;
+        }
+        for (const Device& d : this->devices) {
+            if (d.serial == device.serial) {
+                cerr << path << ":" << number << ": " << device.serial << " is listed twice" << endl;
+                return false;
+            }
+        }
+        device.status = 0;
+        this->devices.push_back(std::move(device));
+    }
+
+    if (this->devices.empty()) {
+        cerr << path << " lists no device" << endl;
+        return false;
+    }
+    return true;
+}
+
+void DeviceServer::run(Configure configure) {
+    // a strand converts one frame at a time, so workers beyond the device count would never have anything to do
+    const long   cores   = sysconf(_SC_NPROCESSORS_ONLN);
+    const size_t workers = min(this->devices.size(), (size_t)max(cores, 1L));
+    unique_ptr<ConversionPool> pool(new ConversionPool(workers));
+    cout << "serving " << this->devices.size() << " devices, converting on " << workers << " cores" << endl;
+
+    for (Device& d : this->devices) {
+        d.pipe.reset(new kinect2pipe_IR());
+        configure(*d.pipe);
+        d.pipe->setStatsEndpoint(nullptr, nullptr);
+        d.pipe->setKinectDevice(d.serial, &this->context);
+        d.pipe->setConversionPool(pool.get());
+        d.pipe->setHandleSignals(false);
+        cout << d.serial << " -> " << d.loopback << endl;
+        d.pipe->openLoopback(d.loopback.c_str());
+        if (!d.backup.empty()) d.pipe->setBackupDevice(d.backup.c_str());
+    }
+
+    EventLoop reactor;
+    sigset_t  signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    const int signalFd = signalfd(-1, &signals, SFD_CLOEXEC | SFD_NONBLOCK);
+    const int doneFd   = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (!reactor.open() || signalFd < 0 || doneFd < 0) {
+        cerr << "failed to set up the device server: " << strerror(errno) << endl;
+        exit(1);
+    }
+
+    size_t done = 0;
+    reactor.add(signalFd, EPOLLIN, [this, signalFd](uint32_t) {
+        struct signalfd_siginfo info;
+        while (read(signalFd, &info, sizeof(info)) == (ssize_t)sizeof(info)) {
+            cout << "received " << strsignal((int)info.ssi_signo) << endl;
+        }
+        for (Device& d : this->devices) d.pipe->shutdown();
+    });
+    reactor.add(doneFd, EPOLLIN, [&done, doneFd](uint32_t) { done += EventLoop::drain(doneFd); });
+
+    for (Device& d : this->devices) {
+        Device* device = &d;
+        d.thread = thread([device, doneFd] {
+            device->status = device->pipe->serve();
+            uint64_t one = 1;
+            if (write(doneFd, &one, sizeof(one)) < 0) {}
+        });
+    }
+    if (!this->statsServer.start(this->statsSocketPath, this->statsFilePath,
+                                 [this](std::ostream& os) { this->report(os); })) {
+        for (Device& d : this->devices) d.pipe->shutdown();
+    }
+
+    while (done < this->devices.size()) {
+        if (reactor.poll(-1) < 0) break;
+    }
+
+    int status = 0;
+    for (Device& d : this->devices) {
+        d.thread.join();
+        if (d.status && !status) status = d.status;
+    }
+    // exit() below unwinds nothing, and no device converts any more
+    pool.reset();
+    // cleanup done, the hard kill is no longer needed
+    alarm(0);
+    this->statsServer.stop();
+    exit(status);
+}
+
+// Merges the reports of every device into one: each sample gets a device label, and the samples of every metric are
+// grouped under a single TYPE line as the Prometheus text format requires.
+void DeviceServer::report(std::ostream& os) const {
+    vector<string>              order;      // metric families, as first seen
+    map<string, string>         types;      // family -> its TYPE line
+    map<string, vector<string>> samples;    // family -> labelled samples
+    vector<string>              comments;
+
+    for (const Device& d : this->devices) {
+        ostringstream report;
+        d.pipe->reportStats(report);
+        istringstream lines(report.str());
+
+        const string label  = "device=\"" + d.serial + "\"";
+        string       family;
+        string       line;
+        while (getline(lines, line)) {
+            if (line.compare(0, 7, "# TYPE ") == 0) {
+                family = line.substr(7, line.find(' ', 7) - 7);
+                if (!types.count(family)) {
+                    types[family] = line;
+                    order.push_back(family);
+                }
+            } else if (line[0] == '#') {
+                comments.push_back("# " + d.serial + line.substr(1));
+            } else if (!line.empty()) {
+                const size_t brace = line.find('{');
+                const size_t space = line.find(' ');
+                if (brace != string::npos && brace < space) {
+                    samples[family].push_back(line.substr(0, brace + 1) + label + "," + line.substr(brace + 1));
+                } else {
+                    samples[family].push_back(line.substr(0, space) + "{" + label + "}" + line.substr(space));
+                }
+            }
+        }
+    }
+
+    os << "# TYPE kinect2pipe_devices gauge\n"
+       << "kinect2pipe_devices " << this->devices.size() << "\n";
+    for (const string& family : order) {
+        os << types[family] << "\n";
+        for (const string& sample : samples[family]) os << sample << "\n";
+    }
+    for (const string& comment : comments) os << comment << "\n";
+}
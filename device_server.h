@@ -0,0 +1,64 @@
+#ifndef kinect2pipe_IR_device_server_H
+#define kinect2pipe_IR_device_server_H
+
+#include <functional>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "kinect2pipe_IR.h"
+#include "kinect_source.h"
+#include "conversion_pool.h"
+#include "stats_server.h"
+
+/**
+ * Serves several Kinects from one process, each to a loopback device of its own, as listed in a configuration file:
+ *
+ *     # serial       loopback device  [backup device]
+ *     003462745047   /dev/video11     /dev/video0
+ *     010421651247   /dev/video12
+ *
+ * Every device gets its own kinect2pipe_IR, whose capture loop and writer run on threads of their own, so a device
+ * that stalls holds up no other. They share a single libfreenect2 context, and with it one USB event thread, and one
+ * ConversionPool with a worker per device (at most one per core) in place of a converter thread each. The
+ * statistics of every device are served together, each sample labelled with the device's serial number.
+ */
+class DeviceServer {
+public:
+    // applies the settings every device shares, before the server's own
+    typedef std::function<void(kinect2pipe_IR&)> Configure;
+
+    DeviceServer();
+
+    // false if the file can't be read, has a malformed line or lists no device
+    bool load(const char* path);
+    void setStatsEndpoint(const char* socketPath, const char* filePath) {
+        statsSocketPath = socketPath ? socketPath : "";
+        statsFilePath   = filePath ? filePath : "";
+    }
+
+    // Opens every device and serves them until SIGINT or SIGTERM, or until all of them are done. Exits with the
+    // status of the first device that failed, 0 if none did.
+    [[noreturn]] void run(Configure configure);
+
+private:
+    struct Device {
+        std::string                     serial;
+        std::string                     loopback;
+        std::string                     backup;
+        std::unique_ptr<kinect2pipe_IR> pipe;
+        std::thread                     thread;
+        int                             status;
+    };
+
+    std::vector<Device> devices;
+    KinectContext       context;
+    StatsServer         statsServer;
+    std::string         statsSocketPath;
+    std::string         statsFilePath;
+
+    void report(std::ostream& os) const;
+};
+
+#endif // kinect2pipe_IR_device_server_H
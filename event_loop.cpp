@@ -0,0 +1,92 @@
+#include "event_loop.h"
+#include <iostream>
+#include <cerrno>
+#include <cstring>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+using namespace std;
+
+EventLoop::EventLoop() {
+    this->epollFd = -1;
+    this->wakeFd  = -1;
+}
+
+EventLoop::~EventLoop() {
+    if (this->wakeFd >= 0) close(this->wakeFd);
+    if (this->epollFd >= 0) close(this->epollFd);
+}
+
+bool EventLoop::open() {
+    this->epollFd = epoll_create1(EPOLL_CLOEXEC);
+    this->wakeFd  = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (this->epollFd < 0 || this->wakeFd < 0) {
+        cerr << "failed to create event loop: " << strerror(errno) << endl;
+        return false;
+    }
+    const int wake = this->wakeFd;
+    return this->add(wake, EPOLLIN, [wake](uint32_t) { drain(wake); });
+}
+
+bool EventLoop::add(int fd, uint32_t events, Handler handler) {
+    struct epoll_event ev{};
+    ev.events  = events;
+    ev.data.fd = fd;
+    if (epoll_ctl(this->epollFd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        cerr << "failed to watch descriptor " << fd << ": " << strerror(errno) << endl;
+        return false;
+    }
+    this->handlers[fd] = handler;
+    return true;
+}
+
+void EventLoop::remove(int fd) {
+    if (this->handlers.erase(fd)) epoll_ctl(this->epollFd, EPOLL_CTL_DEL, fd, nullptr);
+}
+
+int EventLoop::poll(int timeoutMs) {
+    struct epoll_event events[EVENT_LOOP_BATCH];
+    const int n = epoll_wait(this->epollFd, events, EVENT_LOOP_BATCH, timeoutMs);
+    if (n < 0) {
+        if (errno == EINTR) return 0;
+        cerr << "epoll_wait failed: " << strerror(errno) << endl;
+        return -1;
+    }
+
+    int handled = 0;
+    for (int i = 0; i < n; ++i) {
+        // a handler may remove descriptors, its own included, so each one is looked up as it comes and called
+        // through a copy
+        auto it = this->handlers.find(events[i].data.fd);
+        if (it == this->handlers.end()) continue;
+        Handler handler = it->second;
+        handler(events[i].events);
+        handled++;
+    }
+    return handled;
+}
+
+void EventLoop::wake() {
+    uint64_t one = 1;
+    if (write(this->wakeFd, &one, sizeof(one)) < 0) {}
+}
+
+int EventLoop::createTimer() {
+    return timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+}
+
+bool EventLoop::armTimer(int fd, int ms, bool periodic) {
+    struct itimerspec spec{};
+    spec.it_value.tv_sec  = ms / 1000;
+    spec.it_value.tv_nsec = (long)(ms % 1000) * 1000000;
+    if (periodic) spec.it_interval = spec.it_value;
+    return timerfd_settime(fd, 0, &spec, nullptr) == 0;
+}
+
+uint64_t EventLoop::drain(int fd) {
+    uint64_t count = 0;
+    if (read(fd, &count, sizeof(count)) != (ssize_t)sizeof(count)) return 0;
+    return count;
+}
@@ -0,0 +1,54 @@
+#ifndef kinect2pipe_IR_event_loop_H
+#define kinect2pipe_IR_event_loop_H
+
+#include <cstdint>
+#include <functional>
+#include <map>
+
+// ready descriptors handled per epoll_wait()
+#define EVENT_LOOP_BATCH 16
+
+/**
+ * epoll reactor the daemon's main thread runs on.
+ *
+ * Everything the main thread waits for is a file descriptor registered with a handler: signals through a signalfd,
+ * consumers opening and closing the loopback device through inotify, frames through the source's descriptor and
+ * deadlines through timerfds. poll() sleeps until one of them is ready, so nothing wakes the thread up just to check
+ * on a flag. Registration and poll() belong to the main thread; other threads may only call wake().
+ */
+class EventLoop {
+public:
+    typedef std::function<void(uint32_t events)> Handler;
+
+    EventLoop();
+    ~EventLoop();
+
+    EventLoop(const EventLoop&) = delete;
+    EventLoop& operator=(const EventLoop&) = delete;
+
+    bool open();
+
+    // level triggered: the handler runs on every poll() for as long as fd stays ready
+    bool add(int fd, uint32_t events, Handler handler);
+    void remove(int fd);
+
+    // Waits up to timeoutMs (-1 for as long as it takes) for registered descriptors and runs the handlers of the ready
+    // ones. Returns the number of handlers run, -1 if epoll failed.
+    int  poll(int timeoutMs);
+    // makes the poll() in progress, or the next one, return
+    void wake();
+
+    // a CLOCK_MONOTONIC timerfd, -1 on failure
+    static int      createTimer();
+    // fires after ms and, if periodic, every ms after that; 0 disarms
+    static bool     armTimer(int fd, int ms, bool periodic);
+    // reads and resets the counter of an eventfd or timerfd, 0 if there was nothing to read
+    static uint64_t drain(int fd);
+
+private:
+    int                    epollFd;
+    int                    wakeFd;
+    std::map<int, Handler> handlers;
+};
+
+#endif // kinect2pipe_IR_event_loop_H
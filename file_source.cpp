@@ -0,0 +1,82 @@
+#include "file_source.h"
+#include <iostream>
+#include <cerrno>
+#include <cstring>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+using namespace std;
+
+FileSource::FileSource(const std::string& path, double fps, bool loop) : pacer(fps) {
+    this->path       = path;
+    this->loop       = loop;
+    this->mapped     = nullptr;
+    this->length     = 0;
+    this->frameCount = 0;
+    this->next       = 0;
+    this->sequence   = 0;
+}
+
+FileSource::~FileSource() {
+    this->stop();
+}
+
+bool FileSource::start() {
+    int fd = open(this->path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        cerr << "failed to open " << this->path << ": " << strerror(errno) << endl;
+        return false;
+    }
+
+    struct stat st{};
+    if (fstat(fd, &st) < 0 || st.st_size < (off_t)KinectIrFormat::frameSize) {
+        cerr << this->path << " does not hold a single " << KinectIrFormat::width << "x" << KinectIrFormat::height
+             << " IR frame" << endl;
+        close(fd);
+        return false;
+    }
+
+    this->length = (size_t)st.st_size;
+    void* m = mmap(nullptr, this->length, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (m == MAP_FAILED) {
+        cerr << "failed to map " << this->path << ": " << strerror(errno) << endl;
+        return false;
+    }
+    // read front to back, once per frame
+    madvise(m, this->length, MADV_SEQUENTIAL);
+
+    this->mapped     = (const uint8_t*)m;
+    this->frameCount = this->length / KinectIrFormat::frameSize;
+    this->next       = 0;
+    this->sequence   = 0;
+    this->pacer.reset();
+
+    if (this->length % KinectIrFormat::frameSize) {
+        cerr << this->path << ": ignoring " << this->length % KinectIrFormat::frameSize << " trailing bytes" << endl;
+    }
+    cout << "replaying " << this->frameCount << " frames from " << this->path << endl;
+    return true;
+}
+
+void FileSource::stop() {
+    if (!this->mapped) return;
+    munmap((void*)this->mapped, this->length);
+    this->mapped = nullptr;
+}
+
+FrameSource::ReadResult FileSource::read(SourceFrame& frame, int timeoutMs) {
+    if (this->next == this->frameCount) {
+        if (!this->loop) return READ_END;
+        this->next = 0;
+    }
+    if (!this->pacer.wait(timeoutMs)) return READ_TIMEOUT;
+
+    frame.data      = this->mapped + this->next++ * KinectIrFormat::frameSize;
+    frame.bytes     = KinectIrFormat::frameSize;
+    frame.sequence  = this->sequence++;
+    frame.timestamp = this->pacer.timestamp();
+    return READ_FRAME;
+}
@@ -0,0 +1,38 @@
+#ifndef kinect2pipe_IR_file_source_H
+#define kinect2pipe_IR_file_source_H
+
+#include <string>
+#include "frame_source.h"
+
+/**
+ * Replays a file of raw KinectIrFormat frames stored back to back, e.g. dumped from libfreenect2's Frame::Ir data.
+ * The file is mapped, so frames are handed out in place. Ends after the last frame, or starts over when looping.
+ */
+class FileSource : public FrameSource {
+public:
+    FileSource(const std::string& path, double fps, bool loop);
+    ~FileSource();
+
+    const char* name() const { return "file source"; }
+
+    bool start();
+    void stop();
+
+    const FrameFormat& format() const { return KinectIrFormat::format; }
+    double             fps() const { return this->pacer.fps(); }
+
+    ReadResult read(SourceFrame& frame, int timeoutMs);
+    bool       release() { return true; }
+
+private:
+    std::string    path;
+    bool           loop;
+    const uint8_t* mapped;
+    size_t         length;
+    size_t         frameCount;
+    size_t         next;
+    FramePacer     pacer;
+    uint32_t       sequence;
+};
+
+#endif // kinect2pipe_IR_file_source_H
@@ -0,0 +1,61 @@
+#include "frame_arena.h"
+#include <iostream>
+#include <cerrno>
+#include <cstring>
+#include <sys/mman.h>
+#include <unistd.h>
+
+using namespace std;
+
+FrameArena::FrameArena() {
+    this->map       = nullptr;
+    this->mapBytes  = 0;
+    this->usedBytes = 0;
+    this->huge      = false;
+}
+
+FrameArena::~FrameArena() {
+    if (this->map) munmap(this->map, this->mapBytes);
+}
+
+bool FrameArena::reserve(size_t bytes, bool hugePages) {
+    void* map = MAP_FAILED;
+    if (hugePages) {
+        const size_t rounded = (bytes + FRAME_ARENA_HUGE_PAGE - 1) / FRAME_ARENA_HUGE_PAGE * FRAME_ARENA_HUGE_PAGE;
+        map = mmap(nullptr, rounded, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_POPULATE,
+                   -1, 0);
+        if (map != MAP_FAILED) {
+            this->mapBytes = rounded;
+            this->huge     = true;
+        } else {
+            cerr << "no huge pages for the frame buffers (" << strerror(errno) << "), using normal pages" << endl;
+        }
+    }
+    if (map == MAP_FAILED) {
+        const size_t page    = (size_t)sysconf(_SC_PAGESIZE);
+        const size_t rounded = (bytes + page - 1) / page * page;
+        map = mmap(nullptr, rounded, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (map == MAP_FAILED) {
+            cerr << "failed to map the frame buffers: " << strerror(errno) << endl;
+            return false;
+        }
+        // before the pages are touched, so the kernel may back them with huge pages right away
+        madvise(map, rounded, MADV_HUGEPAGE);
+        this->mapBytes = rounded;
+        this->huge     = false;
+    }
+    this->map       = (uint8_t*)map;
+    this->usedBytes = 0;
+
+    // MAP_POPULATE is only a hint, every page is written once to be sure
+    memset(this->map, 0, this->mapBytes);
+    return true;
+}
+
+uint8_t* FrameArena::take(size_t bytes) {
+    const size_t block = blockBytes(bytes);
+    if (!this->map || this->mapBytes - this->usedBytes < block) return nullptr;
+    uint8_t* data = this->map + this->usedBytes;
+    this->usedBytes += block;
+    return data;
+}
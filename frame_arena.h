@@ -0,0 +1,47 @@
+#ifndef kinect2pipe_IR_frame_arena_H
+#define kinect2pipe_IR_frame_arena_H
+
+#include <cstddef>
+#include <cstdint>
+
+// blocks are cache line aligned, like FrameRing's own buffers
+#define FRAME_ARENA_ALIGNMENT 64
+#define FRAME_ARENA_HUGE_PAGE (2u << 20)
+
+/**
+ * One mapping the frame buffers of the real-time profile are carved out of, every page of it faulted in up front so
+ * no frame ever pays for one. On huge pages when asked and the system has enough of them reserved (vm.nr_hugepages);
+ * otherwise on normal pages, with transparent huge pages requested.
+ *
+ * Blocks are handed out in order and only given back all together, when the arena goes away.
+ */
+class FrameArena {
+public:
+    FrameArena();
+    ~FrameArena();
+
+    FrameArena(const FrameArena&) = delete;
+    FrameArena& operator=(const FrameArena&) = delete;
+
+    bool reserve(size_t bytes, bool hugePages);
+
+    // the next block of bytes, nullptr once the arena is used up
+    uint8_t* take(size_t bytes);
+
+    size_t size() const { return this->mapBytes; }
+    size_t used() const { return this->usedBytes; }
+    bool   onHugePages() const { return this->huge; }
+
+    // what a block of bytes takes out of the arena, for sizing it
+    static size_t blockBytes(size_t bytes) {
+        return (bytes + FRAME_ARENA_ALIGNMENT - 1) & ~(size_t)(FRAME_ARENA_ALIGNMENT - 1);
+    }
+
+private:
+    uint8_t* map;
+    size_t   mapBytes;
+    size_t   usedBytes;
+    bool     huge;
+};
+
+#endif // kinect2pipe_IR_frame_arena_H
@@ -0,0 +1,155 @@
+#ifndef kinect2pipe_IR_frame_format_H
+#define kinect2pipe_IR_frame_format_H
+
+#include <cstddef>
+#include <cstdint>
+#include <linux/videodev2.h>
+
+#define FRAME_MAX_PLANES 3
+
+#define FRAME_FOURCC(a, b, c, d) \
+    ((uint32_t)(a) | ((uint32_t)(b) << 8) | ((uint32_t)(c) << 16) | ((uint32_t)(d) << 24))
+
+// libfreenect2 IR frames, one 32-bit float per pixel. Not a V4L2 format, only used inside the pipeline.
+#define FRAME_FOURCC_IR_FLOAT FRAME_FOURCC('I', 'R', 'F', '4')
+// packed Y, Cb, Cr bytes per pixel, what the MJPEG decoder writes for colour output. Only used inside the pipeline.
+#define FRAME_FOURCC_YUV24 FRAME_FOURCC('Y', 'U', 'V', '3')
+
+/**
+ * Memory layout of one image: pixel format, size and the stride and height of each plane, with the planes stored
+ * back to back in a single buffer the way V4L2 single-planar formats are.
+ *
+ * Everything is constexpr so the layouts the pipeline uses all the time can be computed at compile time through
+ * FixedFrameFormat, while backup cameras describe whatever they deliver at runtime with the same type.
+ */
+struct FrameFormat {
+    uint32_t fourcc;
+    int      width;
+    int      height;
+    int      planeCount;
+    int      bytesPerLine[FRAME_MAX_PLANES];
+    int      planeLines[FRAME_MAX_PLANES];
+
+    /**
+     * Layout of fourcc at width x height. bytesPerLine is the stride of the first plane as reported by a driver, or 0
+     * for a tightly packed image; the strides of the other planes are derived from it. Unknown formats get a
+     * planeCount of 0.
+     */
+    static constexpr FrameFormat make(uint32_t fourcc, int width, int height, int bytesPerLine = 0) {
+        FrameFormat f{fourcc, width, height, 0, {0, 0, 0}, {0, 0, 0}};
+        const int chromaWidth  = (width + 1) / 2;
+        const int chromaHeight = (height + 1) / 2;
+
+        switch (fourcc) {
+            case V4L2_PIX_FMT_GREY:
+                f.planeCount      = 1;
+                f.bytesPerLine[0] = bytesPerLine ? bytesPerLine : width;
+                break;
+            case V4L2_PIX_FMT_Y16:
+            case V4L2_PIX_FMT_YUYV:
+            case V4L2_PIX_FMT_UYVY:
+                f.planeCount      = 1;
+                f.bytesPerLine[0] = bytesPerLine ? bytesPerLine : width * 2;
+                break;
+            case V4L2_PIX_FMT_RGB24:
+            case V4L2_PIX_FMT_BGR24:
+            case FRAME_FOURCC_YUV24:
+                f.planeCount      = 1;
+                f.bytesPerLine[0] = bytesPerLine ? bytesPerLine : width * 3;
+                break;
+            case V4L2_PIX_FMT_MJPEG:
+                // compressed, every frame is as long as the driver says; the plane only carries the size
+                f.planeCount      = 1;
+                f.bytesPerLine[0] = 0;
+                break;
+            case FRAME_FOURCC_IR_FLOAT:
+                f.planeCount      = 1;
+                f.bytesPerLine[0] = bytesPerLine ? bytesPerLine : width * 4;
+                break;
+            case V4L2_PIX_FMT_YUV420:
+                f.planeCount      = 3;
+                f.bytesPerLine[0] = bytesPerLine ? bytesPerLine : width;
+                f.bytesPerLine[1] = bytesPerLine ? bytesPerLine / 2 : chromaWidth;
+                f.bytesPerLine[2] = f.bytesPerLine[1];
+                f.planeLines[1]   = chromaHeight;
+                f.planeLines[2]   = chromaHeight;
+                break;
+            case V4L2_PIX_FMT_NV12:
+                f.planeCount      = 2;
+                f.bytesPerLine[0] = bytesPerLine ? bytesPerLine : width;
+                f.bytesPerLine[1] = f.bytesPerLine[0];
+                f.planeLines[1]   = chromaHeight;
+                break;
+            default:
+                break;
+        }
+        f.planeLines[0] = f.planeCount ? height : 0;
+        return f;
+    }
+
+    static FrameFormat fromV4L2(const struct v4l2_pix_format& pix) {
+        return make(pix.pixelformat, (int)pix.width, (int)pix.height, (int)pix.bytesperline);
+    }
+
+    constexpr bool   valid() const { return this->planeCount > 0; }
+    constexpr size_t pixelCount() const { return (size_t)this->width * this->height; }
+    constexpr size_t planeSize(int plane) const { return (size_t)this->bytesPerLine[plane] * this->planeLines[plane]; }
+
+    constexpr size_t planeOffset(int plane) const {
+        size_t offset = 0;
+        for (int i = 0; i < plane; ++i) offset += this->planeSize(i);
+        return offset;
+    }
+
+    constexpr size_t frameSize() const { return this->planeOffset(this->planeCount); }
+
+    // same pixel format, size and stride; the other planes' strides follow from those
+    constexpr bool operator==(const FrameFormat& o) const {
+        return this->fourcc == o.fourcc && this->width == o.width && this->height == o.height &&
+               this->bytesPerLine[0] == o.bytesPerLine[0];
+    }
+    constexpr bool operator!=(const FrameFormat& o) const { return !(*this == o); }
+
+    /**
+     * Fills the plane pointers and strides of a frame stored at base, in the four-entry arrays swscale uses. Unused
+     * entries are set to nullptr / 0.
+     */
+    template <typename T>
+    void planes(T* base, T* ptrs[4], int strides[4]) const {
+        for (int i = 0; i < 4; ++i) {
+            const bool used = i < this->planeCount;
+            ptrs[i]    = used ? base + this->planeOffset(i) : nullptr;
+            strides[i] = used ? this->bytesPerLine[i] : 0;
+        }
+    }
+};
+
+/**
+ * A FrameFormat fixed at compile time, for the layouts of the Kinect's 512x424 frames. Conversion code specialised on
+ * one of these gets its sizes and offsets as constants.
+ */
+template <uint32_t Fourcc, int Width, int Height>
+struct FixedFrameFormat {
+    static constexpr FrameFormat format    = FrameFormat::make(Fourcc, Width, Height);
+    static constexpr uint32_t    fourcc    = Fourcc;
+    static constexpr int         width     = Width;
+    static constexpr int         height    = Height;
+    static constexpr size_t      pixels    = (size_t)Width * Height;
+    static constexpr size_t      frameSize = format.frameSize();
+
+    static_assert(format.valid(), "unsupported fixed frame format");
+};
+
+template <uint32_t Fourcc, int Width, int Height>
+constexpr FrameFormat FixedFrameFormat<Fourcc, Width, Height>::format;
+template <uint32_t Fourcc, int Width, int Height>
+constexpr size_t FixedFrameFormat<Fourcc, Width, Height>::pixels;
+template <uint32_t Fourcc, int Width, int Height>
+constexpr size_t FixedFrameFormat<Fourcc, Width, Height>::frameSize;
+
+typedef FixedFrameFormat<FRAME_FOURCC_IR_FLOAT, 512, 424> KinectIrFormat;
+typedef FixedFrameFormat<V4L2_PIX_FMT_YUV420, KinectIrFormat::width, KinectIrFormat::height> KinectYuv420Format;
+typedef FixedFrameFormat<V4L2_PIX_FMT_GREY,   KinectIrFormat::width, KinectIrFormat::height> KinectGreyFormat;
+typedef FixedFrameFormat<V4L2_PIX_FMT_Y16,    KinectIrFormat::width, KinectIrFormat::height> KinectY16Format;
+
+#endif // kinect2pipe_IR_frame_format_H
@@ -0,0 +1,73 @@
+#include "frame_governor.h"
+
+using namespace std;
+
+FrameGovernor::FrameGovernor(double sourceFps) {
+    this->sourceFps = sourceFps;
+    this->capFps    = 0.0;
+    this->admittedCount.store(0);
+    this->skippedCount.store(0);
+    this->backoffCount.store(0);
+    this->reset();
+}
+
+void FrameGovernor::setMaxFps(double fps) {
+    this->capFps = fps > 0.0 ? fps : 0.0;
+}
+
+void FrameGovernor::reset() {
+    this->started      = false;
+    this->lastChange   = Clock::now();
+    this->backoff.store(0);
+}
+
+// Minimum time between two admitted frames, zero when every frame is wanted.
+FrameGovernor::Clock::duration FrameGovernor::interval() const {
+    const unsigned level = this->backoff.load(memory_order_relaxed);
+    if (this->capFps <= 0.0 && level == 0) return Clock::duration::zero();
+
+    const double fps = this->capFps > 0.0 && this->capFps < this->sourceFps ? this->capFps : this->sourceFps;
+    return chrono::duration_cast<Clock::duration>(chrono::duration<double>((double)(1u << level) / fps));
+}
+
+bool FrameGovernor::admit(Clock::time_point now) {
+    const Clock::duration period = this->interval();
+    if (period == Clock::duration::zero()) {
+        this->admittedCount.fetch_add(1, memory_order_relaxed);
+        return true;
+    }
+
+    // Frames arrive with some jitter, so one arriving up to half a source frame early still counts as on time.
+    // Otherwise a cap of exactly half the source rate would alternate between keeping one frame in two and one in
+    // three.
+    const auto slack = chrono::duration_cast<Clock::duration>(chrono::duration<double>(0.5 / this->sourceFps));
+    if (this->started && now + slack < this->next) {
+        this->skippedCount.fetch_add(1, memory_order_relaxed);
+        return false;
+    }
+
+    // schedule from the ideal time rather than from now to keep the average rate, unless we fell behind
+    this->next    = this->started && now < this->next + period ? this->next + period : now + period;
+    this->started = true;
+    this->admittedCount.fetch_add(1, memory_order_relaxed);
+    return true;
+}
+
+void FrameGovernor::submitted(bool busy, Clock::duration waited) {
+    // a consumer that keeps us waiting for more than half a source frame is not draining the device
+    const auto limit    = chrono::duration<double>(0.5 / this->sourceFps);
+    const bool pushback = busy || waited > limit;
+
+    const Clock::time_point now   = Clock::now();
+    const unsigned          level = this->backoff.load(memory_order_relaxed);
+    if (pushback) {
+        this->lastChange = now;
+        if (level < GOVERNOR_MAX_LEVEL) {
+            this->backoff.store(level + 1, memory_order_relaxed);
+            this->backoffCount.fetch_add(1, memory_order_relaxed);
+        }
+    } else if (level > 0 && now - this->lastChange >= chrono::milliseconds(GOVERNOR_RECOVER_MS)) {
+        this->lastChange = now;
+        this->backoff.store(level - 1, memory_order_relaxed);
+    }
+}
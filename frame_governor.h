@@ -0,0 +1,67 @@
+#ifndef kinect2pipe_IR_frame_governor_H
+#define kinect2pipe_IR_frame_governor_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+// Back-off halves the frame rate per level, so the slowest the governor goes on its own is 1 / 2^GOVERNOR_MAX_LEVEL
+// of the capped (or source) rate.
+#define GOVERNOR_MAX_LEVEL 4
+// time the consumer must keep up without pushing back before the rate is doubled again
+#define GOVERNOR_RECOVER_MS 1000
+
+/**
+ * Decides which captured frames are worth converting.
+ *
+ * Frames are admitted at no more than the configured rate; everything in between is dropped at capture, before any
+ * copy or conversion. On top of that the writer reports whether the loopback device took each frame without
+ * pushing back (EAGAIN, the driver still holding every streaming buffer, or a submission blocking for a large part of
+ * a frame period). Every push-back halves the admitted rate, and every GOVERNOR_RECOVER_MS without one doubles it
+ * again. v4l2loopback gives streaming buffers back at once, so with it the back-off only works in write() mode.
+ *
+ * admit() is called from the capture thread and submitted() from the writer thread.
+ */
+class FrameGovernor {
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    explicit FrameGovernor(double sourceFps);
+
+    // 0 removes the cap
+    void   setMaxFps(double fps);
+    // rate the frames offered to admit() arrive at
+    void   setSourceFps(double fps) { this->sourceFps = fps; }
+    double maxFps() const { return this->capFps; }
+
+    // whether a frame captured at now should go through the pipeline
+    bool admit(Clock::time_point now);
+    // outcome of one submission to the loopback device: busy when the device pushed back, refusing the frame with
+    // EAGAIN or holding on to its buffers, waited the time the submission took
+    void submitted(bool busy, Clock::duration waited);
+    // forgets the back-off and timing, e.g. when a new stream starts; the counts below keep going, they are exported
+    // as counters
+    void reset();
+
+    unsigned level() const { return this->backoff.load(); }
+    uint64_t admitted() const { return this->admittedCount.load(); }
+    uint64_t skipped() const { return this->skippedCount.load(); }
+    uint64_t backoffs() const { return this->backoffCount.load(); }
+
+private:
+    double            sourceFps;
+    double            capFps;
+    Clock::time_point next;
+    bool              started;
+
+    std::atomic<unsigned> backoff;
+    Clock::time_point     lastChange;   // of the back-off level, only used by the writer
+
+    std::atomic<uint64_t> admittedCount;
+    std::atomic<uint64_t> skippedCount;
+    std::atomic<uint64_t> backoffCount;
+
+    Clock::duration interval() const;
+};
+
+#endif // kinect2pipe_IR_frame_governor_H
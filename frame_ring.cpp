@@ -0,0 +1,161 @@
+#include "frame_ring.h"
+#include <cstdlib>
+#include <thread>
+
+#define FRAME_RING_ALIGNMENT 64
+
+FrameRing::FrameRing(size_t depth, size_t slotBytes, size_t consumerSlots)
+    : ownsBuffers(true),
+      queueCap(depth),
+      queue(depth),
+      freeList(depth + 1 + consumerSlots) {
+    // one slot for the producer, depth queued, and whatever the consumer may hold at once
+    const size_t count = depth + 1 + consumerSlots;
+    const size_t bytes = (slotBytes + FRAME_RING_ALIGNMENT - 1) & ~(size_t)(FRAME_RING_ALIGNMENT - 1);
+
+    this->slots.resize(count);
+    for (auto& s : this->slots) {
+        s.data      = (uint8_t*)aligned_alloc(FRAME_RING_ALIGNMENT, bytes);
+        s.bytes     = slotBytes;
+        s.sequence  = 0;
+        s.timestamp = 0;
+        s.captureUs = 0;
+        s.repeat    = false;
+    }
+    this->initQueues();
+}
+
+FrameRing::FrameRing(size_t depth, const std::vector<uint8_t*>& buffers, size_t slotBytes)
+    : ownsBuffers(false),
+      queueCap(depth),
+      queue(depth),
+      freeList(buffers.size()) {
+    this->slots.resize(buffers.size());
+    for (size_t i = 0; i < buffers.size(); ++i) {
+        this->slots[i] = FrameSlot{buffers[i], slotBytes, 0, 0, 0, false};
+    }
+    this->initQueues();
+}
+
+FrameRing::~FrameRing() {
+    if (!this->ownsBuffers) return;
+    for (auto& s : this->slots) free(s.data);
+}
+
+void FrameRing::initQueues() {
+    this->queueHead.store(0);
+    this->queueTail.store(0);
+    this->freeHead.store(0);
+    this->freeTail.store(0);
+    this->publishedCount.store(0);
+    this->droppedCount.store(0);
+    this->closed.store(false);
+
+    this->producerSlot = 0;
+    for (size_t i = 1; i < this->slots.size(); ++i) {
+        this->release((int)i);
+    }
+}
+
+// Pops the oldest queued index. Both sides may call this: the consumer to take a frame, the producer to drop one.
+// Reading a stale queue entry is harmless because the CAS on the tail then fails and we retry.
+bool FrameRing::tryPop(int& index) {
+    uint64_t tail = this->queueTail.load(std::memory_order_acquire);
+    while (true) {
+        uint64_t head = this->queueHead.load(std::memory_order_acquire);
+        if (tail == head) return false;
+        int candidate = this->queue[tail % this->queueCap].load(std::memory_order_relaxed);
+        if (this->queueTail.compare_exchange_weak(tail, tail + 1,
+                                                  std::memory_order_acq_rel, std::memory_order_acquire)) {
+            index = candidate;
+            return true;
+        }
+    }
+}
+
+void FrameRing::publish() {
+    const int filled = this->producerSlot;
+
+    while (true) {
+        uint64_t head = this->queueHead.load(std::memory_order_relaxed);
+        uint64_t tail = this->queueTail.load(std::memory_order_acquire);
+
+        if (head - tail >= this->queueCap) {
+            // Full: take the oldest frame back and reuse its buffer. If the consumer got to it first the queue is
+            // no longer full and the next iteration queues normally.
+            int oldest;
+            if (!this->tryPop(oldest)) continue;
+            this->droppedCount.fetch_add(1, std::memory_order_relaxed);
+            head = this->queueHead.load(std::memory_order_relaxed);
+            this->queue[head % this->queueCap].store(filled, std::memory_order_relaxed);
+            this->queueHead.store(head + 1, std::memory_order_release);
+            this->producerSlot = oldest;
+            break;
+        }
+
+        this->queue[head % this->queueCap].store(filled, std::memory_order_relaxed);
+        this->queueHead.store(head + 1, std::memory_order_release);
+
+        // With the queue not full and the consumer holding at most consumerSlots, a free slot must exist; it may
+        // only be a moment away if the consumer is in the middle of release().
+        while (true) {
+            uint64_t ft = this->freeTail.load(std::memory_order_relaxed);
+            if (ft != this->freeHead.load(std::memory_order_acquire)) {
+                this->producerSlot = this->freeList[ft % this->freeList.size()].load(std::memory_order_relaxed);
+                this->freeTail.store(ft + 1, std::memory_order_release);
+                break;
+            }
+            std::this_thread::yield();
+        }
+        break;
+    }
+
+    this->publishedCount.fetch_add(1, std::memory_order_relaxed);
+
+    // Taking the lock orders this notification after a consumer that has just checked depth() has gone to sleep.
+    { std::lock_guard<std::mutex> lk(this->waitMutex); }
+    this->waitCv.notify_one();
+}
+
+int FrameRing::acquire() {
+    while (true) {
+        if (this->closed.load(std::memory_order_acquire)) return -1;
+
+        int index;
+        if (this->tryPop(index)) return index;
+
+        std::unique_lock<std::mutex> lk(this->waitMutex);
+        this->waitCv.wait(lk, [this]{ return this->closed.load() || this->depth() > 0; });
+    }
+}
+
+int FrameRing::tryAcquire() {
+    int index;
+    return this->tryPop(index) ? index : -1;
+}
+
+void FrameRing::release(int index) {
+    uint64_t head = this->freeHead.load(std::memory_order_relaxed);
+    this->freeList[head % this->freeList.size()].store(index, std::memory_order_relaxed);
+    this->freeHead.store(head + 1, std::memory_order_release);
+}
+
+void FrameRing::close() {
+    {
+        std::lock_guard<std::mutex> lk(this->waitMutex);
+        this->closed.store(true);
+    }
+    this->waitCv.notify_all();
+}
+
+void FrameRing::reopen() {
+    // frames left over from the previous session are stale, hand them back to the producer
+    int index;
+    while (this->tryPop(index)) this->release(index);
+    this->closed.store(false);
+}
+
+size_t FrameRing::depth() const {
+    return (size_t)(this->queueHead.load(std::memory_order_acquire) -
+                    this->queueTail.load(std::memory_order_acquire));
+}
@@ -0,0 +1,95 @@
+#ifndef kinect2pipe_IR_frame_ring_H
+#define kinect2pipe_IR_frame_ring_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+/**
+ * One pre-allocated frame buffer of a FrameRing together with the capture metadata that travels with it.
+ */
+struct FrameSlot {
+    uint8_t* data;
+    size_t   bytes;
+    uint32_t sequence;   // libfreenect2 Frame::sequence, or a running counter for other sources
+    uint32_t timestamp;  // libfreenect2 Frame::timestamp
+    uint64_t captureUs;  // metricsNowUs() when the frame entered the pipeline
+    bool     repeat;     // no frame of its own: the consumer repeats the last one it had
+};
+
+/**
+ * Fixed size single-producer / single-consumer frame queue connecting two pipeline stages.
+ *
+ * All buffers are allocated up front and change owner by index: the producer always owns exactly one slot to fill,
+ * published slots sit in a bounded queue and the consumer owns the slots it has acquired until it releases them.
+ * When the queue is full, publish() steals the oldest queued frame back instead of blocking, so the newest frame
+ * always wins. The data path is lock-free; the mutex is only used to park an idle consumer.
+ */
+class FrameRing {
+public:
+    // depth is the number of frames that can wait between the stages, consumerSlots how many acquired slots the
+    // consumer may hold at the same time before releasing them
+    FrameRing(size_t depth, size_t slotBytes, size_t consumerSlots = 1);
+    // same, but over caller owned buffers (e.g. mmap'd device memory); buffers.size() - depth - 1 of them are left
+    // for the consumer
+    FrameRing(size_t depth, const std::vector<uint8_t*>& buffers, size_t slotBytes);
+    ~FrameRing();
+
+    FrameRing(const FrameRing&) = delete;
+    FrameRing& operator=(const FrameRing&) = delete;
+
+    // producer side ------------------------------------------------------
+    FrameSlot& writeSlot() { return this->slots[this->producerSlot]; }
+    void       publish();
+
+    // consumer side ------------------------------------------------------
+    // Blocks until a frame is queued and returns its slot index, or -1 once close() has been called.
+    int        acquire();
+    // Returns a queued frame's slot index without waiting, -1 if there is none. Still works after close(), to drain
+    // the queue.
+    int        tryAcquire();
+    FrameSlot& slot(int index) { return this->slots[index]; }
+    void       release(int index);
+
+    // wakes the consumer and makes every further acquire() return -1
+    void close();
+    // re-arms a closed ring; only valid while neither side is using it
+    void reopen();
+
+    size_t   slotCount() const { return this->slots.size(); }
+    size_t   capacity() const { return this->queueCap; }
+    size_t   depth() const;
+    uint64_t published() const { return this->publishedCount.load(std::memory_order_relaxed); }
+    uint64_t dropped() const { return this->droppedCount.load(std::memory_order_relaxed); }
+
+private:
+    std::vector<FrameSlot> slots;
+    int                    producerSlot;
+    bool                   ownsBuffers;
+
+    // queued slot indices, head is advanced by the producer only, tail by whichever side wins the CAS
+    size_t                             queueCap;
+    std::vector<std::atomic<int>>      queue;
+    std::atomic<uint64_t>              queueHead;
+    std::atomic<uint64_t>              queueTail;
+
+    // slots handed back by the consumer, consumer pushes and producer pops
+    std::vector<std::atomic<int>>      freeList;
+    std::atomic<uint64_t>              freeHead;
+    std::atomic<uint64_t>              freeTail;
+
+    std::atomic<uint64_t> publishedCount;
+    std::atomic<uint64_t> droppedCount;
+
+    std::mutex              waitMutex;
+    std::condition_variable waitCv;
+    std::atomic<bool>       closed;
+
+    bool tryPop(int& index);
+    void initQueues();
+};
+
+#endif // kinect2pipe_IR_frame_ring_H
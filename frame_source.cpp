@@ -0,0 +1,39 @@
+#include "frame_source.h"
+#include <thread>
+
+using namespace std;
+
+FramePacer::FramePacer(double fps) {
+    this->rate = fps;
+    this->reset();
+}
+
+void FramePacer::reset() {
+    this->first = Clock::now();
+    this->next  = this->first;
+}
+
+bool FramePacer::wait(int timeoutMs) {
+    if (this->rate <= 0.0) return true;
+
+    const Clock::time_point now = Clock::now();
+    if (this->next > now) {
+        const Clock::time_point limit = now + chrono::milliseconds(timeoutMs);
+        if (this->next > limit) {
+            this_thread::sleep_until(limit);
+            return false;
+        }
+        this_thread::sleep_until(this->next);
+    }
+
+    // Slots are laid out from the previous one rather than from now, so the rate doesn't drift, unless we are more
+    // than a frame behind: then the backlog is dropped instead of being delivered in a burst.
+    const Clock::duration period = chrono::duration_cast<Clock::duration>(chrono::duration<double>(1.0 / this->rate));
+    this->next += period;
+    if (this->next < now) this->next = now + period;
+    return true;
+}
+
+uint32_t FramePacer::timestamp() const {
+    return (uint32_t)(chrono::duration_cast<chrono::microseconds>(Clock::now() - this->first).count() / 100);
+}
@@ -0,0 +1,87 @@
+#ifndef kinect2pipe_IR_frame_source_H
+#define kinect2pipe_IR_frame_source_H
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include "frame_format.h"
+
+/**
+ * One frame handed out by a FrameSource. The memory belongs to the source and stays valid until release().
+ */
+struct SourceFrame {
+    const uint8_t* data;
+    size_t         bytes;
+    uint32_t       sequence;   // as numbered by the device, or a running counter
+    uint32_t       timestamp;  // in libfreenect2's units of 0.1 ms
+};
+
+/**
+ * Anything frames can be captured from: the Kinect, a V4L2 capture device, a generated test pattern or a file.
+ *
+ * Sources whose format() is KinectIrFormat feed the IR conversion pipeline; frames in any other format are forwarded
+ * to the loopback device as they are or scaled by swscale. Every source is driven by the same loop, which calls
+ * read() and release() in turn from a single thread.
+ */
+class FrameSource {
+public:
+    enum ReadResult {
+        READ_FRAME,    // frame holds a frame that must be handed back with release()
+        READ_TIMEOUT,  // nothing arrived within the timeout
+        READ_END,      // the source has no more frames
+        READ_ERROR
+    };
+
+    virtual ~FrameSource() {}
+
+    virtual const char* name() const = 0;
+
+    // Does everything start() needs short of delivering frames, ahead of time, so start() itself is quick. A prepared
+    // source stays prepared across stop() and start(). Optional: start() prepares the source itself when needed.
+    virtual bool prepare() { return true; }
+    virtual bool start() = 0;
+    virtual void stop() = 0;
+
+    // layout of every frame read(), valid once start() succeeded
+    virtual const FrameFormat& format() const = 0;
+    // rate frames are delivered at, 0 when as fast as they are read
+    virtual double fps() const = 0;
+
+    // Descriptor that becomes readable when read() has a frame to hand out, for waiting on the source together with
+    // everything else; -1 for sources that produce frames on demand and are simply read in turn.
+    virtual int pollFd() const { return -1; }
+
+    virtual ReadResult read(SourceFrame& frame, int timeoutMs) = 0;
+    // hands the frame of the last successful read() back, false if the source can't go on
+    virtual bool release() = 0;
+
+    // highest rate worth capturing at, for sources that can be asked to slow down. Must be set before start().
+    virtual void setMaxFps(double fps) { (void)fps; }
+};
+
+/**
+ * Paces a source that produces frames on demand: at fps it waits for the next frame's slot, at 0 it never waits.
+ * Also produces the elapsed time in libfreenect2 timestamp units.
+ */
+class FramePacer {
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    explicit FramePacer(double fps = 0.0);
+
+    void   setFps(double fps) { this->rate = fps; }
+    double fps() const { return this->rate; }
+
+    void reset();
+    // waits until the next frame is due, up to timeoutMs; false when it still isn't
+    bool wait(int timeoutMs);
+    // timestamp of the frame that is due now
+    uint32_t timestamp() const;
+
+private:
+    double            rate;
+    Clock::time_point first;
+    Clock::time_point next;
+};
+
+#endif // kinect2pipe_IR_frame_source_H
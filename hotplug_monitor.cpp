@@ -0,0 +1,88 @@
+#include "hotplug_monitor.h"
+#include <iostream>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <unistd.h>
+
+using namespace std;
+
+// multicast group the kernel sends its uevents to; udevd re-sends them to group 2 once it has processed them
+#define UEVENT_KERNEL_GROUP 1
+
+HotplugMonitor::HotplugMonitor() {
+    this->sock = -1;
+}
+
+HotplugMonitor::~HotplugMonitor() {
+    if (this->sock >= 0) close(this->sock);
+}
+
+bool HotplugMonitor::open() {
+    this->sock = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK, NETLINK_KOBJECT_UEVENT);
+    if (this->sock < 0) {
+        cerr << "failed to open the hotplug socket: " << strerror(errno) << endl;
+        return false;
+    }
+    struct sockaddr_nl addr{};
+    addr.nl_family = AF_NETLINK;
+    addr.nl_groups = UEVENT_KERNEL_GROUP;
+    if (bind(this->sock, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        cerr << "failed to listen for hotplug events: " << strerror(errno) << endl;
+        close(this->sock);
+        this->sock = -1;
+        return false;
+    }
+    return true;
+}
+
+HotplugMonitor::Event HotplugMonitor::read() {
+    Event last = HOTPLUG_NONE;
+    char  msg[HOTPLUG_UEVENT_BYTES];
+    while (true) {
+        struct sockaddr_nl from{};
+        socklen_t          fromLength = sizeof(from);
+        const ssize_t n = recvfrom(this->sock, msg, sizeof(msg) - 1, 0, (struct sockaddr*)&from, &fromLength);
+        if (n < 0) {
+            // ENOBUFS: the socket overflowed during a burst of events, the next ones are still worth reading
+            if (errno == ENOBUFS || errno == EINTR) continue;
+            break;
+        }
+        // only the kernel itself (port 0) sends to this group
+        if (from.nl_pid != 0) continue;
+        msg[n] = '\0';
+
+        const Event event = parse(msg, (size_t)n);
+        if (event != HOTPLUG_NONE) last = event;
+    }
+    return last;
+}
+
+// A uevent is "action@devpath" followed by KEY=value strings, each NUL terminated. The Kinect is the USB device (not
+// one of its interfaces) whose PRODUCT is "vendor/product/bcdDevice" in lowercase hex without leading zeros.
+HotplugMonitor::Event HotplugMonitor::parse(const char* msg, size_t length) {
+    const char* action    = nullptr;
+    bool        usbDevice = false;
+    bool        kinect    = false;
+
+    for (const char* field = msg; field < msg + length; field += strlen(field) + 1) {
+        if (strncmp(field, "ACTION=", 7) == 0) {
+            action = field + 7;
+        } else if (strcmp(field, "DEVTYPE=usb_device") == 0) {
+            usbDevice = true;
+        } else if (strncmp(field, "PRODUCT=", 8) == 0) {
+            unsigned vendor = 0, product = 0;
+            if (sscanf(field + 8, "%x/%x", &vendor, &product) == 2) {
+                kinect = vendor == KINECT2_USB_VENDOR &&
+                         (product == KINECT2_USB_PRODUCT || product == KINECT2_USB_PRODUCT_PREVIEW);
+            }
+        }
+    }
+
+    if (!action || !usbDevice || !kinect) return HOTPLUG_NONE;
+    if (strcmp(action, "add") == 0) return HOTPLUG_ADDED;
+    if (strcmp(action, "remove") == 0) return HOTPLUG_REMOVED;
+    return HOTPLUG_NONE;
+}
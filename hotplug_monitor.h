@@ -0,0 +1,44 @@
+#ifndef kinect2pipe_IR_hotplug_monitor_H
+#define kinect2pipe_IR_hotplug_monitor_H
+
+#include <cstddef>
+
+// USB ids of the Kinect v2 camera, as libfreenect2 knows it: the released sensor and the developer preview
+#define KINECT2_USB_VENDOR          0x045e
+#define KINECT2_USB_PRODUCT         0x02d8
+#define KINECT2_USB_PRODUCT_PREVIEW 0x02c4
+
+// size of the buffer a uevent is received into, larger ones are truncated
+#define HOTPLUG_UEVENT_BYTES 8192
+
+/**
+ * Kernel uevents for the Kinect, read from a NETLINK_KOBJECT_UEVENT socket: the same events udev acts on, without
+ * depending on libudev or on udevd running. The socket is non-blocking and meant to be watched by the reactor;
+ * read() goes through every queued event and reports what happened to the Kinect last.
+ */
+class HotplugMonitor {
+public:
+    enum Event {
+        HOTPLUG_NONE,     // nothing about the Kinect
+        HOTPLUG_ADDED,    // the Kinect was plugged in
+        HOTPLUG_REMOVED   // the Kinect was unplugged
+    };
+
+    HotplugMonitor();
+    ~HotplugMonitor();
+
+    HotplugMonitor(const HotplugMonitor&) = delete;
+    HotplugMonitor& operator=(const HotplugMonitor&) = delete;
+
+    bool open();
+    int  fd() const { return this->sock; }
+
+    Event read();
+
+private:
+    int sock;
+
+    static Event parse(const char* msg, size_t length);
+};
+
+#endif // kinect2pipe_IR_hotplug_monitor_H
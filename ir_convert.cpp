@@ -0,0 +1,363 @@
+#include "ir_convert.h"
+#include <cmath>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define IR_CONVERT_X86 1
+#elif defined(__ARM_NEON) || defined(__aarch64__)
+#include <arm_neon.h>
+#define IR_CONVERT_NEON 1
+#endif
+
+// The vectorised kernels below produce bit-identical output to the scalar ones: every implementation clamps in the
+// float domain, computes v * scale + (min + 0.5) and truncates, so rounding never depends on the ISA.
+// NaN inputs (which libfreenect2 never produces, but better safe than sorry) map to black.
+
+void irToLumaScalar(const float* src, uint8_t* dst, size_t count, float maxValue, int lumaMin, int lumaRange) {
+    const float scale = (float)lumaRange / maxValue;
+    const float bias  = (float)lumaMin + 0.5f;
+    for (size_t i = 0; i < count; ++i) {
+        float v = src[i];
+        if (!(v > 0.0f)) v = 0.0f;
+        if (v > maxValue) v = maxValue;
+        dst[i] = (uint8_t)(int)(v * scale + bias);
+    }
+}
+
+void irToY16Scalar(const float* src, uint16_t* dst, size_t count, float maxValue) {
+    const float scale = 65535.0f / maxValue;
+    for (size_t i = 0; i < count; ++i) {
+        float v = src[i];
+        if (!(v > 0.0f)) v = 0.0f;
+        if (v > maxValue) v = maxValue;
+        dst[i] = (uint16_t)(int)(v * scale + 0.5f);
+    }
+}
+
+void irToLumaLutScalar(const float* src, uint8_t* dst, size_t count, float indexScale, const uint8_t* lut,
+                       int lutLast) {
+    const float last = (float)lutLast;
+    for (size_t i = 0; i < count; ++i) {
+        float v = src[i] * indexScale;
+        if (!(v > 0.0f)) v = 0.0f;
+        if (v > last) v = last;
+        dst[i] = lut[(int)v];
+    }
+}
+
+float irAbsDiffScalar(const float* a, const float* b, size_t count) {
+    float sum = 0.0f;
+    for (size_t i = 0; i < count; ++i) {
+        sum += fabsf(a[i] - b[i]);
+    }
+    return sum;
+}
+
+#if defined(IR_CONVERT_X86)
+
+template <size_t FixedCount>
+__attribute__((target("sse2")))
+static void irToLumaSse2(const float* src, uint8_t* dst, size_t count, float maxValue, int lumaMin, int lumaRange) {
+    if (FixedCount) count = FixedCount;
+    const __m128 zero  = _mm_setzero_ps();
+    const __m128 vmax  = _mm_set1_ps(maxValue);
+    const __m128 scale = _mm_set1_ps((float)lumaRange / maxValue);
+    const __m128 bias  = _mm_set1_ps((float)lumaMin + 0.5f);
+
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        // _mm_max_ps returns its second operand when the first one is NaN.
+        __m128 a = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(src + i),      zero), vmax);
+        __m128 b = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(src + i + 4),  zero), vmax);
+        __m128 c = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(src + i + 8),  zero), vmax);
+        __m128 d = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(src + i + 12), zero), vmax);
+
+        __m128i ia = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(a, scale), bias));
+        __m128i ib = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(b, scale), bias));
+        __m128i ic = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(c, scale), bias));
+        __m128i id = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(d, scale), bias));
+
+        __m128i ab = _mm_packs_epi32(ia, ib);
+        __m128i cd = _mm_packs_epi32(ic, id);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_packus_epi16(ab, cd));
+    }
+    irToLumaScalar(src + i, dst + i, count - i, maxValue, lumaMin, lumaRange);
+}
+
+template <size_t FixedCount>
+__attribute__((target("sse2")))
+static void irToY16Sse2(const float* src, uint16_t* dst, size_t count, float maxValue) {
+    if (FixedCount) count = FixedCount;
+    const __m128  zero  = _mm_setzero_ps();
+    const __m128  vmax  = _mm_set1_ps(maxValue);
+    const __m128  scale = _mm_set1_ps(65535.0f / maxValue);
+    const __m128  half  = _mm_set1_ps(0.5f);
+    // SSE2 only has a signed 32 -> 16 bit pack, so values are shifted into the signed range and back
+    const __m128i shift = _mm_set1_epi32(32768);
+    const __m128i flip  = _mm_set1_epi16((short)0x8000);
+
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m128 a = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(src + i),     zero), vmax);
+        __m128 b = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(src + i + 4), zero), vmax);
+
+        __m128i ia = _mm_sub_epi32(_mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(a, scale), half)), shift);
+        __m128i ib = _mm_sub_epi32(_mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(b, scale), half)), shift);
+
+        __m128i y = _mm_xor_si128(_mm_packs_epi32(ia, ib), flip);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), y);
+    }
+    irToY16Scalar(src + i, dst + i, count - i, maxValue);
+}
+
+template <size_t FixedCount>
+__attribute__((target("avx2")))
+static void irToLumaAvx2(const float* src, uint8_t* dst, size_t count, float maxValue, int lumaMin, int lumaRange) {
+    if (FixedCount) count = FixedCount;
+    const __m256  zero  = _mm256_setzero_ps();
+    const __m256  vmax  = _mm256_set1_ps(maxValue);
+    const __m256  scale = _mm256_set1_ps((float)lumaRange / maxValue);
+    const __m256  bias  = _mm256_set1_ps((float)lumaMin + 0.5f);
+    // the 256-bit packs work per 128-bit lane, this puts the 4-byte groups back in memory order
+    const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+
+    size_t i = 0;
+    for (; i + 32 <= count; i += 32) {
+        __m256 a = _mm256_min_ps(_mm256_max_ps(_mm256_loadu_ps(src + i),      zero), vmax);
+        __m256 b = _mm256_min_ps(_mm256_max_ps(_mm256_loadu_ps(src + i + 8),  zero), vmax);
+        __m256 c = _mm256_min_ps(_mm256_max_ps(_mm256_loadu_ps(src + i + 16), zero), vmax);
+        __m256 d = _mm256_min_ps(_mm256_max_ps(_mm256_loadu_ps(src + i + 24), zero), vmax);
+
+        // mul + add rather than FMA so the result matches the scalar and SSE2 kernels exactly
+        __m256i ia = _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(a, scale), bias));
+        __m256i ib = _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(b, scale), bias));
+        __m256i ic = _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(c, scale), bias));
+        __m256i id = _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(d, scale), bias));
+
+        __m256i ab = _mm256_packs_epi32(ia, ib);
+        __m256i cd = _mm256_packs_epi32(ic, id);
+        __m256i y  = _mm256_permutevar8x32_epi32(_mm256_packus_epi16(ab, cd), order);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), y);
+    }
+    irToLumaSse2<0>(src + i, dst + i, count - i, maxValue, lumaMin, lumaRange);
+}
+
+template <size_t FixedCount>
+__attribute__((target("avx2")))
+static void irToY16Avx2(const float* src, uint16_t* dst, size_t count, float maxValue) {
+    if (FixedCount) count = FixedCount;
+    const __m256 zero  = _mm256_setzero_ps();
+    const __m256 vmax  = _mm256_set1_ps(maxValue);
+    const __m256 scale = _mm256_set1_ps(65535.0f / maxValue);
+    const __m256 half  = _mm256_set1_ps(0.5f);
+
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m256 a = _mm256_min_ps(_mm256_max_ps(_mm256_loadu_ps(src + i),     zero), vmax);
+        __m256 b = _mm256_min_ps(_mm256_max_ps(_mm256_loadu_ps(src + i + 8), zero), vmax);
+
+        __m256i ia = _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(a, scale), half));
+        __m256i ib = _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(b, scale), half));
+
+        // per-lane pack yields a0-3 b0-3 a4-7 b4-7, swap the middle 64-bit quarters back
+        __m256i y = _mm256_permute4x64_epi64(_mm256_packus_epi32(ia, ib), 0xd8);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), y);
+    }
+    irToY16Sse2<0>(src + i, dst + i, count - i, maxValue);
+}
+
+// SSE2 has no gather: the indices are computed four at a time and the table is read with scalar loads.
+template <size_t FixedCount>
+__attribute__((target("sse2")))
+static void irToLumaLutSse2(const float* src, uint8_t* dst, size_t count, float indexScale, const uint8_t* lut,
+                            int lutLast) {
+    if (FixedCount) count = FixedCount;
+    const __m128 zero  = _mm_setzero_ps();
+    const __m128 last  = _mm_set1_ps((float)lutLast);
+    const __m128 scale = _mm_set1_ps(indexScale);
+    alignas(16) int32_t idx[16];
+
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        for (int k = 0; k < 4; ++k) {
+            __m128 v = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(src + i + 4 * k), scale), zero), last);
+            _mm_store_si128(reinterpret_cast<__m128i*>(idx + 4 * k), _mm_cvttps_epi32(v));
+        }
+        for (int k = 0; k < 16; ++k) dst[i + k] = lut[idx[k]];
+    }
+    irToLumaLutScalar(src + i, dst + i, count - i, indexScale, lut, lutLast);
+}
+
+template <size_t FixedCount>
+__attribute__((target("avx2")))
+static void irToLumaLutAvx2(const float* src, uint8_t* dst, size_t count, float indexScale, const uint8_t* lut,
+                            int lutLast) {
+    if (FixedCount) count = FixedCount;
+    const __m256  zero  = _mm256_setzero_ps();
+    const __m256  last  = _mm256_set1_ps((float)lutLast);
+    const __m256  scale = _mm256_set1_ps(indexScale);
+    const __m256i low   = _mm256_set1_epi32(0xff);
+    const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+    const int*    table = reinterpret_cast<const int*>(lut);
+
+    size_t i = 0;
+    for (; i + 32 <= count; i += 32) {
+        __m256i g[4];
+        for (int k = 0; k < 4; ++k) {
+            __m256 v = _mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(_mm256_loadu_ps(src + i + 8 * k), scale), zero),
+                                     last);
+            // byte granular gather of 32-bit words, hence IR_LUT_PADDING
+            g[k] = _mm256_and_si256(_mm256_i32gather_epi32(table, _mm256_cvttps_epi32(v), 1), low);
+        }
+        __m256i ab = _mm256_packs_epi32(g[0], g[1]);
+        __m256i cd = _mm256_packs_epi32(g[2], g[3]);
+        __m256i y  = _mm256_permutevar8x32_epi32(_mm256_packus_epi16(ab, cd), order);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), y);
+    }
+    irToLumaLutSse2<0>(src + i, dst + i, count - i, indexScale, lut, lutLast);
+}
+
+__attribute__((target("sse2")))
+static float irAbsDiffSse2(const float* a, const float* b, size_t count) {
+    // clearing the sign bit is the absolute value
+    const __m128 mask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+    __m128 s0 = _mm_setzero_ps();
+    __m128 s1 = _mm_setzero_ps();
+
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        s0 = _mm_add_ps(s0, _mm_and_ps(_mm_sub_ps(_mm_loadu_ps(a + i),     _mm_loadu_ps(b + i)),     mask));
+        s1 = _mm_add_ps(s1, _mm_and_ps(_mm_sub_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4)), mask));
+    }
+    float lanes[4];
+    _mm_storeu_ps(lanes, _mm_add_ps(s0, s1));
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3] + irAbsDiffScalar(a + i, b + i, count - i);
+}
+
+__attribute__((target("avx2")))
+static float irAbsDiffAvx2(const float* a, const float* b, size_t count) {
+    const __m256 mask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+    __m256 s0 = _mm256_setzero_ps();
+    __m256 s1 = _mm256_setzero_ps();
+
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m256 d0 = _mm256_sub_ps(_mm256_loadu_ps(a + i),     _mm256_loadu_ps(b + i));
+        __m256 d1 = _mm256_sub_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8));
+        s0 = _mm256_add_ps(s0, _mm256_and_ps(d0, mask));
+        s1 = _mm256_add_ps(s1, _mm256_and_ps(d1, mask));
+    }
+    const __m256 s   = _mm256_add_ps(s0, s1);
+    const __m128 sum = _mm_add_ps(_mm256_castps256_ps128(s), _mm256_extractf128_ps(s, 1));
+    float lanes[4];
+    _mm_storeu_ps(lanes, sum);
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3] + irAbsDiffSse2(a + i, b + i, count - i);
+}
+
+#elif defined(IR_CONVERT_NEON)
+
+// select instead of vmaxq so NaN (which compares false) becomes zero
+static inline float32x4_t clampIr(float32x4_t v, float32x4_t zero, float32x4_t vmax) {
+    return vminq_f32(vbslq_f32(vcgtq_f32(v, zero), v, zero), vmax);
+}
+
+template <size_t FixedCount>
+static void irToLumaNeon(const float* src, uint8_t* dst, size_t count, float maxValue, int lumaMin, int lumaRange) {
+    if (FixedCount) count = FixedCount;
+    const float32x4_t zero  = vdupq_n_f32(0.0f);
+    const float32x4_t vmax  = vdupq_n_f32(maxValue);
+    const float32x4_t scale = vdupq_n_f32((float)lumaRange / maxValue);
+    const float32x4_t bias  = vdupq_n_f32((float)lumaMin + 0.5f);
+
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        uint16x4_t h[4];
+        for (int k = 0; k < 4; ++k) {
+            float32x4_t v = clampIr(vld1q_f32(src + i + 4 * k), zero, vmax);
+            h[k] = vmovn_u32(vcvtq_u32_f32(vaddq_f32(vmulq_f32(v, scale), bias)));
+        }
+        uint8x8_t lo = vmovn_u16(vcombine_u16(h[0], h[1]));
+        uint8x8_t hi = vmovn_u16(vcombine_u16(h[2], h[3]));
+        vst1q_u8(dst + i, vcombine_u8(lo, hi));
+    }
+    irToLumaScalar(src + i, dst + i, count - i, maxValue, lumaMin, lumaRange);
+}
+
+template <size_t FixedCount>
+static void irToY16Neon(const float* src, uint16_t* dst, size_t count, float maxValue) {
+    if (FixedCount) count = FixedCount;
+    const float32x4_t zero  = vdupq_n_f32(0.0f);
+    const float32x4_t vmax  = vdupq_n_f32(maxValue);
+    const float32x4_t scale = vdupq_n_f32(65535.0f / maxValue);
+    const float32x4_t half  = vdupq_n_f32(0.5f);
+
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        float32x4_t a = clampIr(vld1q_f32(src + i),     zero, vmax);
+        float32x4_t b = clampIr(vld1q_f32(src + i + 4), zero, vmax);
+        uint16x4_t  lo = vmovn_u32(vcvtq_u32_f32(vaddq_f32(vmulq_f32(a, scale), half)));
+        uint16x4_t  hi = vmovn_u32(vcvtq_u32_f32(vaddq_f32(vmulq_f32(b, scale), half)));
+        vst1q_u16(dst + i, vcombine_u16(lo, hi));
+    }
+    irToY16Scalar(src + i, dst + i, count - i, maxValue);
+}
+
+template <size_t FixedCount>
+static void irToLumaLutNeon(const float* src, uint8_t* dst, size_t count, float indexScale, const uint8_t* lut,
+                            int lutLast) {
+    if (FixedCount) count = FixedCount;
+    const float32x4_t zero  = vdupq_n_f32(0.0f);
+    const float32x4_t last  = vdupq_n_f32((float)lutLast);
+    const float32x4_t scale = vdupq_n_f32(indexScale);
+    int32_t idx[16];
+
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        for (int k = 0; k < 4; ++k) {
+            float32x4_t v = clampIr(vmulq_f32(vld1q_f32(src + i + 4 * k), scale), zero, last);
+            vst1q_s32(idx + 4 * k, vcvtq_s32_f32(v));
+        }
+        for (int k = 0; k < 16; ++k) dst[i + k] = lut[idx[k]];
+    }
+    irToLumaLutScalar(src + i, dst + i, count - i, indexScale, lut, lutLast);
+}
+
+static float irAbsDiffNeon(const float* a, const float* b, size_t count) {
+    float32x4_t s0 = vdupq_n_f32(0.0f);
+    float32x4_t s1 = vdupq_n_f32(0.0f);
+
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        s0 = vaddq_f32(s0, vabdq_f32(vld1q_f32(a + i),     vld1q_f32(b + i)));
+        s1 = vaddq_f32(s1, vabdq_f32(vld1q_f32(a + i + 4), vld1q_f32(b + i + 4)));
+    }
+    float lanes[4];
+    vst1q_f32(lanes, vaddq_f32(s0, s1));
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3] + irAbsDiffScalar(a + i, b + i, count - i);
+}
+
+#endif
+
+template <size_t FixedCount>
+IrKernels selectIrKernels() {
+    IrKernels k{irToLumaScalar, irToY16Scalar, irToLumaLutScalar, irAbsDiffScalar, "scalar"};
+
+#if defined(IR_CONVERT_X86)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        k = IrKernels{irToLumaAvx2<FixedCount>, irToY16Avx2<FixedCount>, irToLumaLutAvx2<FixedCount>, irAbsDiffAvx2,
+                      "avx2"};
+    } else if (__builtin_cpu_supports("sse2")) {
+        k = IrKernels{irToLumaSse2<FixedCount>, irToY16Sse2<FixedCount>, irToLumaLutSse2<FixedCount>, irAbsDiffSse2,
+                      "sse2"};
+    }
+#elif defined(IR_CONVERT_NEON)
+    k = IrKernels{irToLumaNeon<FixedCount>, irToY16Neon<FixedCount>, irToLumaLutNeon<FixedCount>, irAbsDiffNeon,
+                  "neon"};
+#endif
+
+    return k;
+}
+
+template IrKernels selectIrKernels<0>();
+template IrKernels selectIrKernels<KinectIrFormat::pixels>();
@@ -0,0 +1,85 @@
+#ifndef kinect2pipe_IR_ir_convert_H
+#define kinect2pipe_IR_ir_convert_H
+
+#include <cstddef>
+#include <cstdint>
+#include "frame_format.h"
+
+// Largest IR value libfreenect2 reports.
+#define IR_MAX_VALUE 65535.0f
+
+// Limited ("studio") range luma used by the YUV420P output, matching what
+// swscale produces for a full range gray input.
+#define IR_LUMA_MIN   16
+#define IR_LUMA_RANGE 219
+
+// Full range used by the single plane GREY output.
+#define IR_GREY_MIN   0
+#define IR_GREY_RANGE 255
+
+// Neutral chroma value for the U and V planes of a gray YUV420P image.
+#define IR_CHROMA_NEUTRAL 0x80
+
+/**
+ * Fused normalise + clamp + gray transfer kernel. Reads count IR floats from src, divides them by maxValue, clamps
+ * to [0, 1], maps the result onto [lumaMin, lumaMin + lumaRange] and stores one byte per pixel in dst.
+ */
+typedef void (*IrToLumaFn)(const float* src, uint8_t* dst, size_t count, float maxValue, int lumaMin, int lumaRange);
+
+/**
+ * Same as IrToLumaFn for 16-bit output: maps [0, maxValue] onto [0, 65535] and stores uint16 values in host order,
+ * which is the little endian layout V4L2_PIX_FMT_Y16 wants on every platform we build for. With maxValue at 65535
+ * this keeps the full IR precision, the values libfreenect2 reports are whole numbers.
+ */
+typedef void (*IrToY16Fn)(const float* src, uint16_t* dst, size_t count, float maxValue);
+
+// Bytes a lookup table passed to IrToLumaLutFn must stay readable for past its last entry. The AVX2 kernel gathers
+// 32-bit words and keeps the low byte.
+#define IR_LUT_PADDING 3
+
+/**
+ * Table-driven variant used by the tone mapper: scales count IR floats from src by indexScale, clamps them to
+ * [0, lutLast] and stores lut[(int)value] in dst. The table holds final output values, so this is the whole per-pixel
+ * cost of any global tone curve.
+ */
+typedef void (*IrToLumaLutFn)(const float* src, uint8_t* dst, size_t count, float indexScale, const uint8_t* lut,
+                              int lutLast);
+
+/**
+ * Sum of |a[i] - b[i]| over count floats, for comparing frames. The lanes are summed separately and added up at the
+ * end, so the result differs from the scalar sum in its last bits; keep count to a row or so for float precision.
+ */
+typedef float (*IrAbsDiffFn)(const float* a, const float* b, size_t count);
+
+/**
+ * The fastest implementation of every kernel supported by the CPU we are running on.
+ */
+struct IrKernels {
+    IrToLumaFn    toLuma;
+    IrToY16Fn     toY16;
+    IrToLumaLutFn toLumaLut;
+    IrAbsDiffFn   absDiff;
+    const char*   name;   // AVX2, SSE2, NEON or scalar
+};
+
+/**
+ * When FixedCount is not 0 every call is for exactly that many pixels: the returned kernels ignore their count
+ * argument and run loops with a compile-time trip count. The Kinect frame size is instantiated for the IR path.
+ * absDiff is the exception, it always takes its count.
+ */
+template <size_t FixedCount = 0>
+IrKernels selectIrKernels();
+
+extern template IrKernels selectIrKernels<0>();
+extern template IrKernels selectIrKernels<KinectIrFormat::pixels>();
+
+/**
+ * Portable reference implementations, also used for the tail of the vectorised kernels.
+ */
+void irToLumaScalar(const float* src, uint8_t* dst, size_t count, float maxValue, int lumaMin, int lumaRange);
+void irToY16Scalar(const float* src, uint16_t* dst, size_t count, float maxValue);
+void irToLumaLutScalar(const float* src, uint8_t* dst, size_t count, float indexScale, const uint8_t* lut,
+                       int lutLast);
+float irAbsDiffScalar(const float* a, const float* b, size_t count);
+
+#endif // kinect2pipe_IR_ir_convert_H
@@ -0,0 +1,286 @@
+#include "ir_decode.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define IR_DECODE_X86 1
+#elif defined(__ARM_NEON) || defined(__aarch64__)
+#include <arm_neon.h>
+#define IR_DECODE_NEON 1
+#endif
+
+// libfreenect2's default DepthPacketProcessor::Parameters, per modulation frequency
+static const float abMultiplierPerFrq[3] = {1.322581f, 1.0f, 1.612903f};
+static const float phaseInRad[3]         = {0.0f, 2.094395f, 4.18879f};
+
+// planes of one row: nine measurements, 18 trig values
+#define IR_DECODE_MEASUREMENTS 9
+#define IR_DECODE_TRIG         18
+
+// The vectorised kernels produce bit-identical output to the scalar one: they evaluate the same expressions in the
+// same order, and sqrt is exactly rounded everywhere.
+
+void irAmplitudeRowScalar(const float* m, const float* trig, size_t stride, const uint32_t* valid,
+                          const uint32_t* saturated, float scale, float* out, size_t count) {
+    for (size_t x = 0; x < count; ++x) {
+        float sum = 0.0f;
+        for (int f = 0; f < 3; ++f) {
+            const float* mf = m + (size_t)(3 * f) * stride + x;
+            const float* tf = trig + (size_t)(6 * f) * stride + x;
+            const float  a  = tf[0] * mf[0] + tf[stride] * mf[stride] + tf[2 * stride] * mf[2 * stride];
+            const float  b  = tf[3 * stride] * mf[0] + tf[4 * stride] * mf[stride] + tf[5 * stride] * mf[2 * stride];
+            sum += sqrtf(a * a + b * b);
+        }
+        float v = sum * scale;
+        if (v > 65535.0f) v = 65535.0f;
+        if (!valid[x]) v = 0.0f;
+        if (saturated[x]) v = 65535.0f;
+        out[x] = v;
+    }
+}
+
+#if defined(IR_DECODE_X86)
+
+__attribute__((target("sse2")))
+static void irAmplitudeRowSse2(const float* m, const float* trig, size_t stride, const uint32_t* valid,
+                               const uint32_t* saturated, float scale, float* out, size_t count) {
+    const __m128 vscale = _mm_set1_ps(scale);
+    const __m128 vmax   = _mm_set1_ps(65535.0f);
+
+    size_t x = 0;
+    for (; x + 4 <= count; x += 4) {
+        __m128 sum = _mm_setzero_ps();
+        for (int f = 0; f < 3; ++f) {
+            const float* mf = m + (size_t)(3 * f) * stride + x;
+            const float* tf = trig + (size_t)(6 * f) * stride + x;
+            const __m128 m0 = _mm_loadu_ps(mf);
+            const __m128 m1 = _mm_loadu_ps(mf + stride);
+            const __m128 m2 = _mm_loadu_ps(mf + 2 * stride);
+            __m128 a = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_loadu_ps(tf), m0),
+                                             _mm_mul_ps(_mm_loadu_ps(tf + stride), m1)),
+                                  _mm_mul_ps(_mm_loadu_ps(tf + 2 * stride), m2));
+            __m128 b = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_loadu_ps(tf + 3 * stride), m0),
+                                             _mm_mul_ps(_mm_loadu_ps(tf + 4 * stride), m1)),
+                                  _mm_mul_ps(_mm_loadu_ps(tf + 5 * stride), m2));
+            sum = _mm_add_ps(sum, _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(a, a), _mm_mul_ps(b, b))));
+        }
+        __m128       v   = _mm_min_ps(_mm_mul_ps(sum, vscale), vmax);
+        const __m128 ok  = _mm_castsi128_ps(_mm_loadu_si128((const __m128i*)(valid + x)));
+        const __m128 sat = _mm_castsi128_ps(_mm_loadu_si128((const __m128i*)(saturated + x)));
+        v = _mm_or_ps(_mm_andnot_ps(sat, _mm_and_ps(v, ok)), _mm_and_ps(sat, vmax));
+        _mm_storeu_ps(out + x, v);
+    }
+    irAmplitudeRowScalar(m + x, trig + x, stride, valid + x, saturated + x, scale, out + x, count - x);
+}
+
+__attribute__((target("avx2")))
+static void irAmplitudeRowAvx2(const float* m, const float* trig, size_t stride, const uint32_t* valid,
+                               const uint32_t* saturated, float scale, float* out, size_t count) {
+    const __m256 vscale = _mm256_set1_ps(scale);
+    const __m256 vmax   = _mm256_set1_ps(65535.0f);
+
+    size_t x = 0;
+    for (; x + 8 <= count; x += 8) {
+        __m256 sum = _mm256_setzero_ps();
+        for (int f = 0; f < 3; ++f) {
+            const float* mf = m + (size_t)(3 * f) * stride + x;
+            const float* tf = trig + (size_t)(6 * f) * stride + x;
+            const __m256 m0 = _mm256_loadu_ps(mf);
+            const __m256 m1 = _mm256_loadu_ps(mf + stride);
+            const __m256 m2 = _mm256_loadu_ps(mf + 2 * stride);
+            __m256 a = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(tf), m0),
+                                                   _mm256_mul_ps(_mm256_loadu_ps(tf + stride), m1)),
+                                     _mm256_mul_ps(_mm256_loadu_ps(tf + 2 * stride), m2));
+            __m256 b = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(tf + 3 * stride), m0),
+                                                   _mm256_mul_ps(_mm256_loadu_ps(tf + 4 * stride), m1)),
+                                     _mm256_mul_ps(_mm256_loadu_ps(tf + 5 * stride), m2));
+            sum = _mm256_add_ps(sum, _mm256_sqrt_ps(_mm256_add_ps(_mm256_mul_ps(a, a), _mm256_mul_ps(b, b))));
+        }
+        __m256       v   = _mm256_min_ps(_mm256_mul_ps(sum, vscale), vmax);
+        const __m256 ok  = _mm256_castsi256_ps(_mm256_loadu_si256((const __m256i*)(valid + x)));
+        const __m256 sat = _mm256_castsi256_ps(_mm256_loadu_si256((const __m256i*)(saturated + x)));
+        v = _mm256_blendv_ps(_mm256_and_ps(v, ok), vmax, sat);
+        _mm256_storeu_ps(out + x, v);
+    }
+    irAmplitudeRowScalar(m + x, trig + x, stride, valid + x, saturated + x, scale, out + x, count - x);
+}
+
+#elif defined(IR_DECODE_NEON)
+
+static void irAmplitudeRowNeon(const float* m, const float* trig, size_t stride, const uint32_t* valid,
+                               const uint32_t* saturated, float scale, float* out, size_t count) {
+    const float32x4_t vscale = vdupq_n_f32(scale);
+    const float32x4_t vmax   = vdupq_n_f32(65535.0f);
+    const float32x4_t zero   = vdupq_n_f32(0.0f);
+
+    size_t x = 0;
+    for (; x + 4 <= count; x += 4) {
+        float32x4_t sum = zero;
+        for (int f = 0; f < 3; ++f) {
+            const float*      mf = m + (size_t)(3 * f) * stride + x;
+            const float*      tf = trig + (size_t)(6 * f) * stride + x;
+            const float32x4_t m0 = vld1q_f32(mf);
+            const float32x4_t m1 = vld1q_f32(mf + stride);
+            const float32x4_t m2 = vld1q_f32(mf + 2 * stride);
+            // separate multiplies and adds, vmlaq may be fused
+            float32x4_t a = vaddq_f32(vaddq_f32(vmulq_f32(vld1q_f32(tf), m0), vmulq_f32(vld1q_f32(tf + stride), m1)),
+                                      vmulq_f32(vld1q_f32(tf + 2 * stride), m2));
+            float32x4_t b = vaddq_f32(vaddq_f32(vmulq_f32(vld1q_f32(tf + 3 * stride), m0),
+                                                vmulq_f32(vld1q_f32(tf + 4 * stride), m1)),
+                                      vmulq_f32(vld1q_f32(tf + 5 * stride), m2));
+            sum = vaddq_f32(sum, vsqrtq_f32(vaddq_f32(vmulq_f32(a, a), vmulq_f32(b, b))));
+        }
+        float32x4_t v = vminq_f32(vmulq_f32(sum, vscale), vmax);
+        v = vbslq_f32(vld1q_u32(valid + x), v, zero);
+        v = vbslq_f32(vld1q_u32(saturated + x), vmax, v);
+        vst1q_f32(out + x, v);
+    }
+    irAmplitudeRowScalar(m + x, trig + x, stride, valid + x, saturated + x, scale, out + x, count - x);
+}
+
+#endif
+
+IrAmplitudeRowFn selectIrAmplitudeKernel(const char** name) {
+    IrAmplitudeRowFn kernel = irAmplitudeRowScalar;
+    const char*      label  = "scalar";
+
+#if defined(IR_DECODE_X86)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        kernel = irAmplitudeRowAvx2;
+        label  = "avx2";
+    } else if (__builtin_cpu_supports("sse2")) {
+        kernel = irAmplitudeRowSse2;
+        label  = "sse2";
+    }
+#elif defined(IR_DECODE_NEON)
+    kernel = irAmplitudeRowNeon;
+    label  = "neon";
+#endif
+
+    if (name) *name = label;
+    return kernel;
+}
+
+IrPacketDecoder::IrPacketDecoder(int threads) : workers(threads) {
+    const int width  = KinectIrFormat::width;
+    const int height = KinectIrFormat::height;
+
+    this->amplitude = selectIrAmplitudeKernel(&this->amplitudeName);
+    this->trig.assign((size_t)height * IR_DECODE_TRIG * width, 0.0f);
+    this->valid.assign((size_t)height * width, 0);
+    memset(this->lut, 0, sizeof(this->lut));
+    for (Band& band : this->bands) {
+        band.measurements.assign((size_t)IR_DECODE_MEASUREMENTS * width, 0.0f);
+        band.saturated.assign((size_t)width, 0);
+    }
+    this->haveP0  = false;
+    this->haveLut = false;
+    this->haveZ   = false;
+}
+
+// Turns the phase offsets the device measured for every pixel into the rotations each frequency's measurements are
+// combined with. The tables come bottom row first, like the packets.
+bool IrPacketDecoder::loadP0Tables(const unsigned char* response, size_t length) {
+    if (length < KINECT2_P0_TABLES_BYTES) {
+        return false;
+    }
+    const int    width  = KinectIrFormat::width;
+    const int    height = KinectIrFormat::height;
+    const size_t table  = (size_t)width * height * 2 + 4;
+
+    for (int f = 0; f < 3; ++f) {
+        const unsigned char* p0 = response + 32 + 2 + f * table;
+        for (int y = 0; y < height; ++y) {
+            float* row = this->trig.data() + ((size_t)y * IR_DECODE_TRIG + 6 * f) * width;
+            for (int x = 0; x < width; ++x) {
+                uint16_t raw;
+                memcpy(&raw, p0 + ((size_t)(height - 1 - y) * width + x) * 2, sizeof(raw));
+                // float and double exactly as in libfreenect2's CpuDepthPacketProcessor
+                const float p = -((float)raw) * 0.000031 * M_PI;
+                for (int k = 0; k < 3; ++k) {
+                    const float phase = p + phaseInRad[k];
+                    row[k * width + x]       = cosf(phase) * abMultiplierPerFrq[f];
+                    row[(3 + k) * width + x] = sinf(-phase) * abMultiplierPerFrq[f];
+                }
+            }
+        }
+    }
+    this->haveP0 = true;
+    return true;
+}
+
+void IrPacketDecoder::loadLookupTable(const int16_t* lut) {
+    memcpy(this->lut, lut, sizeof(this->lut));
+    this->haveLut = true;
+}
+
+void IrPacketDecoder::loadZTable(const float* ztable) {
+    for (size_t i = 0; i < this->valid.size(); ++i) {
+        this->valid[i] = ztable[i] > 0.0f ? 0xffffffffu : 0;
+    }
+    this->haveZ = true;
+}
+
+void IrPacketDecoder::decode(const unsigned char* packet, float* ir) {
+    const int rows = (KinectIrFormat::height + IR_DECODE_BANDS - 1) / IR_DECODE_BANDS;
+    this->workers.run(IR_DECODE_BANDS, [this, packet, ir, rows](int part) {
+        const int first = part * rows;
+        const int last  = std::min(first + rows, (int)KinectIrFormat::height);
+        this->decodeRows(packet, ir, this->bands[part], first, last);
+    });
+}
+
+void IrPacketDecoder::decodeRows(const unsigned char* packet, float* ir, Band& band, int first, int last) {
+    const int   width  = KinectIrFormat::width;
+    const int   height = KinectIrFormat::height;
+    const float scale  = IR_DECODE_AB_MULTIPLIER * 0.3333333f * IR_DECODE_AB_OUTPUT_MULTIPLIER;
+
+    for (int y = first; y < last; ++y) {
+        this->unpackRow(packet, y, band);
+        // the packets are upside down
+        this->amplitude(band.measurements.data(), this->trig.data() + (size_t)y * IR_DECODE_TRIG * width,
+                        (size_t)width, this->valid.data() + (size_t)y * width, band.saturated.data(), scale,
+                        ir + (size_t)(height - 1 - y) * width, (size_t)width);
+    }
+}
+
+// Row y of the nine sub-images, into band's measurement planes. A packed row of 512 11-bit values starts with every
+// fourth pixel from x = 0, then every fourth from x = 1 and so on; the outermost columns hold no measurement. A pixel
+// is saturated if any measurement of any frequency is, and the pixel is valid at all.
+void IrPacketDecoder::unpackRow(const unsigned char* packet, int y, Band& band) {
+    const int width  = KinectIrFormat::width;
+    const int height = KinectIrFormat::height;
+    const int half   = height / 2;
+    const int packed = y < half ? y + half : height - 1 - y;
+    const int block  = width / 4;   // pixels of one column phase
+
+    const uint32_t* valid     = this->valid.data() + (size_t)y * width;
+    uint32_t*       saturated = band.saturated.data();
+    memset(saturated, 0, (size_t)width * sizeof(uint32_t));
+
+    for (int sub = 0; sub < IR_DECODE_MEASUREMENTS; ++sub) {
+        const unsigned char* row = packet + (size_t)sub * KINECT2_SUBIMAGE_BYTES + (size_t)packed * (width * 11 / 8);
+        float*               out = band.measurements.data() + (size_t)sub * width;
+
+        // eight values take eleven bytes; each is read with a 32-bit load, which may reach two bytes past the group
+        // but never past the packet, the tenth sub-image follows the ninth
+        for (int j = 0; j < width; j += 8) {
+            const unsigned char* p = row + j / 8 * 11;
+            const int            x = 4 * (j % block) + j / block;
+            for (int k = 0; k < 8; ++k) {
+                uint32_t bits;
+                memcpy(&bits, p + 11 * k / 8, sizeof(bits));
+                const int16_t m = this->lut[(bits >> (11 * k % 8)) & (KINECT2_LUT_SIZE - 1)];
+                out[x + 4 * k]  = (float)m;
+                if (m == 32767) saturated[x + 4 * k] = valid[x + 4 * k];
+            }
+        }
+        out[0]         = (float)this->lut[0];
+        out[width - 1] = (float)this->lut[0];
+    }
+    saturated[0]         = this->lut[0] == 32767 ? valid[0] : 0;
+    saturated[width - 1] = this->lut[0] == 32767 ? valid[width - 1] : 0;
+}
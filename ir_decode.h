@@ -0,0 +1,91 @@
+#ifndef kinect2pipe_IR_ir_decode_H
+#define kinect2pipe_IR_ir_decode_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "frame_format.h"
+#include "worker_group.h"
+
+// A depth packet holds ten sub-images of 512x424 11-bit values; the first nine are three measurements at each of the
+// Kinect's three modulation frequencies, the tenth isn't needed for IR.
+#define KINECT2_SUBIMAGE_BYTES     (512 * 424 * 11 / 8)
+#define KINECT2_SUBIMAGES          10
+#define KINECT2_DEPTH_PACKET_BYTES (KINECT2_SUBIMAGE_BYTES * KINECT2_SUBIMAGES)
+// 11-bit raw values -> signed measurements
+#define KINECT2_LUT_SIZE           2048
+// the device's P0 tables response: a 32-byte header, then three tables of 512x424 uint16 with a word before and after
+#define KINECT2_P0_TABLES_BYTES    (32 + 3 * (2 + 512 * 424 * 2 + 2))
+
+// libfreenect2's default DepthPacketProcessor::Parameters, the ones the IR image depends on
+#define IR_DECODE_AB_MULTIPLIER        0.6666667f
+#define IR_DECODE_AB_OUTPUT_MULTIPLIER 16.0f
+
+// a frame is decoded in this many bands of rows, spread over the decoder's threads
+#define IR_DECODE_BANDS 8
+
+/**
+ * Amplitude of one row: m holds the nine measurements of count pixels as planes stride floats apart, trig the cosines
+ * and sines of the three frequencies (six planes each, already scaled by the frequency's multiplier). valid and
+ * saturated are all-ones masks; a pixel that isn't valid is 0, a saturated one 65535, the rest
+ * min((amp0 + amp1 + amp2) * scale, 65535).
+ */
+typedef void (*IrAmplitudeRowFn)(const float* m, const float* trig, size_t stride, const uint32_t* valid,
+                                 const uint32_t* saturated, float scale, float* out, size_t count);
+
+void             irAmplitudeRowScalar(const float* m, const float* trig, size_t stride, const uint32_t* valid,
+                                      const uint32_t* saturated, float scale, float* out, size_t count);
+// the fastest implementation the CPU supports, its name (avx2, sse2, neon or scalar) in name
+IrAmplitudeRowFn selectIrAmplitudeKernel(const char** name);
+
+/**
+ * Computes the Kinect's IR image from raw depth packets, and nothing else.
+ *
+ * libfreenect2's CPU depth processor spends most of its time on what only depth needs: phase unwrapping, the
+ * bilateral and edge-aware filters and the depth itself. The IR image is just the mean amplitude of the three
+ * frequencies, sqrt(a^2 + b^2) of each frequency's three measurements rotated by its phase table. This computes
+ * that, the same way libfreenect2 does with its filters off, row by row: the 11-bit values are unpacked with the
+ * scalar code, the amplitudes with SIMD kernels, and the rows are split into bands decoded on several threads.
+ *
+ * The tables are loaded from what the device reports before any packet arrives, like libfreenect2's processors do.
+ */
+class IrPacketDecoder {
+public:
+    // threads including the caller, 0 for one per core
+    explicit IrPacketDecoder(int threads);
+
+    // false if the response is too short
+    bool loadP0Tables(const unsigned char* response, size_t length);
+    void loadLookupTable(const int16_t* lut);
+    void loadZTable(const float* ztable);
+    // every table is loaded
+    bool ready() const { return this->haveP0 && this->haveLut && this->haveZ; }
+
+    // for comparing kernels, the fastest one is used by default
+    void        setKernel(IrAmplitudeRowFn kernel, const char* name) { amplitude = kernel; amplitudeName = name; }
+    const char* kernelName() const { return this->amplitudeName; }
+    int         threadCount() const { return this->workers.threadCount(); }
+
+    // packet holds KINECT2_DEPTH_PACKET_BYTES, ir gets 512x424 floats in KinectIrFormat
+    void decode(const unsigned char* packet, float* ir);
+
+private:
+    struct Band {
+        std::vector<float>    measurements;  // nine planes of one row
+        std::vector<uint32_t> saturated;
+    };
+
+    WorkerGroup           workers;
+    IrAmplitudeRowFn      amplitude;
+    const char*           amplitudeName;
+    std::vector<float>    trig;     // per row: three frequencies of cos0..2, sin0..2 planes
+    std::vector<uint32_t> valid;    // z table > 0
+    int16_t               lut[KINECT2_LUT_SIZE];
+    Band                  bands[IR_DECODE_BANDS];
+    bool                  haveP0, haveLut, haveZ;
+
+    void decodeRows(const unsigned char* packet, float* ir, Band& band, int first, int last);
+    void unpackRow(const unsigned char* packet, int y, Band& band);
+};
+
+#endif // kinect2pipe_IR_ir_decode_H
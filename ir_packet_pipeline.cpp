@@ -0,0 +1,135 @@
+#include "ir_packet_pipeline.h"
+#include <iostream>
+#include <memory>
+#include <vector>
+#include <libfreenect2/depth_packet_processor.h> // internal, from the libfreenect2 source tree
+#include "ir_decode.h"
+#include "packet_recording.h"
+
+using namespace std;
+using namespace libfreenect2;
+
+// packets recorded with --record-packets, about 3 MB each with their reference
+#define IR_PIPELINE_RECORD_PACKETS 90
+
+// Keeps the IR frame libfreenect2's CPU processor produced for the packet it was just given.
+class ReferenceListener : public FrameListener {
+public:
+    std::vector<float> ir;
+
+    bool onNewFrame(Frame::Type type, Frame* frame) {
+        if (type == Frame::Ir) {
+            const float* data = (const float*)frame->data;
+            this->ir.assign(data, data + KinectIrFormat::pixels);
+        }
+        // libfreenect2 keeps the frame and reuses it
+        return false;
+    }
+};
+
+/**
+ * The IR-only DepthPacketProcessor: libfreenect2 calls it on its depth processing thread with every complete packet,
+ * after loading the device's tables. The decoder runs with that thread as one of its own.
+ */
+class IrDepthPacketProcessor : public DepthPacketProcessor {
+public:
+    IrDepthPacketProcessor(int threads, const std::string& recordPath) : decoder(threads) {
+        this->irFrame = new Frame(KinectIrFormat::width, KinectIrFormat::height, sizeof(float));
+        this->irFrame->format = Frame::Float;
+        cout << "decoding IR only, " << this->decoder.kernelName() << " on " << this->decoder.threadCount()
+             << " threads" << endl;
+
+        if (!recordPath.empty() && this->recorder.open(recordPath, true)) {
+            // decodes every recorded packet once more, the way libfreenect2 would with its filters off
+            this->reference.reset(new CpuDepthPacketProcessor());
+            DepthPacketProcessor::Config config;
+            config.EnableBilateralFilter = false;
+            config.EnableEdgeAwareFilter = false;
+            this->reference->setConfiguration(config);
+            this->reference->setFrameListener(&this->referenceListener);
+        }
+    }
+
+    ~IrDepthPacketProcessor() {
+        delete this->irFrame;
+    }
+
+    const char* name() { return "IR only"; }
+
+    void loadP0TablesFromCommandResponse(unsigned char* buffer, size_t buffer_length) {
+        if (!this->decoder.loadP0Tables(buffer, buffer_length)) {
+            cerr << "P0 tables response is too short: " << buffer_length << " bytes" << endl;
+            return;
+        }
+        if (this->reference) {
+            this->reference->loadP0TablesFromCommandResponse(buffer, buffer_length);
+            this->recorder.setP0Tables(buffer, buffer_length);
+        }
+    }
+
+    void loadXZTables(const float* xtable, const float* ztable) {
+        this->decoder.loadZTable(ztable);
+        if (this->reference) {
+            this->reference->loadXZTables(xtable, ztable);
+            this->recorder.setZTable(ztable);
+        }
+    }
+
+    void loadLookupTable(const short* lut) {
+        this->decoder.loadLookupTable(lut);
+        if (this->reference) {
+            this->reference->loadLookupTable(lut);
+            this->recorder.setLookupTable(lut);
+        }
+    }
+
+    void process(const DepthPacket& packet) {
+        if (!this->listener_ || !this->decoder.ready()) return;
+        if (packet.buffer_length < KINECT2_DEPTH_PACKET_BYTES) {
+            cerr << "depth packet too short: " << packet.buffer_length << " bytes" << endl;
+            return;
+        }
+        if (this->reference) this->record(packet);
+
+        this->decoder.decode(packet.buffer, (float*)this->irFrame->data);
+        this->irFrame->sequence  = packet.sequence;
+        this->irFrame->timestamp = packet.timestamp;
+        if (this->listener_->onNewFrame(Frame::Ir, this->irFrame)) {
+            this->irFrame = new Frame(KinectIrFormat::width, KinectIrFormat::height, sizeof(float));
+            this->irFrame->format = Frame::Float;
+        }
+    }
+
+private:
+    IrPacketDecoder                          decoder;
+    Frame*                                   irFrame;
+    PacketRecorder                           recorder;
+    std::unique_ptr<CpuDepthPacketProcessor> reference;
+    ReferenceListener                        referenceListener;
+
+    void record(const DepthPacket& packet) {
+        this->referenceListener.ir.clear();
+        this->reference->process(packet);
+        if (this->referenceListener.ir.empty()) return;
+        const float* ir = this->referenceListener.ir.data();
+        if (!this->recorder.write(packet.buffer, packet.sequence, packet.timestamp, ir) ||
+            this->recorder.written() >= IR_PIPELINE_RECORD_PACKETS) {
+            this->recorder.close();
+            this->reference.reset();
+        }
+    }
+};
+
+IrPacketPipeline::IrPacketPipeline(int threads, const std::string& recordPath) {
+    this->threads    = threads;
+    this->recordPath = recordPath;
+    // BasePacketPipeline's constructor can't call createDepthPacketProcessor() of a class not yet constructed
+    this->initialize();
+}
+
+IrPacketPipeline::~IrPacketPipeline() {
+}
+
+DepthPacketProcessor* IrPacketPipeline::createDepthPacketProcessor() {
+    return new IrDepthPacketProcessor(this->threads, this->recordPath);
+}
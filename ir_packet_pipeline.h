@@ -0,0 +1,29 @@
+#ifndef kinect2pipe_IR_ir_packet_pipeline_H
+#define kinect2pipe_IR_ir_packet_pipeline_H
+
+#include <string>
+#include <libfreenect2/packet_pipeline.h>
+
+/**
+ * libfreenect2's CPU packet pipeline with the depth processor replaced by one that decodes the IR image only, with
+ * IrPacketDecoder, and never produces depth frames.
+ *
+ * libfreenect2 doesn't install the headers its packet processors are declared in, so this is only built when its
+ * source tree is at hand (see LIBFREENECT2_SOURCE_DIR in CMakeLists.txt); KINECT2PIPE_IR_PIPELINE is defined then.
+ */
+class IrPacketPipeline : public libfreenect2::BasePacketPipeline {
+public:
+    // threads decoding a packet, 0 for one per core. Given a path, the first packets are also recorded there, with
+    // libfreenect2's own decoding of each as a reference.
+    explicit IrPacketPipeline(int threads, const std::string& recordPath = "");
+    ~IrPacketPipeline();
+
+protected:
+    libfreenect2::DepthPacketProcessor* createDepthPacketProcessor();
+
+private:
+    int         threads;
+    std::string recordPath;
+};
+
+#endif // kinect2pipe_IR_ir_packet_pipeline_H
@@ -0,0 +1,277 @@
+#include "ir_recording.h"
+#include <iostream>
+#include <cerrno>
+#include <cstring>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+using namespace std;
+
+// ---------------------------------------------------------------------------------------------------------------------
+// codec
+// ---------------------------------------------------------------------------------------------------------------------
+
+static inline uint8_t* putVarint(uint8_t* p, uint32_t v) {
+    while (v >= 0x80) {
+        *p++ = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    *p++ = (uint8_t)v;
+    return p;
+}
+
+static inline bool getVarint(const uint8_t*& p, const uint8_t* end, uint32_t& v) {
+    v = 0;
+    for (int shift = 0; shift < 35; shift += 7) {
+        if (p == end) return false;
+        const uint8_t b = *p++;
+        v |= (uint32_t)(b & 0x7f) << shift;
+        if (!(b & 0x80)) return true;
+    }
+    return false;
+}
+
+// the bit pattern of a float, read and written in place
+typedef uint32_t __attribute__((may_alias)) FloatBits;
+
+static inline uint32_t zigzag(int32_t v) { return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31); }
+static inline int32_t  unzigzag(uint32_t v) { return (int32_t)(v >> 1) ^ -(int32_t)(v & 1); }
+
+// a LEB128 value of 32 bits takes at most 5 bytes
+size_t irEncodeBound(size_t pixels) {
+    return pixels * 5;
+}
+
+// Predicted value of pixel (x, y) is its left neighbour, or the one above it in the first column. Sample is the
+// integer form the codec works on: the 16-bit value for DELTA16, the float's bit pattern for DELTA32.
+template <class Sample>
+static size_t encodeDelta(const Sample* src, int width, int height, uint8_t* dst, size_t limit) {
+    uint8_t*       p   = dst;
+    const uint8_t* end = dst + limit;
+    for (int y = 0; y < height; ++y) {
+        const Sample* row = src + (size_t)y * width;
+        Sample        prev = y ? row[-width] : 0;
+        // check for the limit once per row, against the longest encoding of the row
+        if ((size_t)(end - p) < (size_t)width * (sizeof(Sample) == 2 ? 3 : 5)) return 0;
+        for (int x = 0; x < width; ++x) {
+            p    = putVarint(p, zigzag((int32_t)(uint32_t)(row[x] - prev)));
+            prev = row[x];
+        }
+    }
+    return (size_t)(p - dst);
+}
+
+template <class Sample>
+static bool decodeDelta(const uint8_t* src, size_t size, int width, int height, Sample* dst) {
+    const uint8_t* p   = src;
+    const uint8_t* end = src + size;
+    for (int y = 0; y < height; ++y) {
+        Sample* row  = dst + (size_t)y * width;
+        Sample  prev = y ? row[-width] : 0;
+        for (int x = 0; x < width; ++x) {
+            uint32_t v;
+            if (!getVarint(p, end, v)) return false;
+            prev   = (Sample)(prev + (Sample)unzigzag(v));
+            row[x] = prev;
+        }
+    }
+    return p == end;
+}
+
+IrFrameCodec irEncodeFrame(const float* src, int width, int height, uint8_t* dst, size_t& size) {
+    const size_t pixels = (size_t)width * height;
+    const size_t raw    = pixels * sizeof(float);
+
+    // The 16-bit codec needs every value to be an integer in the Kinect's range; checking that costs less than
+    // encoding, so it is done up front. The 16-bit copy goes to the end of dst, behind what the encoder can write.
+    bool integral = true;
+    for (size_t i = 0; i < pixels && integral; ++i) {
+        integral = src[i] >= 0.0f && src[i] <= 65535.0f && src[i] == (float)(uint16_t)src[i];
+    }
+
+    if (integral) {
+        uint16_t* values = reinterpret_cast<uint16_t*>(dst + irEncodeBound(pixels) - pixels * sizeof(uint16_t));
+        for (size_t i = 0; i < pixels; ++i) values[i] = (uint16_t)src[i];
+        // stay clear of the values still to be read
+        size = encodeDelta(values, width, height, dst, irEncodeBound(pixels) - pixels * sizeof(uint16_t));
+        if (size && size < raw) return IR_CODEC_DELTA16;
+    }
+
+    size = encodeDelta(reinterpret_cast<const FloatBits*>(src), width, height, dst, raw);
+    if (size && size < raw) return IR_CODEC_DELTA32;
+
+    size = raw;
+    return IR_CODEC_RAW;
+}
+
+bool irDecodeFrame(IrFrameCodec codec, const uint8_t* src, size_t size, int width, int height, float* dst) {
+    const size_t pixels = (size_t)width * height;
+    switch (codec) {
+        case IR_CODEC_DELTA16: {
+            // decode in place: the 16-bit values fill the upper half of dst and are widened front to back, so each
+            // float is written after the value it overwrites has been read
+            uint16_t* values = reinterpret_cast<uint16_t*>(dst) + pixels;
+            if (!decodeDelta(src, size, width, height, values)) return false;
+            for (size_t i = 0; i < pixels; ++i) dst[i] = (float)values[i];
+            return true;
+        }
+        case IR_CODEC_DELTA32:
+            return decodeDelta(src, size, width, height, reinterpret_cast<FloatBits*>(dst));
+        case IR_CODEC_RAW:
+            if (size != pixels * sizeof(float)) return false;
+            memcpy(dst, src, size);
+            return true;
+        default:
+            return false;
+    }
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+// recorder
+// ---------------------------------------------------------------------------------------------------------------------
+
+IrRecorder::IrRecorder() : ring(IR_RECORD_QUEUE_DEPTH, KinectIrFormat::frameSize) {
+    this->fd       = -1;
+    this->compress = false;
+    this->offset.store(0);
+    this->writtenCount.store(0);
+    this->failed.store(false);
+}
+
+IrRecorder::~IrRecorder() {
+    this->close();
+}
+
+bool IrRecorder::open(const std::string& path, bool compress) {
+    this->fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (this->fd < 0) {
+        cerr << "failed to create recording " << path << ": " << strerror(errno) << endl;
+        return false;
+    }
+
+    IrRecordingHeader header{};
+    memcpy(header.magic, IR_RECORDING_MAGIC, sizeof(header.magic));
+    header.version    = IR_RECORDING_VERSION;
+    header.fourcc     = KinectIrFormat::fourcc;
+    header.width      = KinectIrFormat::width;
+    header.height     = KinectIrFormat::height;
+    header.compressed = compress;
+    if (write(this->fd, &header, sizeof(header)) != (ssize_t)sizeof(header)) {
+        cerr << "failed to write recording " << path << ": " << strerror(errno) << endl;
+        ::close(this->fd);
+        this->fd = -1;
+        return false;
+    }
+
+    this->path     = path;
+    this->compress = compress;
+    this->offset.store(sizeof(header));
+    this->writtenCount.store(0);
+    this->failed.store(false);
+    if (compress) this->encoded.resize(irEncodeBound(KinectIrFormat::pixels));
+    // an hour at 30 fps before the index has to grow
+    this->index.clear();
+    this->index.reserve(30 * 3600);
+
+    this->ring.reopen();
+    this->writerThread = thread(&IrRecorder::writerLoop, this);
+    cout << "recording IR frames to " << path << (compress ? " (compressed)" : "") << endl;
+    return true;
+}
+
+void IrRecorder::push(const SourceFrame& frame) {
+    if (this->failed.load(memory_order_relaxed)) return;
+
+    FrameSlot& slot = this->ring.writeSlot();
+    memcpy(slot.data, frame.data, KinectIrFormat::frameSize);
+    slot.sequence  = frame.sequence;
+    slot.timestamp = frame.timestamp;
+    this->ring.publish();
+}
+
+void IrRecorder::writerLoop() {
+    int in;
+    while ((in = this->ring.acquire()) >= 0) {
+        if (!this->failed.load() && !this->writeFrame(this->ring.slot(in))) {
+            cerr << "failed to write recording " << this->path << ": " << strerror(errno) << ", recording stopped"
+                 << endl;
+            this->failed.store(true);
+        }
+        this->ring.release(in);
+    }
+
+    // closed: whatever is still queued goes in as well
+    while ((in = this->ring.tryAcquire()) >= 0) {
+        if (!this->failed.load() && !this->writeFrame(this->ring.slot(in))) this->failed.store(true);
+        this->ring.release(in);
+    }
+}
+
+bool IrRecorder::writeFrame(const FrameSlot& slot) {
+    const float* pixels = reinterpret_cast<const float*>(slot.data);
+
+    IrFrameRecord record{};
+    record.magic     = IR_FRAME_MAGIC;
+    record.sequence  = slot.sequence;
+    record.timestamp = slot.timestamp;
+
+    const uint8_t* payload = slot.data;
+    size_t         size    = KinectIrFormat::frameSize;
+    record.codec           = IR_CODEC_RAW;
+    if (this->compress) {
+        record.codec = irEncodeFrame(pixels, KinectIrFormat::width, KinectIrFormat::height, this->encoded.data(), size);
+        if (record.codec != IR_CODEC_RAW) payload = this->encoded.data();
+    }
+    record.size = (uint32_t)size;
+
+    static const uint8_t padding[IR_RECORDING_ALIGN] = {};
+    const size_t         pad = (IR_RECORDING_ALIGN - size % IR_RECORDING_ALIGN) % IR_RECORDING_ALIGN;
+
+    struct iovec iov[3] = {
+        {&record, sizeof(record)},
+        {const_cast<uint8_t*>(payload), size},
+        {const_cast<uint8_t*>(padding), pad},
+    };
+    const ssize_t total = (ssize_t)(sizeof(record) + size + pad);
+    if (writev(this->fd, iov, 3) != total) return false;
+
+    const uint64_t at = this->offset.load(memory_order_relaxed);
+    this->index.push_back(IrIndexEntry{at, slot.sequence, slot.timestamp});
+    this->offset.store(at + total, memory_order_relaxed);
+    this->writtenCount.fetch_add(1, memory_order_relaxed);
+    return true;
+}
+
+bool IrRecorder::writeIndex() {
+    const uint64_t indexOffset = this->offset.load();
+    const size_t   indexBytes  = this->index.size() * sizeof(IrIndexEntry);
+    if (indexBytes && write(this->fd, this->index.data(), indexBytes) != (ssize_t)indexBytes) return false;
+
+    IrRecordingHeader header{};
+    memcpy(header.magic, IR_RECORDING_MAGIC, sizeof(header.magic));
+    header.version     = IR_RECORDING_VERSION;
+    header.fourcc      = KinectIrFormat::fourcc;
+    header.width       = KinectIrFormat::width;
+    header.height      = KinectIrFormat::height;
+    header.compressed  = this->compress;
+    header.frameCount  = this->index.size();
+    header.indexOffset = indexOffset;
+    return pwrite(this->fd, &header, sizeof(header), 0) == (ssize_t)sizeof(header);
+}
+
+void IrRecorder::close() {
+    if (this->fd < 0) return;
+
+    this->ring.close();
+    if (this->writerThread.joinable()) this->writerThread.join();
+
+    if (this->failed.load() || !this->writeIndex()) {
+        cerr << "recording " << this->path << " has no index, it will be scanned on replay" << endl;
+    }
+    cout << "recorded " << this->written() << " frames (" << this->dropped() << " dropped) to " << this->path
+         << ", " << this->bytes() / (1024 * 1024) << " MiB" << endl;
+
+    ::close(this->fd);
+    this->fd = -1;
+}
@@ -0,0 +1,120 @@
+#ifndef kinect2pipe_IR_ir_recording_H
+#define kinect2pipe_IR_ir_recording_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+#include "frame_format.h"
+#include "frame_ring.h"
+#include "frame_source.h"
+
+// A recording of raw IR frames is laid out as
+//
+//   IrRecordingHeader
+//   IrFrameRecord + payload, padded to IR_RECORDING_ALIGN, once per frame
+//   IrIndexEntry, once per frame
+//
+// The index and the header's frameCount / indexOffset are written when the recording is closed. A recording that was
+// cut short has neither; its frames are found by walking the records from the header on.
+#define IR_RECORDING_MAGIC   "K2IRREC1"
+#define IR_RECORDING_VERSION 1
+#define IR_RECORDING_ALIGN   8
+#define IR_FRAME_MAGIC       0x52465249u // "IRFR"
+
+// frames the writer thread may fall behind by before the oldest is dropped
+#define IR_RECORD_QUEUE_DEPTH 8
+
+// how a frame's payload is stored
+enum IrFrameCodec {
+    IR_CODEC_RAW     = 0,  // the float pixels as they are
+    IR_CODEC_DELTA16 = 1,  // integral values 0..65535: difference to the left (or, in the first column, the upper)
+                           // neighbour, zigzag and LEB128 encoded
+    IR_CODEC_DELTA32 = 2   // the same on the float bit patterns, lossless for any value
+};
+
+struct IrRecordingHeader {
+    char     magic[8];
+    uint32_t version;
+    uint32_t fourcc;       // FRAME_FOURCC_IR_FLOAT
+    uint32_t width;
+    uint32_t height;
+    uint32_t compressed;   // whether the recorder tried the delta codecs
+    uint32_t reserved0;
+    uint64_t frameCount;   // 0 until the recording is closed
+    uint64_t indexOffset;
+    uint8_t  reserved[16];
+};
+
+struct IrFrameRecord {
+    uint32_t magic;        // IR_FRAME_MAGIC
+    uint32_t codec;        // IrFrameCodec
+    uint32_t size;         // payload bytes, without padding
+    uint32_t sequence;     // libfreenect2 Frame::sequence
+    uint32_t timestamp;    // libfreenect2 Frame::timestamp
+    uint32_t reserved;
+};
+
+struct IrIndexEntry {
+    uint64_t offset;       // of the frame's IrFrameRecord
+    uint32_t sequence;
+    uint32_t timestamp;
+};
+
+static_assert(sizeof(IrRecordingHeader) == 64, "recording header layout");
+static_assert(sizeof(IrFrameRecord) == 24, "frame record layout");
+static_assert(sizeof(IrIndexEntry) == 16, "index entry layout");
+
+// Encodes width x height IR pixels with the smallest codec that applies. Returns the codec used and its payload
+// size; dst must hold irEncodeBound(pixels) bytes. Raw frames are not copied, their payload is src itself.
+IrFrameCodec irEncodeFrame(const float* src, int width, int height, uint8_t* dst, size_t& size);
+size_t       irEncodeBound(size_t pixels);
+// Decodes a delta coded payload, false if it is corrupt.
+bool         irDecodeFrame(IrFrameCodec codec, const uint8_t* src, size_t size, int width, int height, float* dst);
+
+/**
+ * Appends the Kinect's IR frames to a recording.
+ *
+ * push() only copies the frame into a queue, the encoding and writing happens on a background thread. When the disk
+ * can't keep up the oldest queued frames are dropped, so recording never slows down the capture.
+ */
+class IrRecorder {
+public:
+    IrRecorder();
+    ~IrRecorder();
+
+    IrRecorder(const IrRecorder&) = delete;
+    IrRecorder& operator=(const IrRecorder&) = delete;
+
+    bool open(const std::string& path, bool compress);
+    // drains the queue, writes the index and closes the file
+    void close();
+    bool active() const { return this->fd >= 0; }
+
+    // capture thread only
+    void push(const SourceFrame& frame);
+
+    uint64_t written() const { return this->writtenCount.load(); }
+    uint64_t dropped() const { return this->ring.dropped(); }
+    uint64_t bytes() const { return this->offset.load(); }
+
+private:
+    FrameRing                 ring;
+    int                       fd;
+    bool                      compress;
+    std::string               path;
+    std::vector<uint8_t>      encoded;
+    std::vector<IrIndexEntry> index;
+    std::atomic<uint64_t>     offset;        // end of the last record written
+    std::atomic<uint64_t>     writtenCount;
+    std::atomic<bool>         failed;
+    std::thread               writerThread;
+
+    void writerLoop();
+    bool writeFrame(const FrameSlot& slot);
+    bool writeIndex();
+};
+
+#endif // kinect2pipe_IR_ir_recording_H
@@ -0,0 +1,183 @@
+#include "ir_scale.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define IR_SCALE_X86 1
+#elif defined(__ARM_NEON) || defined(__aarch64__)
+#include <arm_neon.h>
+#define IR_SCALE_NEON 1
+#endif
+
+// Like the conversion kernels, every implementation multiplies and adds separately and in the same order, so the
+// vectorised output is bit-identical to the scalar one.
+
+void areaAccumulateScalar(const float* src, float* acc, size_t count, float weight) {
+    for (size_t i = 0; i < count; ++i) acc[i] += src[i] * weight;
+}
+
+void areaReduceRowScalar(const float* src, float* dst, size_t count, const int32_t* start, const float* weights,
+                         int taps) {
+    for (size_t i = 0; i < count; ++i) {
+        const float* in  = src + start[i];
+        float        sum = 0.0f;
+        for (int k = 0; k < taps; ++k) sum += in[k] * weights[(size_t)k * count + i];
+        dst[i] = sum;
+    }
+}
+
+#if defined(IR_SCALE_X86)
+
+__attribute__((target("sse2")))
+static void areaAccumulateSse2(const float* src, float* acc, size_t count, float weight) {
+    const __m128 w = _mm_set1_ps(weight);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m128 a = _mm_add_ps(_mm_loadu_ps(acc + i),     _mm_mul_ps(_mm_loadu_ps(src + i),     w));
+        __m128 b = _mm_add_ps(_mm_loadu_ps(acc + i + 4), _mm_mul_ps(_mm_loadu_ps(src + i + 4), w));
+        _mm_storeu_ps(acc + i,     a);
+        _mm_storeu_ps(acc + i + 4, b);
+    }
+    areaAccumulateScalar(src + i, acc + i, count - i, weight);
+}
+
+__attribute__((target("avx2")))
+static void areaAccumulateAvx2(const float* src, float* acc, size_t count, float weight) {
+    const __m256 w = _mm256_set1_ps(weight);
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m256 a = _mm256_add_ps(_mm256_loadu_ps(acc + i),     _mm256_mul_ps(_mm256_loadu_ps(src + i),     w));
+        __m256 b = _mm256_add_ps(_mm256_loadu_ps(acc + i + 8), _mm256_mul_ps(_mm256_loadu_ps(src + i + 8), w));
+        _mm256_storeu_ps(acc + i,     a);
+        _mm256_storeu_ps(acc + i + 8, b);
+    }
+    areaAccumulateSse2(src + i, acc + i, count - i, weight);
+}
+
+// eight outputs at a time, their inputs fetched with one gather per tap
+__attribute__((target("avx2")))
+static void areaReduceRowAvx2(const float* src, float* dst, size_t count, const int32_t* start, const float* weights,
+                              int taps) {
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        const __m256i first = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(start + i));
+        __m256 sum = _mm256_setzero_ps();
+        for (int k = 0; k < taps; ++k) {
+            __m256 in = _mm256_i32gather_ps(src, _mm256_add_epi32(first, _mm256_set1_epi32(k)), 4);
+            sum = _mm256_add_ps(sum, _mm256_mul_ps(in, _mm256_loadu_ps(weights + (size_t)k * count + i)));
+        }
+        _mm256_storeu_ps(dst + i, sum);
+    }
+    for (; i < count; ++i) {
+        const float* in  = src + start[i];
+        float        sum = 0.0f;
+        for (int k = 0; k < taps; ++k) sum += in[k] * weights[(size_t)k * count + i];
+        dst[i] = sum;
+    }
+}
+
+#elif defined(IR_SCALE_NEON)
+
+static void areaAccumulateNeon(const float* src, float* acc, size_t count, float weight) {
+    const float32x4_t w = vdupq_n_f32(weight);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        vst1q_f32(acc + i,     vaddq_f32(vld1q_f32(acc + i),     vmulq_f32(vld1q_f32(src + i),     w)));
+        vst1q_f32(acc + i + 4, vaddq_f32(vld1q_f32(acc + i + 4), vmulq_f32(vld1q_f32(src + i + 4), w)));
+    }
+    areaAccumulateScalar(src + i, acc + i, count - i, weight);
+}
+
+#endif
+
+IrAreaScaler::IrAreaScaler() {
+    this->isActive  = false;
+    this->srcWidth  = 0;
+    this->cropX     = 0;
+    this->cropY     = 0;
+    this->cropWidth = 0;
+    this->dstWidth  = 0;
+    this->dstHeight = 0;
+
+    this->accumulate = areaAccumulateScalar;
+    this->reduceRow  = areaReduceRowScalar;
+    this->name       = "scalar";
+#if defined(IR_SCALE_X86)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        this->accumulate = areaAccumulateAvx2;
+        this->reduceRow  = areaReduceRowAvx2;
+        this->name       = "avx2";
+    } else if (__builtin_cpu_supports("sse2")) {
+        this->accumulate = areaAccumulateSse2;
+        this->name       = "sse2";
+    }
+#elif defined(IR_SCALE_NEON)
+    this->accumulate = areaAccumulateNeon;
+    this->name       = "neon";
+#endif
+}
+
+bool IrAreaScaler::configure(int srcWidth, int srcHeight, int x, int y, int width, int height, int dstWidth,
+                             int dstHeight) {
+    if (x < 0 || y < 0 || width <= 0 || height <= 0 || x + width > srcWidth || y + height > srcHeight ||
+        dstWidth <= 0 || dstHeight <= 0 || dstWidth > width || dstHeight > height) {
+        return false;
+    }
+
+    this->isActive  = width != srcWidth || height != srcHeight || dstWidth != width || dstHeight != height;
+    this->srcWidth  = srcWidth;
+    this->cropX     = x;
+    this->cropY     = y;
+    this->cropWidth = width;
+    this->dstWidth  = dstWidth;
+    this->dstHeight = dstHeight;
+    buildTaps(width,  dstWidth,  this->columns);
+    buildTaps(height, dstHeight, this->rows);
+    this->rowAcc.assign(width, 0.0f);
+    return true;
+}
+
+// Output i covers inputs [i * ratio, (i + 1) * ratio); every input it overlaps is weighted by the overlap. All outputs
+// use the same number of taps so the vector kernels can run without per-pixel branches; taps past the covered area
+// get weight 0 and are shifted back inside the input at the far edge.
+void IrAreaScaler::buildTaps(int in, int out, Taps& t) {
+    const double ratio    = (double)in / out;
+    const bool   integral = in % out == 0;
+    t.taps = integral ? in / out : (int)std::ceil(ratio) + 1;
+    if (t.taps > in) t.taps = in;
+    t.start.assign(out, 0);
+    t.weights.assign((size_t)t.taps * out, 0.0f);
+
+    for (int i = 0; i < out; ++i) {
+        const double begin = i * ratio;
+        const double end   = (i + 1) * ratio;
+        int first = (int)std::floor(begin);
+        if (first + t.taps > in) first = in - t.taps;
+        t.start[i] = first;
+        for (int k = 0; k < t.taps; ++k) {
+            const double lo      = std::max(begin, (double)(first + k));
+            const double hi      = std::min(end,   (double)(first + k + 1));
+            t.weights[(size_t)k * out + i] = hi > lo ? (float)((hi - lo) / ratio) : 0.0f;
+        }
+    }
+}
+
+void IrAreaScaler::scale(const float* src, float* dst) {
+    const float* crop = src + (size_t)this->cropY * this->srcWidth + this->cropX;
+    float*       acc  = this->rowAcc.data();
+
+    for (int oy = 0; oy < this->dstHeight; ++oy) {
+        memset(acc, 0, this->cropWidth * sizeof(float));
+        const int first = this->rows.start[oy];
+        for (int k = 0; k < this->rows.taps; ++k) {
+            const float w = this->rows.weights[(size_t)k * this->dstHeight + oy];
+            if (w == 0.0f) continue;
+            this->accumulate(crop + (size_t)(first + k) * this->srcWidth, acc, this->cropWidth, w);
+        }
+        this->reduceRow(acc, dst + (size_t)oy * this->dstWidth, this->dstWidth, this->columns.start.data(),
+                        this->columns.weights.data(), this->columns.taps);
+    }
+}
@@ -0,0 +1,73 @@
+#ifndef kinect2pipe_IR_ir_scale_H
+#define kinect2pipe_IR_ir_scale_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * acc[i] += src[i] * weight for count floats. One row step of the vertical area reduction.
+ */
+typedef void (*AreaAccumulateFn)(const float* src, float* acc, size_t count, float weight);
+
+/**
+ * Horizontal area reduction: dst[i] = sum over k < taps of src[start[i] + k] * weights[k * count + i]. The weights are
+ * stored tap-major so a vector of outputs reads one contiguous run of weights per tap.
+ */
+typedef void (*AreaReduceRowFn)(const float* src, float* dst, size_t count, const int32_t* start,
+                                const float* weights, int taps);
+
+/**
+ * Crops a rectangle out of an IR frame and shrinks it by area averaging (every output pixel is the mean of the input
+ * area it covers, fractional pixels weighted by coverage), which is what a downscale for face detection wants: no
+ * aliasing and no blur beyond the target size.
+ *
+ * The reduction is separable. Each output row accumulates its weighted input rows with a vectorised multiply-add
+ * over the full crop width, then the accumulated row is reduced horizontally with a precomputed tap table.
+ */
+class IrAreaScaler {
+public:
+    IrAreaScaler();
+
+    // Reads the width x height rectangle at (x, y) of srcWidth x srcHeight frames and reduces it to
+    // dstWidth x dstHeight. Only shrinking is supported. Returns false, leaving the scaler unchanged, when the
+    // rectangle does not fit or the target is larger than it.
+    bool configure(int srcWidth, int srcHeight, int x, int y, int width, int height, int dstWidth, int dstHeight);
+
+    // true unless configured for the whole source at its own size
+    bool active() const { return this->isActive; }
+    // scale(src, dst) fills dstWidth * dstHeight floats
+    void scale(const float* src, float* dst);
+
+    const char* kernelName() const { return this->name; }
+
+private:
+    struct Taps {
+        int                  taps;    // inputs contributing to one output
+        std::vector<int32_t> start;   // first input of every output
+        std::vector<float>   weights; // taps x outputs, tap-major
+    };
+
+    bool  isActive;
+    int   srcWidth;
+    int   cropX;
+    int   cropY;
+    int   cropWidth;
+    int   dstWidth;
+    int   dstHeight;
+    Taps  columns;
+    Taps  rows;
+    std::vector<float> rowAcc;
+
+    AreaAccumulateFn accumulate;
+    AreaReduceRowFn  reduceRow;
+    const char*      name;
+
+    static void buildTaps(int in, int out, Taps& t);
+};
+
+void areaAccumulateScalar(const float* src, float* acc, size_t count, float weight);
+void areaReduceRowScalar(const float* src, float* dst, size_t count, const int32_t* start, const float* weights,
+                         int taps);
+
+#endif // kinect2pipe_IR_ir_scale_H
@@ -1,21 +1,26 @@
 #include <iostream>
 #include <libfreenect2/logger.h>
-#include <libfreenect2/libfreenect2.hpp>
-#include <libfreenect2/frame_listener_impl.h>
-#include <libfreenect2/packet_pipeline.h> // For CPU pipeline instead of OpenGL, which isn't available pre login
 #include <linux/videodev2.h>
 #include <sys/inotify.h>
 #include <sys/ioctl.h>
-#include <sys/mman.h>
-#include <sys/select.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/stat.h>
+#include <dirent.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <csignal>
 #include <thread>
 #include <chrono>
 #include <cstring>
+#include <algorithm>
 #include <vector>
+#include <ostream>
 #include "kinect2pipe_IR.h"
+#include "synthetic_source.h"
+#include "file_source.h"
+#include "recording_source.h"
+#include "v4l2_capture_source.h"
 
 extern "C" {
     #include <libswscale/swscale.h>
@@ -25,474 +30,1321 @@ extern "C" {
 using namespace std;
 using namespace libfreenect2;
 
-static kinect2pipe_IR* g_instance = nullptr;
 
-static void signalHandler(int) {
-    if (g_instance) g_instance->shutdown();
+// Capture formats that are forwarded to the loopback device unchanged when the backup device is in use. These are
+// the raw formats V4L2 consumers like OpenCV read natively; anything else is converted to YUV420P.
+static bool isPassthroughFormat(uint32_t pixfmt) {
+    switch (pixfmt) {
+        case V4L2_PIX_FMT_YUYV:
+        case V4L2_PIX_FMT_UYVY:
+        case V4L2_PIX_FMT_GREY:
+        case V4L2_PIX_FMT_YUV420:
+        case V4L2_PIX_FMT_NV12:
+            return true;
+        default:
+            return false;
+    }
 }
 
-kinect2pipe_IR::kinect2pipe_IR() {
-    g_instance = this;
-
-    this->normBuf = (float*)malloc(KINECT2_IMAGE_WIDTH * KINECT2_IMAGE_HEIGHT * sizeof(float));
-
-    this->sws = sws_getContext(
-        KINECT2_IMAGE_WIDTH, KINECT2_IMAGE_HEIGHT, AV_PIX_FMT_GRAYF32,
-        OUTPUT_WIDTH,        OUTPUT_HEIGHT,        AV_PIX_FMT_YUV420P,
-        SWS_BILINEAR, nullptr, nullptr, nullptr);
-
-    memset(this->srcPtr,    0, sizeof(this->srcPtr));
-    memset(this->srcStride, 0, sizeof(this->srcStride));
-
-    this->srcPtr[0]    = reinterpret_cast<uint8_t*>(this->normBuf);
-    this->srcStride[0] = KINECT2_IMAGE_WIDTH * sizeof(float);
-
-    this->imageBuffer = (uint8_t*)calloc(1, YUV_BUFFER_LEN);
-    this->dstPtr[0] = this->imageBuffer;
-    this->dstPtr[1] = this->imageBuffer + YUV_BUFFER_Y_LEN;
-    this->dstPtr[2] = this->imageBuffer + YUV_BUFFER_Y_LEN + YUV_BUFFER_UV_LEN;
-    this->dstPtr[3] = nullptr;
+// swscale's name for a V4L2 pixel format, AV_PIX_FMT_NONE for the ones we cannot convert.
+static AVPixelFormat avPixelFormat(uint32_t fourcc) {
+    switch (fourcc) {
+        case V4L2_PIX_FMT_YUYV:      return AV_PIX_FMT_YUYV422;
+        case V4L2_PIX_FMT_UYVY:      return AV_PIX_FMT_UYVY422;
+        case V4L2_PIX_FMT_GREY:      return AV_PIX_FMT_GRAY8;
+        case V4L2_PIX_FMT_Y16:       return AV_PIX_FMT_GRAY16LE;
+        case V4L2_PIX_FMT_YUV420:    return AV_PIX_FMT_YUV420P;
+        case V4L2_PIX_FMT_NV12:      return AV_PIX_FMT_NV12;
+        case V4L2_PIX_FMT_BGR24:     return AV_PIX_FMT_BGR24;
+        case V4L2_PIX_FMT_RGB24:     return AV_PIX_FMT_RGB24;
+        case FRAME_FOURCC_IR_FLOAT:  return AV_PIX_FMT_GRAYF32;
+        default:                     return AV_PIX_FMT_NONE;
+    }
+}
 
-    this->dstStride[0] = OUTPUT_WIDTH;
-    this->dstStride[1] = OUTPUT_WIDTH / 2;
-    this->dstStride[2] = OUTPUT_WIDTH / 2;
-    this->dstStride[3] = 0;
+// Fused conversion of one IR frame into the Kinect-sized output layout OutFmt. Every size and plane offset is a
+// compile-time constant here; for YUV420 only the Y plane is written, the chroma planes never change.
+template <class OutFmt>
+static void irToOutput(const IrKernels& kernels, const float* src, uint8_t* dst) {
+    static_assert(OutFmt::pixels == KinectIrFormat::pixels, "output must have the IR frame's geometry");
+    uint8_t* y = dst + OutFmt::format.planeOffset(0);
+    if (OutFmt::fourcc == V4L2_PIX_FMT_Y16) {
+        kernels.toY16(src, reinterpret_cast<uint16_t*>(y), OutFmt::pixels, IR_MAX_VALUE);
+    } else if (OutFmt::fourcc == V4L2_PIX_FMT_GREY) {
+        kernels.toLuma(src, y, OutFmt::pixels, IR_MAX_VALUE, IR_GREY_MIN, IR_GREY_RANGE);
+    } else {
+        kernels.toLuma(src, y, OutFmt::pixels, IR_MAX_VALUE, IR_LUMA_MIN, IR_LUMA_RANGE);
+    }
+}
 
-    this->v4l2Device = 0;
-    this->started    = false;
-    this->shouldStop = false;
-    this->cleanupComplete.store(false);
+kinect2pipe_IR::kinect2pipe_IR()
+    : toneMapper(KinectIrFormat::width, KinectIrFormat::height),
+      governor(KINECT2_IR_FPS) {
+    this->irRing.reset(new FrameRing(PIPELINE_QUEUE_DEPTH, KinectIrFormat::frameSize));
+    this->normBuf   = (float*)malloc(KinectIrFormat::frameSize);
+    this->scaledBuf = (float*)malloc(KinectIrFormat::frameSize);
+
+    // created by configureOutput() once the output format is known
+    this->sws = nullptr;
+
+    KinectIrFormat::format.planes(reinterpret_cast<uint8_t*>(this->normBuf), this->srcPtr, this->srcStride);
+
+    this->outputFourcc = V4L2_PIX_FMT_YUV420;
+    this->outputFmt    = FrameFormat{};
+
+    this->kernels    = selectIrKernels<KinectIrFormat::pixels>();
+    this->anyKernels = selectIrKernels<0>();
+    cout << "using " << this->kernels.name << " IR conversion kernels" << endl;
+    this->pipelineFailed.store(false);
+    this->maxFps = 0.0;
+    this->pipelineLossless = false;
+    this->framesQueued     = 0;
+    this->framesDone       = 0;
+
+    this->cropX        = 0;
+    this->cropY        = 0;
+    this->cropWidth    = KinectIrFormat::width;
+    this->cropHeight   = KinectIrFormat::height;
+    this->scaledWidth  = 0;
+    this->scaledHeight = 0;
+
+    this->standby    = false;
+    this->consumerOpenedUs.store(0);
+    this->inotifyFd        = -1;
+    this->rescanTimer      = -1;
+    this->loopbackRdev     = 0;
+    this->watchedConsumers = 0;
+    this->shmClients       = 0;
+    this->shmFormat        = K2P_SHM_FORMAT_FLOAT;
+    this->consumerDriven   = false;
+    this->consumers        = 0;
+    this->shouldStop.store(false);
+
+    this->backupHot        = false;
+    this->backupWatched    = false;
+    this->failbackTimer    = -1;
+    this->failbackAttempts = 0;
+    this->failbackDue      = false;
+    this->kinectRemoved    = false;
+    this->switchStartedUs.store(0);
 
     // default behaviour is to disable hardware acceleration (i.e. use CPU pipeline) so the process can run headless.
-    this->hwAccelEnabled = false;
-
-    signal(SIGINT,  signalHandler);
-    signal(SIGTERM, signalHandler);
+    this->hwAccelEnabled    = false;
+    this->irOnlyDecoder     = true;
+    this->decodeThreads     = 0;
+    this->swscaleConvert    = false;
+    this->streamingOutput   = true;
+    this->backupPassthrough = true;
+
+    this->kinectContext      = nullptr;
+    this->conversionPool     = nullptr;
+    this->conversionStrand   = nullptr;
+    this->handleSignals      = true;
+    this->sourceKind         = Metrics::SOURCE_KINECT;
+    this->sourceFps          = 0.0;
+    this->frameLimit         = 0;
+    this->replayOriginalTiming = true;
+    this->recordCompress     = false;
+    this->capturePassthrough = false;
+    this->backupThreads      = 0;
+    this->backupMjpeg        = false;
+    this->captureScaled      = false;
+    this->captureSws         = nullptr;
+
+    // SIGINT and SIGTERM are read from a signalfd by the main loop. They are blocked before any thread is started, so
+    // every thread inherits the mask and none of them is ever interrupted.
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+    this->signalFd = -1;
 
     libfreenect2::setGlobalLogger(nullptr);
 }
 
-// Schedule a hard kill two seconds after shutdown is first requested. This is needed for when the Kinect is disconnecteded while a client is still connected to the loopback device.
-// This is a separate thread to avoid it never being reached when the main thread is trying to gracefully shut down a non existent device.
+// Schedules a hard kill SHUTDOWN_GRACE_S seconds after shutdown is first requested. This is needed for when the Kinect
+// is disconnected while a client is still connected to the loopback device, and libfreenect2 never returns from
+// stopping it. SIGALRM isn't handled, so its default action ends the process without a thread having to be around
+// to do it. Safe to call from any thread.
 void kinect2pipe_IR::shutdown() {
+    if (this->shouldStop.exchange(true)) return;
     cout << "shutting down" << endl;
-
-    static std::once_flag killFlag;
-    std::call_once(killFlag, [this]{
-        std::thread([this]{
-            std::this_thread::sleep_for(std::chrono::seconds(2));
-            // only send SIGKILL if the cleanup hasn't completed yet
-            if (!this->cleanupComplete.load()) {
-                // SIGKILL cannot be caught or ignored, so this will unconditionally terminate the process.
-                ::kill(::getpid(), SIGKILL);
-            }
-        }).detach();
-    });
-
-    lock_guard<mutex> lk(this->cvMutex);
-    this->shouldStop = true;
-    this->cv.notify_one();
+    alarm(SHUTDOWN_GRACE_S);
+    this->reactor.wake();
 }
 
 void kinect2pipe_IR::openLoopback(const char* loopbackDev) {
-    if (!this->openV4L2LoopbackDevice(loopbackDev, OUTPUT_WIDTH, OUTPUT_HEIGHT)) {
+    if ((this->realtime.enabled() && !this->allocateArena()) || !this->reactor.open() ||
+        (this->handleSignals && !this->openSignals()) || !this->openV4L2LoopbackDevice(loopbackDev)) {
         exit(1);
     }
+    if (this->conversionPool) {
+        this->conversionStrand = this->conversionPool->addStrand([this] { this->convertQueued(); });
+    }
     this->writeBlankFrame();
-    if (!this->openInotifyWatcher(loopbackDev)) {
+    if (!this->statsServer.start(this->statsSocketPath, this->statsFilePath,
+                                 [this](std::ostream& os) { this->reportStats(os); })) {
+        exit(1);
+    }
+    // nobody opens and closes a file sink to start and stop us
+    if (!this->output.isFile() && !this->openInotifyWatcher(loopbackDev)) {
+        exit(1);
+    }
+    // shared memory clients start and stop sessions like consumers of the loopback device
+    if (!this->shmSocketPath.empty() &&
+        !this->shmPublisher.open(this->shmSocketPath, this->shmFormat, this->reactor, [this](int clients) {
+            this->shmClients = clients;
+            this->setConsumers(std::max(this->watchedConsumers, 0) + clients);
+        })) {
         exit(1);
     }
+    // everything allocated so far is faulted in now, and everything allocated later, libfreenect2's buffers
+    // included, as it is allocated
+    if (this->realtime.enabled()) {
+        this->prewarm();
+        this->realtime.lockMemory();
+    }
+}
+
+// Moves the IR pipeline's buffers into one pre-faulted arena: the IR ring, the normalisation and scaling buffers and
+// the output ring for the pipeline's own format, unless the loopback device's buffers end up being used for that.
+bool kinect2pipe_IR::allocateArena() {
+    const size_t irSlots     = PIPELINE_QUEUE_DEPTH + 2;
+    const size_t outputBytes = this->pipelineFormat().frameSize();
+    const size_t bytes = (irSlots + 2) * FrameArena::blockBytes(KinectIrFormat::frameSize) +
+                         PIPELINE_OUTPUT_SLOTS * FrameArena::blockBytes(outputBytes);
+    if (!this->arena.reserve(bytes, this->realtime.useHugePages())) return false;
+
+    std::vector<uint8_t*> irBuffers;
+    for (size_t i = 0; i < irSlots; ++i) irBuffers.push_back(this->arena.take(KinectIrFormat::frameSize));
+    this->irRing.reset(new FrameRing(PIPELINE_QUEUE_DEPTH, irBuffers, KinectIrFormat::frameSize));
+
+    free(this->normBuf);
+    free(this->scaledBuf);
+    this->normBuf   = (float*)this->arena.take(KinectIrFormat::frameSize);
+    this->scaledBuf = (float*)this->arena.take(KinectIrFormat::frameSize);
+
+    for (size_t i = 0; i < PIPELINE_OUTPUT_SLOTS; ++i) this->arenaOutput.push_back(this->arena.take(outputBytes));
+
+    cout << "frame buffers: " << this->arena.used() / 1024 << " kB, pre-faulted, on "
+         << (this->arena.onHugePages() ? "huge" : "normal") << " pages" << endl;
+    return true;
 }
 
 void kinect2pipe_IR::setBackupDevice(const char* dev) {
     this->backupDevPath = dev;
 }
 
-bool kinect2pipe_IR::openV4L2LoopbackDevice(const char* loopbackDev, int width, int height) {
-    this->v4l2Device = open(loopbackDev, O_WRONLY);
-    if (this->v4l2Device < 0) {
-        cerr << "failed to open v4l2loopback device: " << errno << endl;
+bool kinect2pipe_IR::openV4L2LoopbackDevice(const char* loopbackDev) {
+    const FrameFormat format = this->pipelineFormat();
+    if (!this->scaler.configure(KinectIrFormat::width, KinectIrFormat::height,
+                                this->cropX, this->cropY, this->cropWidth, this->cropHeight,
+                                format.width, format.height)) {
+        cerr << "invalid output region: " << this->cropWidth << "x" << this->cropHeight << " at " << this->cropX
+             << "," << this->cropY << " scaled to " << format.width << "x" << format.height << " does not fit in the "
+             << KinectIrFormat::width << "x" << KinectIrFormat::height << " IR frame" << endl;
         return false;
     }
+    this->changeDetector.setRegion(KinectIrFormat::width, this->cropX, this->cropY, this->cropWidth, this->cropHeight);
+    if (this->scaler.active()) {
+        cout << "publishing " << format.width << "x" << format.height << " from the " << this->cropWidth << "x"
+             << this->cropHeight << " region at " << this->cropX << "," << this->cropY << " ("
+             << this->scaler.kernelName() << " area scaler)" << endl;
+    }
 
-    struct v4l2_format fmt{};
-    fmt.type                 = V4L2_BUF_TYPE_VIDEO_OUTPUT;
-    fmt.fmt.pix.width        = width;
-    fmt.fmt.pix.height       = height;
-    fmt.fmt.pix.pixelformat  = V4L2_PIX_FMT_YUV420;
-    fmt.fmt.pix.sizeimage    = YUV_BUFFER_LEN;
-    fmt.fmt.pix.field        = V4L2_FIELD_NONE;
-    fmt.fmt.pix.bytesperline = width;
-    fmt.fmt.pix.colorspace   = V4L2_COLORSPACE_SRGB;
+    // the --swscale path reads the same region out of normBuf
+    KinectIrFormat::format.planes(reinterpret_cast<uint8_t*>(this->normBuf), this->srcPtr, this->srcStride);
+    this->srcPtr[0] += (size_t)this->cropY * this->srcStride[0] + this->cropX * sizeof(float);
 
-    if (ioctl(this->v4l2Device, VIDIOC_S_FMT, &fmt) < 0) {
-        cerr << "failed to issue ioctl to v4l2loopback device: " << errno << endl;
+    if (!this->output.open(loopbackDev)) {
         return false;
     }
-    return true;
+    return this->configureOutput(format);
 }
 
-bool kinect2pipe_IR::openInotifyWatcher(const char* loopbackDev) {
-    this->watcherThread = thread(&kinect2pipe_IR::inotifyWatcher, this, loopbackDev);
-    this->watcherThread.detach();
-    return true;
+// What the Kinect pipeline publishes: the selected region of the IR frame at the output size, in the selected output
+// pixel format.
+FrameFormat kinect2pipe_IR::pipelineFormat() const {
+    const int width  = this->scaledWidth  ? this->scaledWidth  : this->cropWidth;
+    const int height = this->scaledHeight ? this->scaledHeight : this->cropHeight;
+    return FrameFormat::make(this->outputFourcc, width, height);
 }
 
-void kinect2pipe_IR::inotifyWatcher(const char* loopbackDev) {
-    int ifd = inotify_init();
-    if (ifd < 0) {
-        perror("inotify_init");
-        exit(-1);
+// (Re)configures the loopback device for the pipeline's own output format and rebuilds the output ring on top of
+// whatever buffers that leaves us with. Only called while the pipeline is stopped. A format the device doesn't take
+// leaves the previous one, and a ring for it, in place.
+bool kinect2pipe_IR::configureOutput(const FrameFormat& format) {
+    const AVPixelFormat avfmt = avPixelFormat(format.fourcc);
+    if (!format.valid() || avfmt == AV_PIX_FMT_NONE) {
+        cerr << "unsupported output format" << endl;
+        return false;
     }
 
-    if (inotify_add_watch(ifd, loopbackDev, IN_OPEN | IN_CLOSE_WRITE | IN_CLOSE_NOWRITE) < 0) {
-        perror("inotify_add_watch");
-        exit(-1);
+    if (!this->setLoopbackFormat(format)) {
+        return false;
     }
+    this->outputFmt = format;
+    this->buildOutputRing();
 
-    char buf[sizeof(struct inotify_event) + NAME_MAX + 1];
+    this->toneMapper.setSize(format.width, format.height);
+    if (format.fourcc == V4L2_PIX_FMT_GREY) {
+        this->toneMapper.setOutputRange(IR_GREY_MIN, IR_GREY_RANGE);
+    } else {
+        this->toneMapper.setOutputRange(IR_LUMA_MIN, IR_LUMA_RANGE);
+    }
 
-    while (true) {
-        ssize_t len = read(ifd, buf, sizeof(buf));
-        if (len < 0) {
-            if (errno == EINTR) continue;
-            perror("inotify read");
-            break;
-        }
+    // only used by the --swscale comparison path and the backup device
+    this->sws = sws_getCachedContext(this->sws,
+        this->cropWidth, this->cropHeight, AV_PIX_FMT_GRAYF32,
+        format.width,    format.height,    avfmt,
+        SWS_BILINEAR, nullptr, nullptr, nullptr);
+    return true;
+}
 
-        const struct inotify_event* ev = reinterpret_cast<const struct inotify_event*>(buf);
+// Sets the loopback device's format. Should the driver fail only once the streaming buffers are gone, the previous
+// format goes on in write mode and the output ring, which lived in those buffers, is rebuilt for it.
+bool kinect2pipe_IR::setLoopbackFormat(const FrameFormat& format) {
+    const bool streamed = this->output.mode() == LoopbackOutput::MODE_MMAP;
+    if (this->output.setFormat(format)) return true;
+    if (streamed && this->output.mode() != LoopbackOutput::MODE_MMAP) this->buildOutputRing();
+    return false;
+}
+
+// Builds the output ring for outputFmt on the loopback device's buffers, the arena or the heap.
+void kinect2pipe_IR::buildOutputRing() {
+    const FrameFormat& format = this->outputFmt;
+
+    // the ring needs a slot for the converter, PIPELINE_QUEUE_DEPTH queued
+    // frames, the one the writer is submitting and the last one it wrote
+    const unsigned ringSlots = PIPELINE_OUTPUT_SLOTS;
+    std::unique_ptr<FrameRing> ring;
+    if (this->streamingOutput && this->output.enableStreaming(ringSlots)) {
+        cout << "using streaming output to v4l2loopback device" << endl;
+        ring.reset(new FrameRing(PIPELINE_QUEUE_DEPTH, this->output.slotBuffers(), format.frameSize()));
+    } else if (!this->arenaOutput.empty() && format == this->pipelineFormat()) {
+        ring.reset(new FrameRing(PIPELINE_QUEUE_DEPTH, this->arenaOutput, format.frameSize()));
+    } else {
+        ring.reset(new FrameRing(PIPELINE_QUEUE_DEPTH, format.frameSize(), ringSlots - PIPELINE_QUEUE_DEPTH - 1));
+    }
+    {
+        // the stats thread may be reading the old ring's counters
+        lock_guard<mutex> lk(this->outputRingMutex);
+        this->outputRing = std::move(ring);
+    }
+
+    // the fused kernel only ever writes the Y plane, so the chroma of every
+    // output slot is set up once here
+    if (format.fourcc == V4L2_PIX_FMT_YUV420) {
+        for (size_t i = 0; i < this->outputRing->slotCount(); ++i) {
+            this->fillNeutralChroma(this->outputRing->slot((int)i).data);
+        }
+    }
+    format.planes(this->output.frameBuffer(), this->dstPtr, this->dstStride);
+}
 
-        if (ev->mask & IN_OPEN) {
-            cout << "consumer opened device" << endl;
-            lock_guard<mutex> lk(this->cvMutex);
-            this->started = true;
-            this->cv.notify_one();
-        } else if (ev->mask & (IN_CLOSE_WRITE | IN_CLOSE_NOWRITE)) {
-            cout << "consumer closed device, shutting down" << endl;
-            this->shutdown();
-            close(ifd);
-            return;
+bool kinect2pipe_IR::openSignals() {
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    this->signalFd = signalfd(-1, &signals, SFD_CLOEXEC | SFD_NONBLOCK);
+    if (this->signalFd < 0) {
+        cerr << "failed to create signalfd: " << strerror(errno) << endl;
+        return false;
+    }
+    return this->reactor.add(this->signalFd, EPOLLIN, [this](uint32_t) {
+        struct signalfd_siginfo info;
+        while (read(this->signalFd, &info, sizeof(info)) == (ssize_t)sizeof(info)) {
+            cout << "received " << strsignal((int)info.ssi_signo) << endl;
         }
+        this->shutdown();
+    });
+}
+
+// Number of open handles other processes hold on the character device rdev, from their /proc/<pid>/fd entries.
+// complete is false when some processes could not be inspected (they belong to another user and we aren't root), in
+// which case the count is only a lower bound.
+static int countOpenHandles(dev_t rdev, bool& complete) {
+    complete = true;
+    DIR* proc = opendir("/proc");
+    if (!proc) {
+        complete = false;
+        return 0;
     }
 
-    close(ifd);
+    const pid_t self  = getpid();
+    int         count = 0;
+    while (const struct dirent* pe = readdir(proc)) {
+        char* end;
+        const long pid = strtol(pe->d_name, &end, 10);
+        if (*end || pid <= 0 || pid == self) continue;
+
+        const std::string fdDir = std::string("/proc/") + pe->d_name + "/fd";
+        DIR* fds = opendir(fdDir.c_str());
+        if (!fds) {
+            if (errno != ENOENT) complete = false; // ENOENT: the process just exited
+            continue;
+        }
+        while (const struct dirent* fe = readdir(fds)) {
+            if (fe->d_name[0] == '.') continue;
+            struct stat st{};
+            if (stat((fdDir + "/" + fe->d_name).c_str(), &st) == 0 && S_ISCHR(st.st_mode) && st.st_rdev == rdev) {
+                count++;
+            }
+        }
+        closedir(fds);
+    }
+    closedir(proc);
+    return count;
 }
 
-bool kinect2pipe_IR::openKinect2Device() {
-    SyncMultiFrameListener listener(Frame::Ir);
-    Freenect2Device* dev;
+// Counts the consumers of the loopback device from inotify's open and close events. inotify merges identical events
+// that are still queued, so two consumers closing at once may look like one: whenever the count would drop to zero,
+// and every CONSUMER_RESCAN_MS while it doesn't, it is checked against the handles actually open in /proc.
+bool kinect2pipe_IR::openInotifyWatcher(const char* loopbackDev) {
+    struct stat devStat{};
+    if (stat(loopbackDev, &devStat) < 0) {
+        perror("stat");
+        return false;
+    }
+    this->loopbackRdev = devStat.st_rdev;
 
-    if (freenect2.enumerateDevices() == 0) {
-        cerr << "unable to find a kinect2 device to connect to" << endl;
+    this->inotifyFd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+    if (this->inotifyFd < 0) {
+        perror("inotify_init");
+        return false;
+    }
+    if (inotify_add_watch(this->inotifyFd, loopbackDev, IN_OPEN | IN_CLOSE_WRITE | IN_CLOSE_NOWRITE) < 0) {
+        perror("inotify_add_watch");
         return false;
     }
 
-    // On some systems we can't rely on a GPU/OpenGL pipeline until a
-    // graphical session exists, so the default behaviour is to force the CPU
-    // packet pipeline.  When the new --hwaccel flag is supplied we skip this
-    // and let libfreenect2 choose whatever pipeline it prefers.
-    libfreenect2::PacketPipeline *pipeline = nullptr;
-    if (!hwAccelEnabled) {
-        pipeline = new libfreenect2::CpuPacketPipeline();
+    this->rescanTimer = EventLoop::createTimer();
+    if (this->rescanTimer < 0) {
+        perror("timerfd_create");
+        return false;
     }
+    return this->reactor.add(this->inotifyFd, EPOLLIN, [this](uint32_t) { this->readInotify(); }) &&
+           this->reactor.add(this->rescanTimer, EPOLLIN, [this](uint32_t) {
+               EventLoop::drain(this->rescanTimer);
+               this->recountConsumers();
+           });
+}
 
-    std::string serial = freenect2.getDefaultDeviceSerialNumber();
-    
-    if (hwAccelEnabled) {
-        // overload without pipeline pointer
-        dev = freenect2.openDevice(serial);
+void kinect2pipe_IR::readInotify() {
+    // events are read whole, several at a time
+    alignas(struct inotify_event) char buf[16 * (sizeof(struct inotify_event) + NAME_MAX + 1)];
+    bool closed = false;
+
+    ssize_t len;
+    while ((len = read(this->inotifyFd, buf, sizeof(buf))) > 0) {
+        for (ssize_t at = 0; at < len; ) {
+            const struct inotify_event* ev = reinterpret_cast<const struct inotify_event*>(buf + at);
+            if (ev->mask & IN_OPEN) {
+                this->watchedConsumers++;
+            } else if (ev->mask & (IN_CLOSE_WRITE | IN_CLOSE_NOWRITE)) {
+                this->watchedConsumers--;
+                closed = true;
+            }
+            at += sizeof(struct inotify_event) + ev->len;
+        }
+    }
+    if (len < 0 && errno != EAGAIN && errno != EINTR) {
+        perror("inotify read");
+    }
+
+    // a close that leaves nobody is double checked before the session is ended
+    if (closed && this->watchedConsumers <= 0) {
+        this->recountConsumers();
+        return;
+    }
+    this->watchedConsumers = std::max(this->watchedConsumers, 0);
+    this->setConsumers(this->watchedConsumers + this->shmClients);
+}
+
+// Replaces the count from inotify with the handles open in /proc. A scan that couldn't see every process only ever
+// raises the count.
+void kinect2pipe_IR::recountConsumers() {
+    bool      complete;
+    const int open  = countOpenHandles(this->loopbackRdev, complete);
+    const int count = std::max(this->watchedConsumers, 0);
+    if (complete || open > count) {
+        if (open != count) {
+            cout << "consumer count corrected from " << count << " to " << open << endl;
+        }
+        this->watchedConsumers = open;
+    }
+    this->watchedConsumers = std::max(this->watchedConsumers, 0);
+    this->setConsumers(this->watchedConsumers + this->shmClients);
+}
+
+void kinect2pipe_IR::setConsumers(int count) {
+    const int before = this->consumers;
+    if (count == before) return;
+    this->consumers = count;
+
+    if (before == 0) {
+        cout << "consumer opened device" << endl;
+        this->consumerOpenedUs.store(metricsNowUs());
+        EventLoop::armTimer(this->rescanTimer, CONSUMER_RESCAN_MS, true);
+    } else if (count == 0) {
+        cout << "last consumer closed device" << endl;
+        EventLoop::armTimer(this->rescanTimer, 0, false);
     } else {
-        dev = freenect2.openDevice(serial, pipeline);
+        cout << "device open by " << count << " consumers" << endl;
     }
+}
 
-    if (!dev) {
-        cerr << "failed to open kinect2 device" << endl;
-        delete pipeline; // harmless if null
+// Watches the kernel's hotplug events for the Kinect, for failover and failback. Without them the backup device is
+// still switched to once the Kinect stops responding, but the session never goes back to the Kinect.
+bool kinect2pipe_IR::openHotplugMonitor() {
+    if (!this->hotplug.open()) return false;
+    this->failbackTimer = EventLoop::createTimer();
+    if (this->failbackTimer < 0) {
+        perror("timerfd_create");
         return false;
     }
+    return this->reactor.add(this->hotplug.fd(), EPOLLIN, [this](uint32_t) { this->readHotplug(); }) &&
+           this->reactor.add(this->failbackTimer, EPOLLIN, [this](uint32_t) {
+               EventLoop::drain(this->failbackTimer);
+               if (this->failbackAttempts > 0) {
+                   this->failbackAttempts--;
+                   this->failbackDue = true;
+               }
+           });
+}
 
-    dev->setIrAndDepthFrameListener(&listener);
+// The Kinect needs a moment after it appears on the bus before libfreenect2 can open it, so failing back waits for
+// KINECT_FAILBACK_DELAY_MS, and is tried again as many times as KINECT_FAILBACK_ATTEMPTS allows when it fails anyway.
+void kinect2pipe_IR::readHotplug() {
+    switch (this->hotplug.read()) {
+        case HotplugMonitor::HOTPLUG_ADDED:
+            cout << "kinect2 plugged in" << endl;
+            this->kinectRemoved    = false;
+            this->failbackAttempts = KINECT_FAILBACK_ATTEMPTS;
+            EventLoop::armTimer(this->failbackTimer, KINECT_FAILBACK_DELAY_MS, false);
+            break;
+        case HotplugMonitor::HOTPLUG_REMOVED:
+            cerr << "kinect2 unplugged" << endl;
+            this->kinectRemoved    = true;
+            this->failbackAttempts = 0;
+            EventLoop::armTimer(this->failbackTimer, 0, false);
+            break;
+        case HotplugMonitor::HOTPLUG_NONE:
+            break;
+    }
+}
 
-    if (!dev->startStreams(false, true)) {
-        cerr << "unable to start kinect2 ir stream" << endl;
-        dev->close();
+// Called once the main source delivers: opens the session's backup device and maps its buffers, and on a hot standby
+// starts it streaming into the reactor, which hands every frame straight back. A device that isn't there is tried
+// again, from scratch, if it comes to switching.
+void kinect2pipe_IR::readyBackup() {
+    if (!this->backupSource || this->backupWatched) return;
+    if (!this->backupSource->prepare()) return;
+    if (!this->backupHot || !this->backupSource->start()) return;
+
+    V4L2CaptureSource* backup = this->backupSource.get();
+    this->backupWatched = this->reactor.add(backup->pollFd(), EPOLLIN, [this, backup](uint32_t) {
+        if (!backup->discardFrames()) {
+            cerr << "backup device failed while on standby: " << strerror(errno) << endl;
+            this->unwatchBackup();
+            backup->stop();
+        }
+    });
+}
+
+// Takes the hot standby backup device out of the reactor, leaving it streaming for runSource().
+void kinect2pipe_IR::unwatchBackup() {
+    if (!this->backupWatched) return;
+    this->reactor.remove(this->backupSource->pollFd());
+    this->backupWatched = false;
+}
+
+// Capture stage: copy the IR frame into the pipeline so libfreenect2 gets its buffer back immediately, whatever the
+// converter and writer are doing. Frames the governor turns down are not even copied. Returns false once the writer
+// has given up on the loopback device.
+bool kinect2pipe_IR::handleFrame(const SourceFrame& frame) {
+    const uint64_t now = metricsNowUs();
+    this->metrics.irFrame(frame.sequence, frame.timestamp, now);
+    // everything the source sent is recorded, including the frames the governor turns down
+    if (this->recorder.active()) this->recorder.push(frame);
+    const FrameGovernor::Clock::time_point captured = FrameGovernor::Clock::now();
+    if (!this->governor.admit(captured)) {
+        return !this->pipelineFailed.load();
+    }
+    const ChangeDetector::Verdict verdict =
+        this->changeDetector.admit(reinterpret_cast<const float*>(frame.data), captured);
+    if (verdict == ChangeDetector::VERDICT_STATIC) {
+        return !this->pipelineFailed.load();
+    }
+    if (this->pipelineLossless && !this->waitForPipeline()) {
         return false;
     }
 
-    cout << "kinect2 IR stream started" << endl;
+    // a keep-alive only asks the writer to send the last frame again, it is neither copied nor converted
+    FrameSlot& slot = this->irRing->writeSlot();
+    slot.repeat = verdict == ChangeDetector::VERDICT_KEEPALIVE;
+    if (!slot.repeat) memcpy(slot.data, frame.data, KinectIrFormat::frameSize);
+    slot.sequence  = frame.sequence;
+    slot.timestamp = frame.timestamp;
+    slot.captureUs = now;
+    this->irRing->publish();
+    this->framesQueued++;
+    if (this->conversionStrand) this->conversionPool->schedule(this->conversionStrand);
+
+    return !this->pipelineFailed.load();
+}
 
-    // When a backup device is configured use a short timeout so a USB disconnect
-    // is detected within ~0.5 s (5 × 100 ms).  Without backup the original
-    // 1-second timeout is kept to preserve the existing behaviour.
-    const int  timeoutMs  = this->backupDevPath.empty() ? 1000 : 100;
-    const int  maxMissed  = 5;
-    int        missedCount = 0;
+// Blocks while PIPELINE_QUEUE_DEPTH frames are still on their way through the pipeline, which is as many as it
+// holds without dropping one. Returns false once the writer has given up.
+bool kinect2pipe_IR::waitForPipeline() {
+    unique_lock<mutex> lk(this->flowMutex);
+    this->flowCv.wait(lk, [this]{
+        return this->framesQueued - this->framesDone < PIPELINE_QUEUE_DEPTH || this->pipelineFailed.load();
+    });
+    return !this->pipelineFailed.load();
+}
 
-    while (true) {
-        {
-            unique_lock<mutex> lk(this->cvMutex);
-            if (this->shouldStop) break;
+uint64_t kinect2pipe_IR::convertIrFrame(const float* src, uint8_t* dst) {
+    if (this->swscaleConvert) {
+        for (size_t i = 0; i < KinectIrFormat::pixels; ++i) {
+            this->normBuf[i] = src[i] / IR_MAX_VALUE;
         }
+        const uint64_t normalized = metricsNowUs();
+
+        uint8_t* planes[4];
+        int      strides[4];
+        this->outputFmt.planes(dst, planes, strides);
+        sws_scale(this->sws,
+                  this->srcPtr, this->srcStride, 0, this->cropHeight,
+                  planes,       strides);
+        return normalized;
+    }
+
+    // A cropped or scaled output is first reduced to a float frame of the output size, which is then converted like
+    // a Kinect frame with the kernels that take their size at runtime.
+    const bool scaled     = this->scaler.active();
+    uint64_t   normalized = 0;
+    if (scaled) {
+        this->scaler.scale(src, this->scaledBuf);
+        src        = this->scaledBuf;
+        normalized = metricsNowUs();
+    }
+    const IrKernels& kernels = scaled ? this->anyKernels : this->kernels;
+
+    // The adaptive curves replace the linear mapping of the 8-bit outputs. They are applied by the same kind of
+    // single pass over the frame, through a lookup table.
+    if (this->toneMapper.mode() != TONE_FIXED && this->outputFmt.fourcc != V4L2_PIX_FMT_Y16) {
+        this->toneMapper.apply(kernels, src, dst + this->outputFmt.planeOffset(0));
+        return normalized;
+    }
 
-        if (!listener.waitForNewFrame(frames, timeoutMs)) {
-            if (!this->backupDevPath.empty() && ++missedCount >= maxMissed) {
-                cerr << "kinect2 device not responding, switching to backup" << endl;
+    if (scaled) {
+        const size_t n = this->outputFmt.pixelCount();
+        uint8_t*     y = dst + this->outputFmt.planeOffset(0);
+        switch (this->outputFmt.fourcc) {
+            case V4L2_PIX_FMT_GREY:
+                kernels.toLuma(src, y, n, IR_MAX_VALUE, IR_GREY_MIN, IR_GREY_RANGE);
+                break;
+            case V4L2_PIX_FMT_Y16:
+                kernels.toY16(src, reinterpret_cast<uint16_t*>(y), n, IR_MAX_VALUE);
+                break;
+            case V4L2_PIX_FMT_YUV420:
+            default:
+                kernels.toLuma(src, y, n, IR_MAX_VALUE, IR_LUMA_MIN, IR_LUMA_RANGE);
                 break;
-            }
-            continue;
         }
-        missedCount = 0;
+        return normalized;
+    }
 
-        if (!this->handleFrame(frames[Frame::Ir])) {
-            listener.release(frames);
+    // Input and output have the same geometry, so every output format is a straight per-pixel mapping of the IR
+    // values done by the specialisation for that layout.
+    switch (this->outputFmt.fourcc) {
+        case V4L2_PIX_FMT_GREY:
+            irToOutput<KinectGreyFormat>(kernels, src, dst);
             break;
+        case V4L2_PIX_FMT_Y16:
+            irToOutput<KinectY16Format>(kernels, src, dst);
+            break;
+        case V4L2_PIX_FMT_YUV420:
+        default:
+            irToOutput<KinectYuv420Format>(kernels, src, dst);
+            break;
+    }
+    return normalized;
+}
+
+void kinect2pipe_IR::startPipeline() {
+    this->irRing->reopen();
+    this->outputRing->reopen();
+    this->pipelineFailed.store(false);
+    this->governor.reset();
+    this->changeDetector.reset();
+    this->framesQueued = 0;
+    this->framesDone   = 0;
+    if (!this->conversionStrand) this->converterThread = thread(&kinect2pipe_IR::converterLoop, this);
+    this->writerThread = thread(&kinect2pipe_IR::writerLoop, this);
+}
+
+void kinect2pipe_IR::stopPipeline() {
+    this->irRing->close();
+    if (this->conversionStrand) this->conversionPool->wait(this->conversionStrand);
+    this->outputRing->close();
+    if (this->converterThread.joinable()) this->converterThread.join();
+    if (this->writerThread.joinable())    this->writerThread.join();
+
+    PipelineStats st = this->pipelineStats();
+    cout << "pipeline: converted " << st.convert.published << " frames (" << st.convert.dropped << " dropped), "
+         << "written " << st.write.published << " frames (" << st.write.dropped << " dropped), "
+         << st.skipped << " frames skipped by the governor (" << st.backoffs << " back-offs)" << endl;
+    if (this->changeDetector.enabled()) {
+        cout << "pipeline: " << st.unchanged << " static frames skipped, " << st.keepAlives << " kept alive" << endl;
+    }
+    const LatencyHistogram::Summary jitter = this->metrics.jitter.summary();
+    if (jitter.count) {
+        cout << "capture jitter since start: p50 " << jitter.p50 << " us, p99 " << jitter.p99 << " us, max "
+             << jitter.max << " us" << endl;
+    }
+}
+
+void kinect2pipe_IR::converterLoop() {
+    this->realtime.enter(RealtimeProfile::ROLE_CONVERT);
+    while (true) {
+        int in = this->irRing->acquire();
+        if (in < 0) break;
+        this->convertSlot(in);
+    }
+}
+
+// Drain function of the conversion strand: converts every frame queued so far, on a worker of the shared pool.
+void kinect2pipe_IR::convertQueued() {
+    int in;
+    while ((in = this->irRing->tryAcquire()) >= 0) {
+        this->convertSlot(in);
+    }
+}
+
+void kinect2pipe_IR::convertSlot(int in) {
+    FrameSlot&     src   = this->irRing->slot(in);
+    FrameSlot&     dst   = this->outputRing->writeSlot();
+    const uint64_t start = metricsNowUs();
+    this->metrics.queue.record(start - src.captureUs);
+    dst.repeat = src.repeat;
+    if (src.repeat) {
+        dst.sequence  = src.sequence;
+        dst.timestamp = src.timestamp;
+        dst.captureUs = src.captureUs;
+        this->irRing->release(in);
+        this->outputRing->publish();
+        return;
+    }
+    this->shmPublisher.publish(reinterpret_cast<const float*>(src.data), src.sequence, src.captureUs);
+
+    uint64_t normalized = this->convertIrFrame(reinterpret_cast<const float*>(src.data), dst.data);
+    const uint64_t end = metricsNowUs();
+    if (normalized) {
+        this->metrics.normalize.record(normalized - start);
+    } else {
+        normalized = start;
+    }
+    this->metrics.convert.record(end - normalized);
+
+    dst.sequence  = src.sequence;
+    dst.timestamp = src.timestamp;
+    dst.captureUs = src.captureUs;
+
+    this->irRing->release(in);
+    this->outputRing->publish();
+}
+
+void kinect2pipe_IR::writerLoop() {
+    this->realtime.enter(RealtimeProfile::ROLE_WRITE);
+    // the last frame written is kept back from the ring, for keep-alives to send again
+    int last = -1;
+    while (true) {
+        int in = this->outputRing->acquire();
+        if (in < 0) break;
+
+        const uint64_t captureUs = this->outputRing->slot(in).captureUs;
+        if (this->outputRing->slot(in).repeat) {
+            this->outputRing->release(in);
+            in   = last;
+            last = -1;
+        }
+        if (in >= 0) {
+            const int done = this->writeOutputSlot(in, captureUs);
+            if (last >= 0) this->outputRing->release(last);
+            // a slot the driver hands back in place of the one just written doesn't hold that frame
+            last = done == in ? done : -1;
+            if (done != in) this->outputRing->release(done);
         }
 
-        listener.release(frames);
+        if (this->pipelineLossless || this->pipelineFailed.load()) {
+            {
+                lock_guard<mutex> lk(this->flowMutex);
+                this->framesDone++;
+            }
+            this->flowCv.notify_one();
+        }
+        if (this->pipelineFailed.load()) break;
     }
+    if (last >= 0) this->outputRing->release(last);
+}
 
-    cout << "stopping kinect2 IR stream" << endl;
-    this->writeBlankFrame();
+// Submits output slot in, captured at captureUs, to the loopback device and returns the slot the device is done with.
+int kinect2pipe_IR::writeOutputSlot(int in, uint64_t captureUs) {
+    int  done  = in;
+    auto start = FrameGovernor::Clock::now();
+    LoopbackOutput::SubmitResult r = this->output.submitSlot(in, this->outputRing->slot(in).data, done);
+    auto waited = FrameGovernor::Clock::now() - start;
+    if (!this->pipelineLossless) {
+        this->governor.submitted(r == LoopbackOutput::SUBMIT_BUSY || r == LoopbackOutput::SUBMIT_HELD, waited);
+    }
+
+    this->metrics.write.record((uint64_t)chrono::duration_cast<chrono::microseconds>(waited).count());
+    if (r == LoopbackOutput::SUBMIT_OK || r == LoopbackOutput::SUBMIT_HELD) {
+        this->metrics.written.fetch_add(1, memory_order_relaxed);
+        this->metrics.endToEnd.record(metricsNowUs() - captureUs);
+        this->firstFrameWritten();
+    } else if (r == LoopbackOutput::SUBMIT_BUSY) {
+        this->metrics.busy.fetch_add(1, memory_order_relaxed);
+    } else {
+        this->metrics.writeErrors.fetch_add(1, memory_order_relaxed);
+    }
+    if (r == LoopbackOutput::SUBMIT_FAILED) {
+        cerr << "failed to write to v4l2loopback device: " << strerror(errno) << endl;
+        this->pipelineFailed.store(true);
+    }
+    return done;
+}
 
-    // perform the cleanup on the calling thread so we can observe completion
-    // within the two‑second window that shutdown() allows for graceful exit.
-    try {
-        dev->stop();
-        dev->close();
-    } catch (...) {
-        cerr << "kinect2 cleanup caught exception" << endl;
+// Records how long the consumer that opened the loopback device waited for its first frame, and how long a switch
+// between the Kinect and the backup device left it without frames. Every later frame only costs the loads.
+void kinect2pipe_IR::firstFrameWritten() {
+    if (this->switchStartedUs.load(memory_order_relaxed)) {
+        const uint64_t switched = this->switchStartedUs.exchange(0);
+        if (switched) {
+            const uint64_t took = metricsNowUs() - switched;
+            this->metrics.sourceSwitch.record(took);
+            cout << "switched sources in " << took / 1000.0 << " ms" << endl;
+        }
     }
+    if (!this->consumerOpenedUs.load(memory_order_relaxed)) return;
+    const uint64_t opened = this->consumerOpenedUs.exchange(0);
+    if (!opened) return;
 
-    // mark cleanup done so the scheduled SIGKILL won't fire
-    this->cleanupComplete.store(true);
-    return true;
+    const uint64_t waited = metricsNowUs() - opened;
+    this->metrics.firstFrame.record(waited);
+    cout << "first frame " << waited / 1000.0 << " ms after the consumer opened the device" << endl;
 }
 
-bool kinect2pipe_IR::handleFrame(Frame* frame) {
-    const float* src = reinterpret_cast<const float*>(frame->data);
-    const int    n   = KINECT2_IMAGE_WIDTH * KINECT2_IMAGE_HEIGHT;
-    for (int i = 0; i < n; ++i) {
-        this->normBuf[i] = src[i] / IR_MAX_VALUE;
+// Touches every buffer the pipeline writes to so the first frames don't pay for page faults.
+void kinect2pipe_IR::prewarm() {
+    for (size_t i = 0; i < this->irRing->slotCount(); ++i) {
+        memset(this->irRing->slot((int)i).data, 0, KinectIrFormat::frameSize);
     }
+    // only the Y plane, the chroma planes already hold the neutral value
+    const uint8_t blank = this->outputFmt.fourcc == V4L2_PIX_FMT_YUV420 ? IR_LUMA_MIN : 0;
+    for (size_t i = 0; i < this->outputRing->slotCount(); ++i) {
+        memset(this->outputRing->slot((int)i).data, blank, this->outputFmt.planeSize(0));
+    }
+    memset(this->normBuf, 0, KinectIrFormat::frameSize);
+    memset(this->scaledBuf, 0, KinectIrFormat::frameSize);
+}
 
-    sws_scale(this->sws,
-              this->srcPtr,  this->srcStride, 0, KINECT2_IMAGE_HEIGHT,
-              this->dstPtr,  this->dstStride);
+PipelineStats kinect2pipe_IR::pipelineStats() const {
+    PipelineStats st{};
+    // the main thread replaces the output ring whenever the loopback device's format changes
+    lock_guard<mutex> lk(this->outputRingMutex);
+    if (!this->outputRing) return st;
+    st.convert = {this->irRing->depth(), this->irRing->capacity(), this->irRing->published(),
+                  this->irRing->dropped()};
+    st.write   = {this->outputRing->depth(), this->outputRing->capacity(), this->outputRing->published(),
+                  this->outputRing->dropped()};
+    st.skipped  = this->governor.skipped();
+    st.backoffs = this->governor.backoffs();
+    st.unchanged  = this->changeDetector.skipped();
+    st.keepAlives = this->changeDetector.keepAlives();
+    return st;
+}
 
-    return write(this->v4l2Device, this->imageBuffer, YUV_BUFFER_LEN) > 0;
+void kinect2pipe_IR::reportStats(std::ostream& os) const {
+    this->metrics.report(os);
+
+    PipelineStats st = this->pipelineStats();
+    os << "# TYPE kinect2pipe_queue_depth gauge\n"
+       << "kinect2pipe_queue_depth{queue=\"convert\"} " << st.convert.depth << "\n"
+       << "kinect2pipe_queue_depth{queue=\"write\"} "   << st.write.depth   << "\n"
+       << "# TYPE kinect2pipe_queue_dropped_total counter\n"
+       << "kinect2pipe_queue_dropped_total{queue=\"convert\"} " << st.convert.dropped << "\n"
+       << "kinect2pipe_queue_dropped_total{queue=\"write\"} "   << st.write.dropped   << "\n"
+       << "# TYPE kinect2pipe_governor_skipped_total counter\n"
+       << "kinect2pipe_governor_skipped_total " << st.skipped << "\n"
+       << "# TYPE kinect2pipe_governor_backoffs_total counter\n"
+       << "kinect2pipe_governor_backoffs_total " << st.backoffs << "\n"
+       << "# TYPE kinect2pipe_governor_level gauge\n"
+       << "kinect2pipe_governor_level " << this->governor.level() << "\n"
+       << "# TYPE kinect2pipe_static_frames_total counter\n"
+       << "kinect2pipe_static_frames_total{event=\"skipped\"} "    << st.unchanged  << "\n"
+       << "kinect2pipe_static_frames_total{event=\"keepalive\"} "  << st.keepAlives << "\n";
+
+    if (!this->recordPath.empty()) {
+        os << "# TYPE kinect2pipe_recorded_frames_total counter\n"
+           << "kinect2pipe_recorded_frames_total{event=\"written\"} " << this->recorder.written() << "\n"
+           << "kinect2pipe_recorded_frames_total{event=\"dropped\"} " << this->recorder.dropped() << "\n"
+           << "# TYPE kinect2pipe_recorded_bytes_total counter\n"
+           << "kinect2pipe_recorded_bytes_total " << this->recorder.bytes() << "\n";
+    }
+    if (this->shmPublisher.active()) {
+        os << "# TYPE kinect2pipe_shm_clients gauge\n"
+           << "kinect2pipe_shm_clients " << this->shmPublisher.clients() << "\n"
+           << "# TYPE kinect2pipe_shm_frames_total counter\n"
+           << "kinect2pipe_shm_frames_total " << this->shmPublisher.published() << "\n";
+    }
 }
 
-bool kinect2pipe_IR::openBackupDevice() {
-    cout << "switching to backup device: " << this->backupDevPath << endl;
+// Main source as configured: the Kinect unless a synthetic or file source was asked for.
+std::unique_ptr<FrameSource> kinect2pipe_IR::createSource() const {
+    switch (this->sourceKind) {
+        case Metrics::SOURCE_SYNTHETIC:
+            return std::unique_ptr<FrameSource>(new SyntheticSource(this->sourceFps));
+        case Metrics::SOURCE_FILE:
+            return std::unique_ptr<FrameSource>(
+                new FileSource(this->sourcePath, this->sourceFps, this->frameLimit > 0));
+        case Metrics::SOURCE_REPLAY:
+            return std::unique_ptr<FrameSource>(
+                new RecordingSource(this->sourcePath, this->replayOriginalTiming, this->frameLimit > 0));
+        case Metrics::SOURCE_KINECT:
+        default: {
+            // the libfreenect2 context of a source of its own starts libusb's event thread, which takes the usb role
+            KinectSource* kinect = nullptr;
+            this->realtime.runAs(RealtimeProfile::ROLE_USB, [&] {
+                kinect = new KinectSource(this->hwAccelEnabled, this->kinectSerial, this->kinectContext);
+            });
+            kinect->setIrDecoder(this->irOnlyDecoder, this->decodeThreads);
+            kinect->setPacketRecording(this->packetRecordPath);
+            return std::unique_ptr<FrameSource>(kinect);
+        }
+    }
+}
 
-    int fd = open(this->backupDevPath.c_str(), O_RDWR | O_NONBLOCK);
-    if (fd < 0) {
-        cerr << "failed to open backup device: " << strerror(errno) << endl;
-        return false;
+// The capture loop every source runs through, until shutdown, the end of the source, limit frames (0 for no limit)
+// or maxMissed periods of timeoutMs in a row without a frame (0 for no limit). Frames in the Kinect's IR format go
+// through the capture -> convert -> write pipeline; anything else, i.e. a V4L2 capture device, is forwarded to the
+// loopback device as it is or scaled to the output format.
+//
+// The loop sleeps in the reactor, which wakes it for a frame, a signal, a consumer coming or going, or the missed
+// frame timer, the last one re-armed by every frame. Sources without a descriptor are read in turn instead, with a
+// read timeout of SOURCE_READ_SLICE_MS so the reactor is looked at in between. A hotplug event ends the loop early:
+// the Kinect being unplugged fails the main source, the Kinect being back switches away from the backup device.
+kinect2pipe_IR::RunResult kinect2pipe_IR::runSource(FrameSource& source, Metrics::Source kind, int timeoutMs,
+                                                    int maxMissed, uint64_t limit) {
+    if (kind == this->sourceKind) {
+        this->kinectRemoved = false;
+        this->failbackDue   = false;
+    }
+    // an earlier run may have failed to restore the pipeline format, no source is started on the camera's
+    if (!this->closeCapturePath()) return RUN_FAILED;
+    source.setMaxFps(this->maxFps);
+    if (!source.start()) return RUN_FAILED;
+
+    const bool    ir = source.format() == KinectIrFormat::format;
+    const double  sourceFps = source.fps() > 0.0 ? source.fps() : KINECT2_IR_FPS;
+    FrameGovernor captureGovernor(sourceFps);
+    captureGovernor.setMaxFps(this->maxFps);
+
+    if (ir) {
+        this->governor.setSourceFps(sourceFps);
+        this->pipelineLossless = source.fps() <= 0.0;
+        this->startPipeline();
+    } else if (!this->openCapturePath(source.format())) {
+        source.stop();
+        return RUN_FAILED;
     }
+    this->metrics.setSource(kind);
+
+    const int sourceFd  = source.pollFd();
+    bool      ready     = sourceFd < 0;
+    uint64_t  missed    = 0;
+    const int missTimer = EventLoop::createTimer();
+    if (sourceFd >= 0) this->reactor.add(sourceFd, EPOLLIN, [&ready](uint32_t) { ready = true; });
+    this->reactor.add(missTimer, EPOLLIN, [this, &missed, missTimer](uint32_t) {
+        const uint64_t n = EventLoop::drain(missTimer);
+        missed += n;
+        this->metrics.missed.fetch_add(n, memory_order_relaxed);
+    });
+    EventLoop::armTimer(missTimer, timeoutMs, true);
 
-    // Try to negotiate YUYV; if the driver refuses, accept whatever it gives us.
-    struct v4l2_format fmt{};
-    fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    if (ioctl(fd, VIDIOC_G_FMT, &fmt) < 0) {
-        cerr << "backup device: VIDIOC_G_FMT failed: " << strerror(errno) << endl;
-        close(fd);
-        return false;
+    RunResult      result = RUN_STOPPED;
+    uint64_t       count  = 0;
+    const uint64_t first  = metricsNowUs();
+    while (true) {
+        if (this->reactor.poll(ready ? 0 : -1) < 0) {
+            result = RUN_FAILED;
+            break;
+        }
+        if (this->sessionOver()) break;
+        if (maxMissed && missed >= (uint64_t)maxMissed) {
+            cerr << source.name() << " not responding" << endl;
+            result = RUN_FAILED;
+            break;
+        }
+        if (kind == this->sourceKind && this->kinectRemoved) {
+            result = RUN_FAILED;
+            break;
+        }
+        if (kind == Metrics::SOURCE_BACKUP && this->failbackDue) {
+            result = RUN_SWITCH;
+            break;
+        }
+        if (limit && count == limit) {
+            result = RUN_ENDED;
+            break;
+        }
+        if (!ready) continue;
+
+        SourceFrame frame;
+        FrameSource::ReadResult r = source.read(frame, sourceFd < 0 ? SOURCE_READ_SLICE_MS : 0);
+        // a source with a descriptor is read again once the reactor reports it ready, which is right away while
+        // frames are queued
+        if (sourceFd >= 0) ready = false;
+        if (r == FrameSource::READ_TIMEOUT) {
+            continue;
+        }
+        if (r == FrameSource::READ_END) {
+            result = RUN_ENDED;
+            break;
+        }
+        if (r == FrameSource::READ_ERROR) {
+            cerr << source.name() << ": capture failed: " << strerror(errno) << endl;
+            result = RUN_FAILED;
+            break;
+        }
+        missed = 0;
+        EventLoop::armTimer(missTimer, timeoutMs, true);
+        if (count++ == 0 && kind == this->sourceKind) {
+            this->failbackAttempts = 0;
+            this->readyBackup();
+        }
+
+        bool ok;
+        if (ir) {
+            const bool published = this->handleFrame(frame);
+            ok = source.release() && published;
+        } else {
+            ok = this->publishCaptured(source, frame, captureGovernor);
+        }
+        if (!ok) {
+            result = RUN_FAILED;
+            break;
+        }
     }
-    uint32_t wantedFmt = V4L2_PIX_FMT_YUYV;
-    fmt.fmt.pix.pixelformat = wantedFmt;
-    if (ioctl(fd, VIDIOC_S_FMT, &fmt) < 0) {
-        cerr << "backup device: driver refused YUYV, using native format" << endl;
+
+    if (sourceFd >= 0) this->reactor.remove(sourceFd);
+    this->reactor.remove(missTimer);
+    close(missTimer);
+    // the switch starts here, the old source's teardown is part of it
+    if (this->backupSource && (result == RUN_FAILED || result == RUN_SWITCH)) {
+        this->switchStartedUs.store(metricsNowUs());
     }
-    ioctl(fd, VIDIOC_G_FMT, &fmt);   // re-read what was actually set
 
-    int      capWidth  = (int)fmt.fmt.pix.width;
-    int      capHeight = (int)fmt.fmt.pix.height;
-    uint32_t pixfmt    = fmt.fmt.pix.pixelformat;
+    const double seconds = (metricsNowUs() - first) / 1e6;
+    cout << source.name() << ": " << count << " frames in " << seconds << " s";
+    if (seconds > 0.0) cout << " (" << count / seconds << " fps)";
+    cout << endl;
 
-    AVPixelFormat avfmt;
-    switch (pixfmt) {
-        case V4L2_PIX_FMT_YUYV:    avfmt = AV_PIX_FMT_YUYV422; break;
-        case V4L2_PIX_FMT_UYVY:    avfmt = AV_PIX_FMT_UYVY422; break;
-        case V4L2_PIX_FMT_GREY:    avfmt = AV_PIX_FMT_GRAY8;   break;
-        case V4L2_PIX_FMT_YUV420:  avfmt = AV_PIX_FMT_YUV420P; break;
-        case V4L2_PIX_FMT_NV12:    avfmt = AV_PIX_FMT_NV12;    break;
-        case V4L2_PIX_FMT_BGR24:   avfmt = AV_PIX_FMT_BGR24;   break;
-        case V4L2_PIX_FMT_RGB24:   avfmt = AV_PIX_FMT_RGB24;   break;
-        default:
-            cerr << "backup device: unsupported pixel format: "
-                 << (char)(pixfmt & 0xff)         << (char)((pixfmt >> 8) & 0xff)
-                 << (char)((pixfmt >> 16) & 0xff) << (char)((pixfmt >> 24) & 0xff)
-                 << endl;
-            close(fd);
-            return false;
+    if (ir) {
+        this->stopPipeline();
+    } else {
+        cout << source.name() << ": " << captureGovernor.admitted() << " frames published, "
+             << captureGovernor.skipped() << " skipped by the governor (" << captureGovernor.backoffs()
+             << " back-offs)" << endl;
+        if (source.format().fourcc == V4L2_PIX_FMT_MJPEG && this->captureMjpeg) {
+            cout << source.name() << ": " << this->captureMjpeg->corrupt() << " corrupt MJPEG frames dropped" << endl;
+        }
+        // the loopback device is left in the camera's format, nothing of the pipeline's may be written to it
+        if (!this->closeCapturePath()) {
+            source.stop();
+            return RUN_FAILED;
+        }
     }
+    this->writeBlankFrame();
+    source.stop();
+    return result;
+}
 
-    // Request MMAP capture buffers.
-    struct v4l2_requestbuffers req{};
-    req.count  = 2;
-    req.type   = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    req.memory = V4L2_MEMORY_MMAP;
-    if (ioctl(fd, VIDIOC_REQBUFS, &req) < 0 || req.count < 1) {
-        cerr << "backup device: VIDIOC_REQBUFS failed: " << strerror(errno) << endl;
-        close(fd);
+// Sets up forwarding of frames in the capture format capFmt: re-advertises the camera's own format on the loopback
+// device when the consumer can take it as is, so frames are forwarded from the capture buffers untouched instead of
+// being rescaled. If the loopback driver refuses (e.g. because the format is locked while a reader is streaming) we
+// fall back to scaling into our own format.
+bool kinect2pipe_IR::openCapturePath(const FrameFormat& capFmt) {
+    const bool          mjpeg = capFmt.fourcc == V4L2_PIX_FMT_MJPEG;
+    const AVPixelFormat avfmt = avPixelFormat(capFmt.fourcc);
+    if (avfmt == AV_PIX_FMT_NONE && !mjpeg) {
+        const uint32_t pixfmt = capFmt.fourcc;
+        cerr << "backup device: unsupported pixel format: "
+             << (char)(pixfmt & 0xff)         << (char)((pixfmt >> 8) & 0xff)
+             << (char)((pixfmt >> 16) & 0xff) << (char)((pixfmt >> 24) & 0xff)
+             << endl;
         return false;
     }
 
-    struct BufInfo { void* start; size_t length; };
-    std::vector<BufInfo> bufs(req.count, BufInfo{nullptr, 0});
-    unsigned nbuf = req.count;
-    for (unsigned i = 0; i < nbuf; i++) {
-        struct v4l2_buffer buf{};
-        buf.type   = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-        buf.memory = V4L2_MEMORY_MMAP;
-        buf.index  = i;
-        if (ioctl(fd, VIDIOC_QUERYBUF, &buf) < 0) {
-            for (unsigned j = 0; j < i; j++) munmap(bufs[j].start, bufs[j].length);
-            close(fd); return false;
-        }
-        bufs[i].length = buf.length;
-        bufs[i].start  = mmap(nullptr, buf.length,
-                               PROT_READ | PROT_WRITE, MAP_SHARED, fd, buf.m.offset);
-        if (bufs[i].start == MAP_FAILED) {
-            for (unsigned j = 0; j < i; j++) munmap(bufs[j].start, bufs[j].length);
-            close(fd); return false;
-        }
-        if (ioctl(fd, VIDIOC_QBUF, &buf) < 0) {
-            for (unsigned j = 0; j <= i; j++) munmap(bufs[j].start, bufs[j].length);
-            close(fd); return false;
-        }
-    }
-
-    enum v4l2_buf_type btype = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    if (ioctl(fd, VIDIOC_STREAMON, &btype) < 0) {
-        cerr << "backup device: VIDIOC_STREAMON failed: " << strerror(errno) << endl;
-        for (unsigned i = 0; i < nbuf; i++) munmap(bufs[i].start, bufs[i].length);
-        close(fd);
-        return false;
+    this->captureFmt         = capFmt;
+    this->capturePassthrough = false;
+    if (this->backupPassthrough && isPassthroughFormat(capFmt.fourcc)) {
+        // a refused format leaves the pipeline's in place, which is scaled to instead
+        this->capturePassthrough = this->setLoopbackFormat(capFmt);
+        if (!this->capturePassthrough) {
+            cerr << "backup device: loopback refused the camera format, scaling instead" << endl;
+        }
+    }
+    if (this->capturePassthrough) {
+        cout << "backup device: forwarding frames unchanged" << endl;
+        return true;
     }
 
-    cout << "backup device stream started (" << capWidth << "x" << capHeight << ")" << endl;
+    // The camera's frames are converted to the format and size the loopback device is configured for in bands, one
+    // per thread. The threads are started the first time and kept, like the swscale context that converts the
+    // formats the scaler doesn't read, so switching back to the same camera reuses both.
+    // MJPEG is decoded first, as small as the output allows and in grey unless the output has colour.
+    FrameFormat scaledFmt = capFmt;
+    if (mjpeg) {
+        if (!this->captureMjpeg) this->captureMjpeg.reset(new MjpegDecoder());
+        if (!this->captureMjpeg->configure(capFmt.width, capFmt.height, this->outputFmt.width, this->outputFmt.height,
+                                           this->outputFmt.fourcc != V4L2_PIX_FMT_YUV420)) {
+            cerr << "backup device: invalid MJPEG frame size" << endl;
+            return false;
+        }
+        scaledFmt = this->captureMjpeg->format();
+        cout << "backup device: decoding MJPEG at 1/" << this->captureMjpeg->scaleDenominator() << " scale ("
+             << scaledFmt.width << "x" << scaledFmt.height << ")" << endl;
+    }
 
-    // Build a swscale context to convert the backup camera's frames to the
-    // same YUV420P format at OUTPUT_WIDTH x OUTPUT_HEIGHT that the loopback
-    // device expects.
-    SwsContext* backupSws = sws_getContext(
-        capWidth, capHeight, avfmt,
-        OUTPUT_WIDTH, OUTPUT_HEIGHT, AV_PIX_FMT_YUV420P,
+    if (!this->captureScaler) this->captureScaler.reset(new CaptureScaler(this->backupThreads));
+    this->captureScaled = this->captureScaler->configure(scaledFmt, this->outputFmt);
+    if (!this->captureScaled && mjpeg) return false;
+    if (this->captureScaled) {
+        cout << "backup device: converting frames on " << this->captureScaler->threadCount() << " threads" << endl;
+        return true;
+    }
+    this->captureSws = sws_getCachedContext(this->captureSws,
+        capFmt.width,          capFmt.height,          avfmt,
+        this->outputFmt.width, this->outputFmt.height, avPixelFormat(this->outputFmt.fourcc),
         SWS_BILINEAR, nullptr, nullptr, nullptr);
+    return this->captureSws != nullptr;
+}
 
-    static const int BACKUP_SELECT_TIMEOUT_S = 1;
+// Puts the loopback device back into the format the Kinect pipeline renders. Until that succeeds, the device counts as
+// still forwarding the camera's format.
+bool kinect2pipe_IR::closeCapturePath() {
+    if (this->capturePassthrough) {
+        if (!this->configureOutput(this->pipelineFormat())) return false;
+        this->capturePassthrough = false;
+    }
+    return true;
+}
 
-    bool ok = true;
-    while (true) {
-        {
-            unique_lock<mutex> lk(this->cvMutex);
-            if (this->shouldStop) break;
-        }
-
-        fd_set fds;
-        FD_ZERO(&fds);
-        FD_SET(fd, &fds);
-        struct timeval tv = {BACKUP_SELECT_TIMEOUT_S, 0};
-        int r = select(fd + 1, &fds, nullptr, nullptr, &tv);
-        if (r < 0) {
-            if (errno == EINTR) continue;
-            ok = false; break;
-        }
-        if (r == 0) continue; // timeout – re-check shouldStop
-
-        struct v4l2_buffer buf{};
-        buf.type   = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-        buf.memory = V4L2_MEMORY_MMAP;
-        if (ioctl(fd, VIDIOC_DQBUF, &buf) < 0) { ok = false; break; }
-
-        // Build per-plane pointers depending on whether the format is packed
-        // or planar.
-        uint8_t* base = (uint8_t*)bufs[buf.index].start;
-        uint8_t* srcData[4]    = {};
-        int      srcStrides[4] = {};
-        switch (pixfmt) {
-            case V4L2_PIX_FMT_YUYV:
-            case V4L2_PIX_FMT_UYVY:
-            case V4L2_PIX_FMT_BGR24:
-            case V4L2_PIX_FMT_RGB24:
-            case V4L2_PIX_FMT_GREY:
-                srcData[0]    = base;
-                srcStrides[0] = (pixfmt == V4L2_PIX_FMT_BGR24 ||
-                                 pixfmt == V4L2_PIX_FMT_RGB24)
-                                    ? capWidth * 3
-                                    : (pixfmt == V4L2_PIX_FMT_GREY)
-                                        ? capWidth
-                                        : capWidth * 2;
-                break;
-            case V4L2_PIX_FMT_YUV420:
-                srcData[0]    = base;
-                srcData[1]    = base + capWidth * capHeight;
-                srcData[2]    = base + capWidth * capHeight
-                                     + (capWidth / 2) * (capHeight / 2);
-                srcStrides[0] = capWidth;
-                srcStrides[1] = capWidth / 2;
-                srcStrides[2] = capWidth / 2;
-                break;
-            case V4L2_PIX_FMT_NV12:
-                srcData[0]    = base;
-                srcData[1]    = base + capWidth * capHeight;
-                srcStrides[0] = capWidth;
-                srcStrides[1] = capWidth;
-                break;
-            default:
-                break;
+// Publishes one captured frame outside the IR pipeline and hands the capture buffer back to source, as soon as the
+// frame is no longer read from it. Returns false once the loopback device can't be written to or the buffer can't be
+// handed back.
+bool kinect2pipe_IR::publishCaptured(FrameSource& source, const SourceFrame& frame, FrameGovernor& captureGovernor) {
+    const uint64_t dequeuedUs = metricsNowUs();
+    if (!captureGovernor.admit(FrameGovernor::Clock::now())) {
+        return source.release();
+    }
+
+    auto start = FrameGovernor::Clock::now();
+    LoopbackOutput::SubmitResult written;
+    if (this->capturePassthrough) {
+        // straight from the capture buffer to the loopback device, the only copy is the one into the kernel
+        written = this->output.writeExternal(frame.data, frame.bytes);
+        if (!source.release()) return false;
+    } else if (this->captureFmt.fourcc == V4L2_PIX_FMT_MJPEG) {
+        // the decoder's buffer is converted, the capture buffer is done with once the frame is decoded
+        const uint8_t* decoded = this->captureMjpeg->decode(frame.data, frame.bytes);
+        if (!source.release()) return false;
+        // a corrupt frame is skipped, the consumer keeps the previous one
+        if (!decoded) return true;
+        this->captureScaler->scale(decoded, this->output.frameBuffer());
+        written = this->output.submitFrameBuffer();
+    } else {
+        if (this->captureScaled) {
+            this->captureScaler->scale(frame.data, this->output.frameBuffer());
+        } else {
+            uint8_t* srcData[4];
+            int      srcStrides[4];
+            this->captureFmt.planes(const_cast<uint8_t*>(frame.data), srcData, srcStrides);
+            sws_scale(this->captureSws, srcData, srcStrides, 0, this->captureFmt.height,
+                      this->dstPtr, this->dstStride);
         }
+        // the camera can fill the buffer again while the frame is written
+        if (!source.release()) return false;
+        written = this->output.submitFrameBuffer();
+    }
+    captureGovernor.submitted(written == LoopbackOutput::SUBMIT_BUSY || written == LoopbackOutput::SUBMIT_HELD,
+                              FrameGovernor::Clock::now() - start);
+
+    if (written == LoopbackOutput::SUBMIT_OK || written == LoopbackOutput::SUBMIT_HELD) {
+        this->metrics.backupFrames.fetch_add(1, memory_order_relaxed);
+        this->metrics.written.fetch_add(1, memory_order_relaxed);
+        this->metrics.backupFrame.record(metricsNowUs() - dequeuedUs);
+        this->firstFrameWritten();
+    } else if (written == LoopbackOutput::SUBMIT_BUSY) {
+        this->metrics.busy.fetch_add(1, memory_order_relaxed);
+    } else {
+        this->metrics.writeErrors.fetch_add(1, memory_order_relaxed);
+        cerr << "failed to write to v4l2loopback device: " << strerror(errno) << endl;
+    }
+    return written != LoopbackOutput::SUBMIT_FAILED;
+}
 
-        sws_scale(backupSws, srcData, srcStrides, 0, capHeight,
-                  this->dstPtr, this->dstStride);
+void kinect2pipe_IR::run() {
+    const int status = this->serve();
+    // cleanup done, the hard kill is no longer needed
+    alarm(0);
+    this->finish(status);
+}
 
-        if (ioctl(fd, VIDIOC_QBUF, &buf) < 0) { ok = false; break; }
+int kinect2pipe_IR::serve() {
+    // A consumer opening the loopback device starts the Kinect and the last one closing it stops it again. Synthetic
+    // and file sources, and any source writing to a plain file, are there to measure the pipeline: they run a single
+    // session that starts right away.
+    this->consumerDriven = this->sourceKind == Metrics::SOURCE_KINECT && !this->output.isFile();
 
-        if (write(this->v4l2Device, this->imageBuffer, YUV_BUFFER_LEN) < 0) {
-            ok = false; break;
+    // opened before the main thread takes the capture role, so the recorder's thread doesn't inherit it
+    if (!this->recordPath.empty() && !this->recorder.open(this->recordPath, this->recordCompress)) {
+        return -1;
+    }
+    // the main thread receives the frames, and libfreenect2's processing threads it starts inherit its role
+    this->realtime.enter(RealtimeProfile::ROLE_CAPTURE);
+
+    // On standby the Kinect is opened and the pipeline readied now, while nobody is waiting for it. A Kinect that
+    // isn't there yet is looked for again when the consumer arrives.
+    std::unique_ptr<FrameSource> source = this->createSource();
+    if (this->standby && this->sourceKind == Metrics::SOURCE_KINECT) {
+        const uint64_t start = metricsNowUs();
+        this->prewarm();
+        if (source->prepare()) {
+            cout << "standby ready in " << (metricsNowUs() - start) / 1000.0 << " ms" << endl;
         }
     }
 
-    sws_freeContext(backupSws);
-    ioctl(fd, VIDIOC_STREAMOFF, &btype);
-    for (unsigned i = 0; i < nbuf; i++) munmap(bufs[i].start, bufs[i].length);
-    close(fd);
-    return ok;
-}
+    // When a backup device is configured use a short timeout so a Kinect that hangs without leaving the bus is given
+    // up on within ~0.5 s (5 × 100 ms); one that is unplugged is noticed right away through its hotplug event. Without
+    // backup the original 1-second timeout is kept and the Kinect is waited for indefinitely.
+    const bool haveBackup = !this->backupDevPath.empty();
+    if (haveBackup && this->sourceKind == Metrics::SOURCE_KINECT && !this->openHotplugMonitor()) {
+        cerr << "no hotplug events, the backup device will be used until the session ends" << endl;
+    }
+    const int  timeoutMs  = haveBackup ? 100 : 1000;
+    const int  maxMissed  = haveBackup ? 5 : 0;
+
+    if (!this->consumerDriven) {
+        RunResult result = this->runSession(source, timeoutMs, maxMissed);
+        source.reset();
+        this->recorder.close();
+        return result == RUN_FAILED ? -1 : 0;
+    }
 
-void kinect2pipe_IR::run() {
-    // Wait until a consumer opens the device, or until shutdown() is called
-    {
-        unique_lock<mutex> lk(this->cvMutex);
-        this->cv.wait(lk, [this]{ return this->started || this->shouldStop; });
-        if (this->shouldStop) {
-            exit(0);
+    // The daemon outlives its consumers: the Kinect, the buffers and the conversion state are kept between sessions.
+    while (this->waitForConsumer()) {
+        RunResult result = this->runSession(source, timeoutMs, maxMissed);
+        if (result == RUN_FAILED) {
+            // start over with a fresh libfreenect2 context next time, the device may have been replugged
+            source = this->createSource();
+            cerr << "no source left for this session, waiting for the consumer to close the device" << endl;
+            this->waitForIdle();
         }
+        cout << "idle, waiting for a consumer" << endl;
     }
 
-    cout << "starting kinect2 IR capture" << endl;
-    bool kinectOk = this->openKinect2Device();
+    source.reset();
+    this->recorder.close();
+    return 0;
+}
 
-    // If shutdown was requested during capture, exit cleanly.
-    {
-        unique_lock<mutex> lk(this->cvMutex);
-        if (this->shouldStop) exit(0);
+// One session: the main source, and the backup device while the main source can't deliver, until the consumers are
+// gone, shutdown, or the end of the main source. The session goes back to the Kinect whenever it is plugged in again;
+// a Kinect that fails again right away hands over to the backup device again.
+kinect2pipe_IR::RunResult kinect2pipe_IR::runSession(std::unique_ptr<FrameSource>& source, int timeoutMs,
+                                                     int maxMissed) {
+    if (!this->backupDevPath.empty()) {
+        this->backupSource.reset(new V4L2CaptureSource(this->backupDevPath));
+        // the format and rate are settled when the device is prepared, ahead of the first switch
+        this->backupSource->setMaxFps(this->maxFps);
+        this->backupSource->setPreferMjpeg(this->backupMjpeg);
     }
 
-    // Fall back to the backup device when kinect failed to open or disconnected.
-    if (!this->backupDevPath.empty()) {
-        this->openBackupDevice();
-        exit(0);
+    RunResult result;
+    while (true) {
+        cout << "starting " << source->name() << " capture" << endl;
+        result = this->runSource(*source, this->sourceKind, timeoutMs, maxMissed, this->frameLimit);
+        if (result != RUN_FAILED || !this->backupSource || this->sessionOver()) break;
+
+        // start over with a fresh libfreenect2 context when the Kinect comes back
+        source = this->createSource();
+        cerr << "switching to backup device: " << this->backupDevPath << endl;
+        if (this->failbackAttempts > 0) EventLoop::armTimer(this->failbackTimer, KINECT_FAILBACK_DELAY_MS, false);
+
+        this->unwatchBackup();
+        result = this->runSource(*this->backupSource, Metrics::SOURCE_BACKUP, 1000, 0, 0);
+        if (result != RUN_SWITCH || this->sessionOver()) break;
+        cout << "failing back to " << source->name() << endl;
+    }
+
+    this->unwatchBackup();
+    this->backupSource.reset();
+    this->switchStartedUs.store(0);
+    this->metrics.setSource(Metrics::SOURCE_NONE);
+    return result == RUN_SWITCH ? RUN_STOPPED : result;
+}
+
+// true once shutdown was requested or, when sessions follow the consumers, the last consumer is gone
+bool kinect2pipe_IR::sessionOver() {
+    return this->shouldStop.load() || (this->consumerDriven && this->consumers == 0);
+}
+
+// Sleeps in the reactor until a consumer has the loopback device open, false on shutdown.
+bool kinect2pipe_IR::waitForConsumer() {
+    while (this->consumers == 0 && !this->shouldStop.load()) {
+        if (this->reactor.poll(-1) < 0) return false;
+    }
+    return !this->shouldStop.load();
+}
+
+// Sleeps in the reactor until every consumer has closed the loopback device, or shutdown.
+void kinect2pipe_IR::waitForIdle() {
+    while (this->consumers > 0 && !this->shouldStop.load()) {
+        if (this->reactor.poll(-1) < 0) return;
     }
+}
 
-    if (!kinectOk) exit(-1);
-    exit(0);
+// Final statistics go out before the process exits, so a benchmark run leaves complete numbers behind.
+void kinect2pipe_IR::finish(int status) {
+    this->recorder.close();
+    this->shmPublisher.close();
+    this->statsServer.stop();
+    exit(status);
 }
 
 void kinect2pipe_IR::writeBlankFrame() {
-    memset(this->imageBuffer,                    0x10, YUV_BUFFER_Y_LEN);
-    memset(this->imageBuffer + YUV_BUFFER_Y_LEN, 0x80, YUV_BUFFER_UV_LEN * 2);
-    write(this->v4l2Device, this->imageBuffer, YUV_BUFFER_LEN);
-}
\ No newline at end of file
+    // a file only gets the frames that were captured
+    if (this->output.isFile()) return;
+
+    uint8_t* frame = this->output.frameBuffer();
+    if (!frame) return;
+    if (this->outputFmt.fourcc == V4L2_PIX_FMT_YUV420) {
+        memset(frame, IR_LUMA_MIN, this->outputFmt.planeSize(0));
+        this->fillNeutralChroma(frame);
+    } else {
+        memset(frame, 0, this->outputFmt.frameSize());
+    }
+    this->output.submitFrameBuffer();
+}
+
+// The IR image is gray, so the U and V planes of a YUV420P buffer holding it are constant.
+void kinect2pipe_IR::fillNeutralChroma(uint8_t* yuv) {
+    memset(yuv + this->outputFmt.planeOffset(1), IR_CHROMA_NEUTRAL,
+           this->outputFmt.frameSize() - this->outputFmt.planeOffset(1));
+}
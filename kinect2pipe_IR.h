@@ -1,28 +1,84 @@
 #ifndef kinect2pipe_IR_kinect2pipe_IR_H
 #define kinect2pipe_IR_kinect2pipe_IR_H
 
-#include <libfreenect2/libfreenect2.hpp>
-#include <libfreenect2/frame_listener_impl.h>
 #include <string>
 #include <thread>
 #include <mutex>
 #include <condition_variable>
 #include <atomic>
+#include <memory>
+#include <vector>
+#include <sys/types.h>
+#include "frame_format.h"
+#include "ir_convert.h"
+#include "tone_map.h"
+#include "ir_scale.h"
+#include "frame_ring.h"
+#include "frame_governor.h"
+#include "change_detector.h"
+#include "frame_source.h"
+#include "kinect_source.h"
+#include "metrics.h"
+#include "ir_recording.h"
+#include "stats_server.h"
+#include "loopback_output.h"
+#include "event_loop.h"
+#include "conversion_pool.h"
+#include "hotplug_monitor.h"
+#include "v4l2_capture_source.h"
+#include "shm_publisher.h"
+#include "realtime_profile.h"
+#include "frame_arena.h"
+#include "capture_scaler.h"
+#include "mjpeg_decoder.h"
 
 using namespace std;
-using namespace libfreenect2;
 
-#define KINECT2_IMAGE_WIDTH  512
-#define KINECT2_IMAGE_HEIGHT 424
+// Frame layouts are described by FrameFormat (frame_format.h). The Kinect's
+// IR frames are always KinectIrFormat; the loopback device gets the same
+// 512x424 image in one of the Kinect*Format layouts, a crop or downscale of
+// it, or whatever format the backup device forwards.
 
-#define OUTPUT_WIDTH  512
-#define OUTPUT_HEIGHT 424
+// number of frames allowed to wait between two pipeline stages before the
+// oldest one is dropped
+#define PIPELINE_QUEUE_DEPTH 2
+// output ring slots: the converter's, the queued ones, the one being written
+// and the last one written, which keep-alives send again
+#define PIPELINE_OUTPUT_SLOTS (PIPELINE_QUEUE_DEPTH + 3)
 
-#define YUV_BUFFER_Y_LEN   (OUTPUT_WIDTH * OUTPUT_HEIGHT)
-#define YUV_BUFFER_UV_LEN  ((OUTPUT_WIDTH / 2) * (OUTPUT_HEIGHT / 2))
-#define YUV_BUFFER_LEN     (YUV_BUFFER_Y_LEN + (YUV_BUFFER_UV_LEN * 2))
+// how often the consumer count is checked against the open handles in /proc
+// while a consumer is connected, in case inotify merged two close events
+#define CONSUMER_RESCAN_MS 2000
 
-#define IR_MAX_VALUE 65535.0f
+// sources without a descriptor to wait on are read with this timeout, so
+// the reactor is looked at in between
+#define SOURCE_READ_SLICE_MS 50
+
+// seconds shutdown may take before the process is killed
+#define SHUTDOWN_GRACE_S 2
+
+// after the Kinect is plugged back in, the time it is given to boot before
+// the session fails back to it, and how many times that is tried
+#define KINECT_FAILBACK_DELAY_MS 1500
+#define KINECT_FAILBACK_ATTEMPTS 3
+
+// Queue depth and drop counters of the capture -> convert -> write pipeline.
+// Each entry describes the queue feeding that stage.
+struct PipelineStageStats {
+    size_t   depth;
+    size_t   capacity;
+    uint64_t published;
+    uint64_t dropped;
+};
+
+struct PipelineStats {
+    PipelineStageStats convert;    // frames captured but not yet converted
+    PipelineStageStats write;      // frames converted but not yet written
+    uint64_t           skipped;    // frames the governor dropped at capture
+    uint64_t           backoffs;   // times the consumer pushed back and the rate was halved
+    uint64_t           unchanged;  // static frames the change detector dropped at capture
+    uint64_t           keepAlives; // static frames published anyway to keep the consumer fed
+};
 
 class kinect2pipe_IR {
 public:
@@ -38,12 +94,204 @@ public:
     // toggle it before calling run().
     void setHwAccel(bool enable) { hwAccelEnabled = enable; }
 
+    // without hardware acceleration, decode only the IR image of the
+    // Kinect's depth packets on that many threads (0 for one per core)
+    // instead of running libfreenect2's whole CPU depth processor. On by
+    // default in builds that have the IR-only pipeline.
+    void setIrDecoder(bool irOnly, int threads) { irOnlyDecoder = irOnly; decodeThreads = threads; }
+
+    // select the original normBuf + sws_scale conversion instead of the fused
+    // IR -> Y kernel. Both are meant to produce the same image; the old path
+    // is kept so the two outputs can be compared byte for byte.
+    void setSwscaleConvert(bool enable) { swscaleConvert = enable; }
+
+    // hand frames to the loopback device through its MMAP buffers (the
+    // default) or through plain write() calls. Streaming silently falls back
+    // to write() when the loopback driver does not support it. Must be set
+    // before openLoopback().
+    void setStreamingOutput(bool enable) { streamingOutput = enable; }
+
+    // forward backup camera frames in the camera's own format and size when
+    // the loopback device accepts it (the default), instead of always scaling
+    // them to the pipeline's output format.
+    void setBackupPassthrough(bool enable) { backupPassthrough = enable; }
+
+    // pixel format published on the loopback device: V4L2_PIX_FMT_YUV420 (the
+    // default, 12 bpp with constant chroma, understood by every V4L2 client),
+    // V4L2_PIX_FMT_GREY (8 bpp full range, a third less data) or
+    // V4L2_PIX_FMT_Y16 (16 bpp, full IR precision). Must be set before
+    // openLoopback().
+    void setOutputFormat(uint32_t fourcc) { outputFourcc = fourcc; }
+
+    // how IR values are mapped onto the 8-bit GREY and YUV420 outputs,
+    // TONE_FIXED (the original linear mapping) by default. Y16 always keeps
+    // the raw values and the --swscale path always maps linearly.
+    void setToneMode(ToneMode mode) { toneMapper.setMode(mode); }
+    void setToneGamma(float gamma) { toneMapper.setGamma(gamma); }
+
+    // publish only the width x height rectangle at (x, y) of the IR frame,
+    // and/or shrink it to width x height by area averaging (0 keeps the
+    // crop's size). Checked when the loopback device is opened, so both must
+    // be set before openLoopback().
+    void setOutputCrop(int x, int y, int width, int height) {
+        cropX = x; cropY = y; cropWidth = width; cropHeight = height;
+    }
+    void setOutputSize(int width, int height) { scaledWidth = width; scaledHeight = height; }
+
+    // highest rate frames are converted and published at, 0 (the default)
+    // for every frame. Frames in excess are dropped before conversion; the
+    // backup device is asked to capture at this rate in the first place.
+    // Independently of the cap, the rate is lowered automatically while the
+    // consumer does not keep up with it.
+    void setMaxFps(double fps) { maxFps = fps; governor.setMaxFps(fps); }
+
+    // skip IR frames that differ from the last one published by less than
+    // threshold (relative mean absolute difference, e.g. 0.02). During a
+    // static scene the last frame written is sent again keepAliveFps times a
+    // second, without being converted again. A frame that changes more goes
+    // through at once. 0 (the default) publishes every frame.
+    void setChangeDetection(float threshold, double keepAliveFps) {
+        changeDetector.setThreshold(threshold);
+        changeDetector.setKeepAliveFps(keepAliveFps);
+    }
+
+    // serve the latency histograms and counters on a Unix socket and/or
+    // rewrite them to a text file every second (either may be null). Must be
+    // set before openLoopback().
+    void setStatsEndpoint(const char* socketPath, const char* filePath) {
+        statsSocketPath = socketPath ? socketPath : "";
+        statsFilePath   = filePath ? filePath : "";
+    }
+
+    // also publish the Kinect's IR frames, at full precision, to processes that
+    // connect to the Unix socket at socketPath (see kinect2pipe_shm.h), in
+    // K2P_SHM_FORMAT_FLOAT or K2P_SHM_FORMAT_Y16. A connected client counts
+    // as a consumer of the loopback device. Must be set before openLoopback().
+    void setShmOutput(const char* socketPath, uint32_t format) { shmSocketPath = socketPath; shmFormat = format; }
+
+    // run the pipeline on generated frames, or on raw IR frames replayed from a file, instead of the Kinect. Frames
+    // are delivered at fps, or as fast as the pipeline takes them with 0. These sources are meant for measuring the
+    // pipeline without hardware and start right away instead of waiting for a consumer.
+    void setSyntheticSource(double fps) { sourceKind = Metrics::SOURCE_SYNTHETIC; sourceFps = fps; }
+    void setFileSource(const char* path, double fps) {
+        sourceKind = Metrics::SOURCE_FILE; sourcePath = path; sourceFps = fps;
+    }
+
+    // replay a recording made with setRecording(), at the pace it was recorded at or as fast as the pipeline takes
+    // the frames. Starts right away like the synthetic and file sources.
+    void setReplaySource(const char* path, bool originalTiming) {
+        sourceKind = Metrics::SOURCE_REPLAY; sourcePath = path; replayOriginalTiming = originalTiming;
+    }
+
+    // append every IR frame the source delivers to a recording, delta coded when compress is set. The frames are
+    // written by a background thread and dropped rather than slowing down the capture when the disk falls behind.
+    void setRecording(const char* path, bool compress) { recordPath = path; recordCompress = compress; }
+
+    // record the Kinect's first raw depth packets, with libfreenect2's own IR decoding of each, for checking and
+    // benchmarking the IR-only decoder without the device
+    void setPacketRecording(const char* path) { packetRecordPath = path; }
+
+    // stop after this many frames from the main source, 0 (the default) for no limit. File and replay sources start
+    // over at the end of the file until the limit is reached.
+    void setFrameLimit(uint64_t frames) { frameLimit = frames; }
+
+    // open the Kinect and get everything the pipeline needs ready when the daemon starts, instead of when a consumer
+    // opens the loopback device: the consumer then only waits for the IR stream to start. The Kinect stays open with
+    // its emitter off until then. Only applies to the Kinect source.
+    void setStandby(bool enable) { standby = enable; }
+
+    // keep the backup device streaming while the Kinect runs, its frames
+    // thrown away, instead of only opened with its buffers mapped. Switching
+    // to it then doesn't wait for the camera to start, at the price of
+    // keeping it busy (and its LED on) for the whole session.
+    void setBackupHot(bool enable) { backupHot = enable; }
+
+    // threads converting backup camera frames, including the capture
+    // thread; 0 (the default) for one per core
+    void setBackupThreads(int threads) { backupThreads = threads; }
+
+    // capture MJPEG from the backup device at the largest size it has at the
+    // frame rate, decoded at a reduced size, instead of YUYV
+    void setBackupMjpeg(bool enable) { backupMjpeg = enable; }
+
+    // pin the threads on a frame's path to CPUs and, with the real-time
+    // profile enabled, run them at real-time priorities, keep every frame
+    // buffer in one pre-faulted arena (on huge pages if asked) and lock the
+    // process in memory. See RealtimeProfile. Must be set before
+    // openLoopback().
+    void setRealtimeProfile(const RealtimeProfile& profile) { realtime = profile; }
+
+    // Used by DeviceServer to run several instances in one process. The
+    // Kinect with this serial number is opened through the shared context
+    // instead of the first one found, frames are converted by the shared
+    // pool instead of a converter thread of this instance's own, and SIGINT
+    // and SIGTERM are left to the server, which calls shutdown(). All of
+    // them must be set before openLoopback().
+    void setKinectDevice(const std::string& serial, KinectContext* context) {
+        kinectSerial = serial; kinectContext = context;
+    }
+    void setConversionPool(ConversionPool* pool) { conversionPool = pool; }
+    void setHandleSignals(bool enable) { handleSignals = enable; }
+
+    // runs sessions like run() until shutdown or the end of the source and
+    // returns the exit status instead of exiting
+    int serve();
+
+    PipelineStats pipelineStats() const;
+    void          reportStats(std::ostream& os) const;
+
 private:
-    Freenect2        freenect2;
-    FrameMap         frames;
-    int              v4l2Device;
+    enum RunResult {
+        RUN_STOPPED,   // shutdown was requested or the last consumer closed the device
+        RUN_ENDED,     // the source ran out of frames or hit the frame limit
+        RUN_FAILED,    // the source could not be started, stopped responding or the output failed
+        RUN_SWITCH     // the Kinect came back while the backup device was running
+    };
+
+    LoopbackOutput   output;
 
     std::string        backupDevPath;
+    bool               backupHot;
+
+    // Failover: during a session the backup device is opened as soon as the
+    // main source delivers, so switching to it doesn't have to. Kernel
+    // hotplug events tell when the Kinect is unplugged, which fails over at
+    // once, and when it is plugged back in, which fails back after
+    // KINECT_FAILBACK_DELAY_MS. All of it belongs to the main thread.
+    std::unique_ptr<V4L2CaptureSource> backupSource;  // only during a session
+    bool                               backupWatched; // its frames discarded by the reactor
+    HotplugMonitor                     hotplug;
+    int                                failbackTimer;
+    int                                failbackAttempts;
+    bool                               failbackDue;
+    bool                               kinectRemoved;
+    std::atomic<uint64_t>              switchStartedUs; // metricsNowUs() of a switch until the new source's first frame
+
+    Metrics::Source sourceKind;   // main source
+    std::string     sourcePath;
+    double          sourceFps;
+    uint64_t        frameLimit;
+    bool            replayOriginalTiming;
+
+    IrRecorder  recorder;
+    std::string recordPath;
+    bool        recordCompress;
+
+    std::string     kinectSerial;
+    KinectContext*  kinectContext;
+    ConversionPool* conversionPool;
+    ConversionPool::Strand* conversionStrand; // this instance's frames in conversionPool
+    bool            handleSignals;
+
+    // forwarding of captured frames that aren't Kinect IR, set up by openCapturePath()
+    FrameFormat        captureFmt;
+    bool               capturePassthrough;
+    int                backupThreads;
+    bool               backupMjpeg;
+    std::unique_ptr<MjpegDecoder>  captureMjpeg;  // kept like captureScaler, for MJPEG cameras
+    std::unique_ptr<CaptureScaler> captureScaler; // started by the first openCapturePath() that scales
+    bool               captureScaled;             // by captureScaler rather than captureSws
+    struct SwsContext* captureSws;
 
     struct SwsContext* sws;
     float*             normBuf;
@@ -51,27 +299,130 @@ private:
     uint8_t* srcPtr[4]{};
     int      srcStride[4]{};
     uint8_t* dstPtr[4]{};
-    int      dstStride[4]{};
+    int      dstStride[4]{};  // planes of output.frameBuffer()
+
+    uint32_t    outputFourcc;
+    FrameFormat outputFmt;      // layout the loopback device is configured for by configureOutput()
+    IrKernels   kernels;        // runtime-selected fused conversion kernels, fixed to the Kinect frame size
+    IrKernels   anyKernels;     // the same kernels for any pixel count, used for cropped or scaled output
+    ToneMapper  toneMapper;     // adaptive IR -> luma curves, owned by the converter thread while it runs
+
+    // region of the IR frame that is published and the size it is scaled to
+    int          cropX, cropY, cropWidth, cropHeight;
+    int          scaledWidth, scaledHeight;
+    IrAreaScaler scaler;
+    float*       scaledBuf;      // scaler output, converted like a Kinect frame of that size
+
+    // capture -> convert -> write pipeline. The capture loop copies each IR
+    // frame into irRing and hands the libfreenect2 frame back straight away,
+    // the converter thread renders outputRing slots and the writer thread
+    // pushes them to the loopback device. In streaming mode the outputRing
+    // slots are the device's own buffers, so it can only be created once
+    // output is open.
+    std::unique_ptr<FrameRing> irRing;
+    std::unique_ptr<FrameRing> outputRing;
+    mutable mutex              outputRingMutex; // held to replace outputRing and by the stats thread reading it
+    std::thread                converterThread;
+    std::thread                writerThread;
+    std::atomic<bool>          pipelineFailed; // writer could not submit to the loopback device
+    FrameGovernor              governor;       // admits frames at capture, backed off by the writer
+    ChangeDetector             changeDetector; // then drops the ones that would show nothing new
+    double                     maxFps;
+
+    // Frames from a source without a rate of its own wait for the writer instead of being dropped, so the rate such
+    // a source reaches is the throughput of the pipeline. framesDone is written by the writer under flowMutex.
+    bool                       pipelineLossless;
+    uint64_t                   framesQueued;
+    uint64_t                   framesDone;
+    mutex                      flowMutex;
+    condition_variable         flowCv;
+
+    ShmPublisher shmPublisher;   // published to by the conversion stage
+    std::string  shmSocketPath;
+    uint32_t     shmFormat;
+
+    Metrics     metrics;
+    StatsServer statsServer;
+    std::string statsSocketPath;
+    std::string statsFilePath;
+
+    // With the real-time profile irRing, normBuf, scaledBuf and, when the
+    // output isn't streamed, outputRing are carved out of arena.
+    RealtimeProfile       realtime;
+    FrameArena            arena;
+    std::vector<uint8_t*> arenaOutput;      // outputRing buffers for the pipeline format
 
-    uint8_t* imageBuffer;
+    bool                  standby;
+    std::atomic<uint64_t> consumerOpenedUs; // metricsNowUs() of the consumer's open until its first frame is written
 
-    std::thread        watcherThread;
-    mutex              cvMutex;
-    condition_variable cv;
-    bool               started;    // first consumer opened
-    bool               shouldStop; // last consumer gone or signal
-    std::atomic<bool>  cleanupComplete; // set when device shutdown finished
+    // Sessions: with the Kinect as the source a session starts when the
+    // first consumer opens the loopback device and ends when the last one
+    // closes it, after which the daemon idles until the next one.
+    //
+    // The main thread only ever sleeps in the reactor, which watches the
+    // signalfd, the inotify descriptor and its recount timer, and during a
+    // session the source's descriptor and the missed frame timer. Everything
+    // below except shouldStop belongs to the main thread.
+    EventLoop          reactor;
+    int                signalFd;
+    int                inotifyFd;
+    int                rescanTimer;      // recount of the consumers while one is connected
+    dev_t              loopbackRdev;
+    int                watchedConsumers; // from the inotify events, until a recount corrects it
+    int                shmClients;       // connected to shmPublisher
+    bool               consumerDriven;   // sessions follow the consumers, fixed by run()
+    int                consumers;        // handles other processes hold on the loopback device, plus shmClients
+    std::atomic<bool>  shouldStop;       // signal or shutdown()
 
     // internal flag controlling pipeline choice
     bool hwAccelEnabled;
+    bool irOnlyDecoder;
+    int  decodeThreads;
+    std::string packetRecordPath;
+    bool swscaleConvert;
+    bool streamingOutput;
+    bool backupPassthrough;
 
-    bool openV4L2LoopbackDevice(const char* loopbackDev, int width, int height);
+    bool allocateArena();
+    bool openV4L2LoopbackDevice(const char* loopbackDev);
+    bool configureOutput(const FrameFormat& format);
+    bool setLoopbackFormat(const FrameFormat& format);
+    void buildOutputRing();
+    FrameFormat pipelineFormat() const;
+    bool openSignals();
     bool openInotifyWatcher(const char* loopbackDev);
-    bool openKinect2Device();
-    bool openBackupDevice();
-    bool handleFrame(Frame* frame);
-    void inotifyWatcher(const char* loopbackDev);
+    void readInotify();
+    void recountConsumers();
+    bool openHotplugMonitor();
+    void readHotplug();
+    void readyBackup();
+    void unwatchBackup();
+    std::unique_ptr<FrameSource> createSource() const;
+    RunResult runSession(std::unique_ptr<FrameSource>& source, int timeoutMs, int maxMissed);
+    RunResult runSource(FrameSource& source, Metrics::Source kind, int timeoutMs, int maxMissed, uint64_t limit);
+    bool sessionOver();
+    bool waitForConsumer();
+    void waitForIdle();
+    void setConsumers(int count);
+    bool openCapturePath(const FrameFormat& capFmt);
+    bool closeCapturePath();
+    bool publishCaptured(FrameSource& source, const SourceFrame& frame, FrameGovernor& captureGovernor);
+    bool handleFrame(const SourceFrame& frame);
+    bool waitForPipeline();
+    // returns metricsNowUs() at the end of the separate normalisation pass, 0 when there was none
+    uint64_t convertIrFrame(const float* src, uint8_t* dst);
+    void prewarm();
+    void firstFrameWritten();
+    void startPipeline();
+    void stopPipeline();
+    void converterLoop();
+    void convertSlot(int in);
+    void convertQueued();
+    void writerLoop();
+    int  writeOutputSlot(int in, uint64_t captureUs);
     void writeBlankFrame();
+    void fillNeutralChroma(uint8_t* yuv);
+    [[noreturn]] void finish(int status);
 };
 
 #endif // kinect2pipe_IR_kinect2pipe_IR_H
\ No newline at end of file
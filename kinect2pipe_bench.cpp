@@ -0,0 +1,887 @@
+#include "kinect2pipe_IR.h"
+#include "device_server.h"
+#include "ir_decode.h"
+#include "packet_recording.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <fcntl.h>
+extern "C" {
+#include <libswscale/swscale.h>
+}
+
+/**
+ * Benchmarks of the IR decoder, the conversion kernels, the backup path's conversions (swscale's and its own on 1, 2
+ * and 4 threads) and MJPEG decoding, and the output, plus end-to-end runs of the whole pipeline on synthetic frames,
+ * alone and as several devices served by one process.
+ * Every benchmark reports the median, 99th percentile and fastest time of one call; the end-to-end runs report the
+ * frame rate the pipeline sustained and its capture to write latency.
+ *
+ * Results are written as JSON, one benchmark per line. Given a previous result with --baseline, every benchmark whose
+ * median got slower by more than --threshold percent is reported and the exit status is 1. It is 1 as well if the
+ * IR decoder's variants disagree, or with --packets, if it disagrees with libfreenect2's decoding of the packets, and
+ * if the backup conversion gives a different frame on more threads.
+ */
+
+// default measuring time of every benchmark, after BENCH_WARMUP untimed calls
+#define BENCH_MIN_TIME_MS 300
+#define BENCH_WARMUP      5
+// timed calls are capped so a fast kernel doesn't fill memory with samples
+#define BENCH_MAX_SAMPLES 200000
+
+#define BENCH_E2E_FRAMES     3000
+#define BENCH_THRESHOLD_PCT  10.0
+
+// packets of a --packets recording kept in memory, 3 MB each
+#define BENCH_DECODE_PACKETS  30
+// largest difference to libfreenect2's IR decoding accepted, the decoder folds the multipliers differently
+#define BENCH_DECODE_TOLERANCE 1.0f
+
+// size the backup benchmarks capture at, a common webcam mode
+#define BENCH_CAPTURE_WIDTH  640
+#define BENCH_CAPTURE_HEIGHT 480
+// and the high resolution one the banded conversion is timed at
+#define BENCH_HD_CAPTURE_WIDTH  1920
+#define BENCH_HD_CAPTURE_HEIGHT 1080
+
+struct BenchResult {
+    std::string name;
+    uint64_t    iterations;
+    double      medianNs;
+    double      p99Ns;
+    double      minNs;
+    double      pixels;     // per call, 0 when throughput in pixels means nothing
+    // end-to-end runs only
+    double      fps;
+    double      latencyP50Us;
+    double      latencyP99Us;
+};
+
+struct BenchOptions {
+    std::string filter;
+    int         minTimeMs = BENCH_MIN_TIME_MS;
+    std::string sink      = "/dev/null";
+    uint64_t    e2eFrames = BENCH_E2E_FRAMES;
+    bool        e2e       = true;
+    std::string packets;    // a --record-packets recording to decode instead of a made up packet
+};
+
+static BenchOptions             options;
+static std::vector<BenchResult> results;
+
+static bool selected(const std::string& name) {
+    return options.filter.empty() || name.find(options.filter) != std::string::npos;
+}
+
+// Calls fn until minTimeMs have passed and records the time of every call.
+static void bench(const std::string& name, double pixels, const std::function<void()>& fn) {
+    if (!selected(name)) return;
+    typedef std::chrono::steady_clock Clock;
+
+    for (int i = 0; i < BENCH_WARMUP; ++i) fn();
+
+    std::vector<double> samples;
+    samples.reserve(4096);
+    const Clock::time_point end = Clock::now() + std::chrono::milliseconds(options.minTimeMs);
+    Clock::time_point       now;
+    do {
+        const Clock::time_point start = Clock::now();
+        fn();
+        now = Clock::now();
+        samples.push_back((double)std::chrono::duration_cast<std::chrono::nanoseconds>(now - start).count());
+    } while (now < end && samples.size() < BENCH_MAX_SAMPLES);
+
+    std::sort(samples.begin(), samples.end());
+    BenchResult r{};
+    r.name       = name;
+    r.iterations = samples.size();
+    r.medianNs   = samples[samples.size() / 2];
+    r.p99Ns      = samples[std::min(samples.size() - 1, samples.size() * 99 / 100)];
+    r.minNs      = samples.front();
+    r.pixels     = pixels;
+    results.push_back(r);
+
+    fprintf(stderr, "%-32s %12.0f ns median %12.0f ns p99", name.c_str(), r.medianNs, r.p99Ns);
+    if (pixels > 0) fprintf(stderr, " %10.1f Mpix/s", pixels * 1e3 / r.medianNs);
+    fprintf(stderr, "\n");
+}
+
+// An IR frame that looks like a room: a smooth falloff from the centre, a bright disc and sensor noise, all in whole
+// numbers like libfreenect2 reports, with a few saturated pixels.
+static std::vector<float> testFrame() {
+    std::vector<float> frame(KinectIrFormat::pixels);
+    uint32_t           state = 0x9e3779b9u;
+    for (int y = 0; y < KinectIrFormat::height; ++y) {
+        for (int x = 0; x < KinectIrFormat::width; ++x) {
+            state ^= state << 13;
+            state ^= state >> 17;
+            state ^= state << 5;
+            const float dx = x - KinectIrFormat::width / 2.0f;
+            const float dy = y - KinectIrFormat::height / 2.0f;
+            float v = 3000.0f - std::sqrt(dx * dx + dy * dy) * 8.0f + (float)(state % 64);
+            if ((x - 150) * (x - 150) + (y - 200) * (y - 200) < 40 * 40) v += 9000.0f;
+            if (state % 997 == 0) v = 65535.0f;
+            frame[(size_t)y * KinectIrFormat::width + x] = std::floor(std::max(v, 0.0f));
+        }
+    }
+    return frame;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+// kernels
+// ---------------------------------------------------------------------------------------------------------------------
+
+static void benchKernels(const std::vector<float>& frame) {
+    const size_t         pixels = KinectIrFormat::pixels;
+    std::vector<uint8_t> luma(pixels);
+    std::vector<uint16_t> y16(pixels);
+    std::vector<uint8_t> lut(TONE_LUT_SIZE + IR_LUT_PADDING);
+    for (size_t i = 0; i < lut.size(); ++i) lut[i] = (uint8_t)(i * 255 / TONE_LUT_SIZE);
+    const float indexScale = (float)TONE_LUT_SIZE / 65536.0f;
+
+    const IrKernels fixed   = selectIrKernels<KinectIrFormat::pixels>();
+    const IrKernels any     = selectIrKernels<0>();
+    const IrKernels scalar  = {irToLumaScalar, irToY16Scalar, irToLumaLutScalar, irAbsDiffScalar, "scalar"};
+    const float*    src     = frame.data();
+
+    struct Variant { const IrKernels* k; std::string suffix; };
+    const Variant variants[] = {
+        {&fixed,  std::string(fixed.name) + "_fixed"},
+        {&any,    any.name},
+        {&scalar, "scalar"},
+    };
+    for (const Variant& v : variants) {
+        const IrKernels& k = *v.k;
+        bench("ir_to_luma/" + v.suffix, pixels, [&] {
+            k.toLuma(src, luma.data(), pixels, IR_MAX_VALUE, IR_LUMA_MIN, IR_LUMA_RANGE);
+        });
+        bench("ir_to_y16/" + v.suffix, pixels, [&] {
+            k.toY16(src, y16.data(), pixels, IR_MAX_VALUE);
+        });
+        bench("ir_to_luma_lut/" + v.suffix, pixels, [&] {
+            k.toLumaLut(src, luma.data(), pixels, indexScale, lut.data(), TONE_LUT_SIZE - 1);
+        });
+        // one row at a time, the way the change detector calls it
+        bench("abs_diff_row/" + v.suffix, KinectIrFormat::width, [&] {
+            volatile float sum = k.absDiff(src, src + KinectIrFormat::width, KinectIrFormat::width);
+            (void)sum;
+        });
+    }
+
+    // the --swscale path: normalise into floats, then let swscale produce the Y plane
+    std::vector<float> norm(pixels);
+    struct SwsContext* sws = sws_getContext(KinectIrFormat::width, KinectIrFormat::height, AV_PIX_FMT_GRAYF32,
+                                            KinectIrFormat::width, KinectIrFormat::height, AV_PIX_FMT_GRAY8,
+                                            SWS_BILINEAR, nullptr, nullptr, nullptr);
+    if (sws) {
+        bench("ir_to_luma/swscale", pixels, [&] {
+            for (size_t i = 0; i < pixels; ++i) norm[i] = std::min(std::max(src[i] / IR_MAX_VALUE, 0.0f), 1.0f);
+            const uint8_t* in[4]     = {reinterpret_cast<const uint8_t*>(norm.data()), nullptr, nullptr, nullptr};
+            const int      inLine[4] = {KinectIrFormat::width * 4, 0, 0, 0};
+            uint8_t*       out[4]    = {luma.data(), nullptr, nullptr, nullptr};
+            const int      outLine[4] = {KinectIrFormat::width, 0, 0, 0};
+            sws_scale(sws, in, inLine, 0, KinectIrFormat::height, out, outLine);
+        });
+        sws_freeContext(sws);
+    }
+}
+
+static void benchToneMapping(const std::vector<float>& frame) {
+    const IrKernels      kernels = selectIrKernels<KinectIrFormat::pixels>();
+    std::vector<uint8_t> luma(KinectIrFormat::pixels);
+
+    const struct { ToneMode mode; const char* name; } modes[] = {
+        {TONE_FIXED, "fixed"}, {TONE_GAMMA, "gamma"}, {TONE_PERCENTILE, "percentile"}, {TONE_CLAHE, "clahe"},
+    };
+    for (const auto& m : modes) {
+        ToneMapper tone(KinectIrFormat::width, KinectIrFormat::height);
+        tone.setMode(m.mode);
+        tone.setOutputRange(IR_LUMA_MIN, IR_LUMA_RANGE);
+        bench(std::string("tone/") + m.name, KinectIrFormat::pixels, [&] {
+            tone.apply(kernels, frame.data(), luma.data());
+        });
+    }
+}
+
+// The change detector on a static scene, the price every frame pays for the frames it saves, and on a moving one.
+static void benchChangeDetector(const std::vector<float>& frame) {
+    std::vector<float> moved(frame.size());
+    for (size_t i = 0; i < frame.size(); ++i) moved[i] = frame[i] * 0.5f;
+
+    ChangeDetector detector;
+    detector.setThreshold(0.02f);
+    detector.setKeepAliveFps(0.0);
+    detector.setRegion(KinectIrFormat::width, 0, 0, KinectIrFormat::width, KinectIrFormat::height);
+    const ChangeDetector::Clock::time_point now = ChangeDetector::Clock::now();
+    detector.admit(frame.data(), now);
+    bench("change/static", KinectIrFormat::pixels, [&] {
+        detector.admit(frame.data(), now);
+    });
+
+    bool odd = false;
+    bench("change/moving", KinectIrFormat::pixels, [&] {
+        odd = !odd;
+        detector.admit(odd ? moved.data() : frame.data(), now);
+    });
+}
+
+static void benchScaler(const std::vector<float>& frame) {
+    const struct { const char* name; int x, y, width, height, dstWidth, dstHeight; } shapes[] = {
+        {"crop_256x212",      128, 106, 256, 212, 256, 212},
+        {"half_256x212",        0,   0, 512, 424, 256, 212},
+        {"area_320x240",        0,   0, 512, 424, 320, 240},
+        {"crop_area_160x120",  96,  72, 320, 280, 160, 120},
+    };
+    for (const auto& s : shapes) {
+        IrAreaScaler scaler;
+        if (!scaler.configure(KinectIrFormat::width, KinectIrFormat::height, s.x, s.y, s.width, s.height,
+                              s.dstWidth, s.dstHeight)) {
+            continue;
+        }
+        std::vector<float> out((size_t)s.dstWidth * s.dstHeight);
+        bench(std::string("scale/") + s.name, (double)s.width * s.height, [&] {
+            scaler.scale(frame.data(), out.data());
+        });
+    }
+}
+
+static void benchRecording(const std::vector<float>& frame) {
+    const size_t         pixels = KinectIrFormat::pixels;
+    std::vector<uint8_t> encoded(irEncodeBound(pixels));
+    std::vector<float>   decoded(pixels);
+
+    // the same frame as floats that aren't whole numbers, which takes the 32-bit codec
+    std::vector<float> fractional(frame);
+    for (size_t i = 0; i < pixels; ++i) fractional[i] += 0.25f * (float)(i & 3);
+
+    const struct { const char* name; const std::vector<float>* src; } inputs[] = {
+        {"integral", &frame}, {"fractional", &fractional},
+    };
+    for (const auto& in : inputs) {
+        size_t       size  = 0;
+        IrFrameCodec codec = IR_CODEC_RAW;
+        bench(std::string("record_encode/") + in.name, pixels, [&] {
+            codec = irEncodeFrame(in.src->data(), KinectIrFormat::width, KinectIrFormat::height, encoded.data(), size);
+        });
+        if (codec == IR_CODEC_RAW) continue;
+        bench(std::string("record_decode/") + in.name, pixels, [&] {
+            irDecodeFrame(codec, encoded.data(), size, KinectIrFormat::width, KinectIrFormat::height, decoded.data());
+        });
+    }
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+// IR decoding
+// ---------------------------------------------------------------------------------------------------------------------
+
+// Tables and a packet made up for when there is no recording: a smooth phase table, a lookup table that maps the 11-bit
+// values onto signed measurements like the device's does, every pixel valid and random measurements.
+static void syntheticPacket(std::vector<unsigned char>& p0, std::vector<int16_t>& lut, std::vector<float>& ztable,
+                            std::vector<unsigned char>& packet) {
+    p0.assign(KINECT2_P0_TABLES_BYTES, 0);
+    for (size_t i = 32; i + 1 < p0.size(); i += 2) {
+        const uint16_t v = (uint16_t)(((i / 2) % KinectIrFormat::width) * 40);
+        memcpy(&p0[i], &v, sizeof(v));
+    }
+    lut.resize(KINECT2_LUT_SIZE);
+    for (int i = 0; i < KINECT2_LUT_SIZE; ++i) lut[i] = (int16_t)(i < 1024 ? i * 8 : (i - 2048) * 8);
+    lut[KINECT2_LUT_SIZE - 1] = 32767;
+    ztable.assign(KinectIrFormat::pixels, 1.0f);
+
+    packet.resize(KINECT2_DEPTH_PACKET_BYTES);
+    uint32_t state = 0x2545f491u;
+    for (unsigned char& b : packet) {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        b = (unsigned char)state;
+    }
+}
+
+// Decodes with the scalar kernel on one thread and with the fastest one on 1, 2 and 4 threads, which have to agree
+// bit for bit. Packets recorded with --record-packets are also compared with libfreenect2's decoding of each. Returns
+// false if anything disagrees.
+static bool benchDecoder() {
+    std::vector<std::vector<unsigned char>> packets;
+    std::vector<std::vector<float>>         references;
+    PacketRecording                         recording;
+    std::vector<unsigned char>              p0;
+    std::vector<int16_t>                    lut;
+    std::vector<float>                      ztable;
+
+    if (!options.packets.empty()) {
+        if (!recording.open(options.packets)) return false;
+        std::vector<unsigned char> packet;
+        std::vector<float>         reference;
+        while (packets.size() < BENCH_DECODE_PACKETS && recording.next(packet, reference)) {
+            packets.push_back(packet);
+            references.push_back(reference);
+        }
+        if (packets.empty()) {
+            std::cerr << options.packets << " holds no packet" << std::endl;
+            return false;
+        }
+    } else {
+        packets.resize(1);
+        syntheticPacket(p0, lut, ztable, packets[0]);
+    }
+    auto load = [&](IrPacketDecoder& decoder) {
+        if (!options.packets.empty()) return recording.loadTables(decoder);
+        decoder.loadLookupTable(lut.data());
+        decoder.loadZTable(ztable.data());
+        return decoder.loadP0Tables(p0.data(), p0.size());
+    };
+
+    IrPacketDecoder scalar(1);
+    scalar.setKernel(irAmplitudeRowScalar, "scalar");
+    if (!load(scalar)) return false;
+    std::vector<std::vector<float>> expected(packets.size(), std::vector<float>(KinectIrFormat::pixels));
+    for (size_t i = 0; i < packets.size(); ++i) scalar.decode(packets[i].data(), expected[i].data());
+
+    bool ok = true;
+    for (size_t i = 0; i < references.size(); ++i) {
+        if (references[i].empty()) continue;
+        float  worst = 0.0f;
+        size_t off   = 0;
+        for (size_t p = 0; p < KinectIrFormat::pixels; ++p) {
+            const float d = std::fabs(expected[i][p] - references[i][p]);
+            worst = std::max(worst, d);
+            if (d > BENCH_DECODE_TOLERANCE) off++;
+        }
+        if (off) {
+            fprintf(stderr, "ir_decode: packet %zu differs from libfreenect2 by up to %.1f in %zu pixels\n", i, worst,
+                    off);
+            ok = false;
+        }
+    }
+
+    std::vector<float> ir(KinectIrFormat::pixels);
+    size_t             next = 0;
+    bench("ir_decode/scalar_1t", KinectIrFormat::pixels, [&] {
+        scalar.decode(packets[next].data(), ir.data());
+        next = (next + 1) % packets.size();
+    });
+
+    for (int threads : {1, 2, 4}) {
+        IrPacketDecoder decoder(threads);
+        if (!load(decoder)) return false;
+        for (size_t i = 0; i < packets.size(); ++i) {
+            decoder.decode(packets[i].data(), ir.data());
+            if (memcmp(ir.data(), expected[i].data(), KinectIrFormat::frameSize) != 0) {
+                fprintf(stderr, "ir_decode: %s on %d threads differs from the scalar decoding of packet %zu\n",
+                        decoder.kernelName(), threads, i);
+                ok = false;
+            }
+        }
+        bench("ir_decode/" + std::string(decoder.kernelName()) + "_" + std::to_string(threads) + "t",
+              KinectIrFormat::pixels, [&] {
+            decoder.decode(packets[next].data(), ir.data());
+            next = (next + 1) % packets.size();
+        });
+    }
+    return ok;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+// capture and output
+// ---------------------------------------------------------------------------------------------------------------------
+
+static AVPixelFormat avPixelFormat(uint32_t fourcc) {
+    switch (fourcc) {
+        case V4L2_PIX_FMT_YUYV:   return AV_PIX_FMT_YUYV422;
+        case V4L2_PIX_FMT_UYVY:   return AV_PIX_FMT_UYVY422;
+        case V4L2_PIX_FMT_GREY:   return AV_PIX_FMT_GRAY8;
+        case V4L2_PIX_FMT_YUV420: return AV_PIX_FMT_YUV420P;
+        case V4L2_PIX_FMT_NV12:   return AV_PIX_FMT_NV12;
+        case V4L2_PIX_FMT_BGR24:  return AV_PIX_FMT_BGR24;
+        case V4L2_PIX_FMT_RGB24:  return AV_PIX_FMT_RGB24;
+        default:                  return AV_PIX_FMT_NONE;
+    }
+}
+
+// The backup path: a webcam frame converted to the Kinect-sized YUV420 output, as done when passthrough is off or
+// the loopback device refuses the camera's format.
+static void benchBackup() {
+    const FrameFormat out = KinectYuv420Format::format;
+    std::vector<uint8_t> dst(out.frameSize());
+    uint8_t* dstPtr[4]{};
+    int      dstStride[4]{};
+    for (int p = 0; p < out.planeCount; ++p) {
+        dstPtr[p]    = dst.data() + out.planeOffset(p);
+        dstStride[p] = out.bytesPerLine[p];
+    }
+
+    const struct { uint32_t fourcc; const char* name; } inputs[] = {
+        {V4L2_PIX_FMT_YUYV, "yuyv"}, {V4L2_PIX_FMT_UYVY, "uyvy"}, {V4L2_PIX_FMT_NV12, "nv12"},
+        {V4L2_PIX_FMT_YUV420, "yuv420"}, {V4L2_PIX_FMT_BGR24, "bgr24"}, {V4L2_PIX_FMT_RGB24, "rgb24"},
+        {V4L2_PIX_FMT_GREY, "grey"},
+    };
+    for (const auto& in : inputs) {
+        const FrameFormat    cap = FrameFormat::make(in.fourcc, BENCH_CAPTURE_WIDTH, BENCH_CAPTURE_HEIGHT);
+        std::vector<uint8_t> src(cap.frameSize());
+        for (size_t i = 0; i < src.size(); ++i) src[i] = (uint8_t)(i * 7 + (i >> 9));
+
+        struct SwsContext* sws = sws_getContext(cap.width, cap.height, avPixelFormat(in.fourcc),
+                                                out.width, out.height, AV_PIX_FMT_YUV420P,
+                                                SWS_BILINEAR, nullptr, nullptr, nullptr);
+        if (!sws) continue;
+
+        const uint8_t* srcPtr[4]{};
+        int            srcStride[4]{};
+        for (int p = 0; p < cap.planeCount; ++p) {
+            srcPtr[p]    = src.data() + cap.planeOffset(p);
+            srcStride[p] = cap.bytesPerLine[p];
+        }
+        bench(std::string("backup_sws/") + in.name, (double)cap.width * cap.height, [&] {
+            sws_scale(sws, srcPtr, srcStride, 0, cap.height, dstPtr, dstStride);
+        });
+        sws_freeContext(sws);
+    }
+}
+
+// The backup path's own conversion of a high resolution webcam frame on 1, 2 and 4 threads, which has to give the same
+// frame on any number of them. Returns false if it doesn't.
+static bool benchBackupScaler() {
+    const FrameFormat out = KinectYuv420Format::format;
+    const struct { uint32_t fourcc; const char* name; } inputs[] = {
+        {V4L2_PIX_FMT_YUYV, "yuyv"}, {V4L2_PIX_FMT_NV12, "nv12"}, {V4L2_PIX_FMT_GREY, "grey"},
+    };
+    bool ok = true;
+    for (const auto& in : inputs) {
+        const FrameFormat    cap = FrameFormat::make(in.fourcc, BENCH_HD_CAPTURE_WIDTH, BENCH_HD_CAPTURE_HEIGHT);
+        std::vector<uint8_t> src(cap.frameSize());
+        for (size_t i = 0; i < src.size(); ++i) src[i] = (uint8_t)(i * 7 + (i >> 9));
+
+        std::vector<uint8_t> expected(out.frameSize());
+        std::vector<uint8_t> dst(out.frameSize());
+        for (int threads : {1, 2, 4}) {
+            CaptureScaler scaler(threads);
+            if (!scaler.configure(cap, out)) {
+                fprintf(stderr, "backup_scale: %s is not supported\n", in.name);
+                ok = false;
+                break;
+            }
+            scaler.scale(src.data(), threads == 1 ? expected.data() : dst.data());
+            if (threads > 1 && dst != expected) {
+                fprintf(stderr, "backup_scale: %s on %d threads differs from one thread\n", in.name, threads);
+                ok = false;
+            }
+            bench(std::string("backup_scale/") + in.name + "_1080p_" + std::to_string(threads) + "t",
+                  (double)cap.width * cap.height, [&] { scaler.scale(src.data(), dst.data()); });
+        }
+    }
+    return ok;
+}
+
+// A 1080p webcam frame compressed the way UVC cameras send MJPEG, with 4:2:2 chroma.
+static std::vector<uint8_t> mjpegFrame() {
+    const int            width  = BENCH_HD_CAPTURE_WIDTH;
+    const int            height = BENCH_HD_CAPTURE_HEIGHT;
+    std::vector<uint8_t> pixels((size_t)width * height * 3);
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            uint8_t* p = &pixels[((size_t)y * width + x) * 3];
+            p[0] = (uint8_t)((x * 255 / width) ^ (y & 0x3f));
+            p[1] = (uint8_t)(96 + y * 64 / height);
+            p[2] = (uint8_t)(160 - x * 64 / width);
+        }
+    }
+
+    struct jpeg_compress_struct cinfo;
+    struct jpeg_error_mgr       err;
+    cinfo.err = jpeg_std_error(&err);
+    jpeg_create_compress(&cinfo);
+    unsigned char* jpeg  = nullptr;
+    unsigned long  bytes = 0;
+    jpeg_mem_dest(&cinfo, &jpeg, &bytes);
+    cinfo.image_width      = width;
+    cinfo.image_height     = height;
+    cinfo.input_components = 3;
+    cinfo.in_color_space   = JCS_YCbCr;
+    jpeg_set_defaults(&cinfo);
+    jpeg_set_quality(&cinfo, 80, TRUE);
+    cinfo.comp_info[0].h_samp_factor = 2;
+    cinfo.comp_info[0].v_samp_factor = 1;
+    jpeg_start_compress(&cinfo, TRUE);
+    while (cinfo.next_scanline < cinfo.image_height) {
+        JSAMPROW row = &pixels[(size_t)cinfo.next_scanline * width * 3];
+        jpeg_write_scanlines(&cinfo, &row, 1);
+    }
+    jpeg_finish_compress(&cinfo);
+    jpeg_destroy_compress(&cinfo);
+
+    std::vector<uint8_t> frame(jpeg, jpeg + bytes);
+    free(jpeg);
+    return frame;
+}
+
+// Decoding a 1080p MJPEG frame in full and as the backup path does for the Kinect-sized output, in colour and grey,
+// and the whole conversion of one to YUV420.
+static void benchMjpeg() {
+    const std::vector<uint8_t> jpeg = mjpegFrame();
+    const FrameFormat          out  = KinectYuv420Format::format;
+    const struct { const char* name; int width; int height; bool grey; } modes[] = {
+        {"full", BENCH_HD_CAPTURE_WIDTH, BENCH_HD_CAPTURE_HEIGHT, false},
+        {"reduced", out.width, out.height, false},
+        {"reduced_grey", out.width, out.height, true},
+    };
+    for (const auto& m : modes) {
+        MjpegDecoder decoder;
+        decoder.configure(BENCH_HD_CAPTURE_WIDTH, BENCH_HD_CAPTURE_HEIGHT, m.width, m.height, m.grey);
+        if (!decoder.decode(jpeg.data(), jpeg.size())) {
+            fprintf(stderr, "backup_mjpeg: failed to decode the test frame\n");
+            return;
+        }
+        bench(std::string("backup_mjpeg/decode_") + m.name, (double)BENCH_HD_CAPTURE_WIDTH * BENCH_HD_CAPTURE_HEIGHT,
+              [&] { decoder.decode(jpeg.data(), jpeg.size()); });
+    }
+
+    MjpegDecoder  decoder;
+    CaptureScaler scaler(1);
+    decoder.configure(BENCH_HD_CAPTURE_WIDTH, BENCH_HD_CAPTURE_HEIGHT, out.width, out.height, false);
+    scaler.configure(decoder.format(), out);
+    std::vector<uint8_t> dst(out.frameSize());
+    bench("backup_mjpeg/to_yuv420_1t", (double)BENCH_HD_CAPTURE_WIDTH * BENCH_HD_CAPTURE_HEIGHT, [&] {
+        scaler.scale(decoder.decode(jpeg.data(), jpeg.size()), dst.data());
+    });
+}
+
+// What one frame costs the capture thread: the copy into the pipeline's queue. Nothing consumes the ring, so every
+// publish also recycles the oldest queued slot, as happens when the converter falls behind.
+static void benchCapture(const std::vector<float>& frame) {
+    FrameRing ring(PIPELINE_QUEUE_DEPTH, KinectIrFormat::frameSize);
+    uint32_t  sequence = 0;
+    bench("capture/ring_publish", KinectIrFormat::pixels, [&] {
+        FrameSlot& slot = ring.writeSlot();
+        memcpy(slot.data, frame.data(), KinectIrFormat::frameSize);
+        slot.sequence = sequence++;
+        ring.publish();
+    });
+}
+
+static void benchOutput() {
+    const struct { uint32_t fourcc; const char* name; } formats[] = {
+        {V4L2_PIX_FMT_YUV420, "yuv420"}, {V4L2_PIX_FMT_GREY, "grey"}, {V4L2_PIX_FMT_Y16, "y16"},
+    };
+    for (const auto& f : formats) {
+        const std::string name = std::string("write/") + f.name;
+        if (!selected(name)) continue;
+
+        LoopbackOutput output;
+        const FrameFormat format = FrameFormat::make(f.fourcc, KinectIrFormat::width, KinectIrFormat::height);
+        if (!output.open(options.sink.c_str()) || !output.setFormat(format)) continue;
+        memset(output.frameBuffer(), 0x80, output.frameLength());
+        bench(name, KinectIrFormat::pixels, [&] { output.submitFrameBuffer(); });
+        output.close();
+    }
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+// end to end
+// ---------------------------------------------------------------------------------------------------------------------
+
+// value of the sample with these labels, e.g. metric "kinect2pipe_latency_us", labels "stage=\"end_to_end\",..."
+static bool statsValue(const std::string& stats, const std::string& metric, const std::string& labels, double& v) {
+    const std::string  key = metric + "{" + labels + "} ";
+    const size_t       at  = stats.find(key);
+    if (at == std::string::npos) return false;
+    v = strtod(stats.c_str() + at + key.size(), nullptr);
+    return true;
+}
+
+// Runs body, which ends in run() and exits when it is done, in a child process with its output silenced, and reads
+// the statistics file it was given and leaves behind. False if the child failed.
+static bool runDaemon(const std::function<void(const char* statsPath)>& body, std::string& stats) {
+    char statsPath[] = "/tmp/kinect2pipe_bench_XXXXXX";
+    const int statsFd = mkstemp(statsPath);
+    if (statsFd < 0) {
+        perror("mkstemp");
+        return false;
+    }
+    close(statsFd);
+
+    const pid_t child = fork();
+    if (child < 0) {
+        perror("fork");
+        unlink(statsPath);
+        return false;
+    }
+    if (child == 0) {
+        // keep the daemon's progress messages out of the results
+        const int null = open("/dev/null", O_WRONLY);
+        if (null >= 0) {
+            dup2(null, STDOUT_FILENO);
+            dup2(null, STDERR_FILENO);
+        }
+        body(statsPath);
+        _exit(1);
+    }
+
+    int status = 0;
+    waitpid(child, &status, 0);
+    std::ifstream     in(statsPath);
+    std::stringstream text;
+    text << in.rdbuf();
+    unlink(statsPath);
+    stats = text.str();
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+// Runs the daemon on unthrottled synthetic frames into the sink and reports the rate and latency it reached.
+static void benchEndToEnd(uint32_t fourcc, const char* formatName, ToneMode tone, const char* toneName) {
+    const std::string name = std::string("e2e/") + formatName + "_" + toneName;
+    if (!selected(name)) return;
+
+    std::string stats;
+    const bool  ok = runDaemon([fourcc, tone](const char* statsPath) {
+        kinect2pipe_IR k2p;
+        k2p.setOutputFormat(fourcc);
+        k2p.setToneMode(tone);
+        k2p.setSyntheticSource(0.0);
+        k2p.setFrameLimit(options.e2eFrames);
+        k2p.setStatsEndpoint(nullptr, statsPath);
+        k2p.openLoopback(options.sink.c_str());
+        k2p.run();
+    }, stats);
+
+    BenchResult r{};
+    double intervalSum = 0, intervalCount = 0;
+    if (!ok ||
+        !statsValue(stats, "kinect2pipe_latency_us", "stage=\"end_to_end\",quantile=\"0.5\"", r.latencyP50Us) ||
+        !statsValue(stats, "kinect2pipe_latency_us", "stage=\"end_to_end\",quantile=\"0.99\"", r.latencyP99Us) ||
+        !statsValue(stats, "kinect2pipe_latency_us_sum", "stage=\"source_interval\"", intervalSum) ||
+        !statsValue(stats, "kinect2pipe_latency_us_count", "stage=\"source_interval\"", intervalCount) ||
+        intervalSum <= 0) {
+        fprintf(stderr, "%-32s failed\n", name.c_str());
+        return;
+    }
+
+    r.name       = name;
+    r.iterations = (uint64_t)intervalCount + 1;
+    r.fps        = intervalCount * 1e6 / intervalSum;
+    // the time per frame stands in for the call time, so the baseline comparison treats both kinds alike
+    r.medianNs   = 1e9 / r.fps;
+    r.p99Ns      = r.latencyP99Us * 1e3;
+    r.minNs      = 0;
+    r.pixels     = KinectIrFormat::pixels;
+    results.push_back(r);
+
+    fprintf(stderr, "%-32s %12.1f fps %9.0f us p50 %9.0f us p99\n", name.c_str(), r.fps, r.latencyP50Us,
+            r.latencyP99Us);
+}
+
+// Serves count synthetic devices into the sink from one DeviceServer and reports the rate they reached together, to
+// show how the throughput scales with the number of devices. The latencies are those of the slowest device.
+static void benchDevices(size_t count) {
+    const std::string name = "e2e/devices_" + std::to_string(count);
+    if (!selected(name)) return;
+
+    char configPath[] = "/tmp/kinect2pipe_bench_devices_XXXXXX";
+    const int configFd = mkstemp(configPath);
+    if (configFd < 0) {
+        perror("mkstemp");
+        return;
+    }
+    close(configFd);
+    {
+        std::ofstream config(configPath);
+        for (size_t i = 0; i < count; ++i) config << "synthetic" << i << " " << options.sink << "\n";
+    }
+
+    std::string stats;
+    const bool  ok = runDaemon([&configPath](const char* statsPath) {
+        DeviceServer server;
+        if (!server.load(configPath)) return;
+        server.setStatsEndpoint(nullptr, statsPath);
+        server.run([](kinect2pipe_IR& k2p) {
+            k2p.setSyntheticSource(0.0);
+            k2p.setFrameLimit(options.e2eFrames);
+        });
+    }, stats);
+    unlink(configPath);
+
+    BenchResult r{};
+    r.name = name;
+    for (size_t i = 0; ok && i < count; ++i) {
+        const std::string device = "device=\"synthetic" + std::to_string(i) + "\",";
+        double p50 = 0, p99 = 0, intervalSum = 0, intervalCount = 0;
+        if (!statsValue(stats, "kinect2pipe_latency_us", device + "stage=\"end_to_end\",quantile=\"0.5\"", p50) ||
+            !statsValue(stats, "kinect2pipe_latency_us", device + "stage=\"end_to_end\",quantile=\"0.99\"", p99) ||
+            !statsValue(stats, "kinect2pipe_latency_us_sum", device + "stage=\"source_interval\"", intervalSum) ||
+            !statsValue(stats, "kinect2pipe_latency_us_count", device + "stage=\"source_interval\"", intervalCount) ||
+            intervalSum <= 0) {
+            r.fps = 0;
+            break;
+        }
+        r.fps          += intervalCount * 1e6 / intervalSum;
+        r.iterations   += (uint64_t)intervalCount + 1;
+        r.latencyP50Us  = std::max(r.latencyP50Us, p50);
+        r.latencyP99Us  = std::max(r.latencyP99Us, p99);
+    }
+    if (r.fps <= 0) {
+        fprintf(stderr, "%-32s failed\n", name.c_str());
+        return;
+    }
+
+    r.medianNs = 1e9 / r.fps;
+    r.p99Ns    = r.latencyP99Us * 1e3;
+    r.minNs    = 0;
+    r.pixels   = KinectIrFormat::pixels;
+    results.push_back(r);
+
+    fprintf(stderr, "%-32s %12.1f fps %9.0f us p50 %9.0f us p99\n", name.c_str(), r.fps, r.latencyP50Us,
+            r.latencyP99Us);
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+// results
+// ---------------------------------------------------------------------------------------------------------------------
+
+static void writeJson(std::ostream& os) {
+    const IrKernels kernels = selectIrKernels<0>();
+    os << "{\n  \"kernels\": \"" << kernels.name << "\",\n  \"benchmarks\": [\n";
+    for (size_t i = 0; i < results.size(); ++i) {
+        const BenchResult& r = results[i];
+        char line[512];
+        int  n = snprintf(line, sizeof(line),
+                          "    {\"name\": \"%s\", \"iterations\": %llu, \"median_ns\": %.1f, \"p99_ns\": %.1f, "
+                          "\"min_ns\": %.1f",
+                          r.name.c_str(), (unsigned long long)r.iterations, r.medianNs, r.p99Ns, r.minNs);
+        if (r.fps > 0) {
+            n += snprintf(line + n, sizeof(line) - n, ", \"fps\": %.1f, \"latency_p50_us\": %.1f, "
+                          "\"latency_p99_us\": %.1f", r.fps, r.latencyP50Us, r.latencyP99Us);
+        } else if (r.pixels > 0) {
+            n += snprintf(line + n, sizeof(line) - n, ", \"mpix_per_s\": %.1f", r.pixels * 1e3 / r.medianNs);
+        }
+        os << line << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    os << "  ]\n}\n";
+}
+
+// Reads the name and median of every benchmark line of a previous result.
+static bool readBaseline(const std::string& path, std::map<std::string, double>& medians) {
+    std::ifstream in(path);
+    if (!in) {
+        std::cerr << "failed to open baseline " << path << std::endl;
+        return false;
+    }
+    std::string line;
+    while (std::getline(in, line)) {
+        const size_t name   = line.find("\"name\": \"");
+        const size_t median = line.find("\"median_ns\": ");
+        if (name == std::string::npos || median == std::string::npos) continue;
+        const size_t start = name + 9;
+        const size_t end   = line.find('"', start);
+        if (end == std::string::npos) continue;
+        medians[line.substr(start, end - start)] = strtod(line.c_str() + median + 13, nullptr);
+    }
+    return true;
+}
+
+// Number of benchmarks more than thresholdPct slower than in the baseline.
+static int compareBaseline(const std::map<std::string, double>& baseline, double thresholdPct) {
+    int regressions = 0;
+    for (const BenchResult& r : results) {
+        auto it = baseline.find(r.name);
+        if (it == baseline.end() || it->second <= 0) continue;
+        const double change = (r.medianNs / it->second - 1.0) * 100.0;
+        if (change > thresholdPct) {
+            fprintf(stderr, "REGRESSION %-32s %12.0f ns -> %12.0f ns (%+.1f%%)\n", r.name.c_str(), it->second,
+                    r.medianNs, change);
+            regressions++;
+        }
+    }
+    fprintf(stderr, "%d of %zu benchmarks regressed by more than %.1f%%\n", regressions, results.size(),
+            thresholdPct);
+    return regressions;
+}
+
+static void usage(const char* argv0) {
+    fprintf(stderr,
+            "usage: %s [--filter substring] [--min-time ms] [--sink path] [--e2e-frames n] [--no-e2e]\n"
+            "          [--packets recording] [--json path] [--baseline path] [--threshold percent]\n", argv0);
+}
+
+int main(int argc, char** argv) {
+    std::string jsonPath;
+    std::string baselinePath;
+    double      thresholdPct = BENCH_THRESHOLD_PCT;
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc) {
+            options.filter = argv[++i];
+        } else if (strcmp(argv[i], "--min-time") == 0 && i + 1 < argc) {
+            options.minTimeMs = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--sink") == 0 && i + 1 < argc) {
+            options.sink = argv[++i];
+        } else if (strcmp(argv[i], "--e2e-frames") == 0 && i + 1 < argc) {
+            options.e2eFrames = strtoull(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "--no-e2e") == 0) {
+            options.e2e = false;
+        } else if (strcmp(argv[i], "--packets") == 0 && i + 1 < argc) {
+            options.packets = argv[++i];
+        } else if (strcmp(argv[i], "--json") == 0 && i + 1 < argc) {
+            jsonPath = argv[++i];
+        } else if (strcmp(argv[i], "--baseline") == 0 && i + 1 < argc) {
+            baselinePath = argv[++i];
+        } else if (strcmp(argv[i], "--threshold") == 0 && i + 1 < argc) {
+            thresholdPct = strtod(argv[++i], nullptr);
+        } else {
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    if (options.minTimeMs <= 0 || options.e2eFrames == 0 || !(thresholdPct >= 0)) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    std::map<std::string, double> baseline;
+    if (!baselinePath.empty() && !readBaseline(baselinePath, baseline)) return 2;
+
+    const std::vector<float> frame = testFrame();
+    benchKernels(frame);
+    benchToneMapping(frame);
+    benchChangeDetector(frame);
+    benchScaler(frame);
+    benchRecording(frame);
+    const bool decoded = benchDecoder();
+    benchCapture(frame);
+    benchBackup();
+    const bool scaled = benchBackupScaler();
+    benchMjpeg();
+    benchOutput();
+    if (options.e2e) {
+        benchEndToEnd(V4L2_PIX_FMT_YUV420, "yuv420", TONE_FIXED, "fixed");
+        benchEndToEnd(V4L2_PIX_FMT_YUV420, "yuv420", TONE_CLAHE, "clahe");
+        benchEndToEnd(V4L2_PIX_FMT_GREY, "grey", TONE_FIXED, "fixed");
+        benchEndToEnd(V4L2_PIX_FMT_Y16, "y16", TONE_FIXED, "fixed");
+        for (size_t devices : {1, 2, 4}) benchDevices(devices);
+    }
+
+    if (jsonPath.empty()) {
+        writeJson(std::cout);
+    } else {
+        std::ofstream out(jsonPath);
+        writeJson(out);
+        if (!out) {
+            std::cerr << "failed to write " << jsonPath << std::endl;
+            return 2;
+        }
+    }
+
+    if (!baselinePath.empty() && compareBaseline(baseline, thresholdPct) > 0) return 1;
+    return decoded && scaled ? 0 : 1;
+}
@@ -0,0 +1,196 @@
+#define _GNU_SOURCE
+#include "kinect2pipe_shm.h"
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/* a daemon that died without closing is noticed by its socket hanging up, looked at this often while waiting */
+#define K2P_SHM_LIVENESS_MS 250
+
+struct k2p_shm {
+    int                          sock;
+    size_t                       map_bytes;
+    const struct k2p_shm_header* header;
+};
+
+static uint64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+/* the daemon only ever sends the descriptor, so anything readable on the socket is its end */
+static int publisher_gone(const k2p_shm* shm) {
+    struct pollfd pfd = {shm->sock, POLLIN, 0};
+    if (poll(&pfd, 1, 0) <= 0) return 0;
+    return (pfd.revents & (POLLIN | POLLHUP | POLLERR)) != 0;
+}
+
+static int receive_fd(int sock) {
+    char         byte;
+    struct iovec iov = {&byte, 1};
+    union {
+        struct cmsghdr align;
+        char           buf[CMSG_SPACE(sizeof(int))];
+    } control;
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov        = &iov;
+    msg.msg_iovlen     = 1;
+    msg.msg_control    = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+
+    ssize_t n;
+    do {
+        n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+    } while (n < 0 && errno == EINTR);
+    if (n != 1) {
+        if (n >= 0) errno = EPROTO;
+        return -1;
+    }
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    if (!cmsg || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS ||
+        cmsg->cmsg_len != CMSG_LEN(sizeof(int))) {
+        errno = EPROTO;
+        return -1;
+    }
+    int fd;
+    memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+    return fd;
+}
+
+k2p_shm* k2p_shm_connect(const char* socket_path) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+        errno = ENAMETOOLONG;
+        return NULL;
+    }
+    strncpy(addr.sun_path, socket_path, sizeof(addr.sun_path) - 1);
+
+    k2p_shm* shm = calloc(1, sizeof(*shm));
+    if (!shm) return NULL;
+    shm->sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (shm->sock < 0) {
+        free(shm);
+        return NULL;
+    }
+    int fd = -1;
+    if (connect(shm->sock, (struct sockaddr*)&addr, sizeof(addr)) < 0 || (fd = receive_fd(shm->sock)) < 0) {
+        goto fail;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0) goto fail;
+    if ((size_t)st.st_size < sizeof(struct k2p_shm_header)) {
+        errno = EPROTO;
+        goto fail;
+    }
+    void* map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) goto fail;
+    close(fd);
+    fd = -1;
+    shm->map_bytes = (size_t)st.st_size;
+    shm->header    = map;
+
+    const struct k2p_shm_header* h = shm->header;
+    if (__atomic_load_n(&h->magic, __ATOMIC_ACQUIRE) != K2P_SHM_MAGIC || h->version != K2P_SHM_VERSION ||
+        h->slot_count != K2P_SHM_SLOTS || h->map_bytes > shm->map_bytes) {
+        errno = EPROTO;
+        goto fail;
+    }
+    for (int i = 0; i < K2P_SHM_SLOTS; ++i) {
+        if (h->slots[i].offset + h->frame_bytes > h->map_bytes) {
+            errno = EPROTO;
+            goto fail;
+        }
+    }
+    return shm;
+
+fail:;
+    const int err = errno;
+    if (fd >= 0) close(fd);
+    k2p_shm_close(shm);
+    errno = err;
+    return NULL;
+}
+
+/* Sequence lock reader: the metadata is only taken when the buffer's counter is even and unchanged across the read,
+ * and the buffer still holds the newest frame. */
+static int read_latest(const k2p_shm* shm, uint64_t latest, k2p_shm_frame* frame) {
+    const struct k2p_shm_header* h    = shm->header;
+    const uint32_t               slot = (uint32_t)((latest - 1) % K2P_SHM_SLOTS);
+    const struct k2p_shm_slot*   s    = &h->slots[slot];
+
+    const uint32_t seq = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE);
+    if (seq & 1) return 0;
+    const uint64_t number     = __atomic_load_n(&s->frame, __ATOMIC_RELAXED);
+    const uint64_t capture_us = __atomic_load_n(&s->capture_us, __ATOMIC_RELAXED);
+    const uint32_t sequence   = __atomic_load_n(&s->sequence, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&s->seq, __ATOMIC_RELAXED) != seq || number != latest) return 0;
+
+    frame->data           = (const uint8_t*)h + s->offset;
+    frame->format         = h->format;
+    frame->width          = h->width;
+    frame->height         = h->height;
+    frame->bytes_per_line = h->bytes_per_line;
+    frame->frame          = number;
+    frame->capture_us     = capture_us;
+    frame->sequence       = sequence;
+    frame->slot           = slot;
+    frame->seq            = seq;
+    return 1;
+}
+
+int k2p_shm_wait(k2p_shm* shm, k2p_shm_frame* frame, int timeout_ms) {
+    const struct k2p_shm_header* h        = shm->header;
+    const uint64_t               deadline = timeout_ms >= 0 ? now_ms() + (uint64_t)timeout_ms : 0;
+
+    while (1) {
+        /* read before latest, so a frame published in between makes the futex wait return at once */
+        const uint32_t futex = __atomic_load_n(&h->futex, __ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&h->closed, __ATOMIC_ACQUIRE)) return -1;
+
+        const uint64_t latest = __atomic_load_n(&h->latest, __ATOMIC_ACQUIRE);
+        if (latest > frame->frame) {
+            if (read_latest(shm, latest, frame)) return 1;
+            /* overwritten while it was read: latest has moved on already */
+            continue;
+        }
+
+        int slice = K2P_SHM_LIVENESS_MS;
+        if (timeout_ms >= 0) {
+            const uint64_t now = now_ms();
+            if (now >= deadline) return 0;
+            if (deadline - now < (uint64_t)slice) slice = (int)(deadline - now);
+        }
+        struct timespec ts = {slice / 1000, (long)(slice % 1000) * 1000000};
+        syscall(SYS_futex, &h->futex, FUTEX_WAIT, futex, &ts, NULL, 0);
+        if (publisher_gone(shm)) return -1;
+    }
+}
+
+int k2p_shm_valid(const k2p_shm* shm, const k2p_shm_frame* frame) {
+    if (frame->slot >= K2P_SHM_SLOTS) return 0;
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&shm->header->slots[frame->slot].seq, __ATOMIC_RELAXED) == frame->seq;
+}
+
+void k2p_shm_close(k2p_shm* shm) {
+    if (!shm) return;
+    if (shm->header) munmap((void*)shm->header, shm->map_bytes);
+    if (shm->sock >= 0) close(shm->sock);
+    free(shm);
+}
@@ -0,0 +1,98 @@
+#ifndef kinect2pipe_IR_kinect2pipe_shm_H
+#define kinect2pipe_IR_kinect2pipe_shm_H
+
+/*
+ * Client side of kinect2pipe_IR's shared memory output (--shm), for consumers in other processes that want the IR
+ * frames at full precision and without the round trip through v4l2loopback.
+ *
+ * The daemon keeps the newest frames in a ring of K2P_SHM_SLOTS buffers in a memfd. A client connects to the daemon's
+ * Unix socket, gets the memfd over it and maps it read only; frames are read straight out of the mapping, without any
+ * copy. The daemon counts a connected client as a consumer like one holding the loopback device open, so the Kinect
+ * runs while the client is connected.
+ *
+ * Each buffer is guarded by a sequence lock: its counter is odd while the daemon writes it. A frame handed out by
+ * k2p_shm_wait() stays intact until the daemon comes round to its buffer again, K2P_SHM_SLOTS - 1 frames later (about
+ * 100 ms at 30 fps); k2p_shm_valid() tells afterwards whether it did, in which case whatever was computed from it
+ * should be thrown away. New frames are signalled with a futex, so a waiting client sleeps in the kernel.
+ *
+ *     k2p_shm* shm = k2p_shm_connect("/run/kinect2pipe-frames.sock");
+ *     k2p_shm_frame frame = {0};
+ *     while (k2p_shm_wait(shm, &frame, 1000) >= 0) {
+ *         ... use frame.data ...
+ *         if (!k2p_shm_valid(shm, &frame)) ... the frame was overwritten while in use ...
+ *     }
+ *     k2p_shm_close(shm);
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define K2P_SHM_MAGIC   0x4d48534bu /* "KSHM" */
+#define K2P_SHM_VERSION 1
+#define K2P_SHM_SLOTS   4
+
+/* pixel formats: one float per pixel as libfreenect2 reports it (0 .. 65535), or little endian 16-bit values */
+#define K2P_SHM_FORMAT_FLOAT 0x34465249u /* "IRF4" */
+#define K2P_SHM_FORMAT_Y16   0x20363159u /* "Y16 ", V4L2_PIX_FMT_Y16 */
+
+/* layout of the mapping, written by the daemon only */
+struct k2p_shm_slot {
+    uint32_t seq;          /* sequence lock, odd while the buffer is written */
+    uint32_t sequence;     /* libfreenect2's frame sequence number */
+    uint64_t frame;        /* number of the frame in the buffer, counting from 1 */
+    uint64_t capture_us;   /* CLOCK_MONOTONIC time the frame was captured, in microseconds */
+    uint64_t offset;       /* of the pixels from the start of the mapping */
+};
+
+struct k2p_shm_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t format;          /* K2P_SHM_FORMAT_* */
+    uint32_t width;
+    uint32_t height;
+    uint32_t bytes_per_line;
+    uint32_t frame_bytes;
+    uint32_t slot_count;
+    uint64_t map_bytes;
+    uint64_t latest;          /* number of the newest complete frame, 0 before the first */
+    uint32_t futex;           /* bumped after every frame and when the daemon closes */
+    uint32_t closed;          /* the daemon is gone, no frame will follow */
+    struct k2p_shm_slot slots[K2P_SHM_SLOTS];
+};
+
+typedef struct k2p_shm k2p_shm;
+
+typedef struct {
+    const void* data;         /* the pixels, in the shared mapping */
+    uint32_t    format;
+    uint32_t    width;
+    uint32_t    height;
+    uint32_t    bytes_per_line;
+    uint64_t    frame;        /* frames k2p_shm_wait() skipped are the gaps in this number */
+    uint64_t    capture_us;
+    uint32_t    sequence;
+    uint32_t    slot;         /* for k2p_shm_valid() */
+    uint32_t    seq;
+} k2p_shm_frame;
+
+/* Connects to the daemon's socket and maps its frames. NULL with errno set on failure. */
+k2p_shm* k2p_shm_connect(const char* socket_path);
+
+/* Waits up to timeout_ms (-1 for as long as it takes) for a frame newer than the one in frame, which must be zeroed
+ * before the first call. Returns 1 with the newest frame in frame, 0 on timeout, -1 once the daemon is gone. */
+int k2p_shm_wait(k2p_shm* shm, k2p_shm_frame* frame, int timeout_ms);
+
+/* 1 if the frame hasn't been overwritten since k2p_shm_wait() returned it, 0 if it has */
+int k2p_shm_valid(const k2p_shm* shm, const k2p_shm_frame* frame);
+
+void k2p_shm_close(k2p_shm* shm);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* kinect2pipe_IR_kinect2pipe_shm_H */
@@ -0,0 +1,110 @@
+"""
+Python binding of libkinect2pipe_shm, the client side of kinect2pipe_IR's shared memory output (--shm). See
+kinect2pipe_shm.h for how it works.
+
+Frames come as numpy arrays over the daemon's shared memory, without a copy: float32 (0 .. 65535) or uint16 depending
+on --shm-format. A frame stays intact for about 100 ms at 30 fps; copy it to keep it longer, and check valid() after
+using it when the result matters. A Howdy recorder, for instance:
+
+    import kinect2pipe_shm
+    with kinect2pipe_shm.Frames("/run/kinect2pipe-frames.sock") as frames:
+        while True:
+            frame = frames.wait(1000)
+            if frame is None:
+                continue
+            ir = frame.array()
+            ...
+            if not frames.valid(frame):
+                ...  # overwritten while in use, throw the result away
+
+wait() raises EOFError once the daemon is gone. The library is looked for where ctypes finds libraries, or at
+$KINECT2PIPE_SHM_LIBRARY.
+"""
+
+import ctypes
+import ctypes.util
+import os
+
+K2P_SHM_FORMAT_FLOAT = 0x34465249
+K2P_SHM_FORMAT_Y16 = 0x20363159
+
+
+class Frame(ctypes.Structure):
+    _fields_ = [
+        ("data", ctypes.c_void_p),
+        ("format", ctypes.c_uint32),
+        ("width", ctypes.c_uint32),
+        ("height", ctypes.c_uint32),
+        ("bytes_per_line", ctypes.c_uint32),
+        ("frame", ctypes.c_uint64),
+        ("capture_us", ctypes.c_uint64),
+        ("sequence", ctypes.c_uint32),
+        ("slot", ctypes.c_uint32),
+        ("seq", ctypes.c_uint32),
+    ]
+
+    def array(self):
+        """The pixels as a height x width numpy array over the shared memory, read only."""
+        import numpy
+        dtype = numpy.float32 if self.format == K2P_SHM_FORMAT_FLOAT else numpy.uint16
+        size = self.bytes_per_line * self.height
+        buffer = (ctypes.c_char * size).from_address(self.data)
+        pixels = numpy.frombuffer(buffer, dtype=dtype)
+        pixels = pixels.reshape(self.height, self.bytes_per_line // pixels.itemsize)[:, :self.width]
+        pixels.flags.writeable = False
+        return pixels
+
+
+def _load():
+    path = os.environ.get("KINECT2PIPE_SHM_LIBRARY") or ctypes.util.find_library("kinect2pipe_shm")
+    lib = ctypes.CDLL(path or "libkinect2pipe_shm.so", use_errno=True)
+    lib.k2p_shm_connect.restype = ctypes.c_void_p
+    lib.k2p_shm_connect.argtypes = [ctypes.c_char_p]
+    lib.k2p_shm_wait.restype = ctypes.c_int
+    lib.k2p_shm_wait.argtypes = [ctypes.c_void_p, ctypes.POINTER(Frame), ctypes.c_int]
+    lib.k2p_shm_valid.restype = ctypes.c_int
+    lib.k2p_shm_valid.argtypes = [ctypes.c_void_p, ctypes.POINTER(Frame)]
+    lib.k2p_shm_close.restype = None
+    lib.k2p_shm_close.argtypes = [ctypes.c_void_p]
+    return lib
+
+
+class Frames:
+    """A connection to the daemon, which runs the Kinect while it is open."""
+
+    def __init__(self, socket_path):
+        self._lib = _load()
+        self._shm = self._lib.k2p_shm_connect(os.fsencode(socket_path))
+        if not self._shm:
+            err = ctypes.get_errno()
+            raise OSError(err, os.strerror(err), socket_path)
+        self._last = Frame()
+
+    def wait(self, timeout_ms=-1):
+        """The newest frame, once there is one newer than the last returned; None on timeout."""
+        frame = Frame.from_buffer_copy(self._last)
+        r = self._lib.k2p_shm_wait(self._shm, ctypes.byref(frame), timeout_ms)
+        if r < 0:
+            raise EOFError("kinect2pipe_IR is gone")
+        if r == 0:
+            return None
+        self._last = frame
+        return frame
+
+    def valid(self, frame):
+        """Whether frame hasn't been overwritten since wait() returned it."""
+        return self._lib.k2p_shm_valid(self._shm, ctypes.byref(frame)) == 1
+
+    def close(self):
+        if self._shm:
+            self._lib.k2p_shm_close(self._shm)
+            self._shm = None
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *exc):
+        self.close()
+
+    def __del__(self):
+        self.close()
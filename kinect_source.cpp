@@ -0,0 +1,212 @@
+#include "kinect_source.h"
+#include <iostream>
+#include <cerrno>
+#include <cstring>
+#include <libfreenect2/packet_pipeline.h> // For CPU pipeline instead of OpenGL, which isn't available pre login
+#ifdef KINECT2PIPE_IR_PIPELINE
+#include "ir_packet_pipeline.h"
+#endif
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <unistd.h>
+
+using namespace std;
+using namespace libfreenect2;
+
+KinectFrameListener::KinectFrameListener() {
+    this->pending       = nullptr;
+    this->eventFd       = -1;
+    this->replacedCount = 0;
+}
+
+KinectFrameListener::~KinectFrameListener() {
+    delete this->pending;
+    if (this->eventFd >= 0) close(this->eventFd);
+}
+
+bool KinectFrameListener::open() {
+    if (this->eventFd >= 0) return true;
+    this->eventFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (this->eventFd < 0) {
+        cerr << "failed to create kinect2 frame eventfd: " << strerror(errno) << endl;
+        return false;
+    }
+    return true;
+}
+
+bool KinectFrameListener::onNewFrame(Frame::Type type, Frame* frame) {
+    if (type != Frame::Ir) return false;
+    {
+        lock_guard<std::mutex> lk(this->mutex);
+        if (this->pending) {
+            delete this->pending;
+            this->replacedCount++;
+        }
+        this->pending = frame;
+    }
+    uint64_t one = 1;
+    if (write(this->eventFd, &one, sizeof(one)) < 0) {}
+    return true;
+}
+
+Frame* KinectFrameListener::take() {
+    uint64_t count;
+    if (read(this->eventFd, &count, sizeof(count)) < 0) {}
+    lock_guard<std::mutex> lk(this->mutex);
+    Frame* frame  = this->pending;
+    this->pending = nullptr;
+    return frame;
+}
+
+KinectSource::KinectSource(bool hwAccel, const std::string& serial, KinectContext* context) {
+    if (!context) {
+        this->ownContext.reset(new KinectContext());
+        context = this->ownContext.get();
+    }
+    this->context       = context;
+    this->serial        = serial;
+    this->held          = nullptr;
+    this->dev           = nullptr;
+    this->hwAccel       = hwAccel;
+    this->irOnly        = true;
+    this->decodeThreads = 0;
+    this->prepared      = false;
+    this->streaming     = false;
+}
+
+KinectSource::~KinectSource() {
+    this->stop();
+    this->closeDevice();
+    delete this->held;
+}
+
+bool KinectSource::prepare() {
+    if (this->dev) {
+        this->prepared = true;
+        return true;
+    }
+    if (!this->openDevice()) return false;
+    this->prepared = true;
+    cout << "kinect2 opened, on standby" << endl;
+    return true;
+}
+
+// Finds the Kinect and opens it with the packet pipeline we want, without starting any stream.
+bool KinectSource::openDevice() {
+    if (!this->listener.open()) {
+        return false;
+    }
+    lock_guard<std::mutex> lk(this->context->mutex);
+    Freenect2& freenect2 = this->context->freenect2;
+    if (freenect2.enumerateDevices() == 0) {
+        cerr << "unable to find a kinect2 device to connect to" << endl;
+        return false;
+    }
+
+    // On some systems we can't rely on a GPU/OpenGL pipeline until a
+    // graphical session exists, so the default behaviour is to force the CPU
+    // packet pipeline.  When the --hwaccel flag is supplied we skip this
+    // and let libfreenect2 choose whatever pipeline it prefers.
+    PacketPipeline* pipeline = nullptr;
+#ifdef KINECT2PIPE_IR_PIPELINE
+    // we only ever need IR, so the depth math the CPU pipeline does for every packet can be skipped as well
+    if (!this->hwAccel && this->irOnly) {
+        pipeline = new IrPacketPipeline(this->decodeThreads, this->packetRecordPath);
+    }
+#else
+    if (!this->packetRecordPath.empty()) {
+        cerr << "recording packets needs the IR-only packet pipeline, which this build doesn't have" << endl;
+    }
+#endif
+    if (!this->hwAccel && !pipeline) {
+        pipeline = new CpuPacketPipeline();
+    }
+
+    std::string serial = this->serial.empty() ? freenect2.getDefaultDeviceSerialNumber() : this->serial;
+
+    if (this->hwAccel) {
+        // overload without pipeline pointer
+        this->dev = freenect2.openDevice(serial);
+    } else {
+        this->dev = freenect2.openDevice(serial, pipeline);
+    }
+
+    if (!this->dev) {
+        cerr << "failed to open kinect2 device " << serial << endl;
+        delete pipeline; // harmless if null
+        return false;
+    }
+
+    this->dev->setIrAndDepthFrameListener(&this->listener);
+    return true;
+}
+
+bool KinectSource::start() {
+    if (!this->dev && !this->openDevice()) {
+        return false;
+    }
+
+    // a frame left over from the previous session is no use to this one
+    delete this->listener.take();
+
+    if (!this->dev->startStreams(false, true)) {
+        cerr << "unable to start kinect2 ir stream" << endl;
+        this->closeDevice();
+        return false;
+    }
+
+    this->streaming = true;
+    cout << "kinect2 IR stream started" << endl;
+    return true;
+}
+
+void KinectSource::stop() {
+    if (!this->dev || !this->streaming) return;
+
+    cout << "stopping kinect2 IR stream" << endl;
+    this->streaming = false;
+    try {
+        this->dev->stop();
+    } catch (...) {
+        cerr << "kinect2 cleanup caught exception" << endl;
+        this->closeDevice();
+        return;
+    }
+    // a prepared device stays open for the next start()
+    if (!this->prepared) this->closeDevice();
+}
+
+void KinectSource::closeDevice() {
+    if (!this->dev) return;
+    lock_guard<std::mutex> lk(this->context->mutex);
+    try {
+        this->dev->close();
+    } catch (...) {
+        cerr << "kinect2 cleanup caught exception" << endl;
+    }
+    this->dev = nullptr;
+}
+
+FrameSource::ReadResult KinectSource::read(SourceFrame& frame, int timeoutMs) {
+    Frame* ir = this->listener.take();
+    if (!ir && timeoutMs > 0) {
+        struct pollfd pfd = {this->listener.fd(), POLLIN, 0};
+        if (poll(&pfd, 1, timeoutMs) > 0) ir = this->listener.take();
+    }
+    if (!ir) {
+        return READ_TIMEOUT;
+    }
+
+    this->held      = ir;
+    frame.data      = ir->data;
+    frame.bytes     = KinectIrFormat::frameSize;
+    frame.sequence  = ir->sequence;
+    frame.timestamp = ir->timestamp;
+    return READ_FRAME;
+}
+
+bool KinectSource::release() {
+    delete this->held;
+    this->held = nullptr;
+    return true;
+}
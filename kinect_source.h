@@ -0,0 +1,103 @@
+#ifndef kinect2pipe_IR_kinect_source_H
+#define kinect2pipe_IR_kinect_source_H
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <libfreenect2/libfreenect2.hpp>
+#include "frame_source.h"
+
+// rate the Kinect delivers IR frames at
+#define KINECT2_IR_FPS 30.0
+
+/**
+ * Takes the IR frames libfreenect2 decodes on its own thread and signals each one on an eventfd, so the capture loop
+ * can wait for frames in the same epoll set as everything else. Only the newest frame is kept: one that arrives
+ * before the previous one was taken replaces it, like libfreenect2's own SyncMultiFrameListener does.
+ */
+class KinectFrameListener : public libfreenect2::FrameListener {
+public:
+    KinectFrameListener();
+    ~KinectFrameListener();
+
+    bool open();
+    int  fd() const { return this->eventFd; }
+
+    // libfreenect2's thread: keeps IR frames, leaves every other type to libfreenect2
+    bool onNewFrame(libfreenect2::Frame::Type type, libfreenect2::Frame* frame);
+
+    // the newest frame, owned by the caller from now on, or nullptr
+    libfreenect2::Frame* take();
+    // frames that arrived while the previous one was still waiting
+    uint64_t replaced() const { return this->replacedCount; }
+
+private:
+    std::mutex           mutex;
+    libfreenect2::Frame* pending;
+    int                  eventFd;
+    uint64_t             replacedCount;
+};
+
+/**
+ * A libfreenect2 context several KinectSources can share, so the USB transfers of every Kinect in the process are
+ * handled by a single libusb event thread. libfreenect2 doesn't lock its device list: the mutex is held while devices
+ * are enumerated, opened and closed.
+ */
+struct KinectContext {
+    libfreenect2::Freenect2 freenect2;
+    std::mutex              mutex;
+};
+
+/**
+ * IR stream of the Kinect 2, through libfreenect2. Frames are KinectIrFormat and stay in the Frame libfreenect2
+ * decoded them into until they are released.
+ *
+ * prepare() enumerates the devices, builds the packet pipeline and opens the Kinect without starting its streams, so
+ * the emitter stays off. After that start() and stop() only start and stop the IR stream; the device is closed when
+ * the source is destroyed.
+ */
+class KinectSource : public FrameSource {
+public:
+    // hwAccel lets libfreenect2 pick its preferred (OpenGL / OpenCL) packet pipeline instead of the CPU one. serial
+    // picks one of several Kinects, empty for the first one found; without a context the source has one of its own.
+    explicit KinectSource(bool hwAccel, const std::string& serial = "", KinectContext* context = nullptr);
+    ~KinectSource();
+
+    // Without hardware acceleration, decode only the IR image with decodeThreads threads (0 for one per core) instead
+    // of running libfreenect2's whole CPU depth processor, where that was built in. Given a path, the first packets
+    // are recorded there. Both must be set before prepare() or start().
+    void setIrDecoder(bool irOnly, int decodeThreads) { this->irOnly = irOnly; this->decodeThreads = decodeThreads; }
+    void setPacketRecording(const std::string& path) { this->packetRecordPath = path; }
+
+    const char* name() const { return "kinect2"; }
+
+    bool prepare();
+    bool start();
+    void stop();
+
+    const FrameFormat& format() const { return KinectIrFormat::format; }
+    double             fps() const { return KINECT2_IR_FPS; }
+
+    int        pollFd() const { return this->listener.fd(); }
+    ReadResult read(SourceFrame& frame, int timeoutMs);
+    bool       release();
+
+private:
+    std::unique_ptr<KinectContext>       ownContext;
+    KinectContext*                       context;
+    std::string                          serial;
+    KinectFrameListener                  listener;
+    libfreenect2::Frame*                 held;       // handed out by read() until release()
+    libfreenect2::Freenect2Device*       dev;
+    bool                                 hwAccel;
+    bool                                 irOnly;
+    int                                  decodeThreads;
+    std::string                          packetRecordPath;
+    bool                                 prepared;   // keep the device open when the stream stops
+    bool                                 streaming;
+
+    bool openDevice();
+    void closeDevice();
+};
+
+#endif // kinect2pipe_IR_kinect_source_H
@@ -0,0 +1,266 @@
+#include "loopback_output.h"
+#include <iostream>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <linux/videodev2.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <poll.h>
+
+using namespace std;
+
+LoopbackOutput::LoopbackOutput() {
+    this->device     = -1;
+    this->outputMode = MODE_WRITE;
+    this->fileSink   = false;
+    this->frameLen   = 0;
+    this->reserved   = nullptr;
+    this->ringSlots  = 0;
+}
+
+LoopbackOutput::~LoopbackOutput() {
+    this->close();
+}
+
+bool LoopbackOutput::open(const char* path) {
+    struct stat st{};
+    if (stat(path, &st) < 0 || S_ISREG(st.st_mode)) {
+        this->device = ::open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (this->device < 0) {
+            cerr << "failed to open output file " << path << ": " << strerror(errno) << endl;
+            return false;
+        }
+        this->fileSink = true;
+        cout << "writing frames to file " << path << endl;
+        return true;
+    }
+
+    // read access is needed as well, mmap() refuses write-only descriptors. Non-blocking so a consumer that stops
+    // draining the device shows up as EAGAIN instead of stalling the writer.
+    this->device = ::open(path, O_RDWR | O_NONBLOCK);
+    if (this->device < 0) {
+        cerr << "failed to open v4l2loopback device: " << errno << endl;
+        return false;
+    }
+
+    struct v4l2_capability cap{};
+    this->fileSink = ioctl(this->device, VIDIOC_QUERYCAP, &cap) < 0;
+    if (this->fileSink) {
+        cout << path << " is not a V4L2 device, writing frames to it as a file" << endl;
+    }
+    return true;
+}
+
+// v4l2loopback doesn't fail while a reader holds the format: it hands back the format in use and returns 0
+static bool formatKept(const struct v4l2_format& fmt, const FrameFormat& format, size_t frameLen) {
+    return fmt.fmt.pix.width != (uint32_t)format.width || fmt.fmt.pix.height != (uint32_t)format.height ||
+           fmt.fmt.pix.pixelformat != format.fourcc || fmt.fmt.pix.sizeimage != frameLen;
+}
+
+bool LoopbackOutput::setFormat(const FrameFormat& format) {
+    const size_t frameLen = format.frameSize();
+
+    if (!this->fileSink) {
+        struct v4l2_format fmt{};
+        fmt.type                 = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+        fmt.fmt.pix.width        = format.width;
+        fmt.fmt.pix.height       = format.height;
+        fmt.fmt.pix.pixelformat  = format.fourcc;
+        fmt.fmt.pix.sizeimage    = frameLen;
+        fmt.fmt.pix.field        = V4L2_FIELD_NONE;
+        fmt.fmt.pix.bytesperline = format.bytesPerLine[0];
+        fmt.fmt.pix.colorspace   = V4L2_COLORSPACE_SRGB;
+
+        // tried first, so a format the driver won't take leaves the current one and its buffers alone
+        struct v4l2_format tried = fmt;
+        if (ioctl(this->device, VIDIOC_TRY_FMT, &tried) < 0) {
+            cerr << "failed to issue ioctl to v4l2loopback device: " << errno << endl;
+            return false;
+        }
+        if (formatKept(tried, format, frameLen)) {
+            cerr << "v4l2loopback device kept its format (" << tried.fmt.pix.width << "x" << tried.fmt.pix.height
+                 << ", " << tried.fmt.pix.sizeimage << " bytes)" << endl;
+            return false;
+        }
+
+        // the driver refuses format changes while buffers are allocated
+        this->stopStreaming();
+        if (ioctl(this->device, VIDIOC_S_FMT, &fmt) < 0 || formatKept(fmt, format, frameLen)) {
+            cerr << "v4l2loopback device refused the format after trying it" << endl;
+            // the previous format is still the device's, now in write mode
+            if (!this->reserved) this->reserved = (uint8_t*)calloc(1, this->frameLen);
+            return false;
+        }
+    }
+
+    free(this->reserved);
+    this->frameLen = frameLen;
+    this->reserved = (uint8_t*)calloc(1, frameLen);
+    return true;
+}
+
+bool LoopbackOutput::enableStreaming(unsigned slotCount) {
+    if (this->fileSink) return false;
+
+    struct v4l2_requestbuffers req{};
+    req.count  = slotCount + 1;
+    req.type   = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+    req.memory = V4L2_MEMORY_MMAP;
+    if (ioctl(this->device, VIDIOC_REQBUFS, &req) < 0) {
+        cerr << "v4l2loopback device does not support streaming output (" << strerror(errno)
+             << "), falling back to write()" << endl;
+        return false;
+    }
+    if (req.count < slotCount + 1) {
+        cerr << "v4l2loopback device only provides " << req.count << " buffers, " << slotCount + 1
+             << " are needed for streaming output (raise max_buffers), falling back to write()" << endl;
+        req.count = 0;
+        ioctl(this->device, VIDIOC_REQBUFS, &req);
+        return false;
+    }
+
+    for (unsigned i = 0; i < req.count; i++) {
+        struct v4l2_buffer buf{};
+        buf.type   = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+        buf.memory = V4L2_MEMORY_MMAP;
+        buf.index  = i;
+        if (ioctl(this->device, VIDIOC_QUERYBUF, &buf) < 0 || buf.length < this->frameLen) {
+            cerr << "v4l2loopback device: unusable output buffer " << i << ", falling back to write()" << endl;
+            this->unmapAll();
+            return false;
+        }
+        void* start = mmap(nullptr, buf.length, PROT_READ | PROT_WRITE, MAP_SHARED, this->device, buf.m.offset);
+        if (start == MAP_FAILED) {
+            cerr << "v4l2loopback device: mmap failed: " << strerror(errno) << ", falling back to write()" << endl;
+            this->unmapAll();
+            return false;
+        }
+        this->mapped.push_back(MappedBuffer{(uint8_t*)start, buf.length});
+    }
+
+    enum v4l2_buf_type btype = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+    if (ioctl(this->device, VIDIOC_STREAMON, &btype) < 0) {
+        cerr << "v4l2loopback device: VIDIOC_STREAMON failed: " << strerror(errno) << ", falling back to write()"
+             << endl;
+        this->unmapAll();
+        return false;
+    }
+
+    free(this->reserved);
+    this->ringSlots  = slotCount;
+    this->reserved   = this->mapped[slotCount].start;
+    this->outputMode = MODE_MMAP;
+    return true;
+}
+
+void LoopbackOutput::unmapAll() {
+    for (auto& m : this->mapped) munmap(m.start, m.length);
+    this->mapped.clear();
+
+    struct v4l2_requestbuffers req{};
+    req.count  = 0;
+    req.type   = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+    req.memory = V4L2_MEMORY_MMAP;
+    ioctl(this->device, VIDIOC_REQBUFS, &req);
+}
+
+void LoopbackOutput::stopStreaming() {
+    if (this->outputMode != MODE_MMAP) return;
+
+    enum v4l2_buf_type btype = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+    ioctl(this->device, VIDIOC_STREAMOFF, &btype);
+    this->unmapAll();
+    this->reserved   = nullptr;
+    this->ringSlots  = 0;
+    this->outputMode = MODE_WRITE;
+}
+
+void LoopbackOutput::close() {
+    if (this->device < 0) return;
+
+    this->stopStreaming();
+    free(this->reserved);
+    this->reserved = nullptr;
+
+    ::close(this->device);
+    this->device = -1;
+}
+
+std::vector<uint8_t*> LoopbackOutput::slotBuffers() const {
+    std::vector<uint8_t*> buffers;
+    if (this->outputMode == MODE_MMAP) {
+        for (unsigned i = 0; i < this->ringSlots; i++) buffers.push_back(this->mapped[i].start);
+    }
+    return buffers;
+}
+
+bool LoopbackOutput::queueBuffer(unsigned index) {
+    struct v4l2_buffer buf{};
+    buf.type      = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+    buf.memory    = V4L2_MEMORY_MMAP;
+    buf.index     = index;
+    buf.bytesused = this->frameLen;
+    buf.field     = V4L2_FIELD_NONE;
+    return ioctl(this->device, VIDIOC_QBUF, &buf) == 0;
+}
+
+// The next buffer the driver is done with; held is set if there was none yet and it had to be waited for.
+int LoopbackOutput::dequeueBuffer(bool& held) {
+    struct v4l2_buffer buf{};
+    buf.type   = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+    buf.memory = V4L2_MEMORY_MMAP;
+    while (ioctl(this->device, VIDIOC_DQBUF, &buf) < 0) {
+        if (errno == EINTR) continue;
+        if (errno != EAGAIN) return -1;
+        // nothing done yet, wait for the driver like a blocking descriptor would
+        held = true;
+        struct pollfd pfd{this->device, POLLOUT, 0};
+        if (poll(&pfd, 1, -1) < 0 && errno != EINTR) return -1;
+    }
+    return (int)buf.index;
+}
+
+LoopbackOutput::SubmitResult LoopbackOutput::writeFrame(const uint8_t* data, size_t length) {
+    if (write(this->device, data, length) > 0) return SUBMIT_OK;
+    return errno == EAGAIN ? SUBMIT_BUSY : SUBMIT_FAILED;
+}
+
+LoopbackOutput::SubmitResult LoopbackOutput::submitSlot(int index, const uint8_t* data, int& doneIndex) {
+    if (this->outputMode == MODE_WRITE) {
+        doneIndex = index;
+        return this->writeFrame(data, this->frameLen);
+    }
+
+    // Every queued buffer is dequeued again right away, so the kernel never holds on to a ring slot between frames
+    // and the ring never has to account for more than the one slot being submitted.
+    if (!this->queueBuffer((unsigned)index)) {
+        doneIndex = index;
+        return errno == EAGAIN ? SUBMIT_BUSY : SUBMIT_FAILED;
+    }
+    int  done;
+    bool held = false;
+    do {
+        done = this->dequeueBuffer(held);
+        if (done < 0) return SUBMIT_FAILED;
+    } while (done >= (int)this->ringSlots); // a stray reserved buffer, keep going until we get a ring slot back
+    doneIndex = done;
+    return held ? SUBMIT_HELD : SUBMIT_OK;
+}
+
+LoopbackOutput::SubmitResult LoopbackOutput::submitFrameBuffer() {
+    if (this->outputMode == MODE_WRITE) {
+        return this->writeFrame(this->reserved, this->frameLen);
+    }
+    if (!this->queueBuffer(this->ringSlots)) return errno == EAGAIN ? SUBMIT_BUSY : SUBMIT_FAILED;
+    bool held = false;
+    if (this->dequeueBuffer(held) < 0) return SUBMIT_FAILED;
+    return held ? SUBMIT_HELD : SUBMIT_OK;
+}
+
+LoopbackOutput::SubmitResult LoopbackOutput::writeExternal(const uint8_t* data, size_t length) {
+    return this->writeFrame(data, length);
+}
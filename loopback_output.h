@@ -0,0 +1,90 @@
+#ifndef kinect2pipe_IR_loopback_output_H
+#define kinect2pipe_IR_loopback_output_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "frame_format.h"
+
+/**
+ * Output side of the v4l2loopback device.
+ *
+ * In streaming mode the device's own MMAP buffers are used: the first slotCount of them back the pipeline's output
+ * FrameRing so the converter renders straight into memory shared with the kernel, and one extra buffer is reserved
+ * for frames produced outside the pipeline (blank frames, the backup device). Frames are handed over with
+ * VIDIOC_QBUF / VIDIOC_DQBUF instead of being copied by write().
+ *
+ * Loopback versions without streaming output support stay in write mode, where the ring owns ordinary memory and
+ * every frame goes through write() as before.
+ *
+ * A path that isn't a V4L2 device (a regular file, /dev/null) is a plain file sink: frames are appended to it in write
+ * mode, which is enough to measure the pipeline without a loopback device.
+ */
+class LoopbackOutput {
+public:
+    enum Mode { MODE_WRITE, MODE_MMAP };
+
+    // SUBMIT_BUSY: the device refused the frame for now (EAGAIN), it is dropped and the caller may carry on.
+    // SUBMIT_HELD: streaming mode only, the frame went out but the driver was still holding every buffer queued
+    // before it and had to be waited for. Both mean the consumer isn't keeping up.
+    //
+    // v4l2loopback itself hands output buffers straight back, so against it only write() mode ever pushes back.
+    enum SubmitResult { SUBMIT_OK, SUBMIT_HELD, SUBMIT_BUSY, SUBMIT_FAILED };
+
+    LoopbackOutput();
+    ~LoopbackOutput();
+
+    LoopbackOutput(const LoopbackOutput&) = delete;
+    LoopbackOutput& operator=(const LoopbackOutput&) = delete;
+
+    bool open(const char* path);
+    // Sets the output format, every frame being format.frameSize() bytes. Leaves streaming mode, which unmaps the
+    // buffers previously returned by slotBuffers() and frameBuffer(). False if the driver refused the format or kept
+    // a different one, e.g. the one a reader holds; the format is negotiated before anything is released, so the
+    // previous format and its buffers are kept then. Only if the driver fails once streaming was left does the
+    // previous format go on in write mode.
+    bool setFormat(const FrameFormat& format);
+    // switches to streaming mode with slotCount ring buffers plus the reserved one. Returns false and stays in write
+    // mode if the driver does not support it or hands out too few buffers.
+    bool enableStreaming(unsigned slotCount);
+    void close();
+
+    Mode   mode() const { return this->outputMode; }
+    bool   isFile() const { return this->fileSink; }
+    int    fd() const { return this->device; }
+    size_t frameLength() const { return this->frameLen; }
+
+    // buffers that must back the output FrameRing in streaming mode, empty in write mode
+    std::vector<uint8_t*> slotBuffers() const;
+
+    // Submits ring slot index, whose memory is data. Unless it fails doneIndex receives the slot the kernel has
+    // finished with and that can go back to the ring (always index itself in write mode).
+    SubmitResult submitSlot(int index, const uint8_t* data, int& doneIndex);
+
+    // reserved frame for writers outside the pipeline, and its submission
+    uint8_t*     frameBuffer() { return this->reserved; }
+    SubmitResult submitFrameBuffer();
+
+    // writes a complete frame that lives in someone else's memory, e.g. a mapped capture buffer, with a single copy
+    // into the kernel. Only valid in write mode.
+    SubmitResult writeExternal(const uint8_t* data, size_t length);
+
+private:
+    struct MappedBuffer { uint8_t* start; size_t length; };
+
+    int                       device;
+    Mode                      outputMode;
+    bool                      fileSink;
+    size_t                    frameLen;
+    uint8_t*                  reserved;      // last mapped buffer in streaming mode, malloc'd in write mode
+    unsigned                  ringSlots;
+    std::vector<MappedBuffer> mapped;
+
+    SubmitResult writeFrame(const uint8_t* data, size_t length);
+    bool queueBuffer(unsigned index);
+    int  dequeueBuffer(bool& held);
+    void unmapAll();
+    void stopStreaming();
+};
+
+#endif // kinect2pipe_IR_loopback_output_H
@@ -1,40 +1,301 @@
 #include "kinect2pipe_IR.h"
+#include "device_server.h"
 #include <vector>
 #include <cstring>
 
 /**
  * Main is the entry point for the application. It takes a required argument which is the path to the v4l2loopback
- * device to write to, and an optional second argument which is the path to a backup V4L2 capture device used when
- * the Kinect 2 is unavailable.
+ * device (or a plain file) to write to, and an optional second argument which is the path to a backup V4L2 capture
+ * device used when the Kinect 2 is unavailable. With --devices the Kinects and loopback devices are listed in a
+ * configuration file instead, and served together by a DeviceServer.
  * @param argc Number of command line arguments.
  * @param argv Command line arguments.
  * @return Exit status
  */
 int main(int argc, char** argv) {
     bool hwaccel = false;
+    bool fullDepth = false;
+    int decodeThreads = 0;
+    int backupThreads = 0;
+    const char* recordPackets = nullptr;
+    bool swscale = false;
+    bool streaming = true;
+    bool passthrough = true;
+    bool backupHot = false;
+    bool backupMjpeg = false;
+    uint32_t format = V4L2_PIX_FMT_YUV420;
+    ToneMode tone = TONE_FIXED;
+    float gamma = 2.2f;
+    int crop[4] = {0, 0, KinectIrFormat::width, KinectIrFormat::height};
+    int size[2] = {0, 0};
+    double maxFps = 0.0;
+    double staticPct = 0.0;
+    double keepAliveFps = CHANGE_KEEPALIVE_FPS;
+    const char* statsSocket = nullptr;
+    const char* statsFile = nullptr;
+    const char* shmSocket = nullptr;
+    uint32_t shmFormat = K2P_SHM_FORMAT_FLOAT;
+    const char* source = "kinect";
+    double sourceFps = KINECT2_IR_FPS;
+    unsigned long long frameLimit = 0;
+    const char* replay = nullptr;
+    bool replayFast = false;
+    const char* record = nullptr;
+    bool recordCompress = false;
+    bool standby = false;
+    RealtimeProfile realtime;
+    bool realtimePinned = false;
+    const char* devices = nullptr;
     std::vector<char*> positional;
 
-    for (int i = 1; i < argc; ++i) {
+    int i = 1;
+    // whether argv[i] is the option name, which has to be followed by its value
+    auto withValue = [&](const char* name) {
+        if (strcmp(argv[i], name) != 0) return false;
+        if (i + 1 >= argc) {
+            printf("missing value for %s\n", name);
+            exit(-1);
+        }
+        return true;
+    };
+    for (; i < argc; ++i) {
         if (strcmp(argv[i], "--hwaccel") == 0) {
             hwaccel = true;
+        } else if (strcmp(argv[i], "--full-depth") == 0) {
+            fullDepth = true;
+        } else if (withValue("--decode-threads")) {
+            decodeThreads = atoi(argv[++i]);
+            if (decodeThreads < 0) {
+                printf("invalid thread count: %s\n", argv[i]);
+                exit(-1);
+            }
+        } else if (withValue("--record-packets")) {
+            recordPackets = argv[++i];
+        } else if (strcmp(argv[i], "--swscale") == 0) {
+            swscale = true;
+        } else if (strcmp(argv[i], "--write-output") == 0) {
+            streaming = false;
+        } else if (strcmp(argv[i], "--backup-scale") == 0) {
+            passthrough = false;
+        } else if (strcmp(argv[i], "--backup-hot") == 0) {
+            backupHot = true;
+        } else if (strcmp(argv[i], "--backup-mjpeg") == 0) {
+            backupMjpeg = true;
+        } else if (withValue("--backup-threads")) {
+            backupThreads = atoi(argv[++i]);
+            if (backupThreads < 0) {
+                printf("invalid thread count: %s\n", argv[i]);
+                exit(-1);
+            }
+        } else if (withValue("--format")) {
+            const char* name = argv[++i];
+            if (strcmp(name, "yuv420") == 0) {
+                format = V4L2_PIX_FMT_YUV420;
+            } else if (strcmp(name, "grey") == 0) {
+                format = V4L2_PIX_FMT_GREY;
+            } else if (strcmp(name, "y16") == 0) {
+                format = V4L2_PIX_FMT_Y16;
+            } else {
+                printf("unknown output format: %s (expected yuv420, grey or y16)\n", name);
+                exit(-1);
+            }
+        } else if (withValue("--tone")) {
+            const char* name = argv[++i];
+            if (strcmp(name, "fixed") == 0) {
+                tone = TONE_FIXED;
+            } else if (strcmp(name, "gamma") == 0) {
+                tone = TONE_GAMMA;
+            } else if (strcmp(name, "percentile") == 0) {
+                tone = TONE_PERCENTILE;
+            } else if (strcmp(name, "clahe") == 0) {
+                tone = TONE_CLAHE;
+            } else {
+                printf("unknown tone mapping: %s (expected fixed, gamma, percentile or clahe)\n", name);
+                exit(-1);
+            }
+        } else if (withValue("--gamma")) {
+            gamma = strtof(argv[++i], nullptr);
+            if (!(gamma > 0.0f)) {
+                printf("invalid gamma: %s\n", argv[i]);
+                exit(-1);
+            }
+        } else if (withValue("--crop")) {
+            if (sscanf(argv[++i], "%d,%d,%d,%d", &crop[0], &crop[1], &crop[2], &crop[3]) != 4) {
+                printf("invalid crop: %s (expected x,y,width,height)\n", argv[i]);
+                exit(-1);
+            }
+        } else if (withValue("--size")) {
+            if (sscanf(argv[++i], "%dx%d", &size[0], &size[1]) != 2) {
+                printf("invalid size: %s (expected widthxheight)\n", argv[i]);
+                exit(-1);
+            }
+        } else if (withValue("--max-fps")) {
+            maxFps = strtod(argv[++i], nullptr);
+            if (!(maxFps >= 0.0)) {
+                printf("invalid frame rate: %s\n", argv[i]);
+                exit(-1);
+            }
+        } else if (withValue("--skip-static")) {
+            staticPct = strtod(argv[++i], nullptr);
+            if (!(staticPct >= 0.0)) {
+                printf("invalid change threshold: %s (expected a percentage)\n", argv[i]);
+                exit(-1);
+            }
+        } else if (withValue("--keepalive-fps")) {
+            keepAliveFps = strtod(argv[++i], nullptr);
+            if (!(keepAliveFps >= 0.0)) {
+                printf("invalid frame rate: %s\n", argv[i]);
+                exit(-1);
+            }
+        } else if (withValue("--stats-socket")) {
+            statsSocket = argv[++i];
+        } else if (withValue("--stats-file")) {
+            statsFile = argv[++i];
+        } else if (withValue("--shm")) {
+            shmSocket = argv[++i];
+        } else if (withValue("--shm-format")) {
+            const char* name = argv[++i];
+            if (strcmp(name, "float") == 0) {
+                shmFormat = K2P_SHM_FORMAT_FLOAT;
+            } else if (strcmp(name, "y16") == 0) {
+                shmFormat = K2P_SHM_FORMAT_Y16;
+            } else {
+                printf("unknown shared memory format: %s (expected float or y16)\n", name);
+                exit(-1);
+            }
+        } else if (withValue("--source")) {
+            source = argv[++i];
+        } else if (withValue("--source-fps")) {
+            sourceFps = strtod(argv[++i], nullptr);
+            if (!(sourceFps >= 0.0)) {
+                printf("invalid frame rate: %s\n", argv[i]);
+                exit(-1);
+            }
+        } else if (withValue("--frames")) {
+            char* end;
+            frameLimit = strtoull(argv[++i], &end, 10);
+            if (end == argv[i] || *end || argv[i][0] == '-') {
+                printf("invalid frame count: %s\n", argv[i]);
+                exit(-1);
+            }
+        } else if (withValue("--replay")) {
+            replay = argv[++i];
+        } else if (strcmp(argv[i], "--replay-fast") == 0) {
+            replayFast = true;
+        } else if (withValue("--record")) {
+            record = argv[++i];
+        } else if (strcmp(argv[i], "--record-compress") == 0) {
+            recordCompress = true;
+        } else if (strcmp(argv[i], "--standby") == 0) {
+            standby = true;
+        } else if (strcmp(argv[i], "--realtime") == 0) {
+            realtime.setEnabled(true);
+        } else if (withValue("--realtime-policy")) {
+            const char* name = argv[++i];
+            if (strcmp(name, "fifo") == 0) {
+                realtime.setPolicy(RealtimeProfile::POLICY_FIFO);
+            } else if (strcmp(name, "deadline") == 0) {
+                realtime.setPolicy(RealtimeProfile::POLICY_DEADLINE);
+            } else {
+                printf("unknown scheduling policy: %s (expected fifo or deadline)\n", name);
+                exit(-1);
+            }
+        } else if (strcmp(argv[i], "--hugepages") == 0) {
+            realtime.setHugePages(true);
+        } else if (withValue("--pin")) {
+            if (!realtime.parsePin(argv[++i])) {
+                printf("invalid pinning: %s (expected usb|capture|convert|write=cpus, e.g. convert=2,3)\n", argv[i]);
+                exit(-1);
+            }
+            realtimePinned = true;
+        } else if (withValue("--devices")) {
+            devices = argv[++i];
         } else {
             positional.push_back(argv[i]);
         }
     }
 
-    if (positional.size() < 1 || positional.size() > 2) {
+    // a replayed recording takes the place of the source
+    const bool sourceConflict = replay && strcmp(source, "kinect") != 0;
+    if (sourceConflict ||
+        (devices ? !positional.empty() || record || recordPackets || shmSocket || realtime.enabled() || realtimePinned
+                 : positional.size() < 1 || positional.size() > 2)) {
         printf(
-            "usage: kinect2pipe_IR [--hwaccel] [path to v4l2loopback device] "
-            "[optional: path to backup v4l2 capture device]\n");
+            "usage: kinect2pipe_IR [--hwaccel] [--full-depth] [--decode-threads count] [--swscale] [--write-output] "
+            "[--backup-scale] [--backup-hot] [--backup-mjpeg] [--backup-threads count] "
+            "[--format yuv420|grey|y16] "
+            "[--tone fixed|gamma|percentile|clahe] [--gamma value] "
+            "[--crop x,y,width,height] [--size widthxheight] "
+            "[--max-fps fps] [--skip-static percent] [--keepalive-fps fps] "
+            "[--stats-socket path] [--stats-file path] "
+            "[--shm path] [--shm-format float|y16] "
+            "[--source kinect|synthetic|raw IR file | --replay recording] [--source-fps fps] [--frames count] "
+            "[--replay-fast] "
+            "[--record recording] [--record-compress] [--record-packets recording] "
+            "[--standby] "
+            "[--realtime] [--realtime-policy fifo|deadline] [--hugepages] [--pin usb|capture|convert|write=cpus] "
+            "[path to v4l2loopback device or output file] "
+            "[optional: path to backup v4l2 capture device]\n"
+            "       kinect2pipe_IR [options except --record, --record-packets, --shm, --realtime and --pin] "
+            "--devices configuration\n");
         exit(-1);
     }
 
+    // everything but the output and the backup device, which the configuration file gives per device with --devices
+    auto configure = [&](kinect2pipe_IR& pipe) {
+        pipe.setHwAccel(hwaccel);
+        pipe.setIrDecoder(!fullDepth, decodeThreads);
+        pipe.setSwscaleConvert(swscale);
+        pipe.setStreamingOutput(streaming);
+        pipe.setBackupPassthrough(passthrough);
+        pipe.setBackupHot(backupHot);
+        pipe.setBackupThreads(backupThreads);
+        pipe.setBackupMjpeg(backupMjpeg);
+        pipe.setOutputFormat(format);
+        pipe.setToneGamma(gamma);
+        pipe.setToneMode(tone);
+        pipe.setOutputCrop(crop[0], crop[1], crop[2], crop[3]);
+        pipe.setOutputSize(size[0], size[1]);
+        pipe.setMaxFps(maxFps);
+        pipe.setChangeDetection((float)(staticPct / 100.0), keepAliveFps);
+        pipe.setStatsEndpoint(statsSocket, statsFile);
+        if (strcmp(source, "synthetic") == 0) {
+            pipe.setSyntheticSource(sourceFps);
+        } else if (strcmp(source, "kinect") != 0) {
+            pipe.setFileSource(source, sourceFps);
+        }
+        if (replay) {
+            pipe.setReplaySource(replay, !replayFast);
+        }
+        if (record) {
+            pipe.setRecording(record, recordCompress);
+        }
+        if (recordPackets) {
+            pipe.setPacketRecording(recordPackets);
+        }
+        if (shmSocket) {
+            pipe.setShmOutput(shmSocket, shmFormat);
+        }
+        pipe.setRealtimeProfile(realtime);
+        pipe.setFrameLimit(frameLimit);
+        pipe.setStandby(standby);
+    };
+
+    if (devices) {
+        auto* server = new DeviceServer();
+        if (!server->load(devices)) {
+            exit(1);
+        }
+        server->setStatsEndpoint(statsSocket, statsFile);
+        server->run(configure);
+    }
+
     auto* pipe = new kinect2pipe_IR();
-    pipe->setHwAccel(hwaccel);
+    configure(*pipe);
     pipe->openLoopback(positional[0]);
     if (positional.size() == 2) {
         pipe->setBackupDevice(positional[1]);
     }
     pipe->run();
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,175 @@
+#include "metrics.h"
+#include <algorithm>
+#include <chrono>
+
+using namespace std;
+
+// libfreenect2 timestamps count in units of roughly 0.1 ms
+#define KINECT_TIMESTAMP_US 100
+
+uint64_t metricsNowUs() {
+    return (uint64_t)chrono::duration_cast<chrono::microseconds>(
+        chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+LatencyHistogram::LatencyHistogram() {
+    for (auto& b : this->buckets) b.store(0, memory_order_relaxed);
+    this->count.store(0, memory_order_relaxed);
+    this->sum.store(0, memory_order_relaxed);
+    this->max.store(0, memory_order_relaxed);
+}
+
+unsigned LatencyHistogram::bucketOf(uint64_t us) {
+    if (us < HISTOGRAM_LINEAR) return (unsigned)us;
+    const unsigned msb = 63 - __builtin_clzll(us);
+    const unsigned sub = (unsigned)(us >> (msb - HISTOGRAM_SUB_BITS)) & ((1u << HISTOGRAM_SUB_BITS) - 1);
+    return HISTOGRAM_LINEAR + (msb - 4) * (1u << HISTOGRAM_SUB_BITS) + sub;
+}
+
+// largest value that falls into bucket
+uint64_t LatencyHistogram::upperBound(unsigned bucket) {
+    if (bucket < HISTOGRAM_LINEAR) return bucket;
+    const unsigned i   = bucket - HISTOGRAM_LINEAR;
+    const unsigned msb = 4 + (i >> HISTOGRAM_SUB_BITS);
+    const uint64_t sub = i & ((1u << HISTOGRAM_SUB_BITS) - 1);
+    const uint64_t low = (1ull << msb) + (sub << (msb - HISTOGRAM_SUB_BITS));
+    return low + (1ull << (msb - HISTOGRAM_SUB_BITS)) - 1;
+}
+
+void LatencyHistogram::record(uint64_t us) {
+    this->buckets[bucketOf(us)].fetch_add(1, memory_order_relaxed);
+    this->count.fetch_add(1, memory_order_relaxed);
+    this->sum.fetch_add(us, memory_order_relaxed);
+
+    uint64_t seen = this->max.load(memory_order_relaxed);
+    while (us > seen && !this->max.compare_exchange_weak(seen, us, memory_order_relaxed)) {}
+}
+
+LatencyHistogram::Summary LatencyHistogram::summary() const {
+    uint64_t counts[HISTOGRAM_BUCKETS];
+    uint64_t total = 0;
+    for (unsigned b = 0; b < HISTOGRAM_BUCKETS; ++b) {
+        counts[b] = this->buckets[b].load(memory_order_relaxed);
+        total += counts[b];
+    }
+
+    Summary s{total, this->sum.load(memory_order_relaxed), 0, 0, this->max.load(memory_order_relaxed)};
+    if (total == 0) return s;
+
+    // nearest rank, reported as the top of the bucket but never above the largest value actually seen
+    const uint64_t rank50 = (total + 1) / 2;
+    const uint64_t rank99 = total - total / 100;
+    uint64_t       seen   = 0;
+    for (unsigned b = 0; b < HISTOGRAM_BUCKETS; ++b) {
+        if (!counts[b]) continue;
+        seen += counts[b];
+        if (!s.p50 && seen >= rank50) s.p50 = std::min(upperBound(b), s.max);
+        if (seen >= rank99) { s.p99 = std::min(upperBound(b), s.max); break; }
+    }
+    return s;
+}
+
+Metrics::Metrics() {
+    this->captured.store(0);
+    this->written.store(0);
+    this->missed.store(0);
+    this->sequenceGaps.store(0);
+    this->busy.store(0);
+    this->writeErrors.store(0);
+    this->backupFrames.store(0);
+    this->source.store(SOURCE_NONE);
+    this->switches.store(0);
+    this->haveSequence  = false;
+    this->lastSequence  = 0;
+    this->lastTimestamp = 0;
+    this->lastCaptureUs = 0;
+}
+
+// Only called from the capture thread. The jitter is the difference between the interval the frame arrived after and
+// the one the source timestamped it with: whatever USB, libfreenect2's decoding and the scheduler added or took away.
+void Metrics::irFrame(uint32_t sequence, uint32_t timestamp, uint64_t captureUs) {
+    this->captured.fetch_add(1, memory_order_relaxed);
+    if (this->haveSequence && sequence > this->lastSequence) {
+        const uint64_t sourceUs = (uint64_t)(timestamp - this->lastTimestamp) * KINECT_TIMESTAMP_US;
+        const uint64_t hostUs   = captureUs - this->lastCaptureUs;
+        this->sequenceGaps.fetch_add(sequence - this->lastSequence - 1, memory_order_relaxed);
+        this->interval.record(sourceUs);
+        this->jitter.record(hostUs > sourceUs ? hostUs - sourceUs : sourceUs - hostUs);
+    }
+    this->haveSequence  = true;
+    this->lastSequence  = sequence;
+    this->lastTimestamp = timestamp;
+    this->lastCaptureUs = captureUs;
+}
+
+void Metrics::setSource(Source to) {
+    const Source from = (Source)this->source.exchange(to);
+    if (from == to) return;
+    if (to != SOURCE_BACKUP) this->haveSequence = false; // a new stream starts its own numbering
+
+    this->switches.fetch_add(1, memory_order_relaxed);
+    const uint64_t wallMs = (uint64_t)chrono::duration_cast<chrono::milliseconds>(
+        chrono::system_clock::now().time_since_epoch()).count();
+
+    lock_guard<mutex> lk(this->events);
+    if (this->history.size() == METRICS_EVENT_HISTORY) this->history.erase(this->history.begin());
+    this->history.push_back(Event{wallMs, from, to});
+}
+
+const char* Metrics::sourceName(Source s) {
+    switch (s) {
+        case SOURCE_KINECT:    return "kinect";
+        case SOURCE_BACKUP:    return "backup";
+        case SOURCE_SYNTHETIC: return "synthetic";
+        case SOURCE_FILE:      return "file";
+        case SOURCE_REPLAY:    return "replay";
+        case SOURCE_NONE:
+        default:               return "none";
+    }
+}
+
+static void reportHistogram(std::ostream& os, const char* stage, const LatencyHistogram& h) {
+    const LatencyHistogram::Summary s = h.summary();
+    os << "kinect2pipe_latency_us{stage=\"" << stage << "\",quantile=\"0.5\"} "  << s.p50 << "\n"
+       << "kinect2pipe_latency_us{stage=\"" << stage << "\",quantile=\"0.99\"} " << s.p99 << "\n"
+       << "kinect2pipe_latency_us{stage=\"" << stage << "\",quantile=\"1\"} "    << s.max << "\n"
+       << "kinect2pipe_latency_us_sum{stage=\"" << stage << "\"} "   << s.sum   << "\n"
+       << "kinect2pipe_latency_us_count{stage=\"" << stage << "\"} " << s.count << "\n";
+}
+
+void Metrics::report(std::ostream& os) const {
+    os << "# TYPE kinect2pipe_latency_us summary\n";
+    reportHistogram(os, "queue",        this->queue);
+    reportHistogram(os, "normalize",    this->normalize);
+    reportHistogram(os, "convert",      this->convert);
+    reportHistogram(os, "write",        this->write);
+    reportHistogram(os, "end_to_end",   this->endToEnd);
+    reportHistogram(os, "backup_frame", this->backupFrame);
+    reportHistogram(os, "source_interval", this->interval);
+    reportHistogram(os, "capture_jitter", this->jitter);
+    reportHistogram(os, "first_frame",  this->firstFrame);
+    reportHistogram(os, "source_switch", this->sourceSwitch);
+
+    os << "# TYPE kinect2pipe_frames_total counter\n"
+       << "kinect2pipe_frames_total{event=\"captured\"} "      << this->captured.load()     << "\n"
+       << "kinect2pipe_frames_total{event=\"written\"} "       << this->written.load()      << "\n"
+       << "kinect2pipe_frames_total{event=\"missed\"} "        << this->missed.load()       << "\n"
+       << "kinect2pipe_frames_total{event=\"sequence_gap\"} "  << this->sequenceGaps.load() << "\n"
+       << "kinect2pipe_frames_total{event=\"busy\"} "          << this->busy.load()         << "\n"
+       << "kinect2pipe_frames_total{event=\"write_error\"} "   << this->writeErrors.load()  << "\n"
+       << "kinect2pipe_frames_total{event=\"backup\"} "        << this->backupFrames.load() << "\n";
+
+    const Source current = (Source)this->source.load();
+    os << "# TYPE kinect2pipe_source gauge\n";
+    for (Source s : {SOURCE_NONE, SOURCE_KINECT, SOURCE_BACKUP, SOURCE_SYNTHETIC, SOURCE_FILE, SOURCE_REPLAY}) {
+        os << "kinect2pipe_source{source=\"" << sourceName(s) << "\"} " << (s == current ? 1 : 0) << "\n";
+    }
+    os << "# TYPE kinect2pipe_source_switches_total counter\n"
+       << "kinect2pipe_source_switches_total " << this->switches.load() << "\n";
+
+    // most recent switches as comments, the timestamps are wall clock milliseconds
+    lock_guard<mutex> lk(this->events);
+    for (const Event& e : this->history) {
+        os << "# switch " << e.wallMs << " " << sourceName(e.from) << " -> " << sourceName(e.to) << "\n";
+    }
+}
@@ -0,0 +1,114 @@
+#ifndef kinect2pipe_IR_metrics_H
+#define kinect2pipe_IR_metrics_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Values below HISTOGRAM_LINEAR get a bucket each; above that every power of two is split into
+// 2^HISTOGRAM_SUB_BITS buckets, which keeps the relative error of a reported percentile under 12.5%.
+#define HISTOGRAM_LINEAR   16
+#define HISTOGRAM_SUB_BITS 3
+#define HISTOGRAM_BUCKETS  (HISTOGRAM_LINEAR + (64 - 4) * (1 << HISTOGRAM_SUB_BITS))
+
+// switch events kept for the stats report
+#define METRICS_EVENT_HISTORY 16
+
+// microseconds on the monotonic clock, the time base of every timestamp in the metrics
+uint64_t metricsNowUs();
+
+/**
+ * Log-linear histogram of durations in microseconds. record() is wait-free and can be called from any thread; readers
+ * get a consistent enough view by loading every bucket with relaxed ordering.
+ */
+class LatencyHistogram {
+public:
+    struct Summary {
+        uint64_t count;
+        uint64_t sum;
+        uint64_t p50;
+        uint64_t p99;
+        uint64_t max;
+    };
+
+    LatencyHistogram();
+
+    void    record(uint64_t us);
+    Summary summary() const;
+
+private:
+    std::atomic<uint64_t> buckets[HISTOGRAM_BUCKETS];
+    std::atomic<uint64_t> count;
+    std::atomic<uint64_t> sum;
+    std::atomic<uint64_t> max;
+
+    static unsigned bucketOf(uint64_t us);
+    static uint64_t upperBound(unsigned bucket);
+};
+
+/**
+ * Per-frame timings and event counters of the daemon.
+ *
+ * Frames are timestamped when they are captured, before and after the conversion and after they have been handed to
+ * the loopback device, and every interval goes into its own histogram. Everything is cumulative since start; the
+ * report is in the Prometheus text format so it can be scraped as is or dropped into a node_exporter textfile
+ * directory.
+ */
+class Metrics {
+public:
+    enum Source { SOURCE_NONE, SOURCE_KINECT, SOURCE_BACKUP, SOURCE_SYNTHETIC, SOURCE_FILE, SOURCE_REPLAY };
+
+    LatencyHistogram queue;       // captured -> picked up by the converter
+    LatencyHistogram normalize;   // crop / downscale or the --swscale normalisation pass
+    LatencyHistogram convert;     // IR -> output pixel format
+    LatencyHistogram write;       // handing the frame to the loopback device
+    LatencyHistogram endToEnd;    // captured -> written
+    LatencyHistogram backupFrame; // backup device: dequeued -> written
+    LatencyHistogram interval;    // between two IR frames, from the source timestamps
+    LatencyHistogram jitter;      // how much later or earlier than the source said an IR frame arrived
+    LatencyHistogram firstFrame;  // consumer opened the loopback device -> its first frame written
+    LatencyHistogram sourceSwitch; // a source found gone (or the Kinect back) -> first frame of the next one written
+
+    std::atomic<uint64_t> captured;      // frames received from the Kinect (or the synthetic / file / replay source)
+    std::atomic<uint64_t> written;       // frames accepted by the loopback device
+    std::atomic<uint64_t> missed;        // source reads that timed out
+    std::atomic<uint64_t> sequenceGaps;  // frames the Kinect numbered but never delivered
+    std::atomic<uint64_t> busy;          // submissions refused with EAGAIN
+    std::atomic<uint64_t> writeErrors;
+    std::atomic<uint64_t> backupFrames;  // frames published from the backup device
+
+    Metrics();
+
+    // metadata of a frame entering the IR pipeline at metricsNowUs() captureUs, checks the sequence for gaps and
+    // records the source side frame interval and the host side jitter
+    void irFrame(uint32_t sequence, uint32_t timestamp, uint64_t captureUs);
+    // the device frames now come from; every change is counted and logged as a switch event
+    void setSource(Source source);
+
+    void report(std::ostream& os) const;
+
+private:
+    struct Event {
+        uint64_t wallMs;
+        Source   from;
+        Source   to;
+    };
+
+    std::atomic<int>      source;
+    std::atomic<uint64_t> switches;
+    bool                  haveSequence;
+    uint32_t              lastSequence;
+    uint32_t              lastTimestamp;
+    uint64_t              lastCaptureUs;
+
+    mutable std::mutex    events;   // only taken on a switch and when reporting
+    std::vector<Event>    history;
+
+    static const char* sourceName(Source s);
+};
+
+#endif // kinect2pipe_IR_metrics_H
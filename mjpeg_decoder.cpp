@@ -0,0 +1,83 @@
+#include "mjpeg_decoder.h"
+
+using namespace std;
+
+MjpegDecoder::MjpegDecoder() {
+    this->cinfo.err                 = jpeg_std_error(&this->errors.mgr);
+    this->errors.mgr.error_exit     = &MjpegDecoder::errorExit;
+    this->errors.mgr.output_message = &MjpegDecoder::outputMessage;
+    jpeg_create_decompress(&this->cinfo);
+
+    this->width         = 0;
+    this->height        = 0;
+    this->denom         = 1;
+    this->grey          = false;
+    this->decodedFmt    = FrameFormat{};
+    this->corruptFrames = 0;
+}
+
+MjpegDecoder::~MjpegDecoder() {
+    jpeg_destroy_decompress(&this->cinfo);
+}
+
+bool MjpegDecoder::configure(int width, int height, int outWidth, int outHeight, bool grey) {
+    if (width < 1 || height < 1) return false;
+
+    // libjpeg rounds the reduced size up
+    int denom = MJPEG_MAX_SCALE_DENOM;
+    while (denom > 1 && ((width + denom - 1) / denom < outWidth || (height + denom - 1) / denom < outHeight)) {
+        denom /= 2;
+    }
+    this->width      = width;
+    this->height     = height;
+    this->denom      = denom;
+    this->grey       = grey;
+    this->decodedFmt = FrameFormat::make(grey ? V4L2_PIX_FMT_GREY : FRAME_FOURCC_YUV24,
+                                         (width + denom - 1) / denom, (height + denom - 1) / denom);
+
+    this->frame.resize(this->decodedFmt.frameSize());
+    this->rows.resize((size_t)this->decodedFmt.height);
+    for (int y = 0; y < this->decodedFmt.height; ++y) {
+        this->rows[(size_t)y] = this->frame.data() + (size_t)y * this->decodedFmt.bytesPerLine[0];
+    }
+    return true;
+}
+
+const uint8_t* MjpegDecoder::decode(const uint8_t* data, size_t bytes) {
+    if (setjmp(this->errors.jump)) {
+        // the decompressor stays usable for the next frame
+        jpeg_abort_decompress(&this->cinfo);
+        this->corruptFrames++;
+        return nullptr;
+    }
+
+    jpeg_mem_src(&this->cinfo, const_cast<uint8_t*>(data), (unsigned long)bytes);
+    jpeg_read_header(&this->cinfo, TRUE);
+    if ((int)this->cinfo.image_width != this->width || (int)this->cinfo.image_height != this->height) {
+        jpeg_abort_decompress(&this->cinfo);
+        this->corruptFrames++;
+        return nullptr;
+    }
+
+    this->cinfo.out_color_space     = this->grey ? JCS_GRAYSCALE : JCS_YCbCr;
+    this->cinfo.scale_num           = 1;
+    this->cinfo.scale_denom         = (unsigned)this->denom;
+    this->cinfo.dct_method          = JDCT_ISLOW;
+    this->cinfo.do_fancy_upsampling = FALSE;
+    jpeg_start_decompress(&this->cinfo);
+
+    while (this->cinfo.output_scanline < this->cinfo.output_height) {
+        JDIMENSION line = this->cinfo.output_scanline;
+        jpeg_read_scanlines(&this->cinfo, &this->rows[line], this->cinfo.output_height - line);
+    }
+    jpeg_finish_decompress(&this->cinfo);
+    return this->frame.data();
+}
+
+void MjpegDecoder::errorExit(j_common_ptr cinfo) {
+    longjmp(reinterpret_cast<ErrorManager*>(cinfo->err)->jump, 1);
+}
+
+// Webcams send the odd truncated frame, whose warnings are of no use to anybody. Frames that fail are counted instead.
+void MjpegDecoder::outputMessage(j_common_ptr) {
+}
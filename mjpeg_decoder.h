@@ -0,0 +1,72 @@
+#ifndef kinect2pipe_IR_mjpeg_decoder_H
+#define kinect2pipe_IR_mjpeg_decoder_H
+
+#include <csetjmp>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+#include "frame_format.h"
+extern "C" {
+#include <jpeglib.h>
+}
+
+// largest reduction of the decoded image, libjpeg's IDCT scales down to 1/8
+#define MJPEG_MAX_SCALE_DENOM 8
+
+/**
+ * Decodes the MJPEG frames of a backup camera with libjpeg-turbo, straight at a reduced size when they are much
+ * larger than the output: the IDCT then computes only the low frequencies of every block and the full-size image
+ * never exists. The size is halved as often as it stays at least as large as the output, so the scaler after the
+ * decoder only ever shrinks it; a 1080p frame is decoded at 960 x 540 for the Kinect's 512 x 424.
+ *
+ * For grey output only luma is decoded. The chroma has to be entropy decoded all the same, but is never transformed or
+ * upsampled. Colour is decoded to FRAME_FOURCC_YUV24 with the chroma simply repeated, since the scaler filters it
+ * anyway.
+ *
+ * The decompressor, with its tables and working memory, and the frame buffer are kept from one frame to the next.
+ */
+class MjpegDecoder {
+public:
+    MjpegDecoder();
+    ~MjpegDecoder();
+
+    MjpegDecoder(const MjpegDecoder&) = delete;
+    MjpegDecoder& operator=(const MjpegDecoder&) = delete;
+
+    // for width x height frames published at outWidth x outHeight, in colour or grey; false if the size is invalid
+    bool configure(int width, int height, int outWidth, int outHeight, bool grey);
+
+    // what decode() writes: GREY or FRAME_FOURCC_YUV24 at the reduced size
+    const FrameFormat& format() const { return this->decodedFmt; }
+    int scaleDenominator() const { return this->denom; }
+
+    // the decoded frame, valid until the next call; nullptr for a frame that is corrupt or not of the configured size
+    const uint8_t* decode(const uint8_t* data, size_t bytes);
+
+    // frames decode() failed on
+    uint64_t corrupt() const { return this->corruptFrames; }
+
+private:
+    struct ErrorManager {
+        struct jpeg_error_mgr mgr;
+        jmp_buf               jump;
+    };
+
+    struct jpeg_decompress_struct cinfo;
+    ErrorManager                  errors;
+
+    int                   width;
+    int                   height;
+    int                   denom;
+    bool                  grey;
+    FrameFormat           decodedFmt;
+    std::vector<uint8_t>  frame;
+    std::vector<JSAMPROW> rows;
+    uint64_t              corruptFrames;
+
+    static void errorExit(j_common_ptr cinfo);
+    static void outputMessage(j_common_ptr cinfo);
+};
+
+#endif // kinect2pipe_IR_mjpeg_decoder_H
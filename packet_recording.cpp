@@ -0,0 +1,177 @@
+#include "packet_recording.h"
+#include <iostream>
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+#include <fcntl.h>
+
+using namespace std;
+
+PacketRecorder::PacketRecorder() {
+    this->fd        = -1;
+    this->reference = false;
+    this->started   = false;
+    this->count     = 0;
+}
+
+PacketRecorder::~PacketRecorder() {
+    this->close();
+}
+
+bool PacketRecorder::open(const std::string& path, bool reference) {
+    this->fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (this->fd < 0) {
+        cerr << "failed to create packet recording " << path << ": " << strerror(errno) << endl;
+        return false;
+    }
+    this->path      = path;
+    this->reference = reference;
+    this->started   = false;
+    this->count     = 0;
+    return true;
+}
+
+void PacketRecorder::close() {
+    if (this->fd < 0) return;
+    ::close(this->fd);
+    this->fd = -1;
+    cout << "packet recording " << this->path << ": " << this->count << " packets" << endl;
+}
+
+void PacketRecorder::setP0Tables(const unsigned char* response, size_t length) {
+    this->p0.assign(response, response + length);
+}
+
+void PacketRecorder::setLookupTable(const int16_t* lut) {
+    this->lut.assign(lut, lut + KINECT2_LUT_SIZE);
+}
+
+void PacketRecorder::setZTable(const float* ztable) {
+    this->ztable.assign(ztable, ztable + KinectIrFormat::pixels);
+}
+
+bool PacketRecorder::write(const unsigned char* packet, uint32_t sequence, uint32_t timestamp,
+                           const float* reference) {
+    if (this->fd < 0) return false;
+
+    if (!this->started) {
+        if (this->p0.empty() || this->lut.empty() || this->ztable.empty()) {
+            cerr << "packet recording " << this->path << ": the device reported no tables" << endl;
+            this->close();
+            return false;
+        }
+        PacketRecordingHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, PACKET_RECORDING_MAGIC, sizeof(header.magic));
+        header.version     = PACKET_RECORDING_VERSION;
+        header.p0Bytes     = (uint32_t)this->p0.size();
+        header.packetBytes = KINECT2_DEPTH_PACKET_BYTES;
+        header.reference   = this->reference ? 1 : 0;
+        if (!this->writeAll(&header, sizeof(header)) ||
+            !this->writeAll(this->p0.data(), this->p0.size()) ||
+            !this->writeAll(this->lut.data(), this->lut.size() * sizeof(int16_t)) ||
+            !this->writeAll(this->ztable.data(), this->ztable.size() * sizeof(float))) {
+            return false;
+        }
+        this->started = true;
+    }
+
+    PacketRecord record;
+    memset(&record, 0, sizeof(record));
+    record.magic     = PACKET_MAGIC;
+    record.sequence  = sequence;
+    record.timestamp = timestamp;
+    if (!this->writeAll(&record, sizeof(record)) || !this->writeAll(packet, KINECT2_DEPTH_PACKET_BYTES)) {
+        return false;
+    }
+    if (this->reference && !this->writeAll(reference, KinectIrFormat::frameSize)) {
+        return false;
+    }
+    this->count++;
+    return true;
+}
+
+bool PacketRecorder::writeAll(const void* data, size_t size) {
+    const char* p = (const char*)data;
+    while (size > 0) {
+        const ssize_t n = ::write(this->fd, p, size);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            cerr << "failed to write packet recording " << this->path << ": " << strerror(errno)
+                 << ", recording stopped" << endl;
+            this->close();
+            return false;
+        }
+        p    += n;
+        size -= (size_t)n;
+    }
+    return true;
+}
+
+PacketRecording::PacketRecording() {
+    this->fd = -1;
+    memset(&this->header, 0, sizeof(this->header));
+}
+
+PacketRecording::~PacketRecording() {
+    if (this->fd >= 0) ::close(this->fd);
+}
+
+bool PacketRecording::open(const std::string& path) {
+    this->fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (this->fd < 0) {
+        cerr << "failed to open packet recording " << path << ": " << strerror(errno) << endl;
+        return false;
+    }
+    if (!this->readAll(&this->header, sizeof(this->header)) ||
+        memcmp(this->header.magic, PACKET_RECORDING_MAGIC, sizeof(this->header.magic)) != 0 ||
+        this->header.version != PACKET_RECORDING_VERSION ||
+        this->header.packetBytes != KINECT2_DEPTH_PACKET_BYTES ||
+        this->header.p0Bytes < KINECT2_P0_TABLES_BYTES) {
+        cerr << path << " is not a packet recording" << endl;
+        return false;
+    }
+
+    this->p0.resize(this->header.p0Bytes);
+    this->lut.resize(KINECT2_LUT_SIZE);
+    this->ztable.resize(KinectIrFormat::pixels);
+    if (!this->readAll(this->p0.data(), this->p0.size()) ||
+        !this->readAll(this->lut.data(), this->lut.size() * sizeof(int16_t)) ||
+        !this->readAll(this->ztable.data(), this->ztable.size() * sizeof(float))) {
+        cerr << "packet recording " << path << " is cut short" << endl;
+        return false;
+    }
+    return true;
+}
+
+bool PacketRecording::loadTables(IrPacketDecoder& decoder) const {
+    if (!decoder.loadP0Tables(this->p0.data(), this->p0.size())) return false;
+    decoder.loadLookupTable(this->lut.data());
+    decoder.loadZTable(this->ztable.data());
+    return true;
+}
+
+bool PacketRecording::next(std::vector<unsigned char>& packet, std::vector<float>& reference) {
+    PacketRecord record;
+    if (this->fd < 0 || !this->readAll(&record, sizeof(record)) || record.magic != PACKET_MAGIC) return false;
+
+    packet.resize(KINECT2_DEPTH_PACKET_BYTES);
+    if (!this->readAll(packet.data(), packet.size())) return false;
+    if (this->hasReference()) {
+        reference.resize(KinectIrFormat::pixels);
+        if (!this->readAll(reference.data(), KinectIrFormat::frameSize)) return false;
+    }
+    return true;
+}
+
+bool PacketRecording::readAll(void* data, size_t size) {
+    char* p = (char*)data;
+    while (size > 0) {
+        const ssize_t n = ::read(this->fd, p, size);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        p    += n;
+        size -= (size_t)n;
+    }
+    return true;
+}
@@ -0,0 +1,113 @@
+#ifndef kinect2pipe_IR_packet_recording_H
+#define kinect2pipe_IR_packet_recording_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "ir_decode.h"
+
+// A recording of the Kinect's raw depth packets, for working on the IR decoder without the device, is laid out as
+//
+//   PacketRecordingHeader
+//   the P0 tables response, p0Bytes long
+//   the lookup table, KINECT2_LUT_SIZE int16
+//   the z table, 512x424 floats
+//   PacketRecord + KINECT2_DEPTH_PACKET_BYTES of packet + (if the header says so) 512x424 floats of reference IR,
+//   once per packet
+//
+// The reference is libfreenect2's own CPU decoding of the packet with its filters off, which the IR decoder has to
+// match.
+#define PACKET_RECORDING_MAGIC   "K2PKREC1"
+#define PACKET_RECORDING_VERSION 1
+#define PACKET_MAGIC             0x544b5044u // "DPKT"
+
+struct PacketRecordingHeader {
+    char     magic[8];
+    uint32_t version;
+    uint32_t p0Bytes;
+    uint32_t packetBytes;  // KINECT2_DEPTH_PACKET_BYTES
+    uint32_t reference;    // whether every packet is followed by its reference IR
+    uint8_t  reserved[40];
+};
+
+struct PacketRecord {
+    uint32_t magic;        // PACKET_MAGIC
+    uint32_t sequence;
+    uint32_t timestamp;
+    uint32_t reserved;
+};
+
+static_assert(sizeof(PacketRecordingHeader) == 64, "packet recording header layout");
+static_assert(sizeof(PacketRecord) == 16, "packet record layout");
+
+/**
+ * Writes a packet recording. The tables are kept until the first packet comes, since the device reports them one at
+ * a time; packets are written as they come, on the caller's thread, so recordings are meant to be a few seconds long.
+ */
+class PacketRecorder {
+public:
+    PacketRecorder();
+    ~PacketRecorder();
+
+    PacketRecorder(const PacketRecorder&) = delete;
+    PacketRecorder& operator=(const PacketRecorder&) = delete;
+
+    bool open(const std::string& path, bool reference);
+    void close();
+    bool active() const { return this->fd >= 0; }
+
+    void setP0Tables(const unsigned char* response, size_t length);
+    void setLookupTable(const int16_t* lut);
+    void setZTable(const float* ztable);
+
+    // reference is ignored unless the recording was opened with references
+    bool write(const unsigned char* packet, uint32_t sequence, uint32_t timestamp, const float* reference);
+
+    uint64_t written() const { return this->count; }
+
+private:
+    int                        fd;
+    bool                       reference;
+    bool                       started;   // the header and tables are written
+    std::string                path;
+    std::vector<unsigned char> p0;
+    std::vector<int16_t>       lut;
+    std::vector<float>         ztable;
+    uint64_t                   count;
+
+    bool writeAll(const void* data, size_t size);
+};
+
+/**
+ * Reads a packet recording back, for the benchmarks.
+ */
+class PacketRecording {
+public:
+    PacketRecording();
+    ~PacketRecording();
+
+    PacketRecording(const PacketRecording&) = delete;
+    PacketRecording& operator=(const PacketRecording&) = delete;
+
+    // reads the header and the tables
+    bool open(const std::string& path);
+    bool hasReference() const { return this->header.reference != 0; }
+
+    // loads the tables into decoder
+    bool loadTables(IrPacketDecoder& decoder) const;
+
+    // the next packet and, if the recording has them, its reference; false at the end or on a broken record
+    bool next(std::vector<unsigned char>& packet, std::vector<float>& reference);
+
+private:
+    int                        fd;
+    PacketRecordingHeader      header;
+    std::vector<unsigned char> p0;
+    std::vector<int16_t>       lut;
+    std::vector<float>         ztable;
+
+    bool readAll(void* data, size_t size);
+};
+
+#endif // kinect2pipe_IR_packet_recording_H
@@ -0,0 +1,186 @@
+#include "realtime_profile.h"
+#include <iostream>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+using namespace std;
+
+#ifndef SCHED_DEADLINE
+#define SCHED_DEADLINE 6
+#endif
+
+// the kernel's struct sched_attr, which glibc doesn't declare
+struct RealtimeSchedAttr {
+    uint32_t size;
+    uint32_t schedPolicy;
+    uint64_t schedFlags;
+    int32_t  schedNice;
+    uint32_t schedPriority;
+    uint64_t schedRuntime;   // nanoseconds
+    uint64_t schedDeadline;
+    uint64_t schedPeriod;
+};
+
+RealtimeProfile::RealtimeProfile() {
+    this->realtime  = false;
+    this->policy    = POLICY_FIFO;
+    this->hugePages = false;
+    for (int i = 0; i < ROLE_COUNT; ++i) {
+        CPU_ZERO(&this->cpus[i]);
+        this->pinned[i] = false;
+    }
+    // where threads go that aren't pinned, even when they were started by one that is
+    CPU_ZERO(&this->processCpus);
+    if (sched_getaffinity(0, sizeof(this->processCpus), &this->processCpus) < 0) {
+        for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) CPU_SET(cpu, &this->processCpus);
+    }
+    this->warned.store(false);
+}
+
+RealtimeProfile::RealtimeProfile(const RealtimeProfile& other) {
+    *this = other;
+}
+
+RealtimeProfile& RealtimeProfile::operator=(const RealtimeProfile& other) {
+    this->realtime    = other.realtime;
+    this->policy      = other.policy;
+    this->hugePages   = other.hugePages;
+    this->processCpus = other.processCpus;
+    for (int i = 0; i < ROLE_COUNT; ++i) {
+        this->cpus[i]   = other.cpus[i];
+        this->pinned[i] = other.pinned[i];
+    }
+    this->warned.store(other.warned.load());
+    return *this;
+}
+
+bool RealtimeProfile::parsePin(const char* spec) {
+    const char* equals = strchr(spec, '=');
+    if (!equals) return false;
+
+    int role = 0;
+    while (role < ROLE_COUNT && (strncmp(spec, roleName((Role)role), (size_t)(equals - spec)) != 0 ||
+                                 strlen(roleName((Role)role)) != (size_t)(equals - spec))) {
+        role++;
+    }
+    if (role == ROLE_COUNT) return false;
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    const char* p = equals + 1;
+    while (true) {
+        char* end;
+        const long first = strtol(p, &end, 10);
+        if (end == p || first < 0 || first >= CPU_SETSIZE) return false;
+        long last = first;
+        if (*end == '-') {
+            p    = end + 1;
+            last = strtol(p, &end, 10);
+            if (end == p || last < first || last >= CPU_SETSIZE) return false;
+        }
+        for (long cpu = first; cpu <= last; ++cpu) CPU_SET((int)cpu, &set);
+        if (*end == '\0') break;
+        if (*end != ',') return false;
+        p = end + 1;
+    }
+    this->cpus[role]   = set;
+    this->pinned[role] = true;
+    return true;
+}
+
+// Every thread started from here on gets a smaller stack, since locked memory is faulted in whole and there are a
+// few of them per core between libfreenect2 and the IR decoder.
+bool RealtimeProfile::lockMemory() const {
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, RT_THREAD_STACK_BYTES);
+    pthread_setattr_default_np(&attr);
+    pthread_attr_destroy(&attr);
+
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) < 0) {
+        cerr << "failed to lock the process in memory: " << strerror(errno)
+             << " (is RLIMIT_MEMLOCK high enough? LimitMEMLOCK= in the service unit)" << endl;
+        return false;
+    }
+    cout << "process memory locked" << endl;
+    return true;
+}
+
+void RealtimeProfile::enter(Role role) const {
+    const bool deadline = this->realtime && this->policy == POLICY_DEADLINE &&
+                          (role == ROLE_CONVERT || role == ROLE_WRITE);
+    if (this->pinned[role] || this->realtime) {
+        // a SCHED_DEADLINE thread may not be pinned at all
+        const cpu_set_t& set = this->pinned[role] && !deadline ? this->cpus[role] : this->processCpus;
+        const int error = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        if (error) this->warn("CPU affinity", error);
+    }
+    if (this->realtime) {
+        const int error = this->setScheduling(role);
+        if (error) this->warn(deadline ? "SCHED_DEADLINE" : "SCHED_FIFO", error);
+    }
+}
+
+void RealtimeProfile::runAs(Role role, const std::function<void()>& fn) const {
+    if (!this->pinned[role] && !this->realtime) {
+        fn();
+        return;
+    }
+    cpu_set_t          cpus;
+    int                policy;
+    struct sched_param param;
+    const bool saved = pthread_getaffinity_np(pthread_self(), sizeof(cpus), &cpus) == 0 &&
+                       pthread_getschedparam(pthread_self(), &policy, &param) == 0;
+
+    this->enter(role);
+    fn();
+
+    if (saved) {
+        pthread_setschedparam(pthread_self(), policy, &param);
+        pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+    }
+}
+
+int RealtimeProfile::setScheduling(Role role) const {
+    if (this->policy == POLICY_DEADLINE && (role == ROLE_CONVERT || role == ROLE_WRITE)) {
+        RealtimeSchedAttr attr{};
+        attr.size          = sizeof(attr);
+        attr.schedPolicy   = SCHED_DEADLINE;
+        attr.schedRuntime  = (uint64_t)(role == ROLE_CONVERT ? RT_DEADLINE_CONVERT_US : RT_DEADLINE_WRITE_US) * 1000;
+        attr.schedDeadline = (uint64_t)RT_DEADLINE_PERIOD_US * 1000;
+        attr.schedPeriod   = attr.schedDeadline;
+        return syscall(SYS_sched_setattr, 0, &attr, 0) == 0 ? 0 : errno;
+    }
+
+    struct sched_param param{};
+    switch (role) {
+        case ROLE_USB:     param.sched_priority = RT_PRIORITY_USB;     break;
+        case ROLE_CAPTURE: param.sched_priority = RT_PRIORITY_CAPTURE; break;
+        case ROLE_CONVERT: param.sched_priority = RT_PRIORITY_CONVERT; break;
+        case ROLE_WRITE:
+        default:           param.sched_priority = RT_PRIORITY_WRITE;   break;
+    }
+    return pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+}
+
+void RealtimeProfile::warn(const char* what, int error) const {
+    if (this->warned.exchange(true)) return;
+    cerr << "real-time profile: " << what << " refused (" << strerror(error)
+         << "), needs CAP_SYS_NICE or LimitRTPRIO= in the service unit; further refusals are not reported" << endl;
+}
+
+const char* RealtimeProfile::roleName(Role role) {
+    switch (role) {
+        case ROLE_USB:     return "usb";
+        case ROLE_CAPTURE: return "capture";
+        case ROLE_CONVERT: return "convert";
+        case ROLE_WRITE:
+        default:           return "write";
+    }
+}
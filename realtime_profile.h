@@ -0,0 +1,78 @@
+#ifndef kinect2pipe_IR_realtime_profile_H
+#define kinect2pipe_IR_realtime_profile_H
+
+#include <atomic>
+#include <functional>
+#include <sched.h>
+
+// SCHED_FIFO priorities of the threads of the real-time profile. libusb's event thread comes first: a late USB
+// transfer loses the whole frame, a late conversion only delays it.
+#define RT_PRIORITY_USB     60
+#define RT_PRIORITY_CAPTURE 55
+#define RT_PRIORITY_CONVERT 50
+#define RT_PRIORITY_WRITE   45
+
+// SCHED_DEADLINE reservations of the conversion and write stages: so much CPU time every Kinect frame period
+#define RT_DEADLINE_PERIOD_US  33333
+#define RT_DEADLINE_CONVERT_US 8000
+#define RT_DEADLINE_WRITE_US   2000
+
+// stack of the threads started once memory is locked, which is then faulted in whole; glibc's default is 8 MB
+#define RT_THREAD_STACK_BYTES (1u << 20)
+
+/**
+ * Where and how the threads on a frame's path run.
+ *
+ * The roles are libusb's event thread (usb), the main thread that receives the frames (capture), together with the
+ * packet processing and IR decoding threads libfreenect2 starts from it, the converter thread (convert) and the
+ * thread handing frames to the loopback device (write).
+ *
+ * Each role can be pinned to a set of CPUs. With the real-time profile enabled they also run at the SCHED_FIFO
+ * priorities above, or, with the deadline policy, the convert and write stages get SCHED_DEADLINE reservations
+ * instead; the kernel doesn't let those be pinned, so their CPUs are ignored. Threads a role's thread starts inherit
+ * its CPUs and policy. Settings the process isn't allowed to make (without CAP_SYS_NICE or a high enough RLIMIT_RTPRIO)
+ * are warned about and left out: the pipeline works the same, only with more jitter.
+ */
+class RealtimeProfile {
+public:
+    enum Role { ROLE_USB, ROLE_CAPTURE, ROLE_CONVERT, ROLE_WRITE, ROLE_COUNT };
+    enum Policy { POLICY_FIFO, POLICY_DEADLINE };
+
+    RealtimeProfile();
+    RealtimeProfile(const RealtimeProfile& other);
+    RealtimeProfile& operator=(const RealtimeProfile& other);
+
+    void setEnabled(bool enable) { this->realtime = enable; }
+    bool enabled() const { return this->realtime; }
+    void setPolicy(Policy policy) { this->policy = policy; }
+    void setHugePages(bool enable) { this->hugePages = enable; }
+    bool useHugePages() const { return this->hugePages; }
+
+    // "role=cpus" with a role name and a list like 2,3 or 4-7; false if it doesn't parse
+    bool parsePin(const char* spec);
+
+    // locks every current and future page of the process in memory
+    bool lockMemory() const;
+
+    // gives the calling thread the role's CPUs and scheduling; nothing without the profile or a pin for the role
+    void enter(Role role) const;
+    // runs fn as the role on the calling thread and restores the thread afterwards, for threads a library starts
+    void runAs(Role role, const std::function<void()>& fn) const;
+
+private:
+    bool      realtime;
+    Policy    policy;
+    bool      hugePages;
+    cpu_set_t cpus[ROLE_COUNT];
+    bool      pinned[ROLE_COUNT];
+    cpu_set_t processCpus;       // what the process was started with
+
+    mutable std::atomic<bool> warned; // settings refused, said once
+
+    // 0 or the error
+    int  setScheduling(Role role) const;
+    void warn(const char* what, int error) const;
+    static const char* roleName(Role role);
+};
+
+#endif // kinect2pipe_IR_realtime_profile_H
@@ -0,0 +1,176 @@
+#include "recording_source.h"
+#include <iostream>
+#include <thread>
+#include <cerrno>
+#include <cstring>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+using namespace std;
+
+// libfreenect2 timestamps count in units of roughly 0.1 ms
+#define RECORDING_TIMESTAMP_US 100
+
+RecordingSource::RecordingSource(const std::string& path, bool originalTiming, bool loop) {
+    this->path            = path;
+    this->originalTiming  = originalTiming;
+    this->loop            = loop;
+    this->mapped          = nullptr;
+    this->length          = 0;
+    this->index           = nullptr;
+    this->frameCount      = 0;
+    this->next            = 0;
+    this->recordedFps     = 0.0;
+    this->originTimestamp = 0;
+}
+
+RecordingSource::~RecordingSource() {
+    this->stop();
+}
+
+bool RecordingSource::start() {
+    int fd = open(this->path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        cerr << "failed to open recording " << this->path << ": " << strerror(errno) << endl;
+        return false;
+    }
+    struct stat st{};
+    if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(IrRecordingHeader)) {
+        cerr << this->path << " is not a recording" << endl;
+        close(fd);
+        return false;
+    }
+    this->length = (size_t)st.st_size;
+    void* m = mmap(nullptr, this->length, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (m == MAP_FAILED) {
+        cerr << "failed to map recording " << this->path << ": " << strerror(errno) << endl;
+        return false;
+    }
+    madvise(m, this->length, MADV_SEQUENTIAL);
+    this->mapped = (const uint8_t*)m;
+
+    const IrRecordingHeader* header = reinterpret_cast<const IrRecordingHeader*>(this->mapped);
+    if (memcmp(header->magic, IR_RECORDING_MAGIC, sizeof(header->magic)) != 0 ||
+        header->version != IR_RECORDING_VERSION) {
+        cerr << this->path << " is not a recording" << endl;
+        this->stop();
+        return false;
+    }
+    if (header->fourcc != KinectIrFormat::fourcc || header->width != (uint32_t)KinectIrFormat::width ||
+        header->height != (uint32_t)KinectIrFormat::height) {
+        cerr << this->path << ": recorded frames are " << header->width << "x" << header->height
+             << ", not Kinect IR frames" << endl;
+        this->stop();
+        return false;
+    }
+
+    // frameCount is checked first so the size of the index can't overflow
+    const bool     indexFits  = header->frameCount <= this->length / sizeof(IrIndexEntry);
+    const uint64_t indexBytes = header->frameCount * sizeof(IrIndexEntry);
+    if (header->frameCount && indexFits && header->indexOffset <= this->length &&
+        indexBytes <= this->length - header->indexOffset) {
+        this->index      = reinterpret_cast<const IrIndexEntry*>(this->mapped + header->indexOffset);
+        this->frameCount = header->frameCount;
+    } else if (!this->scanRecords()) {
+        this->stop();
+        return false;
+    }
+
+    if (this->frameCount > 1) {
+        const uint32_t span = this->index[this->frameCount - 1].timestamp - this->index[0].timestamp;
+        if (span) this->recordedFps = (this->frameCount - 1) * 1e6 / ((double)span * RECORDING_TIMESTAMP_US);
+    }
+
+    this->decoded.resize(KinectIrFormat::pixels);
+    this->next = 0;
+
+    cout << "replaying " << this->frameCount << " recorded frames from " << this->path;
+    if (this->originalTiming) cout << " at their original timing (" << this->recordedFps << " fps)";
+    cout << endl;
+    return true;
+}
+
+// Rebuilds the index of a recording whose writer never got to write it, from the records that made it to disk.
+bool RecordingSource::scanRecords() {
+    cerr << this->path << " has no index, scanning its frames" << endl;
+
+    size_t at = sizeof(IrRecordingHeader);
+    while (at + sizeof(IrFrameRecord) <= this->length) {
+        const IrFrameRecord* record = reinterpret_cast<const IrFrameRecord*>(this->mapped + at);
+        if (record->magic != IR_FRAME_MAGIC || record->size > this->length - at - sizeof(IrFrameRecord)) break;
+
+        this->scanned.push_back(IrIndexEntry{at, record->sequence, record->timestamp});
+        const size_t padded = (record->size + IR_RECORDING_ALIGN - 1) & ~(size_t)(IR_RECORDING_ALIGN - 1);
+        at += sizeof(IrFrameRecord) + padded;
+    }
+
+    if (this->scanned.empty()) {
+        cerr << this->path << " holds no frames" << endl;
+        return false;
+    }
+    this->index      = this->scanned.data();
+    this->frameCount = this->scanned.size();
+    return true;
+}
+
+void RecordingSource::stop() {
+    if (!this->mapped) return;
+    munmap((void*)this->mapped, this->length);
+    this->mapped = nullptr;
+    this->index  = nullptr;
+}
+
+FrameSource::ReadResult RecordingSource::read(SourceFrame& frame, int timeoutMs) {
+    if (this->next == this->frameCount) {
+        if (!this->loop) return READ_END;
+        this->next = 0;
+    }
+    const IrIndexEntry& entry = this->index[this->next];
+
+    if (this->originalTiming) {
+        // Every frame is due at its recorded distance from the first one, starting over whenever the replay does.
+        const Clock::time_point now = Clock::now();
+        if (this->next == 0) {
+            this->origin          = now;
+            this->originTimestamp = entry.timestamp;
+        }
+        const Clock::time_point due = this->origin +
+            chrono::microseconds((uint64_t)(entry.timestamp - this->originTimestamp) * RECORDING_TIMESTAMP_US);
+        if (due > now + chrono::milliseconds(timeoutMs)) {
+            this_thread::sleep_for(chrono::milliseconds(timeoutMs));
+            return READ_TIMEOUT;
+        }
+        this_thread::sleep_until(due);
+    }
+
+    // the index comes from the file like the records, neither is trusted to stay inside it
+    if (entry.offset > this->length || sizeof(IrFrameRecord) > this->length - entry.offset) {
+        cerr << this->path << ": frame " << this->next << " is corrupt" << endl;
+        return READ_ERROR;
+    }
+    const IrFrameRecord* record  = reinterpret_cast<const IrFrameRecord*>(this->mapped + entry.offset);
+    const uint8_t*       payload = reinterpret_cast<const uint8_t*>(record + 1);
+    if (record->magic != IR_FRAME_MAGIC || record->size > this->length - entry.offset - sizeof(IrFrameRecord)) {
+        cerr << this->path << ": frame " << this->next << " is corrupt" << endl;
+        return READ_ERROR;
+    }
+
+    if (record->codec == IR_CODEC_RAW && record->size == KinectIrFormat::frameSize) {
+        frame.data = payload;
+    } else if (irDecodeFrame((IrFrameCodec)record->codec, payload, record->size,
+                             KinectIrFormat::width, KinectIrFormat::height, this->decoded.data())) {
+        frame.data = reinterpret_cast<const uint8_t*>(this->decoded.data());
+    } else {
+        cerr << this->path << ": frame " << this->next << " is corrupt" << endl;
+        return READ_ERROR;
+    }
+
+    frame.bytes     = KinectIrFormat::frameSize;
+    frame.sequence  = entry.sequence;
+    frame.timestamp = entry.timestamp;
+    this->next++;
+    return READ_FRAME;
+}
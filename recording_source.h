@@ -0,0 +1,53 @@
+#ifndef kinect2pipe_IR_recording_source_H
+#define kinect2pipe_IR_recording_source_H
+
+#include <chrono>
+#include <string>
+#include <vector>
+#include "frame_source.h"
+#include "ir_recording.h"
+
+/**
+ * Replays a recording written by IrRecorder with the frames' original sequence numbers and timestamps.
+ *
+ * The file is mapped and read through its index; raw frames are handed out in place and compressed ones are decoded
+ * into a single buffer allocated up front, so replay does no allocation per frame. Frames are delivered at the pace
+ * they were recorded at, or as fast as they are read.
+ */
+class RecordingSource : public FrameSource {
+public:
+    RecordingSource(const std::string& path, bool originalTiming, bool loop);
+    ~RecordingSource();
+
+    const char* name() const { return "recording"; }
+
+    bool start();
+    void stop();
+
+    const FrameFormat& format() const { return KinectIrFormat::format; }
+    double             fps() const { return this->originalTiming ? this->recordedFps : 0.0; }
+
+    ReadResult read(SourceFrame& frame, int timeoutMs);
+    bool       release() { return true; }
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    std::string               path;
+    bool                      originalTiming;
+    bool                      loop;
+    const uint8_t*            mapped;
+    size_t                    length;
+    const IrIndexEntry*       index;
+    size_t                    frameCount;
+    std::vector<IrIndexEntry> scanned;   // index rebuilt from the records of a recording that was cut short
+    std::vector<float>        decoded;
+    size_t                    next;
+    double                    recordedFps;
+    Clock::time_point         origin;    // when the frame at originTimestamp is due
+    uint32_t                  originTimestamp;
+
+    bool scanRecords();
+};
+
+#endif // kinect2pipe_IR_recording_source_H
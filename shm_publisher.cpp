@@ -0,0 +1,252 @@
+#include "shm_publisher.h"
+#include <iostream>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <linux/futex.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include "frame_format.h"
+
+using namespace std;
+
+// Linux 5.1, missing from older headers
+#ifndef F_SEAL_FUTURE_WRITE
+#define F_SEAL_FUTURE_WRITE 0x0010
+#endif
+
+// buffers start on their own page, so a client could map them separately
+#define SHM_PAGE_BYTES 4096
+
+static size_t pageAligned(size_t bytes) {
+    return (bytes + SHM_PAGE_BYTES - 1) / SHM_PAGE_BYTES * SHM_PAGE_BYTES;
+}
+
+ShmPublisher::ShmPublisher() {
+    this->loop       = nullptr;
+    this->memFd      = -1;
+    this->readOnlyFd = -1;
+    this->listenFd   = -1;
+    this->mapBytes   = 0;
+    this->map        = nullptr;
+    this->header     = nullptr;
+    this->kernels    = selectIrKernels<KinectIrFormat::pixels>();
+    this->clientCount.store(0);
+    this->frames.store(0);
+}
+
+ShmPublisher::~ShmPublisher() {
+    this->close();
+}
+
+bool ShmPublisher::open(const std::string& socketPath, uint32_t format, EventLoop& loop, ClientsChanged changed) {
+    if (format != K2P_SHM_FORMAT_FLOAT && format != K2P_SHM_FORMAT_Y16) {
+        cerr << "unsupported shared memory format" << endl;
+        return false;
+    }
+    this->loop    = &loop;
+    this->changed = changed;
+    if (!this->createMapping(format)) {
+        this->close();
+        return false;
+    }
+
+    struct sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    if (socketPath.size() >= sizeof(addr.sun_path)) {
+        cerr << "shared memory socket path too long: " << socketPath << endl;
+        this->close();
+        return false;
+    }
+    strncpy(addr.sun_path, socketPath.c_str(), sizeof(addr.sun_path) - 1);
+
+    this->listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if (this->listenFd < 0) {
+        cerr << "failed to create shared memory socket: " << strerror(errno) << endl;
+        this->close();
+        return false;
+    }
+    unlink(socketPath.c_str()); // left over from a previous run
+    // only the daemon's own user may connect; the socket is created with these permissions, never briefly without
+    const mode_t mask  = umask(0077);
+    const bool   bound = bind(this->listenFd, (struct sockaddr*)&addr, sizeof(addr)) == 0;
+    umask(mask);
+    if (!bound || listen(this->listenFd, 4) < 0) {
+        cerr << "failed to listen on shared memory socket " << socketPath << ": " << strerror(errno) << endl;
+        this->close();
+        return false;
+    }
+    this->socketPath = socketPath;
+    if (!loop.add(this->listenFd, EPOLLIN, [this](uint32_t) { this->accept(); })) {
+        this->close();
+        return false;
+    }
+    cout << "publishing IR frames to shared memory at " << socketPath << endl;
+    return true;
+}
+
+// The memfd is sized and sealed once, so no client can shrink it under the daemon. Clients get a descriptor opened
+// read only through /proc, which the kernel refuses to map writable. Since the memfd's inode is 0777, a client could
+// still reopen that descriptor read-write through its own /proc. Once the daemon has made its mapping the inode is
+// made 0400 and F_SEAL_FUTURE_WRITE refuses writes and writable mappings to everybody but that mapping.
+bool ShmPublisher::createMapping(uint32_t format) {
+    const uint32_t bytesPerLine = KinectIrFormat::width * (format == K2P_SHM_FORMAT_FLOAT ? sizeof(float) : 2);
+    const uint32_t frameBytes   = bytesPerLine * KinectIrFormat::height;
+    const size_t   headerBytes  = pageAligned(sizeof(k2p_shm_header));
+    const size_t   slotBytes    = pageAligned(frameBytes);
+    this->mapBytes = headerBytes + slotBytes * K2P_SHM_SLOTS;
+
+    this->memFd = memfd_create("kinect2pipe-frames", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (this->memFd < 0 || ftruncate(this->memFd, (off_t)this->mapBytes) < 0 ||
+        fcntl(this->memFd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW) < 0) {
+        cerr << "failed to create shared memory: " << strerror(errno) << endl;
+        return false;
+    }
+    const string path = "/proc/self/fd/" + to_string(this->memFd);
+    this->readOnlyFd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (this->readOnlyFd < 0) {
+        cerr << "failed to reopen shared memory read only: " << strerror(errno) << endl;
+        return false;
+    }
+
+    void* map = mmap(nullptr, this->mapBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, this->memFd, 0);
+    if (map == MAP_FAILED) {
+        cerr << "failed to map shared memory: " << strerror(errno) << endl;
+        return false;
+    }
+    this->map    = (uint8_t*)map;
+    this->header = (k2p_shm_header*)map;
+    if (fcntl(this->memFd, F_ADD_SEALS, F_SEAL_FUTURE_WRITE | F_SEAL_SEAL) < 0 || fchmod(this->memFd, 0400) < 0) {
+        cerr << "failed to seal shared memory: " << strerror(errno) << endl;
+        return false;
+    }
+
+    // the memfd starts out zeroed
+    this->header->version        = K2P_SHM_VERSION;
+    this->header->format         = format;
+    this->header->width          = KinectIrFormat::width;
+    this->header->height         = KinectIrFormat::height;
+    this->header->bytes_per_line = bytesPerLine;
+    this->header->frame_bytes    = frameBytes;
+    this->header->slot_count     = K2P_SHM_SLOTS;
+    this->header->map_bytes      = this->mapBytes;
+    for (int i = 0; i < K2P_SHM_SLOTS; ++i) {
+        this->header->slots[i].offset = headerBytes + slotBytes * i;
+    }
+    // last, so a client never sees a header that is only partly there
+    __atomic_store_n(&this->header->magic, K2P_SHM_MAGIC, __ATOMIC_RELEASE);
+    return true;
+}
+
+void ShmPublisher::close() {
+    for (int fd : this->clientFds) {
+        this->loop->remove(fd);
+        ::close(fd);
+    }
+    this->clientFds.clear();
+    this->clientCount.store(0);
+
+    if (this->listenFd >= 0) {
+        if (this->loop) this->loop->remove(this->listenFd);
+        ::close(this->listenFd);
+        this->listenFd = -1;
+        if (!this->socketPath.empty()) unlink(this->socketPath.c_str());
+    }
+    if (this->header) {
+        // clients still holding the mapping see it and stop waiting
+        __atomic_store_n(&this->header->closed, 1, __ATOMIC_RELEASE);
+        __atomic_add_fetch(&this->header->futex, 1, __ATOMIC_RELEASE);
+        syscall(SYS_futex, &this->header->futex, FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+        munmap(this->map, this->mapBytes);
+        this->map    = nullptr;
+        this->header = nullptr;
+    }
+    if (this->readOnlyFd >= 0) {
+        ::close(this->readOnlyFd);
+        this->readOnlyFd = -1;
+    }
+    if (this->memFd >= 0) {
+        ::close(this->memFd);
+        this->memFd = -1;
+    }
+}
+
+// Sends the new client the read-only memfd, then keeps its connection only to notice it hanging up.
+void ShmPublisher::accept() {
+    int fd;
+    while ((fd = accept4(this->listenFd, nullptr, nullptr, SOCK_CLOEXEC | SOCK_NONBLOCK)) >= 0) {
+        char            byte = 'K';
+        struct iovec    iov  = {&byte, 1};
+        alignas(struct cmsghdr) char control[CMSG_SPACE(sizeof(int))] = {};
+        struct msghdr   msg{};
+        msg.msg_iov        = &iov;
+        msg.msg_iovlen     = 1;
+        msg.msg_control    = control;
+        msg.msg_controllen = sizeof(control);
+        struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type  = SCM_RIGHTS;
+        cmsg->cmsg_len   = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &this->readOnlyFd, sizeof(int));
+
+        if (sendmsg(fd, &msg, MSG_NOSIGNAL) != 1 ||
+            !this->loop->add(fd, EPOLLIN | EPOLLRDHUP, [this, fd](uint32_t events) {
+                char discard[64];
+                const ssize_t n = recv(fd, discard, sizeof(discard), 0);
+                if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR) || (events & (EPOLLHUP | EPOLLERR))) {
+                    this->drop(fd);
+                }
+            })) {
+            cerr << "failed to hand shared memory to a client: " << strerror(errno) << endl;
+            ::close(fd);
+            continue;
+        }
+        this->clientFds.insert(fd);
+        this->clientCount.store((int)this->clientFds.size());
+        cout << "shared memory client connected" << endl;
+        if (this->changed) this->changed(this->clients());
+    }
+}
+
+void ShmPublisher::drop(int fd) {
+    this->loop->remove(fd);
+    ::close(fd);
+    this->clientFds.erase(fd);
+    this->clientCount.store((int)this->clientFds.size());
+    cout << "shared memory client disconnected" << endl;
+    if (this->changed) this->changed(this->clients());
+}
+
+// Sequence lock writer: the buffer's counter is odd from before the first byte is written until after the last, and
+// latest only moves on to a buffer once it is complete. The futex is bumped and woken last.
+void ShmPublisher::publish(const float* ir, uint32_t sequence, uint64_t captureUs) {
+    if (!this->header || this->clientCount.load(std::memory_order_relaxed) == 0) return;
+
+    const uint64_t frame = this->frames.load(std::memory_order_relaxed) + 1;
+    k2p_shm_slot&  slot  = this->header->slots[(frame - 1) % K2P_SHM_SLOTS];
+    const uint32_t seq   = slot.seq;
+    __atomic_store_n(&slot.seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    uint8_t* data = this->map + slot.offset;
+    if (this->header->format == K2P_SHM_FORMAT_Y16) {
+        this->kernels.toY16(ir, reinterpret_cast<uint16_t*>(data), KinectIrFormat::pixels, IR_MAX_VALUE);
+    } else {
+        memcpy(data, ir, KinectIrFormat::frameSize);
+    }
+    __atomic_store_n(&slot.frame, frame, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot.sequence, sequence, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot.capture_us, captureUs, __ATOMIC_RELAXED);
+
+    __atomic_store_n(&slot.seq, seq + 2, __ATOMIC_RELEASE);
+    __atomic_store_n(&this->header->latest, frame, __ATOMIC_RELEASE);
+    __atomic_add_fetch(&this->header->futex, 1, __ATOMIC_RELEASE);
+    syscall(SYS_futex, &this->header->futex, FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+    this->frames.store(frame, std::memory_order_relaxed);
+}
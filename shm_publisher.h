@@ -0,0 +1,66 @@
+#ifndef kinect2pipe_IR_shm_publisher_H
+#define kinect2pipe_IR_shm_publisher_H
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <set>
+#include <string>
+#include "event_loop.h"
+#include "ir_convert.h"
+#include "kinect2pipe_shm.h"
+
+/**
+ * Daemon side of the shared memory output described in kinect2pipe_shm.h: the Kinect's IR frames, at full precision,
+ * in a ring of K2P_SHM_SLOTS buffers in a sealed memfd that clients map read only.
+ *
+ * Clients connect to a Unix socket, which is served by the main thread's reactor: each one is sent a read-only
+ * descriptor of the memfd and then only watched for hanging up. publish() is called by whichever thread converts the
+ * frames, the only writer of the mapping, and costs a copy into the mapping plus a futex wake while a client is
+ * connected, nothing otherwise.
+ */
+class ShmPublisher {
+public:
+    // called on the main thread whenever a client connects or hangs up
+    typedef std::function<void(int clients)> ClientsChanged;
+
+    ShmPublisher();
+    ~ShmPublisher();
+
+    ShmPublisher(const ShmPublisher&) = delete;
+    ShmPublisher& operator=(const ShmPublisher&) = delete;
+
+    // format is K2P_SHM_FORMAT_FLOAT or K2P_SHM_FORMAT_Y16
+    bool open(const std::string& socketPath, uint32_t format, EventLoop& loop, ClientsChanged changed);
+    // tells the clients no frame will follow and removes the socket
+    void close();
+    bool active() const { return this->header != nullptr; }
+
+    int      clients() const { return this->clientCount.load(std::memory_order_relaxed); }
+    uint64_t published() const { return this->frames.load(std::memory_order_relaxed); }
+
+    // one KinectIrFormat frame
+    void publish(const float* ir, uint32_t sequence, uint64_t captureUs);
+
+private:
+    std::string     socketPath;
+    EventLoop*      loop;
+    ClientsChanged  changed;
+    int             memFd;
+    int             readOnlyFd;  // what the clients get
+    int             listenFd;
+    size_t          mapBytes;
+    uint8_t*        map;
+    k2p_shm_header* header;      // at the start of map
+    IrKernels       kernels;     // for the Y16 layout
+
+    std::set<int>         clientFds;   // main thread only
+    std::atomic<int>      clientCount; // read by the publishing thread
+    std::atomic<uint64_t> frames;      // written by the publishing thread
+
+    bool createMapping(uint32_t format);
+    void accept();
+    void drop(int fd);
+};
+
+#endif // kinect2pipe_IR_shm_publisher_H
@@ -0,0 +1,126 @@
+#include "stats_server.h"
+#include <iostream>
+#include <sstream>
+#include <cerrno>
+#include <cstring>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+using namespace std;
+
+StatsServer::StatsServer() {
+    this->listenFd = -1;
+    this->wakeFd   = -1;
+    this->stopping.store(false);
+}
+
+StatsServer::~StatsServer() {
+    this->stop();
+}
+
+bool StatsServer::start(const std::string& socketPath, const std::string& filePath, Reporter reporter) {
+    if (socketPath.empty() && filePath.empty()) return true;
+
+    this->socketPath = socketPath;
+    this->filePath   = filePath;
+    this->reporter   = reporter;
+
+    if (!socketPath.empty()) {
+        struct sockaddr_un addr{};
+        addr.sun_family = AF_UNIX;
+        if (socketPath.size() >= sizeof(addr.sun_path)) {
+            cerr << "stats socket path too long: " << socketPath << endl;
+            return false;
+        }
+        strncpy(addr.sun_path, socketPath.c_str(), sizeof(addr.sun_path) - 1);
+
+        this->listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (this->listenFd < 0) {
+            cerr << "failed to create stats socket: " << strerror(errno) << endl;
+            return false;
+        }
+        unlink(socketPath.c_str()); // left over from a previous run
+        if (bind(this->listenFd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(this->listenFd, 4) < 0) {
+            cerr << "failed to listen on stats socket " << socketPath << ": " << strerror(errno) << endl;
+            close(this->listenFd);
+            this->listenFd = -1;
+            return false;
+        }
+    }
+
+    this->wakeFd = eventfd(0, EFD_CLOEXEC);
+    this->stopping.store(false);
+    this->thread = std::thread(&StatsServer::serve, this);
+    return true;
+}
+
+void StatsServer::stop() {
+    if (!this->thread.joinable()) return;
+
+    this->stopping.store(true);
+    uint64_t one = 1;
+    if (write(this->wakeFd, &one, sizeof(one)) < 0) {}
+    this->thread.join();
+    // last report, so a run that ends on its own leaves its final numbers behind
+    if (!this->filePath.empty()) this->writeFile();
+
+    close(this->wakeFd);
+    this->wakeFd = -1;
+    if (this->listenFd >= 0) {
+        close(this->listenFd);
+        this->listenFd = -1;
+        unlink(this->socketPath.c_str());
+    }
+}
+
+void StatsServer::serve() {
+    struct pollfd fds[2] = {{this->wakeFd, POLLIN, 0}, {this->listenFd, POLLIN, 0}};
+    const nfds_t  nfds   = this->listenFd >= 0 ? 2 : 1;
+    const int     timeout = this->filePath.empty() ? -1 : STATS_FILE_INTERVAL_MS;
+
+    while (!this->stopping.load()) {
+        if (!this->filePath.empty()) this->writeFile();
+
+        int r = poll(fds, nfds, timeout);
+        if (r < 0) {
+            if (errno == EINTR) continue;
+            cerr << "stats server: poll failed: " << strerror(errno) << endl;
+            return;
+        }
+        if (nfds < 2 || !(fds[1].revents & POLLIN)) continue;
+
+        int client = accept4(this->listenFd, nullptr, nullptr, SOCK_CLOEXEC);
+        if (client < 0) continue;
+
+        ostringstream report;
+        this->reporter(report);
+        const string text = report.str();
+        // a client that doesn't read just loses the rest of the report
+        struct timeval tv = {1, 0};
+        setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+        size_t sent = 0;
+        while (sent < text.size()) {
+            ssize_t n = send(client, text.data() + sent, text.size() - sent, MSG_NOSIGNAL);
+            if (n <= 0) break;
+            sent += (size_t)n;
+        }
+        close(client);
+    }
+}
+
+void StatsServer::writeFile() {
+    ostringstream report;
+    this->reporter(report);
+    const string text = report.str();
+
+    const string tmp = this->filePath + ".tmp";
+    int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) return;
+    bool ok = write(fd, text.data(), text.size()) == (ssize_t)text.size();
+    close(fd);
+    if (!ok || rename(tmp.c_str(), this->filePath.c_str()) < 0) unlink(tmp.c_str());
+}
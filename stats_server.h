@@ -0,0 +1,47 @@
+#ifndef kinect2pipe_IR_stats_server_H
+#define kinect2pipe_IR_stats_server_H
+
+#include <atomic>
+#include <functional>
+#include <ostream>
+#include <string>
+#include <thread>
+
+// how often the stats file is rewritten
+#define STATS_FILE_INTERVAL_MS 1000
+
+/**
+ * Publishes the daemon's statistics while it runs, without any effect on the capture pipeline.
+ *
+ * With a socket path, every connection to that Unix socket receives the current report and is closed, so
+ * `socat - UNIX-CONNECT:<path>` or `nc -U <path>` polls it. With a file path, the report is rewritten there every
+ * STATS_FILE_INTERVAL_MS through a rename, so readers never see a partial file.
+ */
+class StatsServer {
+public:
+    typedef std::function<void(std::ostream&)> Reporter;
+
+    StatsServer();
+    ~StatsServer();
+
+    StatsServer(const StatsServer&) = delete;
+    StatsServer& operator=(const StatsServer&) = delete;
+
+    // either path may be empty; returns false if the socket can't be set up
+    bool start(const std::string& socketPath, const std::string& filePath, Reporter reporter);
+    void stop();
+
+private:
+    std::string       socketPath;
+    std::string       filePath;
+    Reporter          reporter;
+    int               listenFd;
+    int               wakeFd;     // eventfd that interrupts the server thread on stop()
+    std::thread       thread;
+    std::atomic<bool> stopping;
+
+    void serve();
+    void writeFile();
+};
+
+#endif // kinect2pipe_IR_stats_server_H
@@ -0,0 +1,59 @@
+#include "synthetic_source.h"
+#include <iostream>
+#include "ir_convert.h"
+
+using namespace std;
+
+SyntheticSource::SyntheticSource(double fps) : pacer(fps) {
+    this->sequence = 0;
+}
+
+bool SyntheticSource::start() {
+    const int    w = KinectIrFormat::width;
+    const int    h = KinectIrFormat::height;
+    const size_t n = KinectIrFormat::pixels;
+    this->pattern.resize(n * SYNTHETIC_FRAMES);
+
+    uint32_t noise = 0x2545f491;
+    for (int f = 0; f < SYNTHETIC_FRAMES; ++f) {
+        float*      frame  = this->pattern.data() + f * n;
+        const float cx     = w * (0.2f + 0.6f * f / SYNTHETIC_FRAMES);
+        const float cy     = h * 0.5f;
+        const float radius = h * 0.2f;
+        for (int y = 0; y < h; ++y) {
+            for (int x = 0; x < w; ++x) {
+                float v = IR_MAX_VALUE * 0.25f * (float)(x + y) / (w + h);
+                const float dx = x - cx, dy = y - cy;
+                if (dx * dx + dy * dy < radius * radius) v += IR_MAX_VALUE * 0.5f;
+
+                // xorshift32, a few percent of the full range
+                noise ^= noise << 13;
+                noise ^= noise >> 17;
+                noise ^= noise << 5;
+                v += (float)(noise & 0x7ff);
+
+                frame[(size_t)y * w + x] = v;
+            }
+        }
+    }
+
+    this->sequence = 0;
+    this->pacer.reset();
+    if (this->pacer.fps() > 0.0) {
+        cout << "synthetic source started (" << this->pacer.fps() << " fps)" << endl;
+    } else {
+        cout << "synthetic source started (unthrottled)" << endl;
+    }
+    return true;
+}
+
+FrameSource::ReadResult SyntheticSource::read(SourceFrame& frame, int timeoutMs) {
+    if (!this->pacer.wait(timeoutMs)) return READ_TIMEOUT;
+
+    frame.data      = reinterpret_cast<const uint8_t*>(
+                          this->pattern.data() + (this->sequence % SYNTHETIC_FRAMES) * KinectIrFormat::pixels);
+    frame.bytes     = KinectIrFormat::frameSize;
+    frame.sequence  = this->sequence++;
+    frame.timestamp = this->pacer.timestamp();
+    return READ_FRAME;
+}
@@ -0,0 +1,35 @@
+#ifndef kinect2pipe_IR_synthetic_source_H
+#define kinect2pipe_IR_synthetic_source_H
+
+#include <vector>
+#include "frame_source.h"
+
+// distinct frames rendered up front and cycled through, so generating them costs nothing while the pipeline runs
+#define SYNTHETIC_FRAMES 16
+
+/**
+ * Generated KinectIrFormat frames for running the pipeline without a Kinect: a gradient with a bright disc moving
+ * across it and some noise, delivered at a fixed rate or as fast as they are read (fps 0).
+ */
+class SyntheticSource : public FrameSource {
+public:
+    explicit SyntheticSource(double fps);
+
+    const char* name() const { return "synthetic source"; }
+
+    bool start();
+    void stop() {}
+
+    const FrameFormat& format() const { return KinectIrFormat::format; }
+    double             fps() const { return this->pacer.fps(); }
+
+    ReadResult read(SourceFrame& frame, int timeoutMs);
+    bool       release() { return true; }
+
+private:
+    std::vector<float> pattern;   // SYNTHETIC_FRAMES frames back to back
+    FramePacer         pacer;
+    uint32_t           sequence;
+};
+
+#endif // kinect2pipe_IR_synthetic_source_H
@@ -0,0 +1,302 @@
+#include "tone_map.h"
+#include <algorithm>
+#include <cmath>
+
+// Weight of the newest frame's samples in the histograms. With 1/16 of the pixels sampled per frame this keeps
+// about one full pass over the sampling grid in the statistics.
+#define TONE_HISTOGRAM_DECAY (1.0f - 1.0f / (TONE_SAMPLE_STEP * TONE_SAMPLE_STEP))
+// how fast the percentile range follows the histogram
+#define TONE_RANGE_SMOOTHING 0.25f
+#define TONE_PERCENTILE_LOW  0.01f
+#define TONE_PERCENTILE_HIGH 0.99f
+// narrowest range the percentile mode stretches over, so a flat scene does not turn into amplified noise
+#define TONE_MIN_RANGE 256.0f
+// CLAHE clip limit as a multiple of the average bin count of a tile
+#define TONE_CLAHE_CLIP 3.0f
+// the vertical blend between tile rows is quantised to this many steps so the blended row curves only have to be
+// rebuilt a few times per tile row
+#define TONE_CLAHE_ROW_STEPS 16
+// how far the range may drift, relative to the one the tile histograms are binned against, before they are rebinned
+#define TONE_CLAHE_REBIN 0.02f
+
+static const float LUT_INDEX_SCALE = (float)TONE_LUT_SIZE / 65536.0f;
+static const float LUT_BIN_WIDTH   = 65536.0f / TONE_LUT_SIZE;
+
+ToneMapper::ToneMapper(int width, int height)
+    : histogram(TONE_LUT_SIZE, 0.0f),
+      lut(TONE_LUT_SIZE + IR_LUT_PADDING, 0),
+      tileHistograms(TONE_CLAHE_TILES_X * TONE_CLAHE_TILES_Y * TONE_CLAHE_BINS, 0.0f),
+      tileLuts(TONE_CLAHE_TILES_X * TONE_CLAHE_TILES_Y * TONE_CLAHE_BINS, 0),
+      rowLuts(TONE_CLAHE_TILES_X * TONE_CLAHE_BINS, 0) {
+    this->toneMode    = TONE_FIXED;
+    this->gamma       = 2.2f;
+    this->lumaMin     = IR_LUMA_MIN;
+    this->lumaRange   = IR_LUMA_RANGE;
+    this->frameCount  = 0;
+    this->rangeLow    = 0.0f;
+    this->rangeHigh   = 0.0f;
+    this->tileRange   = 0.0f;
+    this->samplePhase = 0;
+
+    this->setSize(width, height);
+    this->buildGammaLut();
+}
+
+void ToneMapper::setSize(int width, int height) {
+    this->width  = width;
+    this->height = height;
+    this->columnTile.resize(width);
+    this->columnWeight.resize(width);
+
+    // Each column blends the curves of the two tiles whose centres surround it, 8-bit weight of the right one.
+    const float tileWidth = (float)width / TONE_CLAHE_TILES_X;
+    for (int x = 0; x < width; ++x) {
+        float fx = (x + 0.5f) / tileWidth - 0.5f;
+        int   tx = std::min(std::max((int)std::floor(fx), 0), TONE_CLAHE_TILES_X - 1);
+        float w  = tx == TONE_CLAHE_TILES_X - 1 ? 0.0f : std::min(std::max(fx - tx, 0.0f), 1.0f);
+        this->columnTile[x]   = (uint16_t)tx;
+        this->columnWeight[x] = (uint16_t)(w * 256.0f + 0.5f);
+    }
+}
+
+void ToneMapper::setMode(ToneMode mode) {
+    this->toneMode = mode;
+    this->buildGammaLut();
+}
+
+void ToneMapper::setGamma(float gamma) {
+    this->gamma = gamma > 0.0f ? gamma : 1.0f;
+    this->buildGammaLut();
+}
+
+void ToneMapper::setOutputRange(int lumaMin, int lumaRange) {
+    this->lumaMin   = lumaMin;
+    this->lumaRange = lumaRange;
+    this->buildGammaLut();
+}
+
+void ToneMapper::apply(const IrKernels& kernels, const float* src, uint8_t* dst) {
+    const size_t n = (size_t)this->width * this->height;
+
+    switch (this->toneMode) {
+        case TONE_GAMMA:
+            break;
+        case TONE_PERCENTILE:
+            this->sample(src);
+            this->updateRange();
+            this->buildPercentileLut();
+            break;
+        case TONE_CLAHE:
+            // the tile samples are binned against the range they are looked up with, so it is settled first
+            this->sample(src);
+            this->updateRange();
+            this->rebinTiles();
+            this->sampleTiles(src);
+            this->buildTileLuts();
+            this->applyClahe(src, dst);
+            return;
+        case TONE_FIXED:
+        default:
+            kernels.toLuma(src, dst, n, IR_MAX_VALUE, this->lumaMin, this->lumaRange);
+            return;
+    }
+
+    kernels.toLumaLut(src, dst, n, LUT_INDEX_SCALE, this->lut.data(), TONE_LUT_SIZE - 1);
+}
+
+// Decays the global histogram and adds this frame's share of the sampling grid to it.
+void ToneMapper::sample(const float* src) {
+    this->samplePhase = this->frameCount++ % (TONE_SAMPLE_STEP * TONE_SAMPLE_STEP);
+    const int x0 = (int)(this->samplePhase % TONE_SAMPLE_STEP);
+    const int y0 = (int)(this->samplePhase / TONE_SAMPLE_STEP);
+
+    for (float& h : this->histogram) h *= TONE_HISTOGRAM_DECAY;
+
+    for (int y = y0; y < this->height; y += TONE_SAMPLE_STEP) {
+        const float* row = src + (size_t)y * this->width;
+        for (int x = x0; x < this->width; x += TONE_SAMPLE_STEP) {
+            float v = row[x];
+            if (!(v > 0.0f)) v = 0.0f;
+            if (v > IR_MAX_VALUE) v = IR_MAX_VALUE;
+            this->histogram[(int)(v * LUT_INDEX_SCALE)] += 1.0f;
+        }
+    }
+}
+
+// The same for the tile histograms of TONE_CLAHE, on the grid sample() used and binned over [0, tileRange].
+void ToneMapper::sampleTiles(const float* src) {
+    const int x0 = (int)(this->samplePhase % TONE_SAMPLE_STEP);
+    const int y0 = (int)(this->samplePhase / TONE_SAMPLE_STEP);
+
+    if (this->tileRange <= 0.0f) return;
+    for (float& h : this->tileHistograms) h *= TONE_HISTOGRAM_DECAY;
+    const float tileScale = TONE_CLAHE_BINS / this->tileRange;
+
+    for (int y = y0; y < this->height; y += TONE_SAMPLE_STEP) {
+        const float* row     = src + (size_t)y * this->width;
+        float*       tileRow = &this->tileHistograms[(size_t)(y * TONE_CLAHE_TILES_Y / this->height) *
+                                                     TONE_CLAHE_TILES_X * TONE_CLAHE_BINS];
+        for (int x = x0; x < this->width; x += TONE_SAMPLE_STEP) {
+            float v = row[x] * tileScale;
+            if (!(v > 0.0f)) v = 0.0f;
+            const int bin = std::min((int)v, TONE_CLAHE_BINS - 1);
+            tileRow[(x * TONE_CLAHE_TILES_X / this->width) * TONE_CLAHE_BINS + bin] += 1.0f;
+        }
+    }
+}
+
+// Moves the tile histograms onto bins over the current [0, rangeHigh] once it has drifted noticeably from the range
+// they were binned against, spreading every old bin over the new bins it overlaps.
+void ToneMapper::rebinTiles() {
+    if (this->rangeHigh <= 0.0f) return;
+    if (this->tileRange > 0.0f && std::fabs(this->rangeHigh - this->tileRange) <= this->tileRange * TONE_CLAHE_REBIN) {
+        return;
+    }
+    if (this->tileRange > 0.0f) {
+        // width of an old bin in new bins
+        const float ratio = this->tileRange / this->rangeHigh;
+        float       moved[TONE_CLAHE_BINS];
+        for (int t = 0; t < TONE_CLAHE_TILES_X * TONE_CLAHE_TILES_Y; ++t) {
+            float* h = &this->tileHistograms[(size_t)t * TONE_CLAHE_BINS];
+            std::fill(moved, moved + TONE_CLAHE_BINS, 0.0f);
+            for (int b = 0; b < TONE_CLAHE_BINS; ++b) {
+                if (h[b] <= 0.0f) continue;
+                const float lo      = b * ratio;
+                const float hi      = lo + ratio;
+                const float density = h[b] / ratio;
+                for (int n = (int)lo; n < TONE_CLAHE_BINS && n < hi; ++n) {
+                    moved[n] += density * (std::min(hi, n + 1.0f) - std::max(lo, (float)n));
+                }
+                // what lies above the new range goes to its top bin, where lookups clamp as well
+                if (hi > TONE_CLAHE_BINS) {
+                    moved[TONE_CLAHE_BINS - 1] += density * (hi - std::max(lo, (float)TONE_CLAHE_BINS));
+                }
+            }
+            std::copy(moved, moved + TONE_CLAHE_BINS, h);
+        }
+    }
+    this->tileRange = this->rangeHigh;
+}
+
+// Moves the smoothed range towards the current low and high percentiles of the global histogram.
+void ToneMapper::updateRange() {
+    float total = 0.0f;
+    for (float h : this->histogram) total += h;
+    if (total <= 0.0f) return;
+
+    const float lowCount  = total * TONE_PERCENTILE_LOW;
+    const float highCount = total * TONE_PERCENTILE_HIGH;
+    int   lowBin = -1, highBin = TONE_LUT_SIZE - 1;
+    float sum    = 0.0f;
+    for (int b = 0; b < TONE_LUT_SIZE; ++b) {
+        sum += this->histogram[b];
+        if (lowBin < 0 && sum >= lowCount) lowBin = b;
+        if (sum >= highCount) { highBin = b; break; }
+    }
+
+    float low  = std::max(lowBin, 0) * LUT_BIN_WIDTH;
+    float high = (highBin + 1) * LUT_BIN_WIDTH;
+    if (high - low < TONE_MIN_RANGE) {
+        high = std::min(low + TONE_MIN_RANGE, IR_MAX_VALUE + 1.0f);
+        low  = high - TONE_MIN_RANGE;
+    }
+
+    if (this->rangeHigh <= 0.0f) {
+        this->rangeLow  = low;
+        this->rangeHigh = high;
+    } else {
+        this->rangeLow  += (low  - this->rangeLow)  * TONE_RANGE_SMOOTHING;
+        this->rangeHigh += (high - this->rangeHigh) * TONE_RANGE_SMOOTHING;
+    }
+}
+
+void ToneMapper::buildGammaLut() {
+    if (this->toneMode != TONE_GAMMA) return;
+
+    const float exponent = 1.0f / this->gamma;
+    for (int b = 0; b < TONE_LUT_SIZE; ++b) {
+        float x = std::min(((float)b + 0.5f) * LUT_BIN_WIDTH / IR_MAX_VALUE, 1.0f);
+        this->lut[b] = (uint8_t)(this->lumaMin + (int)(std::pow(x, exponent) * this->lumaRange + 0.5f));
+    }
+}
+
+void ToneMapper::buildPercentileLut() {
+    const float scale = this->lumaRange / (this->rangeHigh - this->rangeLow);
+    for (int b = 0; b < TONE_LUT_SIZE; ++b) {
+        float v = ((float)b + 0.5f) * LUT_BIN_WIDTH - this->rangeLow;
+        float y = std::min(std::max(v * scale, 0.0f), (float)this->lumaRange);
+        this->lut[b] = (uint8_t)(this->lumaMin + (int)(y + 0.5f));
+    }
+}
+
+// Clip-limited equalisation curve of every tile, the excess above the clip limit spread evenly over all bins.
+void ToneMapper::buildTileLuts() {
+    for (int t = 0; t < TONE_CLAHE_TILES_X * TONE_CLAHE_TILES_Y; ++t) {
+        const float* h   = &this->tileHistograms[(size_t)t * TONE_CLAHE_BINS];
+        uint8_t*     out = &this->tileLuts[(size_t)t * TONE_CLAHE_BINS];
+
+        float total = 0.0f;
+        for (int b = 0; b < TONE_CLAHE_BINS; ++b) total += h[b];
+        if (total <= 0.0f) {
+            for (int b = 0; b < TONE_CLAHE_BINS; ++b) {
+                out[b] = (uint8_t)(this->lumaMin + (b * this->lumaRange + TONE_CLAHE_BINS / 2) / TONE_CLAHE_BINS);
+            }
+            continue;
+        }
+
+        const float clip   = TONE_CLAHE_CLIP * total / TONE_CLAHE_BINS;
+        float       excess = 0.0f;
+        for (int b = 0; b < TONE_CLAHE_BINS; ++b) excess += std::max(h[b] - clip, 0.0f);
+        const float spread = excess / TONE_CLAHE_BINS;
+        const float scale  = this->lumaRange / total;
+
+        float cdf = 0.0f;
+        for (int b = 0; b < TONE_CLAHE_BINS; ++b) {
+            cdf += std::min(h[b], clip) + spread;
+            out[b] = (uint8_t)(this->lumaMin + (int)(std::min(cdf * scale, (float)this->lumaRange) + 0.5f));
+        }
+    }
+}
+
+// Bilinear interpolation between the curves of the four surrounding tiles. The vertical blend is done once per
+// TONE_CLAHE_ROW_STEPS step into rowLuts, leaving two lookups and a horizontal blend per pixel.
+void ToneMapper::applyClahe(const float* src, uint8_t* dst) {
+    const float tileHeight = (float)this->height / TONE_CLAHE_TILES_Y;
+    const float scale      = this->tileRange > 0.0f ? TONE_CLAHE_BINS / this->tileRange : 0.0f;
+    const float lastBin    = TONE_CLAHE_BINS - 1;
+    const int   rowLen     = TONE_CLAHE_TILES_X * TONE_CLAHE_BINS;
+    int builtTile = -1, builtStep = -1;
+
+    for (int y = 0; y < this->height; ++y) {
+        float fy   = (y + 0.5f) / tileHeight - 0.5f;
+        int   ty   = std::min(std::max((int)std::floor(fy), 0), TONE_CLAHE_TILES_Y - 1);
+        int   ty1  = std::min(ty + 1, TONE_CLAHE_TILES_Y - 1);
+        float wy   = std::min(std::max(fy - ty, 0.0f), 1.0f);
+        int   step = (int)(wy * TONE_CLAHE_ROW_STEPS + 0.5f);
+
+        if (ty != builtTile || step != builtStep) {
+            const uint8_t* top    = &this->tileLuts[(size_t)ty  * rowLen];
+            const uint8_t* bottom = &this->tileLuts[(size_t)ty1 * rowLen];
+            for (int i = 0; i < rowLen; ++i) {
+                this->rowLuts[i] = (uint8_t)((top[i] * (TONE_CLAHE_ROW_STEPS - step) + bottom[i] * step +
+                                              TONE_CLAHE_ROW_STEPS / 2) / TONE_CLAHE_ROW_STEPS);
+            }
+            builtTile = ty;
+            builtStep = step;
+        }
+
+        const float* in  = src + (size_t)y * this->width;
+        uint8_t*     out = dst + (size_t)y * this->width;
+        for (int x = 0; x < this->width; ++x) {
+            float v = in[x] * scale;
+            if (!(v > 0.0f)) v = 0.0f;
+            if (v > lastBin) v = lastBin;
+            const int      bin   = (int)v;
+            const int      tx    = this->columnTile[x];
+            const int      w     = this->columnWeight[x];
+            const uint8_t* left  = &this->rowLuts[tx * TONE_CLAHE_BINS];
+            const uint8_t* right = w ? left + TONE_CLAHE_BINS : left;
+            out[x] = (uint8_t)((left[bin] * (256 - w) + right[bin] * w + 128) >> 8);
+        }
+    }
+}
@@ -0,0 +1,89 @@
+#ifndef kinect2pipe_IR_tone_map_H
+#define kinect2pipe_IR_tone_map_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "ir_convert.h"
+
+// Global tone curves are tables of TONE_LUT_SIZE entries, each covering 16 IR units of the 0..65535 range.
+#define TONE_LUT_BITS 12
+#define TONE_LUT_SIZE (1 << TONE_LUT_BITS)
+
+// Statistics are gathered on every TONE_SAMPLE_STEP-th pixel of every TONE_SAMPLE_STEP-th row, with the grid shifted
+// each frame so all pixels are visited every TONE_SAMPLE_STEP^2 frames.
+#define TONE_SAMPLE_STEP 4
+
+// Local equalisation grid and the number of histogram bins per tile.
+#define TONE_CLAHE_TILES_X 8
+#define TONE_CLAHE_TILES_Y 8
+#define TONE_CLAHE_BINS    256
+
+enum ToneMode {
+    TONE_FIXED,      // linear over the full 0..65535 IR range, the original mapping
+    TONE_GAMMA,      // fixed power curve over the full range, brightens the dark band faces sit in
+    TONE_PERCENTILE, // linear between the 1st and 99th percentile of recent frames
+    TONE_CLAHE,      // contrast-limited equalisation of 8x8 tiles, interpolated between tiles
+};
+
+/**
+ * Maps IR frames onto 8-bit luma for the GREY and YUV420 outputs.
+ *
+ * The adaptive modes never look at a whole frame to decide the mapping. Each frame adds 1/16th of its pixels (a
+ * sparse grid that moves every frame) to histograms that decay exponentially, so the statistics cover roughly the
+ * last TONE_SAMPLE_STEP^2 frames and follow changes in lighting smoothly. The resulting curve is stored as a lookup
+ * table and applied in the same pass that writes the Y plane.
+ *
+ * Only used from the converter thread.
+ */
+class ToneMapper {
+public:
+    ToneMapper(int width, int height);
+
+    void     setMode(ToneMode mode);
+    ToneMode mode() const { return this->toneMode; }
+    // exponent of the TONE_GAMMA curve is 1 / gamma, so values above 1 brighten
+    void     setGamma(float gamma);
+    // output values of the curve, IR_LUMA_MIN / IR_LUMA_RANGE for YUV420 or IR_GREY_MIN / IR_GREY_RANGE for GREY
+    void     setOutputRange(int lumaMin, int lumaRange);
+    // size of the frames passed to apply(), for outputs cropped or scaled from the Kinect frame
+    void     setSize(int width, int height);
+
+    // Converts one frame of width x height IR values into 8-bit luma in dst, updating the statistics with it first.
+    void apply(const IrKernels& kernels, const float* src, uint8_t* dst);
+
+private:
+    int      width;
+    int      height;
+    ToneMode toneMode;
+    float    gamma;
+    int      lumaMin;
+    int      lumaRange;
+    unsigned frameCount;
+    unsigned samplePhase;  // position of the sampling grid in the current frame
+
+    // global histogram over the TONE_LUT_SIZE bins, and the curve derived from it
+    std::vector<float>   histogram;
+    std::vector<uint8_t> lut;        // TONE_LUT_SIZE entries plus IR_LUT_PADDING
+    float                rangeLow;   // smoothed percentiles, in IR units
+    float                rangeHigh;
+
+    // per tile histograms and curves for TONE_CLAHE, binned over [0, tileRange], which follows rangeHigh
+    float                 tileRange;
+    std::vector<float>    tileHistograms;
+    std::vector<uint8_t>  tileLuts;
+    std::vector<uint8_t>  rowLuts;    // tile curves of one tile row blended for the current output row
+    std::vector<uint16_t> columnTile; // left tile of each column and its weight for the horizontal blend
+    std::vector<uint16_t> columnWeight;
+
+    void sample(const float* src);
+    void sampleTiles(const float* src);
+    void rebinTiles();
+    void updateRange();
+    void buildGammaLut();
+    void buildPercentileLut();
+    void buildTileLuts();
+    void applyClahe(const float* src, uint8_t* dst);
+};
+
+#endif // kinect2pipe_IR_tone_map_H
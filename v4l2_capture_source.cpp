@@ -0,0 +1,275 @@
+#include "v4l2_capture_source.h"
+#include <iostream>
+#include <cerrno>
+#include <cstring>
+#include <linux/videodev2.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <poll.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+using namespace std;
+
+V4L2CaptureSource::V4L2CaptureSource(const std::string& path) {
+    this->path        = path;
+    this->fd          = -1;
+    this->capFmt      = FrameFormat{};
+    this->camFps      = CAPTURE_DEFAULT_FPS;
+    this->maxFps      = 0.0;
+    this->preferMjpeg = false;
+    this->streaming   = false;
+    this->prepared    = false;
+    this->held        = 0;
+}
+
+V4L2CaptureSource::~V4L2CaptureSource() {
+    this->stop();
+    this->closeDevice();
+}
+
+bool V4L2CaptureSource::prepare() {
+    if (this->fd < 0 && !this->openDevice()) return false;
+    if (!this->prepared) {
+        cout << "backup device ready (" << this->capFmt.width << "x" << this->capFmt.height << " at "
+             << this->camFps << " fps)" << endl;
+    }
+    this->prepared = true;
+    return true;
+}
+
+// Opens the device, settles the format and frame rate and maps the buffers: everything but streaming.
+bool V4L2CaptureSource::openDevice() {
+    this->fd = open(this->path.c_str(), O_RDWR | O_NONBLOCK);
+    if (this->fd < 0) {
+        cerr << "failed to open backup device: " << strerror(errno) << endl;
+        return false;
+    }
+
+    // Try to negotiate YUYV, or large MJPEG frames if asked to; if the driver refuses, accept whatever it gives us.
+    struct v4l2_format fmt{};
+    fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    if (ioctl(this->fd, VIDIOC_G_FMT, &fmt) < 0) {
+        cerr << "backup device: VIDIOC_G_FMT failed: " << strerror(errno) << endl;
+        this->closeDevice();
+        return false;
+    }
+    uint32_t width  = 0;
+    uint32_t height = 0;
+    const double fps = this->maxFps > 0.0 ? this->maxFps : CAPTURE_DEFAULT_FPS;
+    if (this->preferMjpeg && this->largestMjpegSize(fps, width, height)) {
+        fmt.fmt.pix.pixelformat  = V4L2_PIX_FMT_MJPEG;
+        fmt.fmt.pix.width        = width;
+        fmt.fmt.pix.height       = height;
+        fmt.fmt.pix.bytesperline = 0;
+        fmt.fmt.pix.sizeimage    = 0;
+    } else {
+        if (this->preferMjpeg) cerr << "backup device: no MJPEG at " << fps << " fps, asking for YUYV" << endl;
+        fmt.fmt.pix.pixelformat = V4L2_PIX_FMT_YUYV;
+    }
+    if (ioctl(this->fd, VIDIOC_S_FMT, &fmt) < 0) {
+        cerr << "backup device: driver refused "
+             << (fmt.fmt.pix.pixelformat == V4L2_PIX_FMT_MJPEG ? "MJPEG" : "YUYV") << ", using native format" << endl;
+    }
+    ioctl(this->fd, VIDIOC_G_FMT, &fmt);   // re-read what was actually set
+
+    this->capFmt = FrameFormat::fromV4L2(fmt.fmt.pix);
+    if (!this->capFmt.valid()) {
+        const uint32_t pixfmt = fmt.fmt.pix.pixelformat;
+        cerr << "backup device: unsupported pixel format: "
+             << (char)(pixfmt & 0xff)         << (char)((pixfmt >> 8) & 0xff)
+             << (char)((pixfmt >> 16) & 0xff) << (char)((pixfmt >> 24) & 0xff)
+             << endl;
+        this->closeDevice();
+        return false;
+    }
+
+    this->negotiateFrameRate();
+
+    if (!this->mapBuffers()) {
+        this->closeDevice();
+        return false;
+    }
+    return true;
+}
+
+bool V4L2CaptureSource::start() {
+    if (this->streaming) return true;
+    if (this->fd < 0 && !this->openDevice()) return false;
+
+    // STREAMOFF took every buffer back, so all of them are queued again
+    for (unsigned i = 0; i < this->bufs.size(); i++) {
+        struct v4l2_buffer buf{};
+        buf.type   = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        buf.memory = V4L2_MEMORY_MMAP;
+        buf.index  = i;
+        if (ioctl(this->fd, VIDIOC_QBUF, &buf) < 0) {
+            cerr << "backup device: VIDIOC_QBUF failed: " << strerror(errno) << endl;
+            this->stop();
+            return false;
+        }
+    }
+
+    enum v4l2_buf_type btype = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    if (ioctl(this->fd, VIDIOC_STREAMON, &btype) < 0) {
+        cerr << "backup device: VIDIOC_STREAMON failed: " << strerror(errno) << endl;
+        this->stop();
+        return false;
+    }
+    this->streaming = true;
+
+    cout << "backup device stream started (" << this->capFmt.width << "x" << this->capFmt.height << " at "
+         << this->camFps << " fps)" << endl;
+    return true;
+}
+
+// Ask the camera for the capped rate directly, so frames we would throw away are never captured. Whatever it settles
+// on becomes the source rate, and the governor still drops frames when the driver can't go as low.
+void V4L2CaptureSource::negotiateFrameRate() {
+    struct v4l2_streamparm parm{};
+    parm.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    if (ioctl(this->fd, VIDIOC_G_PARM, &parm) < 0) return;
+
+    if (this->maxFps > 0.0 && (parm.parm.capture.capability & V4L2_CAP_TIMEPERFRAME)) {
+        parm.parm.capture.timeperframe.numerator   = 1000;
+        parm.parm.capture.timeperframe.denominator = (uint32_t)(this->maxFps * 1000.0);
+        if (ioctl(this->fd, VIDIOC_S_PARM, &parm) < 0) {
+            cerr << "backup device: driver refused the frame interval, skipping frames instead" << endl;
+        }
+        ioctl(this->fd, VIDIOC_G_PARM, &parm);
+    }
+    const struct v4l2_fract& tpf = parm.parm.capture.timeperframe;
+    if (tpf.numerator && tpf.denominator) this->camFps = (double)tpf.denominator / tpf.numerator;
+}
+
+// The largest frame size the camera captures MJPEG at, at no less than fps frames per second. False if it doesn't
+// capture MJPEG at all.
+bool V4L2CaptureSource::largestMjpegSize(double fps, uint32_t& width, uint32_t& height) {
+    bool found = false;
+    struct v4l2_frmsizeenum size{};
+    size.pixel_format = V4L2_PIX_FMT_MJPEG;
+    for (size.index = 0; ioctl(this->fd, VIDIOC_ENUM_FRAMESIZES, &size) == 0; size.index++) {
+        const bool     discrete = size.type == V4L2_FRMSIZE_TYPE_DISCRETE;
+        const uint32_t w        = discrete ? size.discrete.width : size.stepwise.max_width;
+        const uint32_t h        = discrete ? size.discrete.height : size.stepwise.max_height;
+        if (found && (uint64_t)w * h <= (uint64_t)width * height) continue;
+        if (!this->capturesAt(V4L2_PIX_FMT_MJPEG, w, h, fps)) continue;
+        width  = w;
+        height = h;
+        found  = true;
+        if (!discrete) break;
+    }
+    return found;
+}
+
+// Whether the camera captures pixelformat at width x height at fps or faster. Drivers that don't list their frame
+// intervals are taken at their word.
+bool V4L2CaptureSource::capturesAt(uint32_t pixelformat, uint32_t width, uint32_t height, double fps) {
+    struct v4l2_frmivalenum ival{};
+    ival.pixel_format = pixelformat;
+    ival.width        = width;
+    ival.height       = height;
+    // a little slack for intervals like 1001/30000
+    const double wanted = fps * 0.99;
+    for (ival.index = 0; ioctl(this->fd, VIDIOC_ENUM_FRAMEINTERVALS, &ival) == 0; ival.index++) {
+        // for a range, its shortest interval
+        const struct v4l2_fract& tpf = ival.type == V4L2_FRMIVAL_TYPE_DISCRETE ? ival.discrete : ival.stepwise.min;
+        if (tpf.numerator && (double)tpf.denominator / tpf.numerator >= wanted) return true;
+        if (ival.type != V4L2_FRMIVAL_TYPE_DISCRETE) return false;
+    }
+    return ival.index == 0;
+}
+
+bool V4L2CaptureSource::mapBuffers() {
+    struct v4l2_requestbuffers req{};
+    req.count  = CAPTURE_BUFFERS;
+    req.type   = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    req.memory = V4L2_MEMORY_MMAP;
+    if (ioctl(this->fd, VIDIOC_REQBUFS, &req) < 0 || req.count < 1) {
+        cerr << "backup device: VIDIOC_REQBUFS failed: " << strerror(errno) << endl;
+        return false;
+    }
+
+    for (unsigned i = 0; i < req.count; i++) {
+        struct v4l2_buffer buf{};
+        buf.type   = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        buf.memory = V4L2_MEMORY_MMAP;
+        buf.index  = i;
+        if (ioctl(this->fd, VIDIOC_QUERYBUF, &buf) < 0) return false;
+
+        void* start = mmap(nullptr, buf.length, PROT_READ | PROT_WRITE, MAP_SHARED, this->fd, buf.m.offset);
+        if (start == MAP_FAILED) return false;
+        this->bufs.push_back(BufInfo{start, buf.length});
+    }
+    return true;
+}
+
+void V4L2CaptureSource::unmapBuffers() {
+    for (auto& b : this->bufs) munmap(b.start, b.length);
+    this->bufs.clear();
+}
+
+// A prepared device keeps its buffers and stays open, so the next start() only has to queue them and STREAMON.
+void V4L2CaptureSource::stop() {
+    if (this->fd < 0) return;
+
+    // also takes back the buffers of a start() that failed half way
+    enum v4l2_buf_type btype = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    ioctl(this->fd, VIDIOC_STREAMOFF, &btype);
+    this->streaming = false;
+    if (!this->prepared) this->closeDevice();
+}
+
+void V4L2CaptureSource::closeDevice() {
+    if (this->fd < 0) return;
+    this->unmapBuffers();
+    close(this->fd);
+    this->fd = -1;
+}
+
+FrameSource::ReadResult V4L2CaptureSource::read(SourceFrame& frame, int timeoutMs) {
+    // The device is non-blocking: when the caller has already seen it ready the frame is dequeued straight away,
+    // otherwise it is waited for once.
+    struct v4l2_buffer buf{};
+    buf.type   = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    buf.memory = V4L2_MEMORY_MMAP;
+    if (ioctl(this->fd, VIDIOC_DQBUF, &buf) < 0) {
+        if (errno != EAGAIN) return READ_ERROR;
+        if (timeoutMs <= 0) return READ_TIMEOUT;
+
+        struct pollfd pfd = {this->fd, POLLIN, 0};
+        int r = poll(&pfd, 1, timeoutMs);
+        if (r < 0) return errno == EINTR ? READ_TIMEOUT : READ_ERROR;
+        if (r == 0) return READ_TIMEOUT;
+        if (ioctl(this->fd, VIDIOC_DQBUF, &buf) < 0) {
+            return errno == EAGAIN ? READ_TIMEOUT : READ_ERROR;
+        }
+    }
+
+    this->held      = buf.index;
+    frame.data      = (const uint8_t*)this->bufs[buf.index].start;
+    frame.bytes     = buf.bytesused;
+    frame.sequence  = buf.sequence;
+    frame.timestamp = (uint32_t)(buf.timestamp.tv_sec * 10000 + buf.timestamp.tv_usec / 100);
+    return READ_FRAME;
+}
+
+bool V4L2CaptureSource::release() {
+    struct v4l2_buffer buf{};
+    buf.type   = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    buf.memory = V4L2_MEMORY_MMAP;
+    buf.index  = this->held;
+    return ioctl(this->fd, VIDIOC_QBUF, &buf) == 0;
+}
+
+// Hands every frame the camera has filled straight back to it. Keeps a hot standby camera streaming, with its exposure
+// settled, without anybody looking at the frames.
+bool V4L2CaptureSource::discardFrames() {
+    while (true) {
+        struct v4l2_buffer buf{};
+        buf.type   = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        buf.memory = V4L2_MEMORY_MMAP;
+        if (ioctl(this->fd, VIDIOC_DQBUF, &buf) < 0) return errno == EAGAIN;
+        if (ioctl(this->fd, VIDIOC_QBUF, &buf) < 0) return false;
+    }
+}
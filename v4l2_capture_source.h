@@ -0,0 +1,73 @@
+#ifndef kinect2pipe_IR_v4l2_capture_source_H
+#define kinect2pipe_IR_v4l2_capture_source_H
+
+#include <string>
+#include <vector>
+#include "frame_source.h"
+
+// assumed when the driver doesn't report its frame interval
+#define CAPTURE_DEFAULT_FPS 30.0
+// capture buffers asked for: one being converted, one the camera fills meanwhile and spares for when a conversion
+// runs late, so the camera never runs out
+#define CAPTURE_BUFFERS 4
+
+/**
+ * A V4L2 capture device such as a webcam, read through MMAP buffers. YUYV is asked for, or with setPreferMjpeg() the
+ * largest size the camera captures MJPEG at; when the driver refuses, its own format is used as long as it can be
+ * converted. Frames are handed out straight from the mapped capture buffers.
+ *
+ * prepare() opens the device and maps its buffers ahead of time, so start() only has to STREAMON: this is what the
+ * daemon does with the backup camera to switch over to it within a frame interval.
+ */
+class V4L2CaptureSource : public FrameSource {
+public:
+    explicit V4L2CaptureSource(const std::string& path);
+    ~V4L2CaptureSource();
+
+    const char* name() const { return "backup device"; }
+
+    bool prepare();
+    bool start();
+    void stop();
+    bool streams() const { return this->streaming; }
+
+    const FrameFormat& format() const { return this->capFmt; }
+    double             fps() const { return this->camFps; }
+
+    int        pollFd() const { return this->fd; }
+    ReadResult read(SourceFrame& frame, int timeoutMs);
+    bool       release();
+
+    // asks the driver for this frame interval, so frames that would be thrown away are never captured
+    void setMaxFps(double fps) { this->maxFps = fps; }
+    // asks for MJPEG at the largest size the camera captures it at the frame rate, which is usually much larger than
+    // the sizes it can send uncompressed at that rate; YUYV if it has none. Must be set before prepare().
+    void setPreferMjpeg(bool enable) { this->preferMjpeg = enable; }
+
+    // requeues every filled buffer unread, for a device that streams only to be ready; false if the device failed
+    bool discardFrames();
+
+private:
+    struct BufInfo { void* start; size_t length; };
+
+    std::string          path;
+    int                  fd;
+    FrameFormat          capFmt;
+    double               camFps;
+    double               maxFps;
+    bool                 preferMjpeg;
+    std::vector<BufInfo> bufs;
+    bool                 streaming;
+    bool                 prepared;  // stays open across stop() and start()
+    unsigned             held;     // index of the buffer handed out by read()
+
+    bool openDevice();
+    void closeDevice();
+    void negotiateFrameRate();
+    bool largestMjpegSize(double fps, uint32_t& width, uint32_t& height);
+    bool capturesAt(uint32_t pixelformat, uint32_t width, uint32_t height, double fps);
+    bool mapBuffers();
+    void unmapBuffers();
+};
+
+#endif // kinect2pipe_IR_v4l2_capture_source_H
@@ -0,0 +1,71 @@
+#include "worker_group.h"
+#include <sched.h>
+
+using namespace std;
+
+WorkerGroup::WorkerGroup(int threads) {
+    if (threads <= 0) {
+        cpu_set_t allowed;
+        CPU_ZERO(&allowed);
+        threads = sched_getaffinity(0, sizeof(allowed), &allowed) == 0 ? CPU_COUNT(&allowed) : 1;
+    }
+    this->work       = nullptr;
+    this->parts      = 0;
+    this->next       = 0;
+    this->pending    = 0;
+    this->generation = 0;
+    this->stopping   = false;
+    for (int i = 1; i < threads; ++i) {
+        this->workers.push_back(thread(&WorkerGroup::workerLoop, this));
+    }
+}
+
+WorkerGroup::~WorkerGroup() {
+    {
+        lock_guard<std::mutex> lk(this->mutex);
+        this->stopping = true;
+    }
+    this->workCv.notify_all();
+    for (auto& t : this->workers) t.join();
+}
+
+void WorkerGroup::run(int parts, const Work& work) {
+    if (this->workers.empty() || parts <= 1) {
+        for (int part = 0; part < parts; ++part) work(part);
+        return;
+    }
+
+    unique_lock<std::mutex> lk(this->mutex);
+    this->work    = &work;
+    this->parts   = parts;
+    this->next    = 0;
+    this->pending = parts;
+    this->generation++;
+    this->workCv.notify_all();
+
+    this->drain(lk);
+    this->doneCv.wait(lk, [this]{ return this->pending == 0; });
+    this->work = nullptr;
+}
+
+void WorkerGroup::workerLoop() {
+    unique_lock<std::mutex> lk(this->mutex);
+    uint64_t seen = 0;
+    while (true) {
+        this->workCv.wait(lk, [this, seen]{ return this->stopping || this->generation != seen; });
+        if (this->stopping) return;
+        seen = this->generation;
+        this->drain(lk);
+    }
+}
+
+void WorkerGroup::drain(unique_lock<std::mutex>& lk) {
+    while (this->next < this->parts) {
+        const int   part = this->next++;
+        const Work& work = *this->work;
+        lk.unlock();
+        work(part);
+        lk.lock();
+        if (--this->pending == 0) this->doneCv.notify_all();
+    }
+}
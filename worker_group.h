@@ -0,0 +1,52 @@
+#ifndef kinect2pipe_IR_worker_group_H
+#define kinect2pipe_IR_worker_group_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * Splits one piece of work, e.g. the rows of a frame, into parts that run at the same time. The thread calling run()
+ * works on the parts too, so a group of n threads starts only n - 1 of its own, and a group of one runs everything
+ * on the caller without any synchronisation.
+ *
+ * Unlike ConversionPool, which keeps the frames of different devices apart, the parts of a run belong to a single
+ * frame: run() returns once every one of them is done. Only one thread may call run() at a time.
+ */
+class WorkerGroup {
+public:
+    typedef std::function<void(int part)> Work;
+
+    // threads including the caller, 0 for one per core the process may run on
+    explicit WorkerGroup(int threads);
+    ~WorkerGroup();
+
+    WorkerGroup(const WorkerGroup&) = delete;
+    WorkerGroup& operator=(const WorkerGroup&) = delete;
+
+    // calls work(0) .. work(parts - 1), spread over the threads
+    void run(int parts, const Work& work);
+
+    int threadCount() const { return (int)this->workers.size() + 1; }
+
+private:
+    std::vector<std::thread> workers;
+    std::mutex               mutex;
+    std::condition_variable  workCv;
+    std::condition_variable  doneCv;
+    const Work*              work;
+    int                      parts;
+    int                      next;       // first part nobody took yet
+    int                      pending;    // parts not done yet
+    uint64_t                 generation; // bumped by every run(), so workers tell a new run from the last one
+    bool                     stopping;
+
+    void workerLoop();
+    // takes and runs parts until none are left, with the mutex held on entry and on return
+    void drain(std::unique_lock<std::mutex>& lk);
+};
+
+#endif // kinect2pipe_IR_worker_group_H